@@ -0,0 +1,432 @@
+//*****************************************************
+//
+// benchutil.cpp
+// Medio de desempenho das rotinas da bibutil, sem janela:
+// - carga de objetos (CarregaObjeto, em todos os modos) e de
+//		materiais, nos arquivos do Spiderman e em malhas
+//		sintticas maiores;
+// - clculo de normais, rotaes e operaes com vetores;
+// - decodificao de imagens JPG;
+// - desenho de objetos (DesenhaObjeto e DesenhaInstancias), em um
+//		contexto OpenGL criado pela EGL sem janela nem placa de
+//		vdeo (Mesa).
+// Os resultados so escritos em JSON na sada padro (ou no
+// arquivo indicado com -o).
+//
+// Deve ser executado no diretrio do Spiderman. Compilao:
+//   g++ -O2 -o benchutil benchutil.cpp bibutil.cpp -lGL -lGLU -lglut -ljpeg -lEGL -lpthread
+// Execuo:
+//   ./benchutil [-r repeties] [-o arquivo.json] [-rapido]
+// Em mquinas sem placa de vdeo, o contexto  criado pelo
+// llvmpipe (LIBGL_ALWAYS_SOFTWARE=1 fora essa opo).
+//
+//*****************************************************
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include "bibutil.h"
+
+using namespace std;
+
+// Funo interna da bibutil (no declarada em bibutil.h)
+void _leMateriais(char *nomeArquivo);
+
+// Resultado de uma medio: tempos (em ms) e valores derivados
+typedef struct {
+	string nome;
+	double mediana, minimo;
+	vector<pair<string,double> > extras;
+} RESULTADO;
+
+vector<RESULTADO> _resultados;
+
+// Nmero de repeties de cada medio
+int _repeticoes = 5;
+
+// Retorna o tempo corrente em milissegundos
+double _agoraMs()
+{
+	return chrono::duration<double,milli>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Executa func uma vez para aquecer e depois _repeticoes vezes,
+// guardando a mediana e o menor tempo
+template<class F>
+RESULTADO &Mede(const string &nome, F func)
+{
+	func();
+	vector<double> tempos;
+	for(int i=0; i<_repeticoes; ++i)
+	{
+		double ini = _agoraMs();
+		func();
+		tempos.push_back(_agoraMs() - ini);
+	}
+	sort(tempos.begin(), tempos.end());
+	RESULTADO res;
+	res.nome = nome;
+	res.mediana = tempos[tempos.size()/2];
+	res.minimo = tempos[0];
+	_resultados.push_back(res);
+	return _resultados.back();
+}
+
+// Acrescenta um valor derivado ao resultado
+void Extra(RESULTADO &res, const char *nome, double valor)
+{
+	res.extras.push_back(make_pair(string(nome),valor));
+}
+
+// Retorna o tamanho de um arquivo em bytes (0 se no existir)
+long long TamanhoArquivo(const char *nome)
+{
+	struct stat st;
+	return stat(nome,&st) ? 0 : st.st_size;
+}
+
+// Cria o contexto OpenGL sem janela: a plataforma "surfaceless"
+// da Mesa dispensa servidor grfico e placa de vdeo. Retorna
+// false se no for possvel
+bool CriaContexto(int largura, int altura)
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC obtemDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+	EGLDisplay disp = EGL_NO_DISPLAY;
+	if(obtemDisplay != NULL)
+		disp = obtemDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if(disp == EGL_NO_DISPLAY)
+		disp = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	EGLint maior, menor;
+	if(disp == EGL_NO_DISPLAY || !eglInitialize(disp,&maior,&menor))
+		return false;
+	EGLint atrib[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_DEPTH_SIZE, 24, EGL_NONE };
+	EGLConfig config;
+	EGLint num;
+	if(!eglChooseConfig(disp,atrib,&config,1,&num) || num < 1)
+		return false;
+	eglBindAPI(EGL_OPENGL_API);
+	EGLContext ctx = eglCreateContext(disp,config,EGL_NO_CONTEXT,NULL);
+	if(ctx == EGL_NO_CONTEXT) return false;
+	EGLint dim[] = { EGL_WIDTH, largura, EGL_HEIGHT, altura, EGL_NONE };
+	EGLSurface sup = eglCreatePbufferSurface(disp,config,dim);
+	return eglMakeCurrent(disp,sup,sup,ctx) == EGL_TRUE;
+}
+
+// Gera um arquivo .OBJ com uma grade de n x n quadrados (2*n*n
+// tringulos), com texcoords, ondulada para que as normais variem.
+// Retorna false se no for possvel criar o arquivo
+bool GeraMalha(const char *nome, int n)
+{
+	FILE *fp = fopen(nome,"w");
+	if(fp == NULL) return false;
+	fprintf(fp,"# malha sintetica %dx%d\n",n,n);
+	int i, j;
+	for(i=0; i<=n; ++i)
+		for(j=0; j<=n; ++j)
+		{
+			float x = (float) j/n, z = (float) i/n;
+			fprintf(fp,"v %f %f %f\n",x*10-5,0.2f*sinf(x*20)*cosf(z*20),z*10-5);
+		}
+	for(i=0; i<=n; ++i)
+		for(j=0; j<=n; ++j)
+			fprintf(fp,"vt %f %f\n",(float) j/n,(float) i/n);
+	for(i=0; i<n; ++i)
+		for(j=0; j<n; ++j)
+		{
+			int a = i*(n+1)+j+1, b = a+1, c = a+n+1, d = c+1;
+			fprintf(fp,"f %d/%d %d/%d %d/%d\n",a,a,c,c,b,b);
+			fprintf(fp,"f %d/%d %d/%d %d/%d\n",b,b,c,c,d,d);
+		}
+	fclose(fp);
+	return true;
+}
+
+// Mede a carga de um objeto em todos os modos
+void MedeCarga(const char *rotulo, const char *arquivo)
+{
+	const char modos[] = "nmpf";
+	long long tam = TamanhoArquivo(arquivo);
+	for(int m=0; modos[m]; ++m)
+	{
+		SetaModoCarga(modos[m]);
+		int faces = 0;
+		RESULTADO &res = Mede(string("carga/")+rotulo+"/"+modos[m], [&]() {
+			OBJ *obj = CarregaObjeto((char *) arquivo,false);
+			if(obj == NULL) return;
+			faces = obj->numFaces;
+			LiberaObjeto(obj);
+		});
+		Extra(res,"bytes",tam);
+		Extra(res,"faces",faces);
+		Extra(res,"mb_s",tam/(1024.0*1024.0)/(res.mediana/1000));
+		Extra(res,"faces_s",faces/(res.mediana/1000));
+	}
+	SetaModoCarga('n');
+}
+
+// Mede o desenho de um objeto nos modos imediato, display list
+// e VBO: o tempo de envio dos comandos (sem esperar a OpenGL) e o
+// tempo do quadro completo (com glFinish)
+void MedeDesenho(const char *rotulo, const char *arquivo, int desenhos)
+{
+	OBJ *obj = CarregaObjeto((char *) arquivo,false);
+	if(obj == NULL) return;
+	if(!obj->normais_por_vertice) CalculaNormais(obj,'a');
+	const char *modos[] = { "imediato", "dlist", "vbo" };
+	for(int m=0; m<3; ++m)
+	{
+		if(m == 1) CriaDisplayList(obj);
+		if(m == 2)
+		{
+			DesabilitaDisplayList(obj);
+			CriaVBO(obj);
+		}
+		double envio = 0;
+		RESULTADO &res = Mede(string("desenho/")+rotulo+"/"+modos[m], [&]() {
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			double ini = _agoraMs();
+			for(int i=0; i<desenhos; ++i)
+				DesenhaObjeto(obj);
+			envio = _agoraMs() - ini;
+			glFinish();
+		});
+		Extra(res,"desenhos",desenhos);
+		Extra(res,"envio_ms",envio);
+		Extra(res,"triangulos_s",(double) obj->numFaces*desenhos/(res.mediana/1000));
+	}
+
+	// As mesmas cpias, quase sobrepostas, por instncias e uma a uma
+	vector<MATRIZ> matrizes(desenhos);
+	for(int i=0; i<desenhos; ++i)
+	{
+		MatrizIdentidade(matrizes[i]);
+		TransladaMatriz(matrizes[i],i*0.001f*obj->raio,0,0);
+	}
+	const char *modosInst[] = { "instancias_cpu", "instancias" };
+	for(int m=0; m<2; ++m)
+	{
+		SetaInstanciamento(m == 1);
+		RESULTADO &res = Mede(string("desenho/")+rotulo+"/"+modosInst[m], [&]() {
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			DesenhaInstancias(obj,matrizes.data(),NULL,desenhos);
+			glFinish();
+		});
+		Extra(res,"desenhos",desenhos);
+		Extra(res,"triangulos_s",(double) obj->numFaces*desenhos/(res.mediana/1000));
+	}
+	SetaInstanciamento(true);
+	LiberaObjeto(obj);
+}
+
+// Mede as operaes com vetores, sobre um vetor de num elementos
+void MedeVetores(int num)
+{
+	vector<VERT> v(num), w(num), r(num);
+	srand(1);
+	for(int i=0; i<num; ++i)
+	{
+		v[i].x = rand()/(float) RAND_MAX - 0.5f;
+		v[i].y = rand()/(float) RAND_MAX - 0.5f;
+		v[i].z = rand()/(float) RAND_MAX - 0.5f;
+		w[i].x = v[i].y; w[i].y = v[i].z; w[i].z = v[i].x + 1;
+	}
+	RESULTADO *res;
+#define MEDE_OP(nome, expr) \
+	res = &Mede(nome, [&]() { for(int i=0; i<num; ++i) { expr; } }); \
+	Extra(*res,"ns_op",res->mediana*1e6/num);
+	MEDE_OP("vetores/RotaX", RotaX(v[i],r[i],0.3f))
+	MEDE_OP("vetores/RotaY", RotaY(v[i],r[i],0.3f))
+	MEDE_OP("vetores/RotaZ", RotaZ(v[i],r[i],0.3f))
+	MEDE_OP("vetores/ProdutoVetorial", ProdutoVetorial(v[i],w[i],r[i]))
+	MEDE_OP("vetores/VetorNormal", VetorNormal(v[i],w[i],r[(i+1)%num],r[i]))
+	MEDE_OP("vetores/Normaliza", r[i] = v[i]; Normaliza(r[i]))
+#undef MEDE_OP
+	// Verses em lote
+	res = &Mede("vetores/NormalizaVetores", [&]() {
+		r = v;
+		NormalizaVetores(r.data(),num);
+	});
+	Extra(*res,"ns_op",res->mediana*1e6/num);
+	res = &Mede("vetores/ProdutoVetorialVetores", [&]() {
+		ProdutoVetorialVetores(v.data(),w.data(),r.data(),num);
+	});
+	Extra(*res,"ns_op",res->mediana*1e6/num);
+	MATRIZ m;
+	MatrizIdentidade(m);
+	RotaMatrizY(m,30);
+	res = &Mede("vetores/TransformaVetores", [&]() {
+		r = v;
+		TransformaVetores(m,r.data(),num);
+	});
+	Extra(*res,"ns_op",res->mediana*1e6/num);
+}
+
+// Mede o clculo das normais por face de um objeto
+void MedeNormais(const char *rotulo, const char *arquivo)
+{
+	OBJ *obj = CarregaObjeto((char *) arquivo,false);
+	if(obj == NULL) return;
+	if(obj->normais_por_vertice)
+	{
+		LiberaObjeto(obj);
+		return;
+	}
+	RESULTADO &res = Mede(string("normais/")+rotulo, [&]() {
+		CalculaNormaisPorFace(obj);
+	});
+	Extra(res,"faces",obj->numFaces);
+	Extra(res,"faces_s",obj->numFaces/(res.mediana/1000));
+	LiberaObjeto(obj);
+}
+
+// Mede a decodificao de uma imagem JPG
+void MedeJPG(const char *arquivo, int reducao)
+{
+	double pixels = 0;
+	char nome[256];
+	snprintf(nome,sizeof(nome),"jpg/%s/%d",arquivo,reducao);
+	RESULTADO &res = Mede(nome, [&]() {
+		TEX *tex = CarregaJPG(arquivo,true,reducao);
+		if(tex == NULL) return;
+		pixels = (double) tex->dimx*tex->dimy*reducao*reducao;
+		free(tex->data);
+		free(tex);
+	});
+	Extra(res,"bytes",TamanhoArquivo(arquivo));
+	Extra(res,"mpixels_s",pixels/1e6/(res.mediana/1000));
+}
+
+// Escreve uma string em JSON
+void EscreveString(FILE *fp, const char *s)
+{
+	fputc('"',fp);
+	for(; *s; ++s)
+	{
+		if(*s == '"' || *s == '\\') fputc('\\',fp);
+		fputc(*s,fp);
+	}
+	fputc('"',fp);
+}
+
+int main(int argc, char **argv)
+{
+	const char *nomeSaida = NULL;
+	bool rapido = false;
+	for(int i=1; i<argc; ++i)
+	{
+		if(!strcmp(argv[i],"-r") && i+1 < argc)
+			_repeticoes = max(1,atoi(argv[++i]));
+		else if(!strcmp(argv[i],"-o") && i+1 < argc)
+			nomeSaida = argv[++i];
+		else if(!strcmp(argv[i],"-rapido"))
+			rapido = true;
+		else
+		{
+			fprintf(stderr,"Uso: %s [-r repeticoes] [-o arquivo.json] [-rapido]\n",argv[0]);
+			return 1;
+		}
+	}
+	// As mensagens da bibutil vo para /dev/null, para no mistur-las
+	// ao JSON (nem medir o tempo de escrev-las)
+	fflush(stdout);
+	FILE *saida = nomeSaida ? fopen(nomeSaida,"w") : fdopen(dup(1),"w");
+	if(saida == NULL)
+	{
+		fprintf(stderr,"Impossivel criar %s\n",nomeSaida);
+		return 1;
+	}
+	if(freopen("/dev/null","w",stdout) == NULL) return 1;
+
+	if(!CriaContexto(256,256))
+	{
+		fprintf(stderr,"Impossivel criar o contexto OpenGL (EGL)\n");
+		return 1;
+	}
+	glViewport(0,0,256,256);
+	glMatrixMode(GL_PROJECTION);
+	gluPerspective(45,1,0.5,100);
+	glMatrixMode(GL_MODELVIEW);
+	gluLookAt(0,3,15, 0,0,0, 0,1,0);
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_LIGHTING);
+	glEnable(GL_LIGHT0);
+	SetaCacheObjetos(false);
+	SetaCacheTexturas(false);
+
+	// Malhas sintticas
+	int tamanhos[] = { 224, 708 };		// 100 mil e 1 milho de tringulos
+	int numMalhas = rapido ? 1 : 2;
+	char malhas[2][64];
+	for(int i=0; i<numMalhas; ++i)
+	{
+		snprintf(malhas[i],sizeof(malhas[i]),"/tmp/benchutil_%d_%d.obj",(int) getpid(),i);
+		if(!GeraMalha(malhas[i],tamanhos[i]))
+		{
+			fprintf(stderr,"Impossivel criar %s\n",malhas[i]);
+			return 1;
+		}
+	}
+	const char *rotulos[] = { "grade100k", "grade1m" };
+
+	MedeCarga("spiderman.obj","spiderman.obj");
+	MedeCarga("spiderman2.obj","spiderman2.obj");
+	for(int i=0; i<numMalhas; ++i)
+		MedeCarga(rotulos[i],malhas[i]);
+
+	RESULTADO &mat = Mede("materiais/spiderman2.mtl", []() {
+		_leMateriais((char *) "spiderman2.mtl");
+		LiberaMateriais();
+	});
+	Extra(mat,"bytes",TamanhoArquivo("spiderman2.mtl"));
+
+	MedeNormais("spiderman2.obj","spiderman2.obj");
+	for(int i=0; i<numMalhas; ++i)
+		MedeNormais(rotulos[i],malhas[i]);
+
+	MedeVetores(rapido ? 1<<16 : 1<<20);
+
+	MedeJPG("Reference.jpg",1);
+	MedeJPG("Reference.jpg",4);
+	MedeJPG("branco.jpg",1);
+
+	MedeDesenho("spiderman2.obj","spiderman2.obj",rapido ? 10 : 50);
+	MedeDesenho(rotulos[0],malhas[0],rapido ? 2 : 10);
+
+	for(int i=0; i<numMalhas; ++i)
+		remove(malhas[i]);
+	LiberaObjeto(NULL);
+	LiberaMateriais();
+
+	// Escreve os resultados
+	fprintf(saida,"{\n\"ambiente\": {\"gl_renderer\": ");
+	EscreveString(saida,(const char *) glGetString(GL_RENDERER));
+	fprintf(saida,", \"gl_version\": ");
+	EscreveString(saida,(const char *) glGetString(GL_VERSION));
+	fprintf(saida,", \"threads\": %u, \"repeticoes\": %d},\n\"resultados\": [\n",
+		thread::hardware_concurrency(),_repeticoes);
+	for(unsigned int i=0; i<_resultados.size(); ++i)
+	{
+		RESULTADO &res = _resultados[i];
+		fprintf(saida,"  {\"nome\": ");
+		EscreveString(saida,res.nome.c_str());
+		fprintf(saida,", \"mediana_ms\": %.4f, \"minimo_ms\": %.4f",res.mediana,res.minimo);
+		for(unsigned int j=0; j<res.extras.size(); ++j)
+			fprintf(saida,", \"%s\": %.6g",res.extras[j].first.c_str(),res.extras[j].second);
+		fprintf(saida,"}%s\n", i+1 < _resultados.size() ? "," : "");
+	}
+	fprintf(saida,"]\n}\n");
+	fclose(saida);
+	return 0;
+}
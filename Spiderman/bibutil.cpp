@@ -6,16 +6,35 @@
 // - Normalizar um vetor;
 // - Calcular o produto vetorial entre dois vetores;
 // - Calcular um vetor normal a partir de trs vrtices;
+// - Realizar essas operaes em lote, com instrues vetoriais;
 // - Rotacionar um vrtice ao redor de um eixo (x, y ou z);
+// - Montar matrizes de transformao e aplic-las a objetos 3D;
 // - Ler um modelo de objeto 3D de um arquivo no formato 
-//		OBJ e armazenar em uma estrutura;
-// - Desenhar um objeto 3D recebido por parmetro;
+//		OBJ e armazenar em uma estrutura, ou percorr-lo em fluxo,
+//		com memria limitada;
+// - Desenhar um objeto 3D recebido por parmetro, ou vrias
+//		cpias dele de uma vez (instncias);
+// - Gerar nveis de detalhe simplificados de um objeto 3D e
+//		escolh-los no desenho pelo tamanho na tela;
+// - Quantizar os vrtices das malhas, reduzindo a memria ocupada;
+// - Descartar no desenho os objetos (e blocos de faces) fora do
+//		volume de viso;
+// - Reordenar as faces e os vrtices de um objeto 3D para
+//		aproveitar o cache de vrtices da placa;
+// - Selecionar faces de um objeto 3D com o mouse e consultar
+//		pontos prximos e sobreposies, atravs de uma BVH;
 // - Liberar a memria ocupada por um objeto 3D;
-// - Calcular o vetor normal de cada face de um objeto 3D;
+// - Medir os tempos de quadro (CPU e GPU) e registrar zonas de
+//		perfil, exportveis para o Chrome Trace;
+// - Calcular o vetor normal de cada face de um objeto 3D, ou
+//		normais suaves por vrtice;
 // - Decodificar e armazenar numa estrutura uma imagem JPG 
 //		para usar como textura;
 // - Armazenar em uma estrutura uma imagem JPG para usar 
-//		como textura.
+//		como textura, opcionalmente em segundo plano e com cache
+//		das imagens decodificadas;
+// - Juntar as texturas pequenas de um objeto em um atlas;
+// - Gerar os mipmaps das texturas (filtros caixa ou Kaiser).
 //
 // Marcelo Cohen e Isabel H. Manssour
 // Este cdigo acompanha o livro
@@ -25,9 +44,40 @@
 
 #include <math.h>
 #include <string.h>
+#include <stddef.h>
+#include <float.h>
+#include <sys/stat.h>
 #include <vector>
+#include <string>
+#include <unordered_map>
+#include <map>
+#include <queue>
+#include <deque>
+#include <tuple>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 #include "bibutil.h"
 
+// Instrues vetoriais (SSE/AVX2): usadas apenas em processadores
+// x86, com compiladores que permitem habilit-las por funo - a
+// escolha  feita durante a execuo (ver _obtemSIMD)
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#define ALVO_SSE	__attribute__((target("sse2")))
+#define ALVO_AVX2	__attribute__((target("avx2")))
+#endif
+
 #define DEBUG
 
 using namespace std;
@@ -41,12 +91,28 @@ vector<MAT*> _materiais(0);
 // Lista de texturas
 vector<TEX*> _texturas(0);
 
+// Oramento de memria para as texturas, em bytes (0 = ilimitado),
+// e memria j ocupada pelas texturas carregadas
+long long _orcamentoTexturas = 0;
+long long _memoriaTexturas = 0;
+
+// ndices dos materiais e das texturas nas listas acima, por nome.
+// As chaves destas tabelas no mudam de lugar enquanto existirem,
+// por isso os nomes dos materiais e texturas apontam para elas
+unordered_map<string,int> _indiceMateriais, _indiceTexturas;
+
 // Modo de desenho
 char _modo = 't';
 
-// Variveis para controlar a taxa de quadros por segundo
-int _numquadro =0, _tempo, _tempoAnterior = 0;
-float _ultqps = 0;
+// Modo de carga de objetos (ver SetaModoCarga)
+char _modoCarga = 'n';
+
+// Retorna o tempo corrente em segundos, com alta resoluo
+// (usado para medir o desempenho das rotinas de carga)
+double _tempoSeg()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 #ifndef __FREEGLUT_EXT_H__
 // Funo para desenhar um texto na tela com fonte bitmap
@@ -58,27 +124,289 @@ void glutBitmapString(void *fonte,char *texto)
 }
 #endif
 
-// Calcula e retorna a taxa de quadros por segundo
+// Retorna o tempo corrente em nanossegundos, de um relgio monotnico
+long long _tempoNs()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(
+		chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Nmero de quadros considerados nas estatsticas (ver
+// ObtemTemposQuadro), e subdivises de cada potncia de 2 no
+// histograma dos tempos (o erro dos percentis  de at 1/32)
+#define JANELA_QUADROS	1024
+#define SUBFAIXAS_HIST	16
+#define FAIXAS_HIST		(40*SUBFAIXAS_HIST)
+
+// Histograma dos tempos (em ns) dos ltimos JANELA_QUADROS quadros:
+// cada tempo novo entra no histograma e o mais antigo sai
+typedef struct {
+	long long janela[JANELA_QUADROS];
+	int pos, num;
+	long long soma;
+	int cont[FAIXAS_HIST];
+} HISTTEMPOS;
+
+// Funo interna que retorna a faixa do histograma de um tempo: os
+// valores menores que SUBFAIXAS_HIST tm uma faixa cada, e cada
+// potncia de 2 acima disso  dividida em SUBFAIXAS_HIST faixas
+int _faixaHist(long long ns)
+{
+	if(ns < SUBFAIXAS_HIST) return ns > 0 ? (int) ns : 0;
+	// Expoente da maior potncia de 2 que no excede ns (>= 4)
+#if defined(__GNUC__) || defined(__clang__)
+	int e = 63 - __builtin_clzll((unsigned long long) ns);
+#else
+	int e = 4;
+	while(ns >> (e+1)) ++e;
+#endif
+	int f = (e-3)*SUBFAIXAS_HIST + (int) ((ns >> (e-4)) & (SUBFAIXAS_HIST-1));
+	return f < FAIXAS_HIST ? f : FAIXAS_HIST-1;
+}
+
+// Funo interna que retorna o valor central de uma faixa do histograma
+double _centroFaixa(int f)
+{
+	if(f < SUBFAIXAS_HIST) return f;
+	int e = f/SUBFAIXAS_HIST + 3;
+	long long largura = 1LL << (e-4);
+	return (double) ((SUBFAIXAS_HIST + f%SUBFAIXAS_HIST) << (e-4)) + largura/2.0;
+}
+
+// Funo interna que acrescenta um tempo ao histograma
+void _adicionaHist(HISTTEMPOS &h, long long ns)
+{
+	if(h.num == JANELA_QUADROS)
+	{
+		long long antigo = h.janela[h.pos];
+		h.cont[_faixaHist(antigo)]--;
+		h.soma -= antigo;
+	}
+	else h.num++;
+	h.janela[h.pos] = ns;
+	h.pos = (h.pos+1) % JANELA_QUADROS;
+	h.cont[_faixaHist(ns)]++;
+	h.soma += ns;
+}
+
+// Funo interna que retorna, em ms, o percentil p (0..1) dos
+// tempos do histograma (0 se estiver vazio)
+float _percentilHist(const HISTTEMPOS &h, float p)
+{
+	if(!h.num) return 0;
+	int ordem = (int) ceil(p*h.num), acum = 0;
+	if(ordem < 1) ordem = 1;
+	for(int f=0; f<FAIXAS_HIST; ++f)
+	{
+		acum += h.cont[f];
+		if(acum >= ordem) return _centroFaixa(f) / 1e6;
+	}
+	return 0;
+}
+
+// Tempos de quadro na CPU e de desenho na GPU
+HISTTEMPOS _histCPU, _histGPU;
+
+// Variveis para controlar a taxa de quadros por segundo
+long long _inicioQuadro = 0, _inicioQPS = 0;
+int _numquadro = 0;
+long long _totalQuadros = 0;
+float _ultqps = 0;
+
+// Perfil ativo (ver SetaPerfil; lido tambm pelas threads de
+// decodificao) e instante em que foi ativado
+atomic<bool> _perfil(false);
+long long _inicioPerfil = 0;
+
+// Mximo de eventos guardados para SalvaPerfil
+#define MAX_EVENTOS_PERFIL	(1<<20)
+
+// Evento registrado no perfil: zona (com durao) ou contador
+typedef struct {
+	const char *nome;
+	int thread;
+	long long inicio, duracao;	// em ns (duracao < 0: contador)
+	float valor;
+} EVENTOPERFIL;
+
+vector<EVENTOPERFIL> _eventos;
+int _eventosPerdidos = 0;
+mutex _mtxPerfil;
+
+// Nmero sequencial de cada thread que registra zonas
+atomic<int> _proxThread(0);
+thread_local int _idThread = -1;
+
+// Funo interna que registra um evento no perfil
+void _registraEvento(const char *nome, long long inicio, long long duracao, float valor)
+{
+	if(_idThread < 0) _idThread = _proxThread++;
+	EVENTOPERFIL ev = { nome, _idThread, inicio, duracao, valor };
+	lock_guard<mutex> trava(_mtxPerfil);
+	if(_eventos.size() < MAX_EVENTOS_PERFIL) _eventos.push_back(ev);
+	else _eventosPerdidos++;
+}
+
+ZONA::ZONA(const char *nome) : nome(nome)
+{
+	inicio = _perfil ? _tempoNs() : -1;
+}
+
+ZONA::~ZONA()
+{
+	if(inicio >= 0 && _perfil)
+		_registraEvento(nome, inicio, _tempoNs()-inicio, 0);
+}
+
+// Consultas GL_TIME_ELAPSED feitas em DesenhaObjeto e ainda no
+// lidas, com o quadro a que pertencem, e consultas j lidas, que
+// podem ser reaproveitadas
+deque<pair<GLuint,long long> > _consultasPendentes;
+vector<GLuint> _consultasLivres;
+// Quadro cujo tempo de GPU est sendo somado, e a soma
+long long _quadroGPU = -1, _somaGPU = 0;
+
+// Funo interna que l os resultados j disponveis das consultas
+// de tempo da GPU, sem esperar, somando-os por quadro
+void _coletaConsultasGPU()
+{
+	while(!_consultasPendentes.empty())
+	{
+		GLuint id = _consultasPendentes.front().first;
+		GLint pronto = 0;
+		glGetQueryObjectiv(id, GL_QUERY_RESULT_AVAILABLE, &pronto);
+		if(!pronto) break;
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(id, GL_QUERY_RESULT, &ns);
+		long long quadro = _consultasPendentes.front().second;
+		_consultasPendentes.pop_front();
+		_consultasLivres.push_back(id);
+		// Terminou um quadro: o tempo dele entra no histograma
+		if(quadro != _quadroGPU)
+		{
+			if(_quadroGPU >= 0) _adicionaHist(_histGPU,_somaGPU);
+			if(_quadroGPU >= 0 && _perfil)
+				_registraEvento("gpu (ms)", _tempoNs(), -1, _somaGPU/1e6);
+			_quadroGPU = quadro;
+			_somaGPU = 0;
+		}
+		_somaGPU += ns;
+	}
+}
+
+// Calcula e retorna a taxa de quadros por segundo. Deve ser chamada
+// uma vez por quadro: o intervalo entre duas chamadas  o tempo do
+// quadro, medido em nanossegundos (ver ObtemTemposQuadro)
 float CalculaQPS(void)
 {
+	long long agora = _tempoNs();
+	// Registra o tempo do quadro que terminou
+	if(_inicioQuadro)
+	{
+		_adicionaHist(_histCPU, agora-_inicioQuadro);
+		if(_perfil)
+			_registraEvento("quadro", _inicioQuadro, agora-_inicioQuadro, 0);
+	}
+	else _inicioQPS = agora;
+	_inicioQuadro = agora;
+	_totalQuadros++;
+	if(!_consultasPendentes.empty()) _coletaConsultasGPU();
+
 	// Incrementa o contador de quadros
 	_numquadro++;
-
-	// Obtm o tempo atual
-	_tempo = glutGet(GLUT_ELAPSED_TIME);
 	// Verifica se passou mais um segundo
-	if (_tempo - _tempoAnterior > 1000)
+	if (agora - _inicioQPS > 1000000000LL)
 	{
 		// Calcula a taxa atual
-		_ultqps = _numquadro*1000.0/(_tempo - _tempoAnterior);
+		_ultqps = _numquadro*1e9/(agora - _inicioQPS);
 		// Ajusta as variveis de tempo e quadro
-	 	_tempoAnterior = _tempo;
+		_inicioQPS = agora;
 		_numquadro = 0;
 	}
 	// Retorna a taxa atual
 	return _ultqps;
 }
 
+// Obtm as estatsticas dos ltimos JANELA_QUADROS quadros (ver
+// CalculaQPS): mdia, percentis e mximo dos tempos de quadro na CPU
+// e, se o perfil estiver ativo (ver SetaPerfil) e houver consultas
+// de tempo na OpenGL (verso 3.3 ou GL_ARB_timer_query), do tempo de
+// GPU das chamadas a DesenhaObjeto em cada quadro
+void ObtemTemposQuadro(TEMPOSQUADRO *t)
+{
+	if(t == NULL) return;
+	t->quadros = _histCPU.num;
+	t->qps = _ultqps;
+	t->medio = _histCPU.num ? _histCPU.soma / 1e6 / _histCPU.num : 0;
+	t->p50 = _percentilHist(_histCPU, 0.50f);
+	t->p95 = _percentilHist(_histCPU, 0.95f);
+	t->p99 = _percentilHist(_histCPU, 0.99f);
+	long long maior = 0;
+	for(int i=0; i<_histCPU.num; ++i)
+		maior = max(maior, _histCPU.janela[i]);
+	t->maximo = maior / 1e6;
+	t->quadrosGPU = _histGPU.num;
+	t->gpuMedio = _histGPU.num ? _histGPU.soma / 1e6 / _histGPU.num : 0;
+	t->gpuP50 = _percentilHist(_histGPU, 0.50f);
+	t->gpuP95 = _percentilHist(_histGPU, 0.95f);
+	t->gpuP99 = _percentilHist(_histGPU, 0.99f);
+}
+
+// Ativa ou desativa o perfil: com ele ativo, as zonas (ver ZONA) -
+// carga e leitura de objetos, decodificao e envio de texturas,
+// desenho e os quadros - so registradas para SalvaPerfil, e o tempo
+// de GPU de cada DesenhaObjeto  medido com GL_TIME_ELAPSED (por isso,
+// a aplicao no pode ter uma consulta dessas ativa ao desenhar os
+// objetos). Ativ-lo descarta os eventos registrados antes
+void SetaPerfil(bool ativo)
+{
+	if(ativo && !_perfil)
+	{
+		lock_guard<mutex> trava(_mtxPerfil);
+		_eventos.clear();
+		_eventosPerdidos = 0;
+		_inicioPerfil = _tempoNs();
+	}
+	_perfil = ativo;
+}
+
+// Grava os eventos do perfil (ver SetaPerfil) no formato JSON do
+// Chrome Trace Event, que pode ser aberto em chrome://tracing ou no
+// Perfetto. Retorna false se no for possvel criar o arquivo
+bool SalvaPerfil(const char *arquivo)
+{
+	FILE *fp = fopen(arquivo,"w");
+	if(fp == NULL) return false;
+	lock_guard<mutex> trava(_mtxPerfil);
+	fprintf(fp,"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for(unsigned int i=0; i<_eventos.size(); ++i)
+	{
+		EVENTOPERFIL &ev = _eventos[i];
+		fprintf(fp,"%s{\"name\":\"", i ? ",\n" : "");
+		for(const char *c = ev.nome; *c; ++c)
+		{
+			if(*c == '"' || *c == '\\') fputc('\\',fp);
+			fputc(*c,fp);
+		}
+		// Tempos em microssegundos, a partir da ativao do perfil
+		double ts = (ev.inicio - _inicioPerfil) / 1000.0;
+		if(ev.duracao >= 0)
+			fprintf(fp,"\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				ev.thread, ts, ev.duracao/1000.0);
+		else
+			fprintf(fp,"\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"valor\":%g}}",
+				ev.thread, ts, ev.valor);
+	}
+	fprintf(fp,"\n]}\n");
+	fclose(fp);
+#ifdef DEBUG
+	printf("Perfil: %d eventos gravados em %s",(int) _eventos.size(),arquivo);
+	if(_eventosPerdidos) printf(" (%d descartados)",_eventosPerdidos);
+	printf("\n");
+#endif
+	return true;
+}
+
 // Escreve uma string na tela, usando uma projeo ortogrfica
 // normalizada (0..1, 0..1)
 void Escreve2D(float x, float y, char *str)
@@ -173,203 +501,1101 @@ void RotaX(VERT &in, VERT &out, float ang)
 	out.z = -in.y * sin(arad) + in.z * cos(arad);
 }
 
-// Funo interna, usada por CarregaObjeto para
-// interpretar a definio de uma face em um
-// arquivo .OBJ
-// 
-// Recebe um apontador para a posio corrente na
-// string e devolve o valor numrico encontrado
-// at o primeiro / ou -1 caso no exista
-//
-// Tambm retorna em sep o separador encontrado
-int leNum(char **face, char *sep)
+// Conjuntos de instrues vetoriais utilizados pelas rotinas que
+// processam vetores em lote
+enum { SIMD_ESCALAR, SIMD_SSE, SIMD_AVX2 };
+
+// Conjunto de instrues em uso (-1 = ainda no detectado)
+int _simd = -1;
+
+// Funo interna que retorna o melhor conjunto de instrues
+// vetoriais disponvel no processador
+int _simdDisponivel()
 {
-	char temp[10];
-	int pos = 0;
-	while(**face)
+	int simd = SIMD_ESCALAR;
+#ifdef SIMD_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) simd = SIMD_AVX2;
+	else if(__builtin_cpu_supports("sse2")) simd = SIMD_SSE;
+#endif
+	return simd;
+}
+
+// Funo interna que retorna o conjunto de instrues vetoriais
+// em uso (ver SetaInstrucoesSIMD)
+int _obtemSIMD()
+{
+	if(_simd < 0) _simd = _simdDisponivel();
+	return _simd;
+}
+
+// Seleciona as instrues utilizadas pelas rotinas que processam
+// vetores em lote (NormalizaVetores, ProdutoVetorialVetores, etc):
+// 'a' - automtico: as melhores disponveis no processador
+// 'e' - apenas instrues escalares
+// 's' - SSE
+// 'x' - AVX2
+// Se as instrues pedidas no estiverem disponveis, so usadas
+// as melhores que estiverem. Os resultados so sempre idnticos
+// aos das rotinas que processam um vetor de cada vez - desde que
+// o compilador no funda multiplicaes e somas (-ffp-contract=off
+// se a compilao habilitar FMA)
+void SetaInstrucoesSIMD(char modo)
+{
+	int simd;
+	switch(modo)
 	{
-		if(**face == '/' || **face==' ') // achamos o separador
-		{
-			*sep = **face;
-			(*face)++;
-			break;
-		}
-		temp[pos++] = **face;
-		(*face)++;
+		case 'a': _simd = _simdDisponivel(); return;
+		case 'e': simd = SIMD_ESCALAR; break;
+		case 's': simd = SIMD_SSE; break;
+		case 'x': simd = SIMD_AVX2; break;
+		default: return;
 	}
-	temp[pos]=0;
-	if(!pos) // string vazia ?
-		return -1;
-	return atoi(temp);
+	int disponivel = _simdDisponivel();
+	_simd = simd < disponivel ? simd : disponivel;
 }
 
-// Procura um material pelo nome na lista e devolve
-// o ndice onde est, ou -1 se no achar
-int _procuraMaterial(char *nome)
+// Operaes sobre um vetor (x,y,z), usadas pelas verses escalares
+// das rotinas em lote - so as mesmas de Normaliza, ProdutoVetorial
+// e VetorNormal, calculadas na mesma ordem
+inline void _normaliza1(float &x, float &y, float &z)
 {
-	unsigned int i;
-	for(i=0;i<_materiais.size();++i)
-		if(!strcmp(nome,_materiais[i]->nome))
-			return i;
-	return -1;
+	float tam = sqrtf(x*x + y*y + z*z);
+	if(tam == 0) return;
+	x /= tam;
+	y /= tam;
+	z /= tam;
 }
 
-// Procura um material pelo nome e devolve um
-// apontador para ele ou NULL caso no ache
-MAT *ProcuraMaterial(char *nome)
+inline void _produto1(float ax, float ay, float az, float bx, float by, float bz,
+	float &rx, float &ry, float &rz)
 {
-	int pos = _procuraMaterial(nome);
-	if(pos == -1) return NULL;
-	else return _materiais[pos];
+	rx = ay * bz - az * by;
+	ry = az * bx - ax * bz;
+	rz = ax * by - ay * bx;
 }
 
-// Procura uma textura pelo nome na lista e devolve
-// o ndice onde est, ou -1 se no achar
-int _procuraTextura(char *nome)
+inline void _normal1(float ax, float ay, float az, float bx, float by, float bz,
+	float cx, float cy, float cz, float &nx, float &ny, float &nz)
 {
-	unsigned int i;
-	for(i=0;i<_texturas.size();++i)
-		if(!strcmp(nome,_texturas[i]->nome))
-			return i;
-	return -1;
+	// n = (c-b) x (a-b), normalizado
+	_produto1(cx-bx, cy-by, cz-bz, ax-bx, ay-by, az-bz, nx, ny, nz);
+	_normaliza1(nx, ny, nz);
 }
 
-// L um arquivo que define materiais para um objeto 3D no
-// formato .OBJ
-void _leMateriais(char *nomeArquivo)
+inline void _limites1(float x, float y, float z, VERT &min, VERT &max)
 {
-	char aux[256];
-	FILE *fp;
-	MAT *ptr;
-	fp = fopen(nomeArquivo,"r");
+	if(x < min.x) min.x = x;
+	if(y < min.y) min.y = y;
+	if(z < min.z) min.z = z;
+	if(x > max.x) max.x = x;
+	if(y > max.y) max.y = y;
+	if(z > max.z) max.z = z;
+}
 
-	/* Especificao do arquivo de materiais (.mtl):
-	 * 
-	 * #,!,$  - comentrio
-	 * newmtl - nome do novo material(sem espaos)
-	 * Ka	  - Cor ambiente, especificada como 3 floats
-	 * Kd	  - Cor difusa, idem
-	 * Ks	  - Cor especular, idem
-	 * Ns	  - Coeficiente de especularidade, entre 0 and 1000 
-	 *          (convertido para a faixa vlida em OpenGL (0..128) durante a leitura)
-	 * d	  - Transparncia - mesmo significado que o alpha em OpenGL: 0.0 a 1.0 (0.0 = transparente)
-	 *
-	 * Os demais campos so ignorados por este leitor:
-	 * Tr	  - Transparncia (0 = opaco, 1 = transparente)
-	 * map_Kd - Especifica arquivo com a textura a ser mapeada como material difuso
-	 * refl	  - Especifica arquivo com um mapa de reflexo
-	 * Ni	  - ndice de refrao, 1.0 ou maior, onde 1.0 representa sem refrao
-	 * bump	  - Especifica arquivo para "bump mapping"
-	 * illum  - Modelo de iluminao (1 = apenas cores, 2 = textura, 3 = reflexes e raytracing)
-	 * map_Ka - Especifica arquivo com a textura a ser mapeada como cor ambiente
-	 * map_Ks - Especifica arquivo com a textura a ser mapeada como cor especular
-	 * map_Ns - Especifica arquivo com a textura a ser mapeada como reflexo especular
-	 * map_d  - Especifica arquivo cmo a textura a ser mapeada como transparncia (branco  opaco, preto  transparente)
-	 *
-	 */
+#ifdef SIMD_X86
+// Operaes SSE sobre 4 vetores (um por posio dos registradores)
+ALVO_SSE inline void _normaliza4(__m128 &x, __m128 &y, __m128 &z)
+{
+	__m128 tam = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x,x),
+		_mm_mul_ps(y,y)),_mm_mul_ps(z,z)));
+	// Onde o tamanho  zero, mantm o valor original
+	__m128 nulo = _mm_cmpeq_ps(tam,_mm_setzero_ps());
+	x = _mm_or_ps(_mm_and_ps(nulo,x),_mm_andnot_ps(nulo,_mm_div_ps(x,tam)));
+	y = _mm_or_ps(_mm_and_ps(nulo,y),_mm_andnot_ps(nulo,_mm_div_ps(y,tam)));
+	z = _mm_or_ps(_mm_and_ps(nulo,z),_mm_andnot_ps(nulo,_mm_div_ps(z,tam)));
+}
 
-	while(!feof(fp))
-	{
-		fgets(aux,255,fp);
-		if (strlen(aux)>1)
-			aux[strlen(aux)-1]=0;	// elimina o \n lido do arquivo
-		if(aux[0]=='#') continue;
-		if(!strncmp(aux,"newmtl",6)) // Novo material ?
-		{
-			// Se material j existe na lista, pula para o 
-			// prximo
-			if(_procuraMaterial(&aux[7])!=-1)
-			{
-				ptr = NULL;
-				continue;
-			}
-			if((ptr = (MAT *) malloc(sizeof(MAT)))==NULL)
-			{
-				printf("Sem memria para novo material!");
-				exit(1);
-			}
-			// Adiciona  lista
-			_materiais.push_back(ptr);
-			// Copia nome do material
-			strcpy(ptr->nome,&aux[7]);
-			// No existe "emission" na definio do material
-			// mas o valor pode ser setado mais tarde,
-			// via SetaEmissaoMaterial(..)
-			ptr->ke[0] = ptr->ke[1] = ptr->ke[2] = 0.0;
-		}
-		if(!strncmp(aux,"Ka ",3)) // Ambiente
-		{
-			if(ptr==NULL) continue;
-			sscanf(aux,"Ka %f %f %f",&ptr->ka[0],&ptr->ka[1],&ptr->ka[2]);
-		}
-		if(!strncmp(aux,"Kd ",3)) // Difuso
-		{
-			if(ptr==NULL) continue;
-			sscanf(aux,"Kd %f %f %f",&ptr->kd[0],&ptr->kd[1],&ptr->kd[2]);
-		}
-		if(!strncmp(aux,"Ks ",3)) // Especular
-		{
-			if(ptr==NULL) continue;
-			sscanf(aux,"Ks %f %f %f",&ptr->ks[0],&ptr->ks[1],&ptr->ks[2]);
-		}
-		if(!strncmp(aux,"Ns ",3)) // Fator de especularidade
-		{
-			if(ptr==NULL) continue;
-			sscanf(aux,"Ns %f",&ptr->spec);
-			// Converte da faixa lida (0...1000) para o intervalo
-			// vlido em OpenGL (0...128)
-			ptr->spec = ptr->spec/1000.0 * 128;
-		}
-		if(!strncmp(aux,"d ",2)) // Alpha
-		{
-			if(ptr==NULL) continue;
-			// No existe alpha na definio de cada componente
-			// mas o valor  lido em separado e vale para todos
-			float alpha;
-			sscanf(aux,"d %f",&alpha);
-			ptr->ka[3] = alpha;
-			ptr->kd[3] = alpha;
-			ptr->ks[3] = alpha;
-		}
-	}
-	fclose(fp);
+ALVO_SSE inline void _produto4(__m128 ax, __m128 ay, __m128 az, __m128 bx,
+	__m128 by, __m128 bz, __m128 &rx, __m128 &ry, __m128 &rz)
+{
+	rx = _mm_sub_ps(_mm_mul_ps(ay,bz),_mm_mul_ps(az,by));
+	ry = _mm_sub_ps(_mm_mul_ps(az,bx),_mm_mul_ps(ax,bz));
+	rz = _mm_sub_ps(_mm_mul_ps(ax,by),_mm_mul_ps(ay,bx));
 }
 
-// Cria e carrega um objeto 3D que esteja armazenado em um
-// arquivo no formato OBJ, cujo nome  passado por parmetro.
-//  feita a leitura do arquivo para preencher as estruturas 
-// de vrtices e faces, que so retornadas atravs de um OBJ.
-//
-// O parmetro mipmap indica se deve-se gerar mipmaps a partir
-// das texturas (se houver)
-OBJ *CarregaObjeto(char *nomeArquivo, bool mipmap)
+ALVO_SSE inline void _normal4(__m128 ax, __m128 ay, __m128 az, __m128 bx,
+	__m128 by, __m128 bz, __m128 cx, __m128 cy, __m128 cz,
+	__m128 &nx, __m128 &ny, __m128 &nz)
 {
-	int i;
-	int vcont,ncont,fcont,tcont;
-	int material, texid;
-	char aux[256];
-	TEX *ptr;
-	FILE *fp;
-	OBJ *obj;
+	_produto4(_mm_sub_ps(cx,bx),_mm_sub_ps(cy,by),_mm_sub_ps(cz,bz),
+		_mm_sub_ps(ax,bx),_mm_sub_ps(ay,by),_mm_sub_ps(az,bz),nx,ny,nz);
+	_normaliza4(nx,ny,nz);
+}
 
-	fp = fopen(nomeArquivo, "r");  // abre arquivo texto para leitura
+// L 4 VERTs consecutivos, separando as coordenadas
+ALVO_SSE inline void _carregaVERT4(const VERT *v, __m128 &x, __m128 &y, __m128 &z)
+{
+	const float *p = &v->x;
+	__m128 a = _mm_loadu_ps(p);		// x0 y0 z0 x1
+	__m128 b = _mm_loadu_ps(p+4);	// y1 z1 x2 y2
+	__m128 c = _mm_loadu_ps(p+8);	// z2 x3 y3 z3
+	x = _mm_shuffle_ps(a,_mm_shuffle_ps(b,c,_MM_SHUFFLE(0,1,0,2)),_MM_SHUFFLE(2,0,3,0));
+	y = _mm_shuffle_ps(_mm_shuffle_ps(a,b,_MM_SHUFFLE(0,0,0,1)),
+		_mm_shuffle_ps(b,c,_MM_SHUFFLE(0,2,0,3)),_MM_SHUFFLE(2,0,2,0));
+	z = _mm_shuffle_ps(_mm_shuffle_ps(a,b,_MM_SHUFFLE(0,1,0,2)),
+		_mm_shuffle_ps(c,c,_MM_SHUFFLE(0,3,0,0)),_MM_SHUFFLE(2,0,2,0));
+}
 
-#ifdef DEBUG
-	printf("*** Objeto: %s\n",nomeArquivo);
-#endif
-	/* Especificao do formato .obj para objetos poligonais:
-	 * 
-	 * # - commentrio
-	 * v x y z - vrtice
-	 * vn x y z - normal
-	 * vt x y z - texcoord
-	 * f a1 a2 ... - face com apenas ndices de vrtices
-	 * f a1/b1/c1 a2/b2/c2 ... - face com ndices de vrtices, normais e texcoords
-	 * f a1//c1 a2//c2 ... - face com ndices de vrtices e normais (sem texcoords)
-	 *
+// Grava 4 VERTs consecutivos a partir das coordenadas separadas
+ALVO_SSE inline void _gravaVERT4(VERT *v, __m128 x, __m128 y, __m128 z)
+{
+	float *p = &v->x;
+	_mm_storeu_ps(p,_mm_shuffle_ps(_mm_shuffle_ps(x,y,_MM_SHUFFLE(0,0,0,0)),
+		_mm_shuffle_ps(z,x,_MM_SHUFFLE(1,1,0,0)),_MM_SHUFFLE(2,0,2,0)));
+	_mm_storeu_ps(p+4,_mm_shuffle_ps(_mm_shuffle_ps(y,z,_MM_SHUFFLE(1,1,1,1)),
+		_mm_shuffle_ps(x,y,_MM_SHUFFLE(2,2,2,2)),_MM_SHUFFLE(2,0,2,0)));
+	_mm_storeu_ps(p+8,_mm_shuffle_ps(_mm_shuffle_ps(z,x,_MM_SHUFFLE(3,3,2,2)),
+		_mm_shuffle_ps(y,z,_MM_SHUFFLE(3,3,3,3)),_MM_SHUFFLE(2,0,2,0)));
+}
+
+// Operaes AVX2 sobre 8 vetores
+ALVO_AVX2 inline void _normaliza8(__m256 &x, __m256 &y, __m256 &z)
+{
+	__m256 tam = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x,x),
+		_mm256_mul_ps(y,y)),_mm256_mul_ps(z,z)));
+	// Onde o tamanho  zero, mantm o valor original
+	__m256 nulo = _mm256_cmp_ps(tam,_mm256_setzero_ps(),_CMP_EQ_OQ);
+	x = _mm256_blendv_ps(_mm256_div_ps(x,tam),x,nulo);
+	y = _mm256_blendv_ps(_mm256_div_ps(y,tam),y,nulo);
+	z = _mm256_blendv_ps(_mm256_div_ps(z,tam),z,nulo);
+}
+
+ALVO_AVX2 inline void _produto8(__m256 ax, __m256 ay, __m256 az, __m256 bx,
+	__m256 by, __m256 bz, __m256 &rx, __m256 &ry, __m256 &rz)
+{
+	rx = _mm256_sub_ps(_mm256_mul_ps(ay,bz),_mm256_mul_ps(az,by));
+	ry = _mm256_sub_ps(_mm256_mul_ps(az,bx),_mm256_mul_ps(ax,bz));
+	rz = _mm256_sub_ps(_mm256_mul_ps(ax,by),_mm256_mul_ps(ay,bx));
+}
+
+ALVO_AVX2 inline void _normal8(__m256 ax, __m256 ay, __m256 az, __m256 bx,
+	__m256 by, __m256 bz, __m256 cx, __m256 cy, __m256 cz,
+	__m256 &nx, __m256 &ny, __m256 &nz)
+{
+	_produto8(_mm256_sub_ps(cx,bx),_mm256_sub_ps(cy,by),_mm256_sub_ps(cz,bz),
+		_mm256_sub_ps(ax,bx),_mm256_sub_ps(ay,by),_mm256_sub_ps(az,bz),nx,ny,nz);
+	_normaliza8(nx,ny,nz);
+}
+
+// L 8 VERTs consecutivos: os 4 primeiros ficam na metade inferior
+// dos registradores e os demais na superior, separados como em
+// _carregaVERT4
+ALVO_AVX2 inline void _carregaVERT8(const VERT *v, __m256 &x, __m256 &y, __m256 &z)
+{
+	const float *p = &v->x;
+	__m256 a = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p)),_mm_loadu_ps(p+12),1);
+	__m256 b = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p+4)),_mm_loadu_ps(p+16),1);
+	__m256 c = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p+8)),_mm_loadu_ps(p+20),1);
+	x = _mm256_shuffle_ps(a,_mm256_shuffle_ps(b,c,_MM_SHUFFLE(0,1,0,2)),_MM_SHUFFLE(2,0,3,0));
+	y = _mm256_shuffle_ps(_mm256_shuffle_ps(a,b,_MM_SHUFFLE(0,0,0,1)),
+		_mm256_shuffle_ps(b,c,_MM_SHUFFLE(0,2,0,3)),_MM_SHUFFLE(2,0,2,0));
+	z = _mm256_shuffle_ps(_mm256_shuffle_ps(a,b,_MM_SHUFFLE(0,1,0,2)),
+		_mm256_shuffle_ps(c,c,_MM_SHUFFLE(0,3,0,0)),_MM_SHUFFLE(2,0,2,0));
+}
+
+ALVO_AVX2 inline void _gravaVERT8(VERT *v, __m256 x, __m256 y, __m256 z)
+{
+	float *p = &v->x;
+	__m256 a = _mm256_shuffle_ps(_mm256_shuffle_ps(x,y,_MM_SHUFFLE(0,0,0,0)),
+		_mm256_shuffle_ps(z,x,_MM_SHUFFLE(1,1,0,0)),_MM_SHUFFLE(2,0,2,0));
+	__m256 b = _mm256_shuffle_ps(_mm256_shuffle_ps(y,z,_MM_SHUFFLE(1,1,1,1)),
+		_mm256_shuffle_ps(x,y,_MM_SHUFFLE(2,2,2,2)),_MM_SHUFFLE(2,0,2,0));
+	__m256 c = _mm256_shuffle_ps(_mm256_shuffle_ps(z,x,_MM_SHUFFLE(3,3,2,2)),
+		_mm256_shuffle_ps(y,z,_MM_SHUFFLE(3,3,3,3)),_MM_SHUFFLE(2,0,2,0));
+	_mm_storeu_ps(p,   _mm256_castps256_ps128(a));
+	_mm_storeu_ps(p+4, _mm256_castps256_ps128(b));
+	_mm_storeu_ps(p+8, _mm256_castps256_ps128(c));
+	_mm_storeu_ps(p+12,_mm256_extractf128_ps(a,1));
+	_mm_storeu_ps(p+16,_mm256_extractf128_ps(b,1));
+	_mm_storeu_ps(p+20,_mm256_extractf128_ps(c,1));
+}
+#endif
+
+#ifdef SIMD_X86
+// Verses vetoriais das rotinas em lote: processam os vetores em
+// grupos de 4 (SSE) ou 8 (AVX2) e retornam quantos foram
+// processados - os restantes ficam para a verso escalar
+ALVO_SSE int _normalizaVetoresSSE(VERT *v, int num)
+{
+	int i = 0;
+	for(; i+4<=num; i+=4)
+	{
+		__m128 x, y, z;
+		_carregaVERT4(&v[i],x,y,z);
+		_normaliza4(x,y,z);
+		_gravaVERT4(&v[i],x,y,z);
+	}
+	return i;
+}
+
+ALVO_SSE int _normalizaSoASSE(VETSOA v, int num)
+{
+	int i = 0;
+	for(; i+4<=num; i+=4)
+	{
+		__m128 x = _mm_loadu_ps(v.x+i), y = _mm_loadu_ps(v.y+i), z = _mm_loadu_ps(v.z+i);
+		_normaliza4(x,y,z);
+		_mm_storeu_ps(v.x+i,x); _mm_storeu_ps(v.y+i,y); _mm_storeu_ps(v.z+i,z);
+	}
+	return i;
+}
+
+ALVO_SSE int _produtoVetorialSSE(VERT *v1, VERT *v2, VERT *vr, int num)
+{
+	int i = 0;
+	for(; i+4<=num; i+=4)
+	{
+		__m128 ax, ay, az, bx, by, bz, rx, ry, rz;
+		_carregaVERT4(&v1[i],ax,ay,az);
+		_carregaVERT4(&v2[i],bx,by,bz);
+		_produto4(ax,ay,az,bx,by,bz,rx,ry,rz);
+		_gravaVERT4(&vr[i],rx,ry,rz);
+	}
+	return i;
+}
+
+ALVO_SSE int _produtoSoASSE(VETSOA a, VETSOA b, VETSOA r, int num)
+{
+	int i = 0;
+	for(; i+4<=num; i+=4)
+	{
+		__m128 rx, ry, rz;
+		_produto4(_mm_loadu_ps(a.x+i),_mm_loadu_ps(a.y+i),_mm_loadu_ps(a.z+i),
+			_mm_loadu_ps(b.x+i),_mm_loadu_ps(b.y+i),_mm_loadu_ps(b.z+i),rx,ry,rz);
+		_mm_storeu_ps(r.x+i,rx); _mm_storeu_ps(r.y+i,ry); _mm_storeu_ps(r.z+i,rz);
+	}
+	return i;
+}
+
+ALVO_SSE int _vetorNormalSSE(VERT *v1, VERT *v2, VERT *v3, VERT *vn, int num)
+{
+	int i = 0;
+	for(; i+4<=num; i+=4)
+	{
+		__m128 ax, ay, az, bx, by, bz, cx, cy, cz, nx, ny, nz;
+		_carregaVERT4(&v1[i],ax,ay,az);
+		_carregaVERT4(&v2[i],bx,by,bz);
+		_carregaVERT4(&v3[i],cx,cy,cz);
+		_normal4(ax,ay,az,bx,by,bz,cx,cy,cz,nx,ny,nz);
+		_gravaVERT4(&vn[i],nx,ny,nz);
+	}
+	return i;
+}
+
+ALVO_SSE int _normalSoASSE(VETSOA a, VETSOA b, VETSOA c, VETSOA n, int num)
+{
+	int i = 0;
+	for(; i+4<=num; i+=4)
+	{
+		__m128 nx, ny, nz;
+		_normal4(_mm_loadu_ps(a.x+i),_mm_loadu_ps(a.y+i),_mm_loadu_ps(a.z+i),
+			_mm_loadu_ps(b.x+i),_mm_loadu_ps(b.y+i),_mm_loadu_ps(b.z+i),
+			_mm_loadu_ps(c.x+i),_mm_loadu_ps(c.y+i),_mm_loadu_ps(c.z+i),nx,ny,nz);
+		_mm_storeu_ps(n.x+i,nx); _mm_storeu_ps(n.y+i,ny); _mm_storeu_ps(n.z+i,nz);
+	}
+	return i;
+}
+
+// Os limites parciais de cada posio so combinados no final
+ALVO_SSE int _limitesVetoresSSE(VERT *v, int num, VERT &min, VERT &max)
+{
+	if(num < 4) return 0;
+	__m128 minx, miny, minz, maxx, maxy, maxz;
+	_carregaVERT4(v,minx,miny,minz);
+	maxx = minx; maxy = miny; maxz = minz;
+	int i = 4;
+	for(; i+4<=num; i+=4)
+	{
+		__m128 x, y, z;
+		_carregaVERT4(&v[i],x,y,z);
+		minx = _mm_min_ps(x,minx); miny = _mm_min_ps(y,miny); minz = _mm_min_ps(z,minz);
+		maxx = _mm_max_ps(x,maxx); maxy = _mm_max_ps(y,maxy); maxz = _mm_max_ps(z,maxz);
+	}
+	float mn[3][4], mx[3][4];
+	_mm_storeu_ps(mn[0],minx); _mm_storeu_ps(mn[1],miny); _mm_storeu_ps(mn[2],minz);
+	_mm_storeu_ps(mx[0],maxx); _mm_storeu_ps(mx[1],maxy); _mm_storeu_ps(mx[2],maxz);
+	min.x = mn[0][0]; min.y = mn[1][0]; min.z = mn[2][0];
+	max = min;
+	for(int k=0; k<4; ++k)
+	{
+		_limites1(mn[0][k],mn[1][k],mn[2][k],min,max);
+		_limites1(mx[0][k],mx[1][k],mx[2][k],min,max);
+	}
+	return i;
+}
+
+ALVO_SSE int _limitesSoASSE(VETSOA v, int num, VERT &min, VERT &max)
+{
+	if(num < 4) return 0;
+	__m128 minx = _mm_loadu_ps(v.x), miny = _mm_loadu_ps(v.y), minz = _mm_loadu_ps(v.z);
+	__m128 maxx = minx, maxy = miny, maxz = minz;
+	int i = 4;
+	for(; i+4<=num; i+=4)
+	{
+		__m128 x = _mm_loadu_ps(v.x+i), y = _mm_loadu_ps(v.y+i), z = _mm_loadu_ps(v.z+i);
+		minx = _mm_min_ps(x,minx); miny = _mm_min_ps(y,miny); minz = _mm_min_ps(z,minz);
+		maxx = _mm_max_ps(x,maxx); maxy = _mm_max_ps(y,maxy); maxz = _mm_max_ps(z,maxz);
+	}
+	float mn[3][4], mx[3][4];
+	_mm_storeu_ps(mn[0],minx); _mm_storeu_ps(mn[1],miny); _mm_storeu_ps(mn[2],minz);
+	_mm_storeu_ps(mx[0],maxx); _mm_storeu_ps(mx[1],maxy); _mm_storeu_ps(mx[2],maxz);
+	min.x = mn[0][0]; min.y = mn[1][0]; min.z = mn[2][0];
+	max = min;
+	for(int k=0; k<4; ++k)
+	{
+		_limites1(mn[0][k],mn[1][k],mn[2][k],min,max);
+		_limites1(mx[0][k],mx[1][k],mx[2][k],min,max);
+	}
+	return i;
+}
+
+ALVO_AVX2 int _normalizaVetoresAVX2(VERT *v, int num)
+{
+	int i = 0;
+	for(; i+8<=num; i+=8)
+	{
+		__m256 x, y, z;
+		_carregaVERT8(&v[i],x,y,z);
+		_normaliza8(x,y,z);
+		_gravaVERT8(&v[i],x,y,z);
+	}
+	return i;
+}
+
+ALVO_AVX2 int _normalizaSoAAVX2(VETSOA v, int num)
+{
+	int i = 0;
+	for(; i+8<=num; i+=8)
+	{
+		__m256 x = _mm256_loadu_ps(v.x+i), y = _mm256_loadu_ps(v.y+i), z = _mm256_loadu_ps(v.z+i);
+		_normaliza8(x,y,z);
+		_mm256_storeu_ps(v.x+i,x); _mm256_storeu_ps(v.y+i,y); _mm256_storeu_ps(v.z+i,z);
+	}
+	return i;
+}
+
+ALVO_AVX2 int _produtoVetorialAVX2(VERT *v1, VERT *v2, VERT *vr, int num)
+{
+	int i = 0;
+	for(; i+8<=num; i+=8)
+	{
+		__m256 ax, ay, az, bx, by, bz, rx, ry, rz;
+		_carregaVERT8(&v1[i],ax,ay,az);
+		_carregaVERT8(&v2[i],bx,by,bz);
+		_produto8(ax,ay,az,bx,by,bz,rx,ry,rz);
+		_gravaVERT8(&vr[i],rx,ry,rz);
+	}
+	return i;
+}
+
+ALVO_AVX2 int _produtoSoAAVX2(VETSOA a, VETSOA b, VETSOA r, int num)
+{
+	int i = 0;
+	for(; i+8<=num; i+=8)
+	{
+		__m256 rx, ry, rz;
+		_produto8(_mm256_loadu_ps(a.x+i),_mm256_loadu_ps(a.y+i),_mm256_loadu_ps(a.z+i),
+			_mm256_loadu_ps(b.x+i),_mm256_loadu_ps(b.y+i),_mm256_loadu_ps(b.z+i),rx,ry,rz);
+		_mm256_storeu_ps(r.x+i,rx); _mm256_storeu_ps(r.y+i,ry); _mm256_storeu_ps(r.z+i,rz);
+	}
+	return i;
+}
+
+ALVO_AVX2 int _vetorNormalAVX2(VERT *v1, VERT *v2, VERT *v3, VERT *vn, int num)
+{
+	int i = 0;
+	for(; i+8<=num; i+=8)
+	{
+		__m256 ax, ay, az, bx, by, bz, cx, cy, cz, nx, ny, nz;
+		_carregaVERT8(&v1[i],ax,ay,az);
+		_carregaVERT8(&v2[i],bx,by,bz);
+		_carregaVERT8(&v3[i],cx,cy,cz);
+		_normal8(ax,ay,az,bx,by,bz,cx,cy,cz,nx,ny,nz);
+		_gravaVERT8(&vn[i],nx,ny,nz);
+	}
+	return i;
+}
+
+ALVO_AVX2 int _normalSoAAVX2(VETSOA a, VETSOA b, VETSOA c, VETSOA n, int num)
+{
+	int i = 0;
+	for(; i+8<=num; i+=8)
+	{
+		__m256 nx, ny, nz;
+		_normal8(_mm256_loadu_ps(a.x+i),_mm256_loadu_ps(a.y+i),_mm256_loadu_ps(a.z+i),
+			_mm256_loadu_ps(b.x+i),_mm256_loadu_ps(b.y+i),_mm256_loadu_ps(b.z+i),
+			_mm256_loadu_ps(c.x+i),_mm256_loadu_ps(c.y+i),_mm256_loadu_ps(c.z+i),nx,ny,nz);
+		_mm256_storeu_ps(n.x+i,nx); _mm256_storeu_ps(n.y+i,ny); _mm256_storeu_ps(n.z+i,nz);
+	}
+	return i;
+}
+
+// Os limites parciais de cada posio so combinados no final
+ALVO_AVX2 int _limitesVetoresAVX2(VERT *v, int num, VERT &min, VERT &max)
+{
+	if(num < 8) return 0;
+	__m256 minx, miny, minz, maxx, maxy, maxz;
+	_carregaVERT8(v,minx,miny,minz);
+	maxx = minx; maxy = miny; maxz = minz;
+	int i = 8;
+	for(; i+8<=num; i+=8)
+	{
+		__m256 x, y, z;
+		_carregaVERT8(&v[i],x,y,z);
+		minx = _mm256_min_ps(x,minx); miny = _mm256_min_ps(y,miny); minz = _mm256_min_ps(z,minz);
+		maxx = _mm256_max_ps(x,maxx); maxy = _mm256_max_ps(y,maxy); maxz = _mm256_max_ps(z,maxz);
+	}
+	float mn[3][8], mx[3][8];
+	_mm256_storeu_ps(mn[0],minx); _mm256_storeu_ps(mn[1],miny); _mm256_storeu_ps(mn[2],minz);
+	_mm256_storeu_ps(mx[0],maxx); _mm256_storeu_ps(mx[1],maxy); _mm256_storeu_ps(mx[2],maxz);
+	min.x = mn[0][0]; min.y = mn[1][0]; min.z = mn[2][0];
+	max = min;
+	for(int k=0; k<8; ++k)
+	{
+		_limites1(mn[0][k],mn[1][k],mn[2][k],min,max);
+		_limites1(mx[0][k],mx[1][k],mx[2][k],min,max);
+	}
+	return i;
+}
+
+ALVO_AVX2 int _limitesSoAAVX2(VETSOA v, int num, VERT &min, VERT &max)
+{
+	if(num < 8) return 0;
+	__m256 minx = _mm256_loadu_ps(v.x), miny = _mm256_loadu_ps(v.y), minz = _mm256_loadu_ps(v.z);
+	__m256 maxx = minx, maxy = miny, maxz = minz;
+	int i = 8;
+	for(; i+8<=num; i+=8)
+	{
+		__m256 x = _mm256_loadu_ps(v.x+i), y = _mm256_loadu_ps(v.y+i), z = _mm256_loadu_ps(v.z+i);
+		minx = _mm256_min_ps(x,minx); miny = _mm256_min_ps(y,miny); minz = _mm256_min_ps(z,minz);
+		maxx = _mm256_max_ps(x,maxx); maxy = _mm256_max_ps(y,maxy); maxz = _mm256_max_ps(z,maxz);
+	}
+	float mn[3][8], mx[3][8];
+	_mm256_storeu_ps(mn[0],minx); _mm256_storeu_ps(mn[1],miny); _mm256_storeu_ps(mn[2],minz);
+	_mm256_storeu_ps(mx[0],maxx); _mm256_storeu_ps(mx[1],maxy); _mm256_storeu_ps(mx[2],maxz);
+	min.x = mn[0][0]; min.y = mn[1][0]; min.z = mn[2][0];
+	max = min;
+	for(int k=0; k<8; ++k)
+	{
+		_limites1(mn[0][k],mn[1][k],mn[2][k],min,max);
+		_limites1(mx[0][k],mx[1][k],mx[2][k],min,max);
+	}
+	return i;
+}
+
+#endif
+
+// As rotinas em lote abaixo usam as instrues vetoriais
+// selecionadas (ver SetaInstrucoesSIMD), com resultados idnticos
+// aos das rotinas que tratam um vetor de cada vez. Os vetores de
+// resultado podem ser os prprios vetores de entrada. As verses
+// SoA recebem as coordenadas em vetores separados (ver VETSOA)
+
+// Normaliza os num vetores de v (como Normaliza)
+void NormalizaVetores(VERT *v, int num)
+{
+	int i = 0;
+#ifdef SIMD_X86
+	switch(_obtemSIMD())
+	{
+		case SIMD_AVX2: i = _normalizaVetoresAVX2(v,num); break;
+		case SIMD_SSE:  i = _normalizaVetoresSSE(v,num); break;
+	}
+#endif
+	for(; i<num; ++i)
+		_normaliza1(v[i].x,v[i].y,v[i].z);
+}
+
+void NormalizaVetoresSoA(VETSOA v, int num)
+{
+	int i = 0;
+#ifdef SIMD_X86
+	switch(_obtemSIMD())
+	{
+		case SIMD_AVX2: i = _normalizaSoAAVX2(v,num); break;
+		case SIMD_SSE:  i = _normalizaSoASSE(v,num); break;
+	}
+#endif
+	for(; i<num; ++i)
+		_normaliza1(v.x[i],v.y[i],v.z[i]);
+}
+
+// Calcula vresult[i] = v1[i] x v2[i] (como ProdutoVetorial)
+void ProdutoVetorialVetores(VERT *v1, VERT *v2, VERT *vresult, int num)
+{
+	int i = 0;
+#ifdef SIMD_X86
+	switch(_obtemSIMD())
+	{
+		case SIMD_AVX2: i = _produtoVetorialAVX2(v1,v2,vresult,num); break;
+		case SIMD_SSE:  i = _produtoVetorialSSE(v1,v2,vresult,num); break;
+	}
+#endif
+	for(; i<num; ++i)
+		_produto1(v1[i].x,v1[i].y,v1[i].z,v2[i].x,v2[i].y,v2[i].z,
+			vresult[i].x,vresult[i].y,vresult[i].z);
+}
+
+void ProdutoVetorialSoA(VETSOA v1, VETSOA v2, VETSOA vresult, int num)
+{
+	int i = 0;
+#ifdef SIMD_X86
+	switch(_obtemSIMD())
+	{
+		case SIMD_AVX2: i = _produtoSoAAVX2(v1,v2,vresult,num); break;
+		case SIMD_SSE:  i = _produtoSoASSE(v1,v2,vresult,num); break;
+	}
+#endif
+	for(; i<num; ++i)
+		_produto1(v1.x[i],v1.y[i],v1.z[i],v2.x[i],v2.y[i],v2.z[i],
+			vresult.x[i],vresult.y[i],vresult.z[i]);
+}
+
+// Calcula em n[i] o vetor normal aos vrtices vert1[i], vert2[i] e
+// vert3[i] (como VetorNormal)
+void VetorNormalVetores(VERT *vert1, VERT *vert2, VERT *vert3, VERT *n, int num)
+{
+	int i = 0;
+#ifdef SIMD_X86
+	switch(_obtemSIMD())
+	{
+		case SIMD_AVX2: i = _vetorNormalAVX2(vert1,vert2,vert3,n,num); break;
+		case SIMD_SSE:  i = _vetorNormalSSE(vert1,vert2,vert3,n,num); break;
+	}
+#endif
+	for(; i<num; ++i)
+		_normal1(vert1[i].x,vert1[i].y,vert1[i].z,vert2[i].x,vert2[i].y,vert2[i].z,
+			vert3[i].x,vert3[i].y,vert3[i].z,n[i].x,n[i].y,n[i].z);
+}
+
+void VetorNormalSoA(VETSOA vert1, VETSOA vert2, VETSOA vert3, VETSOA n, int num)
+{
+	int i = 0;
+#ifdef SIMD_X86
+	switch(_obtemSIMD())
+	{
+		case SIMD_AVX2: i = _normalSoAAVX2(vert1,vert2,vert3,n,num); break;
+		case SIMD_SSE:  i = _normalSoASSE(vert1,vert2,vert3,n,num); break;
+	}
+#endif
+	for(; i<num; ++i)
+		_normal1(vert1.x[i],vert1.y[i],vert1.z[i],vert2.x[i],vert2.y[i],vert2.z[i],
+			vert3.x[i],vert3.y[i],vert3.z[i],n.x[i],n.y[i],n.z[i]);
+}
+
+// Calcula os limites (mnimos e mximos em x, y e z) dos num
+// vetores de v. Se num for zero, min e max no so alterados
+void LimitesVetores(VERT *v, int num, VERT &min, VERT &max)
+{
+	int i = 0;
+	if(num <= 0) return;
+#ifdef SIMD_X86
+	switch(_obtemSIMD())
+	{
+		case SIMD_AVX2: i = _limitesVetoresAVX2(v,num,min,max); break;
+		case SIMD_SSE:  i = _limitesVetoresSSE(v,num,min,max); break;
+	}
+#endif
+	if(!i)
+	{
+		min = max = v[0];
+		i = 1;
+	}
+	for(; i<num; ++i)
+		_limites1(v[i].x,v[i].y,v[i].z,min,max);
+}
+
+void LimitesSoA(VETSOA v, int num, VERT &min, VERT &max)
+{
+	int i = 0;
+	if(num <= 0) return;
+#ifdef SIMD_X86
+	switch(_obtemSIMD())
+	{
+		case SIMD_AVX2: i = _limitesSoAAVX2(v,num,min,max); break;
+		case SIMD_SSE:  i = _limitesSoASSE(v,num,min,max); break;
+	}
+#endif
+	if(!i)
+	{
+		min.x = max.x = v.x[0];
+		min.y = max.y = v.y[0];
+		min.z = max.z = v.z[0];
+		i = 1;
+	}
+	for(; i<num; ++i)
+		_limites1(v.x[i],v.y[i],v.z[i],min,max);
+}
+
+// As matrizes de transformao (MATRIZ) so armazenadas por
+// colunas, como em OpenGL - portanto podem ser passadas diretamente
+// para glMultMatrixf e glLoadMatrixf
+
+// Inicializa m com a matriz identidade
+void MatrizIdentidade(MATRIZ &m)
+{
+	for(int i=0; i<16; ++i)
+		m.m[i] = (i % 5) ? 0 : 1;
+}
+
+// Calcula mresult = m1 * m2, ou seja, a transformao que aplica
+// m2 e depois m1 (mresult pode ser a prpria m1 ou m2)
+void MultiplicaMatrizes(MATRIZ &m1, MATRIZ &m2, MATRIZ &mresult)
+{
+	MATRIZ res;
+	for(int col=0; col<4; ++col)
+		for(int lin=0; lin<4; ++lin)
+			res.m[col*4+lin] = m1.m[lin]    * m2.m[col*4]
+							 + m1.m[4+lin]  * m2.m[col*4+1]
+							 + m1.m[8+lin]  * m2.m[col*4+2]
+							 + m1.m[12+lin] * m2.m[col*4+3];
+	mresult = res;
+}
+
+// Funo interna que acrescenta a m uma transformao dada pela
+// sua parte 3x3 (r, por linhas) e pela translao t: a nova
+// transformao  aplicada depois das que j estavam em m
+void _acumulaMatriz(MATRIZ &m, const float r[9], float tx, float ty, float tz)
+{
+	MATRIZ t;
+	MatrizIdentidade(t);
+	for(int lin=0; lin<3; ++lin)
+		for(int col=0; col<3; ++col)
+			t.m[col*4+lin] = r[lin*3+col];
+	t.m[12] = tx; t.m[13] = ty; t.m[14] = tz;
+	MultiplicaMatrizes(t,m,m);
+}
+
+// Acrescenta  matriz m uma escala
+void EscalaMatriz(MATRIZ &m, float ex, float ey, float ez)
+{
+	float r[9] = { ex, 0, 0,  0, ey, 0,  0, 0, ez };
+	_acumulaMatriz(m,r,0,0,0);
+}
+
+// Acrescenta  matriz m uma translao
+void TransladaMatriz(MATRIZ &m, float tx, float ty, float tz)
+{
+	float r[9] = { 1, 0, 0,  0, 1, 0,  0, 0, 1 };
+	_acumulaMatriz(m,r,tx,ty,tz);
+}
+
+// Acrescentam  matriz m uma rotao de <ang> graus em torno de
+// Z, Y ou X - no mesmo sentido de RotaZ, RotaY e RotaX. O seno e o
+// cosseno so calculados uma nica vez, na criao da matriz
+void RotaMatrizZ(MATRIZ &m, float ang)
+{
+	float arad = ang*M_PI/180.0;
+	float c = cos(arad), s = sin(arad);
+	float r[9] = { c, s, 0,  -s, c, 0,  0, 0, 1 };
+	_acumulaMatriz(m,r,0,0,0);
+}
+
+void RotaMatrizY(MATRIZ &m, float ang)
+{
+	float arad = ang*M_PI/180.0;
+	float c = cos(arad), s = sin(arad);
+	float r[9] = { c, 0, -s,  0, 1, 0,  s, 0, c };
+	_acumulaMatriz(m,r,0,0,0);
+}
+
+void RotaMatrizX(MATRIZ &m, float ang)
+{
+	float arad = ang*M_PI/180.0;
+	float c = cos(arad), s = sin(arad);
+	float r[9] = { 1, 0, 0,  0, c, s,  0, -s, c };
+	_acumulaMatriz(m,r,0,0,0);
+}
+
+// Aplica a matriz m a um vrtice (a ltima linha da matriz 
+// ignorada, ou seja, a transformao deve ser afim)
+void TransformaVertice(MATRIZ &m, VERT &in, VERT &out)
+{
+	VERT res;
+	res.x = m.m[0]*in.x + m.m[4]*in.y + m.m[8]*in.z  + m.m[12];
+	res.y = m.m[1]*in.x + m.m[5]*in.y + m.m[9]*in.z  + m.m[13];
+	res.z = m.m[2]*in.x + m.m[6]*in.y + m.m[10]*in.z + m.m[14];
+	out = res;
+}
+
+#ifdef SIMD_X86
+// Verses vetoriais de TransformaVetores: retornam quantos
+// vetores foram processados
+ALVO_SSE int _transformaVetoresSSE(MATRIZ &m, VERT *v, int num)
+{
+	__m128 c[12];
+	for(int k=0; k<12; ++k) c[k] = _mm_set1_ps(m.m[(k/3)*4 + k%3]);
+	int i = 0;
+	for(; i+4<=num; i+=4)
+	{
+		__m128 x, y, z;
+		_carregaVERT4(&v[i],x,y,z);
+		__m128 rx = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0],x),_mm_mul_ps(c[3],y)),_mm_mul_ps(c[6],z)),c[9]);
+		__m128 ry = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c[1],x),_mm_mul_ps(c[4],y)),_mm_mul_ps(c[7],z)),c[10]);
+		__m128 rz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c[2],x),_mm_mul_ps(c[5],y)),_mm_mul_ps(c[8],z)),c[11]);
+		_gravaVERT4(&v[i],rx,ry,rz);
+	}
+	return i;
+}
+
+ALVO_AVX2 int _transformaVetoresAVX2(MATRIZ &m, VERT *v, int num)
+{
+	__m256 c[12];
+	for(int k=0; k<12; ++k) c[k] = _mm256_set1_ps(m.m[(k/3)*4 + k%3]);
+	int i = 0;
+	for(; i+8<=num; i+=8)
+	{
+		__m256 x, y, z;
+		_carregaVERT8(&v[i],x,y,z);
+		__m256 rx = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[0],x),_mm256_mul_ps(c[3],y)),_mm256_mul_ps(c[6],z)),c[9]);
+		__m256 ry = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[1],x),_mm256_mul_ps(c[4],y)),_mm256_mul_ps(c[7],z)),c[10]);
+		__m256 rz = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[2],x),_mm256_mul_ps(c[5],y)),_mm256_mul_ps(c[8],z)),c[11]);
+		_gravaVERT8(&v[i],rx,ry,rz);
+	}
+	return i;
+}
+#endif
+
+// Aplica a matriz m aos num vetores de v (como TransformaVertice)
+void TransformaVetores(MATRIZ &m, VERT *v, int num)
+{
+	int i = 0;
+#ifdef SIMD_X86
+	switch(_obtemSIMD())
+	{
+		case SIMD_AVX2: i = _transformaVetoresAVX2(m,v,num); break;
+		case SIMD_SSE:  i = _transformaVetoresSSE(m,v,num); break;
+	}
+#endif
+	for(; i<num; ++i)
+		TransformaVertice(m,v[i],v[i]);
+}
+
+// Funo interna, usada por CarregaObjeto para
+// interpretar a definio de uma face em um
+// arquivo .OBJ
+// 
+// Recebe um apontador para a posio corrente na
+// string e devolve o valor numrico encontrado
+// at o primeiro / ou -1 caso no exista
+//
+// Tambm retorna em sep o separador encontrado
+int leNum(char **face, char *sep)
+{
+	char temp[10];
+	int pos = 0;
+	while(**face)
+	{
+		if(**face == '/' || **face==' ') // achamos o separador
+		{
+			*sep = **face;
+			(*face)++;
+			break;
+		}
+		temp[pos++] = **face;
+		(*face)++;
+	}
+	temp[pos]=0;
+	if(!pos) // string vazia ?
+		return -1;
+	return atoi(temp);
+}
+
+// Funo interna que procura um nome em uma das tabelas de
+// ndices e devolve o ndice associado, ou -1 se no achar
+int _procuraIndice(unordered_map<string,int> &tabela, const char *nome)
+{
+	// A chave  reaproveitada entre as buscas, evitando alocar
+	// memria a cada uma
+	static string chave;
+	chave.assign(nome);
+	unordered_map<string,int>::iterator it = tabela.find(chave);
+	return it == tabela.end() ? -1 : it->second;
+}
+
+// Procura um material pelo nome na lista e devolve
+// o ndice onde est, ou -1 se no achar
+int _procuraMaterial(const char *nome)
+{
+	return _procuraIndice(_indiceMateriais,nome);
+}
+
+// Funo interna que inclui um material na lista, com o nome
+// recebido, e devolve o seu ndice (que no muda mais)
+int _registraMaterial(MAT *mat, const char *nome)
+{
+	int indice = _materiais.size();
+	pair<unordered_map<string,int>::iterator,bool> res =
+		_indiceMateriais.insert(make_pair(string(nome),indice));
+	if(!res.second) return res.first->second;	// j existe
+	mat->nome = res.first->first.c_str();
+	_materiais.push_back(mat);
+	return indice;
+}
+
+// Procura um material pelo nome e devolve um
+// apontador para ele ou NULL caso no ache
+MAT *ProcuraMaterial(char *nome)
+{
+	int pos = _procuraMaterial(nome);
+	if(pos == -1) return NULL;
+	else return _materiais[pos];
+}
+
+// Procura uma textura pelo nome na lista e devolve
+// o ndice onde est, ou -1 se no achar
+int _procuraTextura(const char *nome)
+{
+	return _procuraIndice(_indiceTexturas,nome);
+}
+
+// Funo interna que inclui uma textura na lista, com o nome
+// recebido, e devolve o seu ndice
+int _registraTextura(TEX *tex, const char *nome)
+{
+	int indice = _texturas.size();
+	pair<unordered_map<string,int>::iterator,bool> res =
+		_indiceTexturas.insert(make_pair(string(nome),indice));
+	if(!res.second) return res.first->second;	// j existe
+	tex->nome = res.first->first.c_str();
+	_texturas.push_back(tex);
+	return indice;
+}
+
+// Bibliotecas de materiais (mtllib) lidas pela carga corrente, que
+// o cache do objeto tambm verifica (ver _gravaCacheObjeto)
+vector<string> _bibliotecasLidas;
+
+// L um arquivo que define materiais para um objeto 3D no
+// formato .OBJ
+void _leMateriais(char *nomeArquivo)
+{
+	char aux[256];
+	FILE *fp;
+	MAT *ptr = NULL;
+	_bibliotecasLidas.push_back(nomeArquivo);
+	fp = fopen(nomeArquivo,"r");
+
+	/* Especificao do arquivo de materiais (.mtl):
+	 * 
+	 * #,!,$  - comentrio
+	 * newmtl - nome do novo material(sem espaos)
+	 * Ka	  - Cor ambiente, especificada como 3 floats
+	 * Kd	  - Cor difusa, idem
+	 * Ks	  - Cor especular, idem
+	 * Ns	  - Coeficiente de especularidade, entre 0 and 1000 
+	 *          (convertido para a faixa vlida em OpenGL (0..128) durante a leitura)
+	 * d	  - Transparncia - mesmo significado que o alpha em OpenGL: 0.0 a 1.0 (0.0 = transparente)
+	 *
+	 * Os demais campos so ignorados por este leitor:
+	 * Tr	  - Transparncia (0 = opaco, 1 = transparente)
+	 * map_Kd - Especifica arquivo com a textura a ser mapeada como material difuso
+	 * refl	  - Especifica arquivo com um mapa de reflexo
+	 * Ni	  - ndice de refrao, 1.0 ou maior, onde 1.0 representa sem refrao
+	 * bump	  - Especifica arquivo para "bump mapping"
+	 * illum  - Modelo de iluminao (1 = apenas cores, 2 = textura, 3 = reflexes e raytracing)
+	 * map_Ka - Especifica arquivo com a textura a ser mapeada como cor ambiente
+	 * map_Ks - Especifica arquivo com a textura a ser mapeada como cor especular
+	 * map_Ns - Especifica arquivo com a textura a ser mapeada como reflexo especular
+	 * map_d  - Especifica arquivo cmo a textura a ser mapeada como transparncia (branco  opaco, preto  transparente)
+	 *
+	 */
+
+	while(!feof(fp))
+	{
+		fgets(aux,255,fp);
+		if (strlen(aux)>1)
+			aux[strlen(aux)-1]=0;	// elimina o \n lido do arquivo
+		if(aux[0]=='#') continue;
+		if(!strncmp(aux,"newmtl",6)) // Novo material ?
+		{
+			// Se material j existe na lista, pula para o 
+			// prximo
+			if(_procuraMaterial(&aux[7])!=-1)
+			{
+				ptr = NULL;
+				continue;
+			}
+			if((ptr = (MAT *) malloc(sizeof(MAT)))==NULL)
+			{
+				printf("Sem memria para novo material!");
+				exit(1);
+			}
+			// Adiciona  lista, com o nome do material
+			_registraMaterial(ptr,&aux[7]);
+			// Valores padro de OpenGL para os campos que no
+			// aparecerem no arquivo - opaco, se no houver "d"
+			ptr->ka[0] = ptr->ka[1] = ptr->ka[2] = 0.2;
+			ptr->kd[0] = ptr->kd[1] = ptr->kd[2] = 0.8;
+			ptr->ks[0] = ptr->ks[1] = ptr->ks[2] = 0.0;
+			ptr->ka[3] = ptr->kd[3] = ptr->ks[3] = 1.0;
+			ptr->spec = 0.0;
+			// No existe "emission" na definio do material
+			// mas o valor pode ser setado mais tarde,
+			// via SetaEmissaoMaterial(..)
+			ptr->ke[0] = ptr->ke[1] = ptr->ke[2] = 0.0;
+			ptr->ke[3] = 1.0;
+		}
+		if(!strncmp(aux,"Ka ",3)) // Ambiente
+		{
+			if(ptr==NULL) continue;
+			sscanf(aux,"Ka %f %f %f",&ptr->ka[0],&ptr->ka[1],&ptr->ka[2]);
+		}
+		if(!strncmp(aux,"Kd ",3)) // Difuso
+		{
+			if(ptr==NULL) continue;
+			sscanf(aux,"Kd %f %f %f",&ptr->kd[0],&ptr->kd[1],&ptr->kd[2]);
+		}
+		if(!strncmp(aux,"Ks ",3)) // Especular
+		{
+			if(ptr==NULL) continue;
+			sscanf(aux,"Ks %f %f %f",&ptr->ks[0],&ptr->ks[1],&ptr->ks[2]);
+		}
+		if(!strncmp(aux,"Ns ",3)) // Fator de especularidade
+		{
+			if(ptr==NULL) continue;
+			sscanf(aux,"Ns %f",&ptr->spec);
+			// Converte da faixa lida (0...1000) para o intervalo
+			// vlido em OpenGL (0...128)
+			ptr->spec = ptr->spec/1000.0 * 128;
+		}
+		if(!strncmp(aux,"d ",2)) // Alpha
+		{
+			if(ptr==NULL) continue;
+			// No existe alpha na definio de cada componente
+			// mas o valor  lido em separado e vale para todos
+			float alpha;
+			sscanf(aux,"d %f",&alpha);
+			ptr->ka[3] = alpha;
+			ptr->kd[3] = alpha;
+			ptr->ks[3] = alpha;
+		}
+	}
+	fclose(fp);
+}
+
+// Funo interna que aloca um novo objeto e inicializa
+// seus campos (sem vrtices, faces, normais ou texcoords)
+OBJ *_alocaObjeto()
+{
+	OBJ *obj;
+	if ( ( obj = (OBJ *) malloc(sizeof(OBJ)) ) == NULL)
+		return NULL;
+
+	// Inicializa contadores do objeto
+	obj->numVertices  = 0;
+	obj->numFaces     = 0;
+	obj->numNormais   = 0;
+	obj->numTexcoords = 0;
+	// A princpio no temos normais por vrtice...
+	obj->normais_por_vertice = false;
+	// E tambm no temos materiais...
+	obj->tem_materiais = false;
+	obj->textura = -1;	// sem textura associada
+	obj->dlist = -1;	// sem display list
+
+	obj->vertices = NULL;
+	obj->faces = NULL;
+	obj->normais = NULL;
+	obj->texcoords = NULL;
+	// ndices no formato compacto (ver CompactaFaces)
+	obj->inicio_faces = NULL;
+	obj->ind_vertices = NULL;
+	obj->ind_normais = NULL;
+	obj->ind_texcoords = NULL;
+	// Sem cache binrio mapeado
+	obj->cache = NULL;
+	obj->tam_cache = 0;
+	// Nenhuma malha para desenho indexado (ver CriaMalha)
+	obj->malha = NULL;
+	// Sem buffers (ver CriaVBO)
+	obj->vbo = obj->ibo = obj->vao = 0;
+	// Sem instncias (ver DesenhaInstancias)
+	obj->vboInstancias = 0;
+	obj->capInstancias = 0;
+	obj->instancias = NULL;
+	// Faces ainda no agrupadas (ver AgrupaFaces)
+	obj->lotes = NULL;
+	obj->numLotes = 0;
+	obj->trocasEvitadas = 0;
+	// Limites ainda desconhecidos (ver _calculaLimites)
+	memset(&obj->min,0,sizeof(VERT));
+	obj->max = obj->centro = obj->min;
+	obj->raio = 0;
+	// Faces no divididas em blocos (ver CriaBlocos)
+	obj->blocos = NULL;
+	obj->numBlocos = 0;
+	// Sem BVH (ver CriaBVH)
+	obj->bvh = NULL;
+	return obj;
+}
+
+// Funo interna que calcula a esfera envolvente de um objeto, com
+// o centro na sua caixa envolvente (obj->min e obj->max)
+void _esferaEnvolvente(OBJ *obj)
+{
+	obj->centro.x = (obj->min.x + obj->max.x) / 2;
+	obj->centro.y = (obj->min.y + obj->max.y) / 2;
+	obj->centro.z = (obj->min.z + obj->max.z) / 2;
+	float raio = 0;
+	for(int i=0; i<obj->numVertices; ++i)
+	{
+		float dx = obj->vertices[i].x - obj->centro.x;
+		float dy = obj->vertices[i].y - obj->centro.y;
+		float dz = obj->vertices[i].z - obj->centro.z;
+		raio = max(raio, dx*dx + dy*dy + dz*dz);
+	}
+	obj->raio = sqrt(raio);
+}
+
+// Funo interna que calcula a caixa e a esfera envolventes
+// dos vrtices de um objeto
+void _calculaLimites(OBJ *obj)
+{
+	if(obj->numVertices)
+		LimitesVetores(obj->vertices,obj->numVertices,obj->min,obj->max);
+	else
+	{
+		memset(&obj->min,0,sizeof(VERT));
+		obj->max = obj->min;
+	}
+	_esferaEnvolvente(obj);
+}
+
+// Funo interna, usada por CarregaObjeto no modo de carga 'n':
+// l o arquivo em duas passagens (a primeira apenas conta os
+// elementos) usando fgets e sscanf
+OBJ *_carregaObjetoTexto(char *nomeArquivo, bool mipmap)
+{
+	int i;
+	int vcont,ncont,fcont,tcont;
+	int material, texid, grupo;
+	char aux[256];
+	TEX *ptr;
+	FILE *fp;
+	OBJ *obj;
+
+	fp = fopen(nomeArquivo, "r");  // abre arquivo texto para leitura
+
+#ifdef DEBUG
+	printf("*** Objeto: %s\n",nomeArquivo);
+#endif
+	/* Especificao do formato .obj para objetos poligonais:
+	 * 
+	 * # - commentrio
+	 * v x y z - vrtice
+	 * vn x y z - normal
+	 * vt x y z - texcoord
+	 * f a1 a2 ... - face com apenas ndices de vrtices
+	 * f a1/b1/c1 a2/b2/c2 ... - face com ndices de vrtices, normais e texcoords
+	 * f a1//c1 a2//c2 ... - face com ndices de vrtices e normais (sem texcoords)
+	 *
+	 * s numerogrupo ou off - especifica um grupo de suavizao ("smoothing"),
+	 *                        usado por CalculaNormais
+	 *
 	 * Campos ignorados:
 	 * g nomegrupo1 nomegrupo2... - especifica que o objeto  parte de um ou mais grupos
-	 * s numerogrupo ou off - especifica um grupo de suavizao ("smoothing")
 	 * o nomeobjeto: define um nome para o objeto
 	 *
 	 * Biblioteca de materiais e textura:
@@ -379,527 +1605,6172 @@ OBJ *CarregaObjeto(char *nomeArquivo, bool mipmap)
 	 * 
 	 */
 
-	if(fp == NULL)
-          return NULL;
+	if(fp == NULL)
+          return NULL;
+
+	if ( ( obj = _alocaObjeto() ) == NULL)
+		return NULL;
+
+	// A primeira passagem serve apenas para contar quantos
+	// elementos existem no arquivo - necessrio para
+	// alocar memria depois
+	while(!feof(fp))
+	{
+		fgets(aux,255,fp);
+		if(!strncmp(aux,"v ",2)) // encontramos um vrtice
+			obj->numVertices++;
+		if(!strncmp(aux,"f ",2)) // encontramos uma face
+			obj->numFaces++;
+		if(!strncmp(aux,"vn ",3)) // encontramos uma normal
+			obj->numNormais++;
+		if(!strncmp(aux,"vt ",3)) // encontramos uma texcoord
+			obj->numTexcoords++;
+	}
+	// Agora voltamos ao incio do arquivo para ler os elementos
+	rewind(fp);
+
+#ifdef DEBUG
+	printf("Vertices: %d\n",obj->numVertices);
+	printf("Faces:    %d\n",obj->numFaces);
+	printf("Normais:  %d\n",obj->numNormais);
+	printf("Texcoords:%d\n",obj->numTexcoords);
+#endif
+
+	// Aloca os vrtices
+	if ( ( obj->vertices = (VERT *) malloc((sizeof(VERT)) * obj->numVertices) ) == NULL )
+		return NULL;
+
+	// Aloca as faces
+	if ( ( obj->faces = (FACE *) malloc((sizeof(FACE)) * obj->numFaces) ) == NULL )
+		return NULL;
+
+	// Aloca as normais
+	if(obj->numNormais)
+		if ( ( obj->normais = (VERT *) malloc((sizeof(VERT)) * obj->numNormais) ) == NULL )
+			return NULL;
+
+	// Aloca as texcoords
+	if(obj->numTexcoords)
+		if ( ( obj->texcoords = (TEXCOORD *) malloc((sizeof(TEXCOORD)) * obj->numTexcoords) ) == NULL )
+			return NULL;
+
+	// A segunda passagem  para ler efetivamente os
+	// elementos do arquivo, j que sabemos quantos
+	// tem de cada tipo
+	vcont = 0;
+	ncont = 0;
+	tcont = 0;
+	fcont = 0;
+	// Material corrente = nenhum
+	material = -1;
+	// Textura corrente = nenhuma
+	texid = -1;
+	// Grupo de suavizao corrente = nenhum
+	grupo = 0;
+
+	// Utilizadas para determinar os limites do objeto
+	// em x,y e z
+	float minx = 0, miny = 0, minz = 0;
+	float maxx = 0, maxy = 0, maxz = 0;
+
+	while(!feof(fp))
+	{
+		fgets(aux,255,fp);
+		aux[strlen(aux)-1]=0;	// elimina o \n lido do arquivo
+		// Pula comentrios
+		if(aux[0]=='#') continue;
+
+		// Definio da biblioteca de materiais ?
+		if(!strncmp(aux,"mtllib",6))
+		{
+				// Chama funo para ler e interpretar o arquivo
+				// que define os materiais
+				_leMateriais(&aux[7]);
+				// Indica que o objeto possui materiais
+				obj->tem_materiais = true;
+		}
+		// Seleo de material ?
+		if(!strncmp(aux,"usemtl",6))
+		{
+			// Procura pelo nome e salva o ndice para associar
+			// s prximas faces
+			material = _procuraMaterial(&aux[7]);
+			texid = -1;
+		}
+		// Seleo de uma textura (.jpg)
+		if(!strncmp(aux,"usemat",6))
+		{
+			// s vezes,  especificado o valor (null) como textura
+			// (especialmente em se tratando do mdulo de exportao
+			// do Blender)
+			if(!strcmp(&aux[7],"(null)"))
+			{
+				texid = -1;
+				continue;
+			}
+			// Tenta carregar a textura
+			ptr = CarregaTextura(&aux[7],mipmap);
+			texid = ptr->texid;
+		}
+		// Grupo de suavizao ? ("s off" desativa)
+		if(!strncmp(aux,"s ",2))
+			grupo = strncmp(&aux[2],"off",3) ? atoi(&aux[2]) : 0;
+		// Vrtice ?
+		if(!strncmp(aux,"v ",2))
+		{
+			sscanf(aux,"v %f %f %f",&obj->vertices[vcont].x,
+					&obj->vertices[vcont].y,
+					&obj->vertices[vcont].z);
+			if(!vcont)
+			{
+				minx = maxx = obj->vertices[vcont].x;
+				miny = maxy = obj->vertices[vcont].y;
+				minz = maxz = obj->vertices[vcont].z;
+			}
+			else
+			{
+				if(obj->vertices[vcont].x < minx) minx = obj->vertices[vcont].x;
+				if(obj->vertices[vcont].y < miny) miny = obj->vertices[vcont].y;
+				if(obj->vertices[vcont].z < minz) minz = obj->vertices[vcont].z;
+				if(obj->vertices[vcont].x > maxx) maxx = obj->vertices[vcont].x;
+				if(obj->vertices[vcont].y > maxy) maxy = obj->vertices[vcont].y;
+				if(obj->vertices[vcont].z > maxz) maxz = obj->vertices[vcont].z;
+			}
+			vcont++;
+		}
+		// Normal ?
+		if(!strncmp(aux,"vn ",3))
+		{
+			sscanf(aux,"vn %f %f %f",&obj->normais[ncont].x,
+					&obj->normais[ncont].y,
+					&obj->normais[ncont].z);
+			ncont++;
+			// Registra que o arquivo possui definio de normais por
+			// vrtice
+			obj->normais_por_vertice = true;
+		}
+		// Texcoord ?
+		if(!strncmp(aux,"vt ",3))
+		{
+			sscanf(aux,"vt %f %f %f",&obj->texcoords[tcont].s,
+					&obj->texcoords[tcont].t,
+					&obj->texcoords[tcont].r);
+			tcont++;
+		}
+		// Face ?
+		if(!strncmp(aux,"f ",2))
+		{
+			// Pula "f "
+			char *ptr = aux+2;
+			// Associa  face o ndice do material corrente, ou -1 se
+			// no houver
+			obj->faces[fcont].mat = material;
+			// Associa  face o texid da textura seleciona ou -1 se
+			// no ouver
+			obj->faces[fcont].texid = texid;
+			// E tambm o grupo de suavizao corrente
+			obj->faces[fcont].grupo = grupo;
+			// Temporrios para armazenar os ndices desta face
+			int vi[10],ti[10],ni[10];
+			// Separador encontrado
+			char sep;
+			obj->faces[fcont].nv = 0;
+			int nv = 0;
+			bool tem_t = false;
+			bool tem_n = false;
+			// Interpreta a descrio da face
+			while(*ptr)
+			{
+				// L ndice do vrtice
+				vi[nv] = leNum(&ptr,&sep);
+				// Se o separador for espao, significa que
+				// no temos texcoord nem normais
+				if(sep==' ')
+				{
+					// Nesse caso, incrementamos o contador
+					// de vrtices e continuamos
+					nv++;
+					continue;
+				}
+				// L ndice da texcoord
+				int aux = leNum(&ptr,&sep);
+				// Se o valor for != -1, significa
+				// que existe um ndice de texcoord
+				if(aux!=-1)
+				{
+					ti[nv] = aux;
+					tem_t = true;
+				}
+				// Mas se o separador for " ", significa
+				// que no existe um ndice de normal
+				if(sep==' ')
+				{
+					// E nesse caso, pulamos para
+					// o prximo vrtice
+					nv++;
+					continue;
+				}
+				// L o ndice da normal
+				aux = leNum(&ptr,&sep);
+				if(aux!=-1)
+				{
+					ni[nv] = aux;
+					tem_n = true;
+				}
+				// Prepara para prximo vrtice
+				nv++;
+			}
+			// Fim da face, aloca memria para estruturas e preenche com
+			// os valores lidos
+			obj->faces[fcont].nv = nv;
+			obj->faces[fcont].vert = (int *) malloc(sizeof(int)*nv);
+			// S aloca memria para normais e texcoords se for necessrio
+			if(tem_n) obj->faces[fcont].norm = (int *) malloc(sizeof(int)*nv);
+				else obj->faces[fcont].norm = NULL;
+			if(tem_t) obj->faces[fcont].tex  = (int *) malloc(sizeof(int)*nv);
+				else obj->faces[fcont].tex = NULL;
+			// Copia os ndices dos arrays temporrios para a face
+			for(i=0;i<nv;++i)
+			{
+				// Subtramos -1 dos ndices porque o formato OBJ comea
+				// a contar a partir de 1, no 0
+				obj->faces[fcont].vert[i] = vi[i]-1;
+				if(tem_n) obj->faces[fcont].norm[i] = ni[i]-1;
+				if(tem_t) obj->faces[fcont].tex[i]  = ti[i]-1;
+			}
+			// Prepara para prxima face
+			fcont++;
+		}
+	}
+	// Guarda os limites do objeto
+	if(vcont)
+	{
+		obj->min.x = minx; obj->min.y = miny; obj->min.z = minz;
+		obj->max.x = maxx; obj->max.y = maxy; obj->max.z = maxz;
+	}
+	_esferaEnvolvente(obj);
+#ifdef DEBUG
+	printf("Limites: %f %f %f - %f %f %f\n",minx,miny,minz,maxx,maxy,maxz);
+#endif
+	// Fim, fecha arquivo e retorna apontador para objeto
+	fclose(fp);
+	// Adiciona na lista
+	_objetos.push_back(obj);
+	return obj;
+}
+
+// Estrutura interna que representa um arquivo inteiro
+// disponvel em memria (mapeado, ou lido de uma s vez
+// nos sistemas sem mmap)
+typedef struct {
+	char *dados;	// contedo do arquivo
+	size_t tam;		// tamanho em bytes
+	bool mapeado;	// true se foi obtido atravs de mmap
+} ARQMEM;
+
+// Funo interna que disponibiliza o contedo de um arquivo
+// em memria. Retorna false se no conseguir abri-lo.
+//
+// Se alteravel for true, o contedo pode ser modificado (sem
+// afetar o arquivo) e as pginas s so lidas quando acessadas;
+// caso contrrio,  somente para leitura sequencial
+bool _mapeiaArquivo(const char *nomeArquivo, ARQMEM *arq, bool alteravel=false)
+{
+	arq->dados = NULL;
+	arq->tam = 0;
+	arq->mapeado = false;
+#ifndef _WIN32
+	int fd = open(nomeArquivo, O_RDONLY);
+	if(fd == -1) return false;
+	struct stat st;
+	if(fstat(fd,&st) == -1)
+	{
+		close(fd);
+		return false;
+	}
+	arq->tam = st.st_size;
+	// Arquivo vazio: no h o que mapear
+	if(!arq->tam)
+	{
+		close(fd);
+		return true;
+	}
+	int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+	// J carrega as pginas, evitando uma falta de pgina a cada 4 KB
+	if(!alteravel) flags |= MAP_POPULATE;
+#endif
+	void *ptr = mmap(NULL, arq->tam, alteravel ? PROT_READ|PROT_WRITE : PROT_READ,
+		flags, fd, 0);
+	// O descritor pode ser fechado, o mapeamento continua vlido
+	close(fd);
+	if(ptr == MAP_FAILED) return false;
+	// Avisa o sistema que o arquivo ser lido em sequncia
+	if(!alteravel) madvise(ptr, arq->tam, MADV_SEQUENTIAL);
+	arq->dados = (char *) ptr;
+	arq->mapeado = true;
+	return true;
+#else
+	// Sem mmap: l o arquivo inteiro de uma s vez
+	FILE *fp = fopen(nomeArquivo, "rb");
+	if(fp == NULL) return false;
+	fseek(fp, 0, SEEK_END);
+	arq->tam = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if((arq->dados = (char *) malloc(arq->tam+1)) == NULL)
+	{
+		fclose(fp);
+		return false;
+	}
+	arq->tam = fread(arq->dados, 1, arq->tam, fp);
+	fclose(fp);
+	return true;
+#endif
+}
+
+// Libera a memria ocupada por um arquivo obtido com _mapeiaArquivo
+void _liberaArquivo(ARQMEM *arq)
+{
+#ifndef _WIN32
+	if(arq->mapeado) munmap(arq->dados, arq->tam);
+	else
+#endif
+	if(arq->dados != NULL) free(arq->dados);
+	arq->dados = NULL;
+	arq->tam = 0;
+}
+
+// Vetor interno que cresce conforme a necessidade.  alocado
+// com malloc/realloc para que o seu contedo possa ser entregue
+// diretamente a um OBJ (e liberado depois com free)
+template <class T> struct _Vetor {
+	T *dados;	// elementos armazenados
+	int num;	// quantidade de elementos em uso
+	int cap;	// capacidade alocada
+
+	_Vetor() : dados(NULL), num(0), cap(0) {}
+	~_Vetor() { if(dados != NULL) free(dados); }
+
+	// Garante espao para pelo menos n elementos
+	void reserva(int n)
+	{
+		if(n <= cap) return;
+		if((dados = (T *) realloc(dados, sizeof(T)*n)) == NULL)
+		{
+			printf("Sem memria para carregar objeto!\n");
+			exit(1);
+		}
+		cap = n;
+	}
+	// Devolve o apontador para um novo elemento no final
+	T *novo()
+	{
+		if(num == cap) reserva(cap ? cap*2 : 1024);
+		return &dados[num++];
+	}
+	void adiciona(const T &val) { *novo() = val; }
+	// Libera o contedo
+	void libera()
+	{
+		if(dados != NULL) free(dados);
+		dados = NULL;
+		num = cap = 0;
+	}
+	// Entrega o contedo (ajustado ao tamanho exato) para
+	// quem chamou, que passa a ser responsvel por liber-lo
+	T *entrega()
+	{
+		T *ptr = NULL;
+		if(num) ptr = (T *) realloc(dados, sizeof(T)*num);
+		else if(dados != NULL) free(dados);
+		dados = NULL;
+		num = cap = 0;
+		return ptr;
+	}
+};
+
+// Potncias de 10 exatamente representveis em double,
+// usadas por _leFloat
+const double _pot10[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+	1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+	1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+// Funo interna que pula espaos, tabulaes e \r a partir
+// de p, sem ultrapassar fim
+inline const char *_pulaEspacos(const char *p, const char *fim)
+{
+	while(p < fim && (*p==' ' || *p=='\t' || *p=='\r')) ++p;
+	return p;
+}
+
+// Funo interna, usada pela leitura rpida de arquivos .OBJ
+// para converter um nmero real sem depender do "locale"
+// corrente (ao contrrio de sscanf e atof).
+//
+// Recebe um apontador para a posio corrente no texto e o
+// avana at o final do nmero. Retorna false se no houver
+// um nmero na posio corrente.
+bool _leFloat(const char **texto, const char *fim, float *valor)
+{
+	const char *p = *texto;
+	bool negativo = false;
+	if(p < fim && (*p=='-' || *p=='+'))
+		negativo = (*p++ == '-');
+	unsigned long long mant = 0;	// dgitos significativos
+	int digitos = 0;				// quantos dgitos esto em mant
+	int exp = 0;					// expoente decimal a aplicar
+	const char *ini = p;
+	// Parte inteira
+	while(p < fim && *p>='0' && *p<='9')
+	{
+		if(digitos < 19) { mant = mant*10 + (*p-'0'); if(mant) digitos++; }
+		else exp++;	// dgitos alm da preciso s alteram o expoente
+		++p;
+	}
+	// Parte fracionria
+	if(p < fim && *p=='.')
+	{
+		++p;
+		while(p < fim && *p>='0' && *p<='9')
+		{
+			if(digitos < 19) { mant = mant*10 + (*p-'0'); if(mant) digitos++; exp--; }
+			++p;
+		}
+	}
+	// Nenhum dgito lido ?
+	if(p == ini || (p == ini+1 && *ini=='.'))
+		return false;
+	// Expoente
+	if(p < fim && (*p=='e' || *p=='E'))
+	{
+		const char *q = p+1;
+		bool expneg = false;
+		if(q < fim && (*q=='-' || *q=='+'))
+			expneg = (*q++ == '-');
+		if(q < fim && *q>='0' && *q<='9')
+		{
+			int e = 0;
+			while(q < fim && *q>='0' && *q<='9')
+			{
+				if(e < 10000) e = e*10 + (*q-'0');
+				++q;
+			}
+			exp += expneg ? -e : e;
+			p = q;
+		}
+	}
+	double v = (double) mant;
+	// Se possvel, usa apenas uma multiplicao/diviso exata
+	// (caso mais comum: at 22 casas decimais)
+	if(exp < 0)
+	{
+		if(exp >= -22) v /= _pot10[-exp];
+		else v *= pow(10.0, exp);
+	}
+	else if(exp > 0)
+	{
+		if(exp <= 22) v *= _pot10[exp];
+		else v *= pow(10.0, exp);
+	}
+	*valor = (float) (negativo ? -v : v);
+	*texto = p;
+	return true;
+}
+
+// Funo interna que converte um nmero inteiro (com sinal
+// opcional) a partir da posio corrente no texto, avanando-a.
+// Retorna false se no houver um nmero na posio corrente.
+bool _leInt(const char **texto, const char *fim, int *valor)
+{
+	const char *p = *texto;
+	bool negativo = false;
+	if(p < fim && (*p=='-' || *p=='+'))
+		negativo = (*p++ == '-');
+	if(p >= fim || *p<'0' || *p>'9')
+		return false;
+	int v = 0;
+	while(p < fim && *p>='0' && *p<='9')
+		v = v*10 + (*p++ - '0');
+	*valor = negativo ? -v : v;
+	*texto = p;
+	return true;
+}
+
+// Dados acumulados durante a leitura rpida de um arquivo .OBJ
+typedef struct {
+	_Vetor<VERT> vertices;
+	_Vetor<VERT> normais;
+	_Vetor<TEXCOORD> texcoords;
+	_Vetor<FACE> faces;
+	_Vetor<GLint> inicio;	// posio do 1o. ndice de cada face
+	_Vetor<GLint> iv;		// ndices de vrtices de todas as faces
+	_Vetor<GLint> in;		// ndices de normais (-1 se no houver)
+	_Vetor<GLint> it;		// ndices de texcoords (-1 se no houver)
+} LEITURA;
+
+// Tipos de linha reconhecidos por _interpretaLinha que
+// precisam de tratamento por parte de quem a chamou
+enum { LINHA_DADOS, LINHA_MTLLIB, LINHA_USEMTL, LINHA_USEMAT, LINHA_SUAVIZA };
+
+// Funo interna que compara o incio da linha com um
+// comando do formato .OBJ, que deve ser seguido por espao
+// ou tabulao
+inline bool _comando(const char *p, const char *fim, const char *cmd, int tam)
+{
+	return fim-p > tam && !strncmp(p,cmd,tam) && (p[tam]==' ' || p[tam]=='\t');
+}
+
+// Funo interna, usada pela leitura rpida, que interpreta uma
+// linha de um arquivo .OBJ (de p at fim, sem o \n). Vrtices,
+// normais, texcoords e faces so acumulados em le. As linhas que
+// alteram o estado da leitura (mtllib, usemtl, usemat e s) apenas
+// tm o seu tipo retornado, com o nome que as acompanha em
+// nome/tamnome - cabe a quem chamou trat-las.
+int _interpretaLinha(const char *p, const char *fim, LEITURA *le,
+	const char **nome, int *tamnome)
+{
+	if(p >= fim || *p=='#') return LINHA_DADOS;
+	if(p[0]=='v')
+	{
+		// Vrtice ?
+		if(_comando(p,fim,"v",1))
+		{
+			VERT *v = le->vertices.novo();
+			p += 2;
+			v->x = v->y = v->z = 0;
+			p = _pulaEspacos(p,fim); _leFloat(&p,fim,&v->x);
+			p = _pulaEspacos(p,fim); _leFloat(&p,fim,&v->y);
+			p = _pulaEspacos(p,fim); _leFloat(&p,fim,&v->z);
+		}
+		// Normal ?
+		else if(_comando(p,fim,"vn",2))
+		{
+			VERT *n = le->normais.novo();
+			p += 3;
+			n->x = n->y = n->z = 0;
+			p = _pulaEspacos(p,fim); _leFloat(&p,fim,&n->x);
+			p = _pulaEspacos(p,fim); _leFloat(&p,fim,&n->y);
+			p = _pulaEspacos(p,fim); _leFloat(&p,fim,&n->z);
+		}
+		// Texcoord ?
+		else if(_comando(p,fim,"vt",2))
+		{
+			TEXCOORD *t = le->texcoords.novo();
+			p += 3;
+			t->s = t->t = t->r = 0;
+			p = _pulaEspacos(p,fim); _leFloat(&p,fim,&t->s);
+			p = _pulaEspacos(p,fim); _leFloat(&p,fim,&t->t);
+			p = _pulaEspacos(p,fim); _leFloat(&p,fim,&t->r);
+		}
+		return LINHA_DADOS;
+	}
+	// Face ?
+	if(_comando(p,fim,"f",1))
+	{
+		p += 2;
+		FACE *face = le->faces.novo();
+		face->nv = 0;
+		face->vert = face->norm = face->tex = NULL;
+		le->inicio.adiciona(le->iv.num);
+		// Cada vrtice da face tem a forma v, v/t, v//n ou v/t/n
+		for(;;)
+		{
+			p = _pulaEspacos(p,fim);
+			int v, t = 0, n = 0;
+			if(!_leInt(&p,fim,&v)) break;
+			if(p < fim && *p=='/')
+			{
+				++p;
+				_leInt(&p,fim,&t);
+				if(p < fim && *p=='/')
+				{
+					++p;
+					_leInt(&p,fim,&n);
+				}
+			}
+			// Subtramos 1 dos ndices porque o formato OBJ comea
+			// a contar a partir de 1, no 0 (-1 indica que no h
+			// normal ou texcoord)
+			le->iv.adiciona(v-1);
+			le->it.adiciona(t-1);
+			le->in.adiciona(n-1);
+			face->nv++;
+			// Ignora o restante do vrtice, se houver
+			while(p < fim && *p!=' ' && *p!='\t') ++p;
+		}
+		return LINHA_DADOS;
+	}
+	int tipo, tam = 6;
+	if(_comando(p,fim,"mtllib",6))		 tipo = LINHA_MTLLIB;
+	else if(_comando(p,fim,"usemtl",6)) tipo = LINHA_USEMTL;
+	else if(_comando(p,fim,"usemat",6)) tipo = LINHA_USEMAT;
+	else if(_comando(p,fim,"s",1))		{ tipo = LINHA_SUAVIZA; tam = 1; }
+	else return LINHA_DADOS;	// demais comandos so ignorados
+	// Separa o nome, sem espaos no incio e no final
+	p = _pulaEspacos(p+tam+1,fim);
+	while(fim > p && (fim[-1]==' ' || fim[-1]=='\t' || fim[-1]=='\r')) --fim;
+	*nome = p;
+	*tamnome = fim-p;
+	return tipo;
+}
+
+// Funo interna que trata as linhas que alteram o estado da
+// leitura (mtllib, usemtl, usemat e s), atualizando o material,
+// a textura e o grupo de suavizao correntes
+void _trataComando(OBJ *obj, int tipo, const char *nomeLido, int tamnome,
+	bool mipmap, GLint *material, GLint *texid, GLint *grupo)
+{
+	// Copia o nome para uma string terminada por \0
+	char nome[256];
+	if(tamnome > 255) tamnome = 255;
+	memcpy(nome,nomeLido,tamnome);
+	nome[tamnome] = 0;
+	switch(tipo)
+	{
+		case LINHA_MTLLIB:
+			// L a biblioteca de materiais
+			_leMateriais(nome);
+			obj->tem_materiais = true;
+			break;
+		case LINHA_USEMTL:
+			*material = _procuraMaterial(nome);
+			*texid = -1;
+			break;
+		case LINHA_USEMAT:
+			// O Blender s vezes exporta (null) como textura
+			if(!strcmp(nome,"(null)"))
+				*texid = -1;
+			else
+				*texid = CarregaTextura(nome,mipmap)->texid;
+			break;
+		case LINHA_SUAVIZA:
+			// "s off" (ou "s 0") desativa a suavizao
+			*grupo = strcmp(nome,"off") ? atoi(nome) : 0;
+			break;
+	}
+}
+
+// Funo interna que faz os ndices de cada face apontarem para
+// os vetores compactos do objeto. Uma face s tem normais e
+// texcoords se pelo menos um dos seus vrtices os tiver
+void _apontaFaces(OBJ *obj)
+{
+	for(int i=0; i<obj->numFaces; ++i)
+	{
+		FACE *face = &obj->faces[i];
+		int ini = obj->inicio_faces[i];
+		int nv = face->nv = obj->inicio_faces[i+1] - ini;
+		face->vert = &obj->ind_vertices[ini];
+		face->norm = face->tex = NULL;
+		for(int j=ini; j<ini+nv; ++j)
+		{
+			if(obj->ind_normais != NULL && obj->ind_normais[j] != -1)
+				face->norm = &obj->ind_normais[ini];
+			if(obj->ind_texcoords != NULL && obj->ind_texcoords[j] != -1)
+				face->tex = &obj->ind_texcoords[ini];
+		}
+	}
+}
+
+// Converte os ndices de um objeto lido no modo de carga 'n'
+// (alocados separadamente para cada face) para o formato
+// compacto utilizado pelos demais modos
+void CompactaFaces(OBJ *obj)
+{
+	int i, j;
+	// J est no formato compacto ?
+	if(obj == NULL || obj->inicio_faces != NULL) return;
+	GLint *inicio = (GLint *) malloc(sizeof(GLint)*(obj->numFaces+1));
+	if(inicio == NULL) return;
+	bool tem_n = false, tem_t = false;
+	inicio[0] = 0;
+	for(i=0; i<obj->numFaces; ++i)
+	{
+		inicio[i+1] = inicio[i] + obj->faces[i].nv;
+		if(obj->faces[i].norm != NULL) tem_n = true;
+		if(obj->faces[i].tex != NULL)  tem_t = true;
+	}
+	int total = inicio[obj->numFaces];
+	GLint *iv = (GLint *) malloc(sizeof(GLint)*total);
+	GLint *in = tem_n ? (GLint *) malloc(sizeof(GLint)*total) : NULL;
+	GLint *it = tem_t ? (GLint *) malloc(sizeof(GLint)*total) : NULL;
+	if(iv == NULL || (tem_n && in == NULL) || (tem_t && it == NULL))
+	{
+		free(inicio); free(iv); free(in); free(it);
+		return;
+	}
+	// Copia os ndices de cada face e libera os originais
+	for(i=0; i<obj->numFaces; ++i)
+	{
+		FACE *face = &obj->faces[i];
+		for(j=0; j<face->nv; ++j)
+		{
+			iv[inicio[i]+j] = face->vert[j];
+			if(tem_n) in[inicio[i]+j] = face->norm != NULL ? face->norm[j] : -1;
+			if(tem_t) it[inicio[i]+j] = face->tex  != NULL ? face->tex[j]  : -1;
+		}
+		free(face->vert);
+		if(face->norm != NULL) free(face->norm);
+		if(face->tex  != NULL) free(face->tex);
+	}
+	obj->inicio_faces  = inicio;
+	obj->ind_vertices  = iv;
+	obj->ind_normais   = in;
+	obj->ind_texcoords = it;
+	_apontaFaces(obj);
+}
+
+// Funo interna que transfere os dados acumulados em le para
+// o objeto
+void _finalizaLeitura(OBJ *obj, LEITURA *le)
+{
+	obj->numVertices  = le->vertices.num;
+	obj->numNormais   = le->normais.num;
+	obj->numTexcoords = le->texcoords.num;
+	obj->numFaces     = le->faces.num;
+	obj->normais_por_vertice = obj->numNormais > 0;
+	obj->vertices  = le->vertices.entrega();
+	obj->normais   = le->normais.entrega();
+	obj->texcoords = le->texcoords.entrega();
+	obj->faces     = le->faces.entrega();
+
+	// Os ndices ficam no formato compacto (CSR): um vetor para
+	// cada atributo, com o incio de cada face em inicio_faces
+	// (mais uma posio final, com o total de ndices)
+	le->inicio.adiciona(le->iv.num);
+	bool tem_n = false, tem_t = false;
+	for(int j=0; j<le->iv.num; ++j)
+	{
+		if(le->in.dados[j] != -1) tem_n = true;
+		if(le->it.dados[j] != -1) tem_t = true;
+	}
+	obj->inicio_faces  = le->inicio.entrega();
+	obj->ind_vertices  = le->iv.entrega();
+	obj->ind_normais   = tem_n ? le->in.entrega() : NULL;
+	obj->ind_texcoords = tem_t ? le->it.entrega() : NULL;
+	_apontaFaces(obj);
+	_calculaLimites(obj);
+#ifdef DEBUG
+	printf("Vertices: %d\n",obj->numVertices);
+	printf("Faces:    %d\n",obj->numFaces);
+	printf("Normais:  %d\n",obj->numNormais);
+	printf("Texcoords:%d\n",obj->numTexcoords);
+	printf("Limites: %f %f %f - %f %f %f\n",obj->min.x,obj->min.y,obj->min.z,
+		obj->max.x,obj->max.y,obj->max.z);
+#endif
+}
+
+// Funo interna, usada por CarregaObjeto no modo de carga 'm':
+// mapeia o arquivo em memria e interpreta-o em uma nica
+// passagem, sem sscanf
+OBJ *_carregaObjetoMapeado(char *nomeArquivo, bool mipmap)
+{
+	ARQMEM arq;
+	LEITURA le;
+	OBJ *obj;
+
+#ifdef DEBUG
+	printf("*** Objeto: %s\n",nomeArquivo);
+#endif
+	if(!_mapeiaArquivo(nomeArquivo,&arq))
+		return NULL;
+
+	if ( ( obj = _alocaObjeto() ) == NULL)
+	{
+		_liberaArquivo(&arq);
+		return NULL;
+	}
+
+	// Material, textura e grupo de suavizao correntes = nenhum
+	GLint material = -1, texid = -1, grupo = 0;
+	int faceAnt = 0;
+	const char *p = arq.dados;
+	const char *fim = arq.dados + arq.tam;
+	while(p < fim)
+	{
+		// Localiza o final da linha corrente
+		const char *fimLinha = (const char *) memchr(p,'\n',fim-p);
+		if(fimLinha == NULL) fimLinha = fim;
+		const char *nome;
+		int tamnome;
+		int tipo = _interpretaLinha(p,fimLinha,&le,&nome,&tamnome);
+		if(tipo != LINHA_DADOS)
+		{
+			// Associa o estado anterior s faces lidas at aqui
+			for(; faceAnt<le.faces.num; ++faceAnt)
+			{
+				le.faces.dados[faceAnt].mat = material;
+				le.faces.dados[faceAnt].texid = texid;
+				le.faces.dados[faceAnt].grupo = grupo;
+			}
+			_trataComando(obj,tipo,nome,tamnome,mipmap,&material,&texid,&grupo);
+		}
+		p = fimLinha+1;
+	}
+	for(; faceAnt<le.faces.num; ++faceAnt)
+	{
+		le.faces.dados[faceAnt].mat = material;
+		le.faces.dados[faceAnt].texid = texid;
+		le.faces.dados[faceAnt].grupo = grupo;
+	}
+	_liberaArquivo(&arq);
+
+	_finalizaLeitura(obj,&le);
+	// Adiciona na lista
+	_objetos.push_back(obj);
+	return obj;
+}
+
+// Tamanho padro e mnimo (em bytes) da janela de leitura
+// utilizada por LeObjetoFluxo
+#define TAM_JANELA_OBJ		(256*1024)
+#define TAM_MIN_JANELA_OBJ	256
+
+// Funo interna, usada por LeObjetoFluxo, que interpreta uma linha
+// e entrega o registro correspondente ao leitor. Os vetores de le
+// guardam apenas a linha corrente, e so esvaziados em seguida
+void _entregaLinha(const char *p, const char *fim, LEITURA *le, LEITOROBJ *leitor)
+{
+	const char *nomeLido;
+	int tamnome;
+	int tipo = _interpretaLinha(p,fim,le,&nomeLido,&tamnome);
+	if(tipo == LINHA_DADOS)
+	{
+		if(le->vertices.num && leitor->vertice != NULL)
+			leitor->vertice(leitor->dados,le->vertices.dados[0]);
+		if(le->normais.num && leitor->normal != NULL)
+			leitor->normal(leitor->dados,le->normais.dados[0]);
+		if(le->texcoords.num && leitor->texcoord != NULL)
+			leitor->texcoord(leitor->dados,le->texcoords.dados[0]);
+		if(le->faces.num && leitor->face != NULL)
+			leitor->face(leitor->dados,le->iv.num,le->iv.dados,le->in.dados,le->it.dados);
+		le->vertices.num = le->normais.num = le->texcoords.num = 0;
+		le->faces.num = le->inicio.num = 0;
+		le->iv.num = le->in.num = le->it.num = 0;
+		return;
+	}
+	// Copia o nome para uma string terminada por \0
+	char nome[256];
+	if(tamnome > 255) tamnome = 255;
+	memcpy(nome,nomeLido,tamnome);
+	nome[tamnome] = 0;
+	switch(tipo)
+	{
+		case LINHA_MTLLIB:
+			if(leitor->biblioteca != NULL) leitor->biblioteca(leitor->dados,nome);
+			break;
+		case LINHA_USEMTL:
+			if(leitor->material != NULL) leitor->material(leitor->dados,nome);
+			break;
+		case LINHA_USEMAT:
+			if(leitor->textura != NULL) leitor->textura(leitor->dados,nome);
+			break;
+		case LINHA_SUAVIZA:
+			// "s off" (ou "s 0") desativa a suavizao
+			if(leitor->suavizacao != NULL)
+				leitor->suavizacao(leitor->dados,strcmp(nome,"off") ? atoi(nome) : 0);
+			break;
+	}
+}
+
+// L um arquivo no formato OBJ sem montar um objeto: cada registro
+// (vrtice, normal, texcoord, face, mtllib, usemtl, usemat e s) 
+// entregue, na ordem do arquivo,  funo correspondente do leitor.
+// O arquivo  lido sequencialmente atravs de uma janela de
+// tamJanela bytes (0 = TAM_JANELA_OBJ), portanto a memria ocupada
+// no depende do tamanho do arquivo - que pode at ser um pipe.
+// Linhas maiores que a janela so truncadas no ltimo espao.
+//
+// Retorna false se o arquivo no puder ser aberto ou lido
+bool LeObjetoFluxo(const char *nomeArquivo, LEITOROBJ *leitor, int tamJanela)
+{
+	if(tamJanela <= 0) tamJanela = TAM_JANELA_OBJ;
+	if(tamJanela < TAM_MIN_JANELA_OBJ) tamJanela = TAM_MIN_JANELA_OBJ;
+	FILE *fp = fopen(nomeArquivo,"rb");
+	if(fp == NULL) return false;
+	char *janela = (char *) malloc(tamJanela);
+	if(janela == NULL)
+	{
+		fclose(fp);
+		return false;
+	}
+	LEITURA le;
+	int usado = 0;			// bytes ainda no interpretados na janela
+	bool fimArq = false;
+	bool descarta = false;	// true se o incio da linha j foi entregue
+	while(!fimArq || usado > 0)
+	{
+		if(!fimArq)
+		{
+			usado += fread(janela+usado,1,tamJanela-usado,fp);
+			fimArq = usado < tamJanela;
+		}
+		const char *p = janela;
+		const char *fim = janela + usado;
+		while(p < fim)
+		{
+			const char *fimLinha = (const char *) memchr(p,'\n',fim-p);
+			if(fimLinha == NULL)
+			{
+				// Linha incompleta: aguarda o restante, a no
+				// ser que seja a ltima do arquivo
+				if(!fimArq) break;
+				fimLinha = fim;
+			}
+			if(descarta) descarta = false;
+			else _entregaLinha(p,fimLinha,&le,leitor);
+			p = fimLinha+1;
+		}
+		if(p > fim) p = fim;
+		// Linha maior que a janela: entrega at o ltimo espao
+		// e descarta o restante
+		if(p == janela && usado == tamJanela)
+		{
+			const char *corte = fim;
+			while(corte > p && corte[-1]!=' ' && corte[-1]!='\t') --corte;
+			if(!descarta)
+				_entregaLinha(p,corte > p ? corte : fim,&le,leitor);
+			descarta = true;
+			p = fim;
+		}
+		usado = fim-p;
+		memmove(janela,p,usado);
+	}
+	bool erro = ferror(fp) != 0;
+	fclose(fp);
+	free(janela);
+	return !erro;
+}
+
+// Estado da carga de um objeto no modo 'f' (ver _carregaObjetoFluxo)
+typedef struct {
+	OBJ *obj;
+	LEITURA le;
+	bool mipmap;
+	GLint material, texid, grupo;	// estado corrente
+} CARGAFLUXO;
+
+// Funes internas que recebem os registros lidos por LeObjetoFluxo
+// e os acumulam no objeto em carga
+void _fluxoVertice(void *dados, const VERT &v)
+{
+	((CARGAFLUXO *) dados)->le.vertices.adiciona(v);
+}
+
+void _fluxoNormal(void *dados, const VERT &n)
+{
+	((CARGAFLUXO *) dados)->le.normais.adiciona(n);
+}
+
+void _fluxoTexcoord(void *dados, const TEXCOORD &t)
+{
+	((CARGAFLUXO *) dados)->le.texcoords.adiciona(t);
+}
+
+void _fluxoFace(void *dados, int nv, const GLint *vert, const GLint *norm, const GLint *tex)
+{
+	CARGAFLUXO *carga = (CARGAFLUXO *) dados;
+	LEITURA &le = carga->le;
+	FACE *face = le.faces.novo();
+	face->nv = nv;
+	face->vert = face->norm = face->tex = NULL;
+	face->mat = carga->material;
+	face->texid = carga->texid;
+	face->grupo = carga->grupo;
+	le.inicio.adiciona(le.iv.num);
+	for(int i=0; i<nv; ++i)
+	{
+		le.iv.adiciona(vert[i]);
+		le.in.adiciona(norm[i]);
+		le.it.adiciona(tex[i]);
+	}
+}
+
+void _fluxoBiblioteca(void *dados, const char *nome)
+{
+	CARGAFLUXO *carga = (CARGAFLUXO *) dados;
+	_trataComando(carga->obj,LINHA_MTLLIB,nome,strlen(nome),carga->mipmap,
+		&carga->material,&carga->texid,&carga->grupo);
+}
+
+void _fluxoMaterial(void *dados, const char *nome)
+{
+	CARGAFLUXO *carga = (CARGAFLUXO *) dados;
+	_trataComando(carga->obj,LINHA_USEMTL,nome,strlen(nome),carga->mipmap,
+		&carga->material,&carga->texid,&carga->grupo);
+}
+
+void _fluxoTextura(void *dados, const char *nome)
+{
+	CARGAFLUXO *carga = (CARGAFLUXO *) dados;
+	_trataComando(carga->obj,LINHA_USEMAT,nome,strlen(nome),carga->mipmap,
+		&carga->material,&carga->texid,&carga->grupo);
+}
+
+void _fluxoSuavizacao(void *dados, int grupo)
+{
+	((CARGAFLUXO *) dados)->grupo = grupo;
+}
+
+// Funo interna, usada por CarregaObjeto no modo de carga 'f':
+// monta o objeto a partir dos registros entregues por LeObjetoFluxo,
+// sem mapear o arquivo em memria
+OBJ *_carregaObjetoFluxo(char *nomeArquivo, bool mipmap)
+{
+	CARGAFLUXO carga;
+	LEITOROBJ leitor = { &carga, _fluxoVertice, _fluxoNormal, _fluxoTexcoord,
+		_fluxoFace, _fluxoBiblioteca, _fluxoMaterial, _fluxoTextura, _fluxoSuavizacao };
+
+#ifdef DEBUG
+	printf("*** Objeto: %s\n",nomeArquivo);
+#endif
+	if ( ( carga.obj = _alocaObjeto() ) == NULL)
+		return NULL;
+	// Material, textura e grupo de suavizao correntes = nenhum
+	carga.mipmap = mipmap;
+	carga.material = carga.texid = -1;
+	carga.grupo = 0;
+	if(!LeObjetoFluxo(nomeArquivo,&leitor,0))
+	{
+		free(carga.obj);
+		return NULL;
+	}
+	_finalizaLeitura(carga.obj,&carga.le);
+	// Adiciona na lista
+	_objetos.push_back(carga.obj);
+	return carga.obj;
+}
+
+// Nmero de threads utilizado nas rotinas paralelas
+// (0 = determinado automaticamente)
+int _numThreads = 0;
+
+// Define o nmero de threads utilizado pelas rotinas que
+// executam em paralelo (0 = um por ncleo disponvel)
+void SetaNumThreads(int num)
+{
+	if(num < 0) return;
+	_numThreads = num;
+}
+
+// Funo interna que retorna o nmero de threads a utilizar
+int _obtemNumThreads()
+{
+	if(_numThreads) return _numThreads;
+	int num = thread::hardware_concurrency();
+	return num > 0 ? num : 1;
+}
+
+// Funo interna que executa func(0) ... func(num-1) em paralelo,
+// retornando apenas quando todas as chamadas tiverem terminado
+void _executaParalelo(int num, const function<void(int)> &func)
+{
+	if(num <= 1)
+	{
+		if(num == 1) func(0);
+		return;
+	}
+	vector<thread> threads;
+	for(int i=1; i<num; ++i)
+		threads.push_back(thread(func,i));
+	// A thread corrente tambm trabalha
+	func(0);
+	for(unsigned int i=0; i<threads.size(); ++i)
+		threads[i].join();
+}
+
+// Funo interna que divide o intervalo [0,num) entre as threads
+// (com pelo menos minimo elementos em cada parte) e executa
+// func(ini,fim) para cada parte, em paralelo
+void _executaIntervalos(int num, int minimo, const function<void(int,int)> &func)
+{
+	int partes = _obtemNumThreads();
+	if(num / minimo < partes) partes = num / minimo;
+	if(partes < 1) partes = 1;
+	_executaParalelo(partes, [&](int t) {
+		func((long long) num * t / partes, (long long) num * (t+1) / partes);
+	});
+}
+
+// Comando (mtllib, usemtl, usemat ou s) encontrado em um trecho
+// durante a carga paralela
+typedef struct {
+	int tipo;			// LINHA_MTLLIB, LINHA_USEMTL, LINHA_USEMAT ou LINHA_SUAVIZA
+	int face;			// faces j lidas no trecho antes do comando
+	const char *nome;	// nome (aponta para o arquivo mapeado)
+	int tamnome;
+} COMANDO;
+
+// Trecho de um arquivo .OBJ, interpretado por uma thread
+// na carga paralela
+typedef struct {
+	const char *ini, *fim;		// limites no arquivo mapeado
+	LEITURA le;					// dados lidos no trecho
+	vector<COMANDO> comandos;	// comandos encontrados, na ordem
+} TRECHO;
+
+// Tamanho mnimo de um trecho na carga paralela - abaixo disso
+// no compensa criar mais threads
+#ifndef TAM_MIN_TRECHO
+#define TAM_MIN_TRECHO (256*1024)
+#endif
+
+// Funo interna que copia n elementos de um _Vetor para a posio
+// pos de outro (que j deve ter espao suficiente)
+template <class T> void _copiaVetor(_Vetor<T> &dest, int pos, _Vetor<T> &orig)
+{
+	if(orig.num) memcpy(&dest.dados[pos],orig.dados,sizeof(T)*orig.num);
+}
+
+// Funo interna, usada por CarregaObjeto no modo de carga 'p':
+// divide o arquivo mapeado em trechos terminados em final de linha,
+// interpreta cada um em uma thread e depois junta os resultados.
+//
+// Os ndices das faces so absolutos no formato .OBJ, portanto
+// no precisam ser corrigidos; apenas o incio de cada face nos
+// vetores de ndices  deslocado pela soma dos trechos anteriores.
+// Os comandos que alteram o estado (mtllib, usemtl, usemat, s) so
+// executados depois, na ordem do arquivo e na thread corrente
+// (onde est o contexto OpenGL para carregar as texturas).
+OBJ *_carregaObjetoParalelo(char *nomeArquivo, bool mipmap)
+{
+	ARQMEM arq;
+	OBJ *obj;
+
+#ifdef DEBUG
+	printf("*** Objeto: %s\n",nomeArquivo);
+#endif
+	if(!_mapeiaArquivo(nomeArquivo,&arq))
+		return NULL;
+
+	if ( ( obj = _alocaObjeto() ) == NULL)
+	{
+		_liberaArquivo(&arq);
+		return NULL;
+	}
+
+	// Divide o arquivo em trechos, cada um terminando em um \n
+	int numTrechos = _obtemNumThreads();
+	if(arq.tam / TAM_MIN_TRECHO < (size_t) numTrechos)
+		numTrechos = arq.tam / TAM_MIN_TRECHO;
+	if(numTrechos < 1) numTrechos = 1;
+	vector<TRECHO> trechos(numTrechos);
+	const char *fim = arq.dados + arq.tam;
+	const char *p = arq.dados;
+	for(int i=0; i<numTrechos; ++i)
+	{
+		trechos[i].ini = p;
+		if(i == numTrechos-1)
+			p = fim;
+		else
+		{
+			p = arq.dados + arq.tam / numTrechos * (i+1);
+			if(p < trechos[i].ini) p = trechos[i].ini;
+			const char *nl = (const char *) memchr(p,'\n',fim-p);
+			p = nl ? nl+1 : fim;
+		}
+		trechos[i].fim = p;
+	}
+
+	// Interpreta os trechos em paralelo
+	_executaParalelo(numTrechos, [&](int t) {
+		TRECHO &tr = trechos[t];
+		const char *p = tr.ini;
+		while(p < tr.fim)
+		{
+			const char *fimLinha = (const char *) memchr(p,'\n',tr.fim-p);
+			if(fimLinha == NULL) fimLinha = tr.fim;
+			COMANDO cmd;
+			cmd.tipo = _interpretaLinha(p,fimLinha,&tr.le,&cmd.nome,&cmd.tamnome);
+			if(cmd.tipo != LINHA_DADOS)
+			{
+				cmd.face = tr.le.faces.num;
+				tr.comandos.push_back(cmd);
+			}
+			p = fimLinha+1;
+		}
+	});
+
+	// Soma de prefixos: posio de cada trecho nos vetores finais
+	vector<int> pv(numTrechos+1,0), pn(numTrechos+1,0), pt(numTrechos+1,0);
+	vector<int> pf(numTrechos+1,0), pi(numTrechos+1,0);
+	for(int i=0; i<numTrechos; ++i)
+	{
+		pv[i+1] = pv[i] + trechos[i].le.vertices.num;
+		pn[i+1] = pn[i] + trechos[i].le.normais.num;
+		pt[i+1] = pt[i] + trechos[i].le.texcoords.num;
+		pf[i+1] = pf[i] + trechos[i].le.faces.num;
+		pi[i+1] = pi[i] + trechos[i].le.iv.num;
+	}
+	LEITURA le;
+	le.vertices.reserva(pv[numTrechos]);	le.vertices.num  = pv[numTrechos];
+	le.normais.reserva(pn[numTrechos]);		le.normais.num   = pn[numTrechos];
+	le.texcoords.reserva(pt[numTrechos]);	le.texcoords.num = pt[numTrechos];
+	le.faces.reserva(pf[numTrechos]);		le.faces.num     = pf[numTrechos];
+	le.inicio.reserva(pf[numTrechos]);		le.inicio.num    = pf[numTrechos];
+	le.iv.reserva(pi[numTrechos]);			le.iv.num        = pi[numTrechos];
+	le.in.reserva(pi[numTrechos]);			le.in.num        = pi[numTrechos];
+	le.it.reserva(pi[numTrechos]);			le.it.num        = pi[numTrechos];
+
+	// Junta os trechos, tambm em paralelo
+	_executaParalelo(numTrechos, [&](int t) {
+		LEITURA &lt = trechos[t].le;
+		_copiaVetor(le.vertices, pv[t], lt.vertices);
+		_copiaVetor(le.normais, pn[t], lt.normais);
+		_copiaVetor(le.texcoords, pt[t], lt.texcoords);
+		_copiaVetor(le.faces, pf[t], lt.faces);
+		_copiaVetor(le.iv, pi[t], lt.iv);
+		_copiaVetor(le.in, pi[t], lt.in);
+		_copiaVetor(le.it, pi[t], lt.it);
+		for(int i=0; i<lt.inicio.num; ++i)
+			le.inicio.dados[pf[t]+i] = lt.inicio.dados[i] + pi[t];
+		// Libera o trecho assim que possvel
+		lt.vertices.libera(); lt.normais.libera(); lt.texcoords.libera();
+		lt.faces.libera(); lt.inicio.libera();
+		lt.iv.libera(); lt.in.libera(); lt.it.libera();
+	});
+
+	// Executa os comandos na ordem do arquivo, associando o
+	// material, a textura e o grupo de suavizao correntes s faces
+	GLint material = -1, texid = -1, grupo = 0;
+	int faceAnt = 0;
+	for(int t=0; t<numTrechos; ++t)
+	{
+		for(unsigned int c=0; c<trechos[t].comandos.size(); ++c)
+		{
+			COMANDO &cmd = trechos[t].comandos[c];
+			for(; faceAnt < pf[t]+cmd.face; ++faceAnt)
+			{
+				le.faces.dados[faceAnt].mat = material;
+				le.faces.dados[faceAnt].texid = texid;
+				le.faces.dados[faceAnt].grupo = grupo;
+			}
+			_trataComando(obj,cmd.tipo,cmd.nome,cmd.tamnome,mipmap,&material,&texid,&grupo);
+		}
+	}
+	for(; faceAnt<le.faces.num; ++faceAnt)
+	{
+		le.faces.dados[faceAnt].mat = material;
+		le.faces.dados[faceAnt].texid = texid;
+		le.faces.dados[faceAnt].grupo = grupo;
+	}
+	_liberaArquivo(&arq);
+
+	_finalizaLeitura(obj,&le);
+	// Adiciona na lista
+	_objetos.push_back(obj);
+	return obj;
+}
+
+// Indica se CarregaObjeto deve usar o cache binrio (ver SetaCacheObjetos)
+bool _usaCache = false;
+
+// Identificao e verso do formato do cache binrio de objetos
+// (a verso deve ser incrementada sempre que o formato mudar)
+#define MAGICA_CACHE	"BOBJ"
+#define VERSAO_CACHE	4
+
+// Blocos de dados armazenados no cache, na ordem em que aparecem
+enum { CACHE_VERTICES, CACHE_NORMAIS, CACHE_TEXCOORDS, CACHE_INICIO,
+	CACHE_IND_VERT, CACHE_IND_NORM, CACHE_IND_TEX, CACHE_FACE_MAT,
+	CACHE_FACE_TEX, CACHE_FACE_GRUPO, CACHE_MATERIAIS, CACHE_TEXTURAS,
+	CACHE_BIBLIOTECAS, CACHE_NUM_BLOCOS };
+
+// Cabealho do arquivo de cache
+typedef struct {
+	char magica[4];			// MAGICA_CACHE
+	GLint versao;			// VERSAO_CACHE
+	long long tamOrigem;	// tamanho do arquivo .obj de origem
+	long long dataOrigem;	// data de modificao da origem
+	unsigned long long hashOrigem;	// hash de amostras da origem
+	GLint numVertices, numNormais, numTexcoords, numFaces;
+	GLint numIndices;		// total de ndices das faces
+	GLint numMateriais, numTexturas;
+	GLint numBibliotecas;	// bibliotecas de materiais (ver BIBCACHE)
+	GLint flags;			// ver FLAG_CACHE_*
+	VERT min, max;			// limites do objeto
+	GLint trocasEvitadas;	// ver AgrupaFaces
+	long long desl[CACHE_NUM_BLOCOS];	// posio de cada bloco no arquivo
+	long long tamTotal;		// tamanho do arquivo de cache
+} CABCACHE;
+
+#define FLAG_CACHE_NORMAIS_VERT	1	// normais_por_vertice
+#define FLAG_CACHE_MATERIAIS	2	// tem_materiais
+#define FLAG_CACHE_IND_NORM		4	// faces com ndices de normais
+#define FLAG_CACHE_IND_TEX		8	// faces com ndices de texcoords
+
+// Material armazenado no cache
+typedef struct {
+	char nome[256];
+	GLfloat ka[4], kd[4], ks[4], ke[4];
+	GLfloat spec;
+} MATCACHE;
+
+// Nome de textura armazenado no cache
+typedef struct {
+	char nome[256];
+} TEXCACHE;
+
+// Biblioteca de materiais lida na carga original, identificada
+// como o arquivo .obj (tam = -1 se no existia)
+typedef struct {
+	char nome[256];
+	long long tam;
+	long long data;
+	unsigned long long hash;
+} BIBCACHE;
+
+// Alinhamento dos blocos no arquivo de cache (em bytes)
+#define ALINHA_CACHE 16
+
+// Ativa ou desativa o cache binrio de objetos. Quando ativado,
+// CarregaObjeto grava ao lado de cada arquivo .obj lido um arquivo
+// .obj.cache com o objeto j interpretado e, nas cargas seguintes,
+// usa-o diretamente (mapeado em memria) enquanto o .obj e as suas
+// bibliotecas de materiais (.mtl) no forem alterados
+void SetaCacheObjetos(bool usa)
+{
+	_usaCache = usa;
+}
+
+// Funo interna que monta o nome do arquivo de cache
+void _nomeCache(const char *nomeArquivo, char *nomeCache, int tam)
+{
+	snprintf(nomeCache,tam,"%s.cache",nomeArquivo);
+}
+
+// Funo interna que calcula um hash (FNV-1a de 64 bits) de
+// amostras do incio e do final de um arquivo, para detectar
+// alteraes que no mudem o tamanho nem a data
+unsigned long long _hashAmostras(const char *nomeArquivo, long long tam)
+{
+	const int TAM_AMOSTRA = 64*1024;
+	unsigned long long hash = 14695981039346656037ULL;
+	unsigned char *buf = (unsigned char *) malloc(TAM_AMOSTRA);
+	FILE *fp = fopen(nomeArquivo,"rb");
+	if(fp == NULL || buf == NULL)
+	{
+		if(fp != NULL) fclose(fp);
+		free(buf);
+		return 0;
+	}
+	for(int a=0; a<2; ++a)
+	{
+		// Segunda amostra: final do arquivo
+		if(a == 1)
+		{
+			if(tam <= TAM_AMOSTRA) break;
+			fseek(fp, tam > 2*TAM_AMOSTRA ? tam-TAM_AMOSTRA : TAM_AMOSTRA, SEEK_SET);
+		}
+		size_t lidos = fread(buf,1,TAM_AMOSTRA,fp);
+		for(size_t i=0; i<lidos; ++i)
+		{
+			hash ^= buf[i];
+			hash *= 1099511628211ULL;
+		}
+	}
+	fclose(fp);
+	free(buf);
+	return hash;
+}
+
+// Funo interna que obtm o tamanho, a data e o hash de amostras
+// que identificam um arquivo. Retorna false se no conseguir
+// acess-lo
+bool _identificaArquivo(const char *nomeArquivo, long long &tam, long long &data,
+	unsigned long long &hash)
+{
+	struct stat st;
+	if(stat(nomeArquivo,&st)) return false;
+	tam  = st.st_size;
+	data = st.st_mtime;
+	hash = _hashAmostras(nomeArquivo,st.st_size);
+	return true;
+}
+
+// Funo interna que preenche no cabealho os dados que
+// identificam o arquivo de origem. Retorna false se no
+// conseguir acess-lo
+bool _identificaOrigem(const char *nomeArquivo, CABCACHE *cab)
+{
+	return _identificaArquivo(nomeArquivo,cab->tamOrigem,cab->dataOrigem,cab->hashOrigem);
+}
+
+// Funo interna que preenche a identificao de uma biblioteca de
+// materiais, com tam = -1 se ela no existir
+void _identificaBiblioteca(const char *nomeArquivo, BIBCACHE *bib)
+{
+	memset(bib,0,sizeof(BIBCACHE));
+	strncpy(bib->nome,nomeArquivo,255);
+	if(!_identificaArquivo(nomeArquivo,bib->tam,bib->data,bib->hash))
+		bib->tam = -1;
+}
+
+// Funo interna que grava um bloco no arquivo de cache,
+// alinhado em ALINHA_CACHE bytes, e registra a sua posio em desl
+void _gravaBloco(FILE *fp, long long &desl, const void *dados, size_t tam)
+{
+	static const char zeros[ALINHA_CACHE] = { 0 };
+	long long pos = ftell(fp);
+	long long resto = pos % ALINHA_CACHE;
+	if(resto)
+	{
+		fwrite(zeros,1,ALINHA_CACHE-resto,fp);
+		pos += ALINHA_CACHE-resto;
+	}
+	desl = pos;
+	if(tam) fwrite(dados,1,tam,fp);
+}
+
+// Funo interna que grava o cache binrio de um objeto recm
+// carregado. O arquivo  escrito com outro nome e depois
+// renomeado, para que nunca exista um cache incompleto
+void _gravaCacheObjeto(OBJ *obj, const char *nomeArquivo)
+{
+	int i, j;
+	CABCACHE cab;
+	char nomeCache[512], nomeTemp[520];
+
+	memset(&cab,0,sizeof(cab));
+	if(!_identificaOrigem(nomeArquivo,&cab)) return;
+	memcpy(cab.magica,MAGICA_CACHE,4);
+	cab.versao = VERSAO_CACHE;
+	cab.numVertices  = obj->numVertices;
+	cab.numNormais   = obj->numNormais;
+	cab.numTexcoords = obj->numTexcoords;
+	cab.numFaces     = obj->numFaces;
+	if(obj->normais_por_vertice) cab.flags |= FLAG_CACHE_NORMAIS_VERT;
+	if(obj->tem_materiais) cab.flags |= FLAG_CACHE_MATERIAIS;
+	cab.trocasEvitadas = obj->trocasEvitadas;
+	// Limites do objeto
+	LimitesVetores(obj->vertices,obj->numVertices,cab.min,cab.max);
+
+	// ndices no formato compacto (convertendo, se o objeto
+	// foi lido no modo 'n')
+	vector<GLint> inicio(obj->numFaces+1), iv, in, it;
+	bool tem_n = false, tem_t = false;
+	for(i=0; i<obj->numFaces; ++i)
+	{
+		if(obj->faces[i].norm != NULL) tem_n = true;
+		if(obj->faces[i].tex != NULL) tem_t = true;
+	}
+	inicio[0] = 0;
+	for(i=0; i<obj->numFaces; ++i)
+	{
+		FACE &face = obj->faces[i];
+		inicio[i+1] = inicio[i] + face.nv;
+		for(j=0; j<face.nv; ++j)
+		{
+			iv.push_back(face.vert[j]);
+			if(tem_n) in.push_back(face.norm != NULL ? face.norm[j] : -1);
+			if(tem_t) it.push_back(face.tex != NULL ? face.tex[j] : -1);
+		}
+	}
+	cab.numIndices = iv.size();
+	if(tem_n) cab.flags |= FLAG_CACHE_IND_NORM;
+	if(tem_t) cab.flags |= FLAG_CACHE_IND_TEX;
+
+	// Materiais e texturas usados pelas faces so gravados pelo
+	// nome, j que os ndices e texids s valem nesta execuo
+	vector<GLint> fmat(obj->numFaces), ftex(obj->numFaces), fgrupo(obj->numFaces);
+	vector<MATCACHE> mats;
+	vector<TEXCACHE> texs;
+	vector<GLint> mapaMat(_materiais.size(),-1);
+	for(i=0; i<obj->numFaces; ++i)
+	{
+		int mat = obj->faces[i].mat;
+		fgrupo[i] = obj->faces[i].grupo;
+		fmat[i] = -1;
+		if(mat >= 0 && mat < (int) _materiais.size())
+		{
+			if(mapaMat[mat] == -1)
+			{
+				MATCACHE mc;
+				memset(&mc,0,sizeof(mc));
+				strncpy(mc.nome,_materiais[mat]->nome,255);
+				memcpy(mc.ka,_materiais[mat]->ka,sizeof(mc.ka));
+				memcpy(mc.kd,_materiais[mat]->kd,sizeof(mc.kd));
+				memcpy(mc.ks,_materiais[mat]->ks,sizeof(mc.ks));
+				memcpy(mc.ke,_materiais[mat]->ke,sizeof(mc.ke));
+				mc.spec = _materiais[mat]->spec;
+				mapaMat[mat] = mats.size();
+				mats.push_back(mc);
+			}
+			fmat[i] = mapaMat[mat];
+		}
+		ftex[i] = -1;
+		if(obj->faces[i].texid == -1) continue;
+		// Procura a textura com este texid (primeiro entre as
+		// j gravadas, que costumam ser poucas)
+		GLint texid = obj->faces[i].texid;
+		if(i && obj->faces[i-1].texid == texid)
+		{
+			ftex[i] = ftex[i-1];
+			continue;
+		}
+		for(unsigned int t=0; t<_texturas.size(); ++t)
+			if((GLint) _texturas[t]->texid == texid)
+			{
+				unsigned int k;
+				for(k=0; k<texs.size(); ++k)
+					if(!strcmp(texs[k].nome,_texturas[t]->nome)) break;
+				if(k == texs.size())
+				{
+					TEXCACHE tc;
+					memset(&tc,0,sizeof(tc));
+					strncpy(tc.nome,_texturas[t]->nome,255);
+					texs.push_back(tc);
+				}
+				ftex[i] = k;
+				break;
+			}
+	}
+	cab.numMateriais = mats.size();
+	cab.numTexturas  = texs.size();
+	// Bibliotecas de materiais lidas (nomes longos demais no
+	// poderiam ser verificados depois)
+	vector<BIBCACHE> bibs(_bibliotecasLidas.size());
+	for(i=0; i<(int) bibs.size(); ++i)
+	{
+		if(_bibliotecasLidas[i].size() > 255) return;
+		_identificaBiblioteca(_bibliotecasLidas[i].c_str(),&bibs[i]);
+	}
+	cab.numBibliotecas = bibs.size();
+
+	_nomeCache(nomeArquivo,nomeCache,sizeof(nomeCache));
+	snprintf(nomeTemp,sizeof(nomeTemp),"%s.tmp",nomeCache);
+	FILE *fp = fopen(nomeTemp,"wb");
+	if(fp == NULL) return;
+	// O cabealho  reescrito no final, com as posies dos blocos
+	fwrite(&cab,sizeof(cab),1,fp);
+	_gravaBloco(fp,cab.desl[CACHE_VERTICES],obj->vertices,sizeof(VERT)*obj->numVertices);
+	_gravaBloco(fp,cab.desl[CACHE_NORMAIS],obj->normais,sizeof(VERT)*obj->numNormais);
+	_gravaBloco(fp,cab.desl[CACHE_TEXCOORDS],obj->texcoords,sizeof(TEXCOORD)*obj->numTexcoords);
+	_gravaBloco(fp,cab.desl[CACHE_INICIO],inicio.data(),sizeof(GLint)*inicio.size());
+	_gravaBloco(fp,cab.desl[CACHE_IND_VERT],iv.data(),sizeof(GLint)*iv.size());
+	_gravaBloco(fp,cab.desl[CACHE_IND_NORM],in.data(),sizeof(GLint)*in.size());
+	_gravaBloco(fp,cab.desl[CACHE_IND_TEX],it.data(),sizeof(GLint)*it.size());
+	_gravaBloco(fp,cab.desl[CACHE_FACE_MAT],fmat.data(),sizeof(GLint)*fmat.size());
+	_gravaBloco(fp,cab.desl[CACHE_FACE_TEX],ftex.data(),sizeof(GLint)*ftex.size());
+	_gravaBloco(fp,cab.desl[CACHE_FACE_GRUPO],fgrupo.data(),sizeof(GLint)*fgrupo.size());
+	_gravaBloco(fp,cab.desl[CACHE_MATERIAIS],mats.data(),sizeof(MATCACHE)*mats.size());
+	_gravaBloco(fp,cab.desl[CACHE_TEXTURAS],texs.data(),sizeof(TEXCACHE)*texs.size());
+	_gravaBloco(fp,cab.desl[CACHE_BIBLIOTECAS],bibs.data(),sizeof(BIBCACHE)*bibs.size());
+	cab.tamTotal = ftell(fp);
+	fseek(fp,0,SEEK_SET);
+	fwrite(&cab,sizeof(cab),1,fp);
+	bool erro = ferror(fp) != 0;
+	fclose(fp);
+	if(erro || rename(nomeTemp,nomeCache))
+		remove(nomeTemp);
+}
+
+// Funo interna que verifica se um bloco do cache com num
+// elementos de tam bytes est alinhado e cabe no arquivo
+bool _blocoCacheValido(const ARQMEM &arq, int bloco, long long num, size_t tam)
+{
+	const CABCACHE *cab = (const CABCACHE *) arq.dados;
+	long long desl = cab->desl[bloco];
+	return num >= 0 && desl >= (long long) sizeof(CABCACHE) && desl % ALINHA_CACHE == 0
+		&& desl <= (long long) arq.tam && num <= ((long long) arq.tam - desl) / (long long) tam;
+}
+
+// Funo interna que verifica se os ndices de um bloco do cache
+// esto entre minimo e maximo-1
+bool _indicesCacheValidos(const GLint *ind, long long num, GLint minimo, GLint maximo)
+{
+	for(long long i=0; i<num; ++i)
+		if(ind[i] < minimo || ind[i] >= maximo) return false;
+	return true;
+}
+
+// Funo interna que verifica a estrutura de um cache cujo cabealho
+// j foi conferido: as posies e os tamanhos de todos os blocos, os
+// ndices das faces, as referncias a materiais e texturas e os nomes
+// (que precisam terminar em \0). Nenhum apontador  montado antes
+// disso, para que um cache danificado no seja lido fora do arquivo
+bool _estruturaCacheValida(const ARQMEM &arq)
+{
+	const CABCACHE *cab = (const CABCACHE *) arq.dados;
+	const char *base = arq.dados;
+	int i;
+	long long numInd = (cab->flags & FLAG_CACHE_IND_NORM) ? cab->numIndices : 0;
+	long long numTex = (cab->flags & FLAG_CACHE_IND_TEX) ? cab->numIndices : 0;
+	if(cab->numFaces < 0
+		|| !_blocoCacheValido(arq,CACHE_VERTICES,cab->numVertices,sizeof(VERT))
+		|| !_blocoCacheValido(arq,CACHE_NORMAIS,cab->numNormais,sizeof(VERT))
+		|| !_blocoCacheValido(arq,CACHE_TEXCOORDS,cab->numTexcoords,sizeof(TEXCOORD))
+		|| !_blocoCacheValido(arq,CACHE_INICIO,(long long) cab->numFaces+1,sizeof(GLint))
+		|| !_blocoCacheValido(arq,CACHE_IND_VERT,cab->numIndices,sizeof(GLint))
+		|| !_blocoCacheValido(arq,CACHE_IND_NORM,numInd,sizeof(GLint))
+		|| !_blocoCacheValido(arq,CACHE_IND_TEX,numTex,sizeof(GLint))
+		|| !_blocoCacheValido(arq,CACHE_FACE_MAT,cab->numFaces,sizeof(GLint))
+		|| !_blocoCacheValido(arq,CACHE_FACE_TEX,cab->numFaces,sizeof(GLint))
+		|| !_blocoCacheValido(arq,CACHE_FACE_GRUPO,cab->numFaces,sizeof(GLint))
+		|| !_blocoCacheValido(arq,CACHE_MATERIAIS,cab->numMateriais,sizeof(MATCACHE))
+		|| !_blocoCacheValido(arq,CACHE_TEXTURAS,cab->numTexturas,sizeof(TEXCACHE))
+		|| !_blocoCacheValido(arq,CACHE_BIBLIOTECAS,cab->numBibliotecas,sizeof(BIBCACHE)))
+		return false;
+
+	// Incio de cada face: crescente, de 0 at o total de ndices
+	const GLint *inicio = (const GLint *) (base + cab->desl[CACHE_INICIO]);
+	if(inicio[0] != 0 || inicio[cab->numFaces] != cab->numIndices)
+		return false;
+	for(i=0; i<cab->numFaces; ++i)
+		if(inicio[i+1] < inicio[i]) return false;
+	// ndices dos vrtices, normais e texcoords
+	if(!_indicesCacheValidos((const GLint *) (base + cab->desl[CACHE_IND_VERT]),
+			cab->numIndices,0,cab->numVertices)
+		|| !_indicesCacheValidos((const GLint *) (base + cab->desl[CACHE_IND_NORM]),
+			numInd,-1,cab->numNormais)
+		|| !_indicesCacheValidos((const GLint *) (base + cab->desl[CACHE_IND_TEX]),
+			numTex,-1,cab->numTexcoords))
+		return false;
+	// Materiais e texturas das faces
+	if(!_indicesCacheValidos((const GLint *) (base + cab->desl[CACHE_FACE_MAT]),
+			cab->numFaces,-1,cab->numMateriais)
+		|| !_indicesCacheValidos((const GLint *) (base + cab->desl[CACHE_FACE_TEX]),
+			cab->numFaces,-1,cab->numTexturas))
+		return false;
+	// Nomes
+	const MATCACHE *mats = (const MATCACHE *) (base + cab->desl[CACHE_MATERIAIS]);
+	const TEXCACHE *texs = (const TEXCACHE *) (base + cab->desl[CACHE_TEXTURAS]);
+	const BIBCACHE *bibs = (const BIBCACHE *) (base + cab->desl[CACHE_BIBLIOTECAS]);
+	for(i=0; i<cab->numMateriais; ++i)
+		if(memchr(mats[i].nome,0,sizeof(mats[i].nome)) == NULL) return false;
+	for(i=0; i<cab->numTexturas; ++i)
+		if(memchr(texs[i].nome,0,sizeof(texs[i].nome)) == NULL) return false;
+	for(i=0; i<cab->numBibliotecas; ++i)
+		if(memchr(bibs[i].nome,0,sizeof(bibs[i].nome)) == NULL) return false;
+	return true;
+}
+
+// Funo interna que verifica se as bibliotecas de materiais
+// registradas no cache continuam iguais s da carga original
+bool _bibliotecasCacheAtuais(const ARQMEM &arq)
+{
+	const CABCACHE *cab = (const CABCACHE *) arq.dados;
+	const BIBCACHE *bibs = (const BIBCACHE *) (arq.dados + cab->desl[CACHE_BIBLIOTECAS]);
+	for(int i=0; i<cab->numBibliotecas; ++i)
+	{
+		BIBCACHE atual;
+		_identificaBiblioteca(bibs[i].nome,&atual);
+		if(atual.tam != bibs[i].tam || (atual.tam >= 0
+			&& (atual.data != bibs[i].data || atual.hash != bibs[i].hash)))
+			return false;
+	}
+	return true;
+}
+
+// Funo interna que tenta carregar um objeto a partir do seu
+// cache binrio. Retorna NULL se o cache no existir, for de outra
+// verso, estiver danificado ou desatualizado em relao ao arquivo
+// .obj ou s suas bibliotecas de materiais.
+//
+// Os vrtices, normais, texcoords e ndices no so copiados: os
+// vetores do objeto apontam diretamente para o arquivo mapeado
+// (de forma privada, portanto podem ser alterados sem afetar o
+// cache)
+OBJ *_leCacheObjeto(char *nomeArquivo, bool mipmap)
+{
+	char nomeCache[512];
+	ARQMEM arq;
+	CABCACHE orig;
+	int i;
+
+	_nomeCache(nomeArquivo,nomeCache,sizeof(nomeCache));
+	if(!_mapeiaArquivo(nomeCache,&arq,true))
+		return NULL;
+	CABCACHE *cab = (CABCACHE *) arq.dados;
+	// Verifica a identificao, a verso e a origem
+	if(arq.tam < sizeof(CABCACHE) || memcmp(cab->magica,MAGICA_CACHE,4)
+		|| cab->versao != VERSAO_CACHE || cab->tamTotal != (long long) arq.tam
+		|| !_identificaOrigem(nomeArquivo,&orig)
+		|| orig.tamOrigem != cab->tamOrigem || orig.dataOrigem != cab->dataOrigem
+		|| orig.hashOrigem != cab->hashOrigem
+		|| !_estruturaCacheValida(arq) || !_bibliotecasCacheAtuais(arq))
+	{
+#ifdef DEBUG
+		printf("Cache desatualizado ou invlido: %s\n",nomeCache);
+#endif
+		_liberaArquivo(&arq);
+		return NULL;
+	}
+
+	OBJ *obj = _alocaObjeto();
+	FACE *faces = (FACE *) malloc(sizeof(FACE)*cab->numFaces);
+	if(obj == NULL || (faces == NULL && cab->numFaces))
+	{
+		free(obj); free(faces);
+		_liberaArquivo(&arq);
+		return NULL;
+	}
+#ifdef DEBUG
+	printf("*** Objeto: %s (cache)\n",nomeArquivo);
+#endif
+	obj->numVertices  = cab->numVertices;
+	obj->numNormais   = cab->numNormais;
+	obj->numTexcoords = cab->numTexcoords;
+	obj->numFaces     = cab->numFaces;
+	obj->normais_por_vertice = (cab->flags & FLAG_CACHE_NORMAIS_VERT) != 0;
+	obj->tem_materiais = (cab->flags & FLAG_CACHE_MATERIAIS) != 0;
+	obj->cache = arq.dados;
+	obj->tam_cache = arq.tam;
+	char *base = arq.dados;
+	if(cab->numVertices)  obj->vertices  = (VERT *) (base + cab->desl[CACHE_VERTICES]);
+	if(cab->numNormais)   obj->normais   = (VERT *) (base + cab->desl[CACHE_NORMAIS]);
+	if(cab->numTexcoords) obj->texcoords = (TEXCOORD *) (base + cab->desl[CACHE_TEXCOORDS]);
+	obj->inicio_faces = (GLint *) (base + cab->desl[CACHE_INICIO]);
+	obj->ind_vertices = (GLint *) (base + cab->desl[CACHE_IND_VERT]);
+	if(cab->flags & FLAG_CACHE_IND_NORM)
+		obj->ind_normais = (GLint *) (base + cab->desl[CACHE_IND_NORM]);
+	if(cab->flags & FLAG_CACHE_IND_TEX)
+		obj->ind_texcoords = (GLint *) (base + cab->desl[CACHE_IND_TEX]);
+	obj->faces = faces;
+
+	// Registra os materiais (se ainda no existirem) e carrega
+	// as texturas, obtendo os ndices e texids desta execuo
+	MATCACHE *mats = (MATCACHE *) (base + cab->desl[CACHE_MATERIAIS]);
+	TEXCACHE *texs = (TEXCACHE *) (base + cab->desl[CACHE_TEXTURAS]);
+	vector<GLint> mapaMat(cab->numMateriais), mapaTex(cab->numTexturas);
+	for(i=0; i<cab->numMateriais; ++i)
+	{
+		mapaMat[i] = _procuraMaterial(mats[i].nome);
+		if(mapaMat[i] != -1) continue;
+		MAT *ptr;
+		if((ptr = (MAT *) malloc(sizeof(MAT)))==NULL)
+		{
+			printf("Sem memria para novo material!");
+			exit(1);
+		}
+		memcpy(ptr->ka,mats[i].ka,sizeof(ptr->ka));
+		memcpy(ptr->kd,mats[i].kd,sizeof(ptr->kd));
+		memcpy(ptr->ks,mats[i].ks,sizeof(ptr->ks));
+		memcpy(ptr->ke,mats[i].ke,sizeof(ptr->ke));
+		ptr->spec = mats[i].spec;
+		mapaMat[i] = _registraMaterial(ptr,mats[i].nome);
+	}
+	for(i=0; i<cab->numTexturas; ++i)
+		mapaTex[i] = CarregaTextura(texs[i].nome,mipmap)->texid;
+
+	GLint *fmat = (GLint *) (base + cab->desl[CACHE_FACE_MAT]);
+	GLint *ftex = (GLint *) (base + cab->desl[CACHE_FACE_TEX]);
+	GLint *fgrupo = (GLint *) (base + cab->desl[CACHE_FACE_GRUPO]);
+	for(i=0; i<obj->numFaces; ++i)
+	{
+		faces[i].mat   = fmat[i] != -1 ? mapaMat[fmat[i]] : -1;
+		faces[i].texid = ftex[i] != -1 ? mapaTex[ftex[i]] : -1;
+		faces[i].grupo = fgrupo[i];
+	}
+	_apontaFaces(obj);
+	// As faces j foram gravadas agrupadas: basta montar os lotes
+	AgrupaFaces(obj);
+	obj->trocasEvitadas = cab->trocasEvitadas;
+	// A caixa envolvente tambm est no cache
+	obj->min = cab->min;
+	obj->max = cab->max;
+	_esferaEnvolvente(obj);
+#ifdef DEBUG
+	printf("Vertices: %d\n",obj->numVertices);
+	printf("Faces:    %d\n",obj->numFaces);
+	printf("Normais:  %d\n",obj->numNormais);
+	printf("Texcoords:%d\n",obj->numTexcoords);
+	printf("Limites: %f %f %f - %f %f %f\n",cab->min.x,cab->min.y,cab->min.z,
+		cab->max.x,cab->max.y,cab->max.z);
+#endif
+	// Adiciona na lista
+	_objetos.push_back(obj);
+	return obj;
+}
+
+// Tamanho mximo das texturas agrupadas em atlas por CarregaObjeto
+// (0 = no cria atlas)
+int _tamAtlas = 0;
+
+// Faz com que CarregaObjeto junte em um atlas (ver CriaAtlasTexturas)
+// as texturas de cada objeto com no mximo tamMax texels de largura
+// e de altura (0 desativa)
+void SetaAtlasTexturas(int tamMax)
+{
+	if(tamMax >= 0) _tamAtlas = tamMax;
+}
+
+// Seleciona o modo de carga utilizado por CarregaObjeto
+// 'n' - leitura tradicional, em duas passagens (fgets/sscanf)
+// 'm' - arquivo mapeado em memria e lido em uma s passagem
+// 'p' - arquivo mapeado em memria e lido em paralelo, em trechos
+// 'f' - arquivo lido em fluxo, com memria limitada (ver LeObjetoFluxo)
+void SetaModoCarga(char modo)
+{
+	if(modo!='n' && modo!='m' && modo!='p' && modo!='f') return;
+	_modoCarga = modo;
+}
+
+// Cria e carrega um objeto 3D que esteja armazenado em um
+// arquivo no formato OBJ, cujo nome  passado por parmetro.
+//  feita a leitura do arquivo para preencher as estruturas 
+// de vrtices e faces, que so retornadas atravs de um OBJ.
+// A forma de leitura depende do modo selecionado com
+// SetaModoCarga.
+//
+// O parmetro mipmap indica se deve-se gerar mipmaps a partir
+// das texturas (se houver)
+OBJ *CarregaObjeto(char *nomeArquivo, bool mipmap)
+{
+	ZONA zona("carga");
+	OBJ *obj = NULL;
+	char modo = _modoCarga;
+#ifdef DEBUG
+	double inicio = _tempoSeg();
+#endif
+	{
+		ZONA leitura("leitura");
+		_bibliotecasLidas.clear();
+		// Se possvel, usa o cache binrio
+		if(_usaCache && (obj = _leCacheObjeto(nomeArquivo,mipmap)) != NULL)
+			modo = 'c';
+		else if(_modoCarga == 'm')
+			obj = _carregaObjetoMapeado(nomeArquivo,mipmap);
+		else if(_modoCarga == 'p')
+			obj = _carregaObjetoParalelo(nomeArquivo,mipmap);
+		else if(_modoCarga == 'f')
+			obj = _carregaObjetoFluxo(nomeArquivo,mipmap);
+		else
+			obj = _carregaObjetoTexto(nomeArquivo,mipmap);
+	}
+	// Agrupa as faces por textura e material
+	if(obj != NULL && modo != 'c')
+		AgrupaFaces(obj);
+	// Grava o cache para a prxima carga
+	if(_usaCache && obj != NULL && modo != 'c')
+		_gravaCacheObjeto(obj,nomeArquivo);
+	// Junta as texturas pequenas em um atlas (depois de gravar o
+	// cache, que guarda as texturas originais)
+	if(_tamAtlas && obj != NULL)
+		CriaAtlasTexturas(obj,_tamAtlas,mipmap);
+#ifdef DEBUG
+	// Exibe o tempo de carga e a taxa de leitura obtida
+	struct stat st;
+	double tempo = _tempoSeg() - inicio;
+	if(obj != NULL && !stat(nomeArquivo,&st) && tempo > 0)
+		printf("Carga (modo %c): %.2f ms - %.1f MB/s\n",modo,
+			tempo*1000, st.st_size/(1024.0*1024.0)/tempo);
+#endif
+	// Envia para OpenGL as texturas j decodificadas (ver
+	// SetaTexturasAssincronas)
+	ProcessaTexturasPendentes(false);
+	return obj;
+}
+
+// Funo interna que libera um vetor de um objeto, a no ser
+// que ele esteja no cache binrio mapeado em memria
+void _liberaVetor(OBJ *obj, void *ptr)
+{
+	if (ptr == NULL) return;
+	if (obj->cache != NULL && (char *) ptr >= obj->cache
+		&& (char *) ptr < obj->cache + obj->tam_cache)
+		return;
+	free(ptr);
+}
+
+// Nmero de chamadas de troca de estado (materiais e texturas)
+// evitadas pelo agrupamento das faces desde a ltima consulta
+// (ver TrocasEvitadas)
+int _trocasEvitadas = 0;
+
+// Funo interna que retorna o custo, em chamadas OpenGL, das
+// trocas de estado para desenhar as faces na ordem informada:
+// cada face com material envia 5 parmetros, e cada mudana de
+// textura exige um glBindTexture
+int _custoEstado(OBJ *obj, const vector<int> &ordem, bool porLote)
+{
+	int custo = 0;
+	GLint ult_texid = -1, ult_mat = -2;
+	for(unsigned int i=0; i<ordem.size(); ++i)
+	{
+		FACE &face = obj->faces[ordem[i]];
+		bool novoLote = face.mat != ult_mat || face.texid != ult_texid;
+		if(face.mat != -1 && (!porLote || novoLote))
+			custo += 5;
+		if(face.texid != -1 && face.texid != ult_texid)
+			custo++;
+		ult_mat = face.mat;
+		ult_texid = face.texid;
+	}
+	return custo;
+}
+
+// Funo interna que informa se um material  transparente
+// (nesse caso, as suas faces no podem ser reordenadas)
+bool _materialTransparente(int mat)
+{
+	return mat >= 0 && mat < (int) _materiais.size() && _materiais[mat]->kd[3] < 1.0;
+}
+
+// Funo interna que reordena as faces de um objeto (a nova face
+// i  a antiga ordem[i]), junto com as normais por face e os ndices
+// no formato compacto. Retorna false se faltar memria
+bool _reordenaFaces(OBJ *obj, const vector<int> &ordem)
+{
+	int i;
+	FACE *faces = obj->faces;
+	bool mudou = false;
+	for(i=0; i<obj->numFaces && !mudou; ++i)
+		mudou = ordem[i] != i;
+	if(mudou)
+	{
+		FACE *novas = (FACE *) malloc(sizeof(FACE)*obj->numFaces);
+		if(novas == NULL) return false;
+		for(i=0; i<obj->numFaces; ++i)
+			novas[i] = faces[ordem[i]];
+		// Normais por face acompanham as faces
+		if(!obj->normais_por_vertice && obj->normais != NULL)
+		{
+			VERT *normais = (VERT *) malloc(sizeof(VERT)*obj->numFaces);
+			if(normais == NULL) { free(novas); return false; }
+			for(i=0; i<obj->numFaces; ++i)
+				normais[i] = obj->normais[ordem[i]];
+			_liberaVetor(obj,obj->normais);
+			obj->normais = normais;
+		}
+		free(obj->faces);
+		obj->faces = novas;
+		// No formato compacto, os ndices tambm so reordenados
+		if(obj->inicio_faces != NULL)
+		{
+			int total = obj->inicio_faces[obj->numFaces];
+			GLint *inicio = (GLint *) malloc(sizeof(GLint)*(obj->numFaces+1));
+			GLint *iv = (GLint *) malloc(sizeof(GLint)*total);
+			GLint *in = obj->ind_normais ? (GLint *) malloc(sizeof(GLint)*total) : NULL;
+			GLint *it = obj->ind_texcoords ? (GLint *) malloc(sizeof(GLint)*total) : NULL;
+			inicio[0] = 0;
+			for(i=0; i<obj->numFaces; ++i)
+			{
+				int ini = obj->inicio_faces[ordem[i]];
+				int nv = obj->inicio_faces[ordem[i]+1] - ini;
+				inicio[i+1] = inicio[i] + nv;
+				memcpy(&iv[inicio[i]],&obj->ind_vertices[ini],sizeof(GLint)*nv);
+				if(in) memcpy(&in[inicio[i]],&obj->ind_normais[ini],sizeof(GLint)*nv);
+				if(it) memcpy(&it[inicio[i]],&obj->ind_texcoords[ini],sizeof(GLint)*nv);
+			}
+			_liberaVetor(obj,obj->inicio_faces);
+			_liberaVetor(obj,obj->ind_vertices);
+			_liberaVetor(obj,obj->ind_normais);
+			_liberaVetor(obj,obj->ind_texcoords);
+			obj->inicio_faces  = inicio;
+			obj->ind_vertices  = iv;
+			obj->ind_normais   = in;
+			obj->ind_texcoords = it;
+			_apontaFaces(obj);
+		}
+		// A BVH, se houver, passa a indicar as novas posies das faces
+		if(obj->bvh != NULL)
+		{
+			vector<int> nova(obj->numFaces);
+			for(i=0; i<obj->numFaces; ++i)
+				nova[ordem[i]] = i;
+			for(i=0; i<obj->bvh->numTriangulos; ++i)
+				obj->bvh->faces[i] = nova[obj->bvh->faces[i]];
+		}
+	}
+	return true;
+}
+
+// Agrupa as faces de um objeto em lotes com a mesma textura e o
+// mesmo material, para que o desenho s troque de estado entre
+// um lote e outro. As faces opacas so ordenadas por textura e
+// material; as faces com materiais transparentes vo para o final,
+// mantendo a ordem original entre si (pois dela depende o resultado
+// da mistura de cores).
+//
+//  chamada automaticamente por CarregaObjeto. Se for chamada
+// depois, a malha e os buffers do objeto (se houver) devem ser
+// recriados.
+void AgrupaFaces(OBJ *obj)
+{
+	int i;
+	if(obj == NULL) return;
+	// No desenho, uma face sem material usa o ltimo material
+	// aplicado antes dela: como a ordem das faces vai mudar, essa
+	// herana precisa ficar explcita
+	GLint ult_mat = -1;
+	for(i=0; i<obj->numFaces; ++i)
+	{
+		if(obj->faces[i].mat == -1)
+			obj->faces[i].mat = ult_mat;
+		else ult_mat = obj->faces[i].mat;
+	}
+	// Ordem das faces: opacas por (textura, material), depois
+	// as transparentes na ordem original (a ordenao  estvel)
+	vector<int> ordem(obj->numFaces);
+	for(i=0; i<obj->numFaces; ++i) ordem[i] = i;
+	FACE *faces = obj->faces;
+	stable_sort(ordem.begin(), ordem.end(), [faces](int a, int b) {
+		bool ta = _materialTransparente(faces[a].mat);
+		bool tb = _materialTransparente(faces[b].mat);
+		if(ta || tb) return !ta && tb;
+		if(faces[a].texid != faces[b].texid) return faces[a].texid < faces[b].texid;
+		return faces[a].mat < faces[b].mat;
+	});
+	// Estima quantas chamadas sero evitadas a cada desenho
+	vector<int> original(obj->numFaces);
+	for(i=0; i<obj->numFaces; ++i) original[i] = i;
+	obj->trocasEvitadas = _custoEstado(obj,original,false) - _custoEstado(obj,ordem,true);
+
+	// Reordena as faces e descarta os blocos, que deixam de valer
+	_reordenaFaces(obj,ordem);
+	if(obj->blocos != NULL) free(obj->blocos);
+	obj->blocos = NULL;
+	obj->numBlocos = 0;
+
+	// Monta os lotes de faces consecutivas com o mesmo estado
+	_Vetor<LOTE> lotes;
+	for(i=0; i<obj->numFaces; ++i)
+	{
+		FACE &face = obj->faces[i];
+		if(!lotes.num || lotes.dados[lotes.num-1].mat != face.mat
+			|| lotes.dados[lotes.num-1].texid != face.texid)
+		{
+			LOTE *lote = lotes.novo();
+			lote->mat = face.mat;
+			lote->texid = face.texid;
+			lote->inicio = i;
+			lote->num = 0;
+		}
+		lotes.dados[lotes.num-1].num++;
+	}
+	if(obj->lotes != NULL) free(obj->lotes);
+	obj->numLotes = lotes.num;
+	obj->lotes = lotes.entrega();
+#ifdef DEBUG
+	printf("Lotes:    %d (%d chamadas evitadas por desenho)\n",obj->numLotes,obj->trocasEvitadas);
+#endif
+}
+
+// Retorna o nmero de chamadas de troca de estado (materiais e
+// texturas) evitadas pelo agrupamento das faces nos desenhos
+// feitos desde a chamada anterior - chamando-a uma vez a cada
+// quadro, obtm-se o valor por quadro
+int TrocasEvitadas()
+{
+	int trocas = _trocasEvitadas;
+	_trocasEvitadas = 0;
+	return trocas;
+}
+
+// Seta o modo de desenho a ser utilizado para os objetos
+// 'w' - wireframe
+// 's' - slido
+// 't' - slido + textura
+void SetaModoDesenho(char modo)
+{
+	if(modo!='w' && modo!='s' && modo!='t') return;
+	_modo = modo;
+}
+
+// Cor da instncia sendo desenhada, se houver (ver
+// _desenhaInstanciasCPU)
+const GLfloat *_corInstancia = NULL;
+
+// Funo interna que envia para OpenGL os parmetros de um
+// material. Se a face for texturizada (e o modo de desenho for
+// 't'), a cor difusa do material  substituda por branco
+// (caso contrrio, a textura  colorizada em GL_MODULATE).
+// A cor de uma instncia substitui a ambiente e a difusa
+void _aplicaMaterial(int mat, bool texturizada)
+{
+	static const GLfloat branco[4] = { 1.0, 1.0, 1.0, 1.0 };	// constante para cor branca
+	glMaterialfv(GL_FRONT,GL_AMBIENT,_corInstancia ? _corInstancia : _materiais[mat]->ka);
+	if(_corInstancia)
+		glMaterialfv(GL_FRONT,GL_DIFFUSE,_corInstancia);
+	else if(texturizada && _modo=='t')
+		glMaterialfv(GL_FRONT,GL_DIFFUSE,branco);
+	else
+		glMaterialfv(GL_FRONT,GL_DIFFUSE,_materiais[mat]->kd);
+	glMaterialfv(GL_FRONT,GL_SPECULAR,_materiais[mat]->ks);
+	glMaterialfv(GL_FRONT,GL_EMISSION,_materiais[mat]->ke);
+	glMaterialf(GL_FRONT,GL_SHININESS,_materiais[mat]->spec);
+}
+
+// Funo interna que verifica se a verso de OpenGL do contexto
+// corrente  pelo menos maior.menor, ou se a extenso informada
+// est disponvel
+bool _suportaGL(int maior, int menor, const char *extensao)
+{
+	const char *versao = (const char *) glGetString(GL_VERSION);
+	if(versao == NULL) return false;
+	int vmaior = 0, vmenor = 0;
+	sscanf(versao,"%d.%d",&vmaior,&vmenor);
+	if(vmaior > maior || (vmaior == maior && vmenor >= menor))
+		return true;
+	if(extensao == NULL) return false;
+	const char *ext = (const char *) glGetString(GL_EXTENSIONS);
+	return ext != NULL && strstr(ext,extensao) != NULL;
+}
+
+// Funo interna que configura os apontadores de vrtices,
+// normais e texcoords para o buffer de vrtices de um objeto
+// (ou, se no houver buffers, para a malha em memria)
+void _configuraArraysVBO(OBJ *obj)
+{
+	const char *base = NULL;
+	if(obj->vbo)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, obj->vbo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->ibo);
+	}
+	else base = (const char *) obj->malha->vertices;
+	glEnableClientState(GL_VERTEX_ARRAY);
+	// Vrtices quantizados (ver QuantizaMalha)
+	QUANTMALHA *q = obj->malha->quant;
+	if(q != NULL)
+	{
+		if(!obj->vbo) base = q->vertices;
+		glVertexPointer(3, GL_SHORT, q->tamVertice, base);
+		if(q->deslNormal >= 0)
+		{
+			glEnableClientState(GL_NORMAL_ARRAY);
+			glNormalPointer(GL_BYTE, q->tamVertice, base + q->deslNormal);
+		}
+		if(q->deslTex >= 0)
+		{
+			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+			glTexCoordPointer(2, GL_SHORT, q->tamVertice, base + q->deslTex);
+		}
+		return;
+	}
+	glVertexPointer(3, GL_FLOAT, sizeof(VERTMALHA), base + offsetof(VERTMALHA,pos));
+	if(obj->malha->tem_normais)
+	{
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glNormalPointer(GL_FLOAT, sizeof(VERTMALHA), base + offsetof(VERTMALHA,normal));
+	}
+	if(obj->malha->tem_texcoords)
+	{
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glTexCoordPointer(2, GL_FLOAT, sizeof(VERTMALHA), base + offsetof(VERTMALHA,tex));
+	}
+}
+
+// Funo interna que cria os buffers de um objeto
+void _criaVBO(OBJ *obj)
+{
+	// Cria a malha, se ainda no existir
+	if(obj->malha == NULL && CriaMalha(obj) == NULL)
+		return;
+	MALHA *malha = obj->malha;
+	// Recria os buffers, se j existirem
+	if(obj->vbo) DesabilitaVBO(obj);
+
+	glGenBuffers(1, &obj->vbo);
+	glGenBuffers(1, &obj->ibo);
+	glBindBuffer(GL_ARRAY_BUFFER, obj->vbo);
+	if(malha->quant != NULL)
+		glBufferData(GL_ARRAY_BUFFER, malha->quant->tamVertice*malha->numVertices,
+			malha->quant->vertices, GL_STATIC_DRAW);
+	else
+		glBufferData(GL_ARRAY_BUFFER, sizeof(VERTMALHA)*malha->numVertices,
+			malha->vertices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, malha->numIndices *
+		(malha->tipoIndice == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint)),
+		malha->indices, GL_STATIC_DRAW);
+
+	// Se houver VAOs, guarda neles a configurao dos arrays
+	if(_suportaGL(3,0,"GL_ARB_vertex_array_object"))
+	{
+		glGenVertexArrays(1, &obj->vao);
+		glBindVertexArray(obj->vao);
+		_configuraArraysVBO(obj);
+		glBindVertexArray(0);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+// Cria buffers (VBOs) com a malha do objeto informado, que passa
+// a ser desenhado com glDrawElements ao invs de glBegin/glEnd
+// - se for NULL, cria buffers para TODOS os objetos.
+// No tem efeito se o contexto OpenGL no suportar buffers
+// (verso 1.5 ou GL_ARB_vertex_buffer_object)
+void CriaVBO(OBJ *ptr)
+{
+	if(!_suportaGL(1,5,"GL_ARB_vertex_buffer_object")) return;
+	if(ptr==NULL)
+	{
+		for(unsigned int i=0;i<_objetos.size();++i)
+			_criaVBO(_objetos[i]);
+	}
+	else _criaVBO(ptr);
+}
+
+// Libera os buffers do objeto especificado, que volta a ser
+// desenhado da forma tradicional
+void DesabilitaVBO(OBJ *ptr)
+{
+	if(ptr == NULL) return;
+	if(ptr->vao) glDeleteVertexArrays(1, &ptr->vao);
+	if(ptr->vbo) glDeleteBuffers(1, &ptr->vbo);
+	if(ptr->ibo) glDeleteBuffers(1, &ptr->ibo);
+	ptr->vao = ptr->vbo = ptr->ibo = 0;
+	// O buffer de instncias  recriado no prximo desenho
+	if(ptr->vboInstancias) glDeleteBuffers(1, &ptr->vboInstancias);
+	if(ptr->instancias != NULL) free(ptr->instancias);
+	ptr->vboInstancias = 0;
+	ptr->capInstancias = 0;
+	ptr->instancias = NULL;
+}
+
+// Limite, em pixels, para o erro dos nveis de detalhe no desenho
+// (0 = sempre desenha a malha original - ver SetaNivelDetalhe)
+float _erroLOD = 0;
+
+// Define o erro mximo, em pixels na tela, admitido no desenho dos
+// objetos com nveis de detalhe (ver CriaNiveisDetalhe):  desenhado
+// o nvel mais simples cujo erro, projetado a partir da distncia
+// da esfera envolvente do objeto (obj->centro e obj->raio)  cmera,
+// no passe deste limite.
+// 0 desativa a escolha (a malha original  sempre desenhada)
+void SetaNivelDetalhe(float pixels)
+{
+	if(pixels >= 0) _erroLOD = pixels;
+}
+
+// Funo interna que escolhe o nvel de detalhe com que o objeto
+// ser desenhado com as matrizes correntes (0 = malha original)
+int _escolheNivel(OBJ *obj)
+{
+	MALHA *malha = obj->malha;
+	if(_erroLOD <= 0 || malha == NULL || !malha->numNiveis)
+		return 0;
+	GLfloat mv[16], pr[16];
+	GLint vp[4];
+	glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+	glGetFloatv(GL_PROJECTION_MATRIX, pr);
+	glGetIntegerv(GL_VIEWPORT, vp);
+	// Maior escala aplicada pela modelview
+	float esc = 0;
+	for(int c=0; c<3; ++c)
+		esc = max(esc, mv[c*4]*mv[c*4] + mv[c*4+1]*mv[c*4+1] + mv[c*4+2]*mv[c*4+2]);
+	esc = sqrt(esc);
+	// Pixels por unidade na distncia do centro da esfera (em
+	// projeo perspectiva, a cmera no pode estar dentro dela)
+	float pixels = pr[5] * vp[3] * 0.5f;
+	if(pr[15] == 0)
+	{
+		const VERT &c = obj->centro;
+		float dist = -(mv[2]*c.x + mv[6]*c.y + mv[10]*c.z + mv[14]);
+		if(dist <= obj->raio * esc) return 0;
+		pixels /= dist;
+	}
+	pixels *= esc;
+	for(int n=malha->numNiveis; n>0; --n)
+		if(malha->niveis[n-1].erro * pixels <= _erroLOD)
+			return n;
+	return 0;
+}
+
+// Indica se os objetos e blocos fora do volume de viso devem
+// ser descartados no desenho (ver SetaRecorte)
+bool _recorte = false;
+
+// Ativa ou desativa o descarte, em DesenhaObjeto, dos objetos que
+// esto fora do volume de viso definido pelas matrizes correntes:
+//  testada a esfera e depois a caixa envolvente de cada objeto e,
+// nos objetos divididos em blocos (ver CriaBlocos), a caixa de cada
+// bloco - apenas os blocos visveis so desenhados. O teste no 
+// feito durante a criao das display lists
+void SetaRecorte(bool usa)
+{
+	_recorte = usa;
+}
+
+// Funo interna que obtm os 6 planos do volume de viso, no
+// sistema de coordenadas do objeto (a partir das matrizes de
+// projeo e modelview correntes), com as normais para dentro
+// e unitrias
+void _extraiVolumeVisao(float plano[6][4])
+{
+	GLfloat mv[16], pr[16], m[16];
+	glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+	glGetFloatv(GL_PROJECTION_MATRIX, pr);
+	// m = projeo * modelview (matrizes por colunas)
+	for(int c=0; c<4; ++c)
+		for(int l=0; l<4; ++l)
+			m[c*4+l] = pr[l]*mv[c*4] + pr[4+l]*mv[c*4+1]
+				+ pr[8+l]*mv[c*4+2] + pr[12+l]*mv[c*4+3];
+	// Cada plano  a soma ou a diferena entre a ltima
+	// linha e uma das outras
+	for(int p=0; p<6; ++p)
+	{
+		int l = p/2;
+		float sinal = p%2 ? -1 : 1;
+		float tam = 0;
+		for(int c=0; c<4; ++c)
+		{
+			plano[p][c] = m[c*4+3] + sinal*m[c*4+l];
+			if(c < 3) tam += plano[p][c]*plano[p][c];
+		}
+		tam = sqrt(tam);
+		if(tam > 0)
+			for(int c=0; c<4; ++c) plano[p][c] /= tam;
+	}
+}
+
+// Funo interna que verifica se uma esfera pode estar dentro
+// do volume de viso
+bool _esferaVisivel(const float plano[6][4], const VERT &centro, float raio)
+{
+	for(int p=0; p<6; ++p)
+		if(plano[p][0]*centro.x + plano[p][1]*centro.y + plano[p][2]*centro.z
+			+ plano[p][3] < -raio)
+			return false;
+	return true;
+}
+
+// Funo interna que verifica se uma caixa pode estar dentro do
+// volume de viso: basta que, para cada plano, o seu vrtice mais
+//  frente no esteja atrs dele
+bool _caixaVisivel(const float plano[6][4], const VERT &min, const VERT &max)
+{
+	for(int p=0; p<6; ++p)
+		if(plano[p][0]*(plano[p][0] > 0 ? max.x : min.x)
+			+ plano[p][1]*(plano[p][1] > 0 ? max.y : min.y)
+			+ plano[p][2]*(plano[p][2] > 0 ? max.z : min.z) + plano[p][3] < 0)
+			return false;
+	return true;
+}
+
+// Funo interna que calcula a caixa envolvente de cada bloco
+// de faces de um objeto
+void _limitesBlocos(OBJ *obj)
+{
+	_executaIntervalos(obj->numBlocos, 16, [&](int ini, int fim) {
+		for(int b=ini; b<fim; ++b)
+		{
+			BLOCO &bloco = obj->blocos[b];
+			bool primeiro = true;
+			for(int i=bloco.inicio; i<bloco.inicio+bloco.num; ++i)
+			{
+				FACE &face = obj->faces[i];
+				for(int k=0; k<face.nv; ++k)
+				{
+					VERT &v = obj->vertices[face.vert[k]];
+					if(primeiro)
+					{
+						bloco.min = bloco.max = v;
+						primeiro = false;
+					}
+					else _limites1(v.x,v.y,v.z,bloco.min,bloco.max);
+				}
+			}
+		}
+	});
+}
+
+// Funo interna que recria a malha de um objeto cujas faces mudaram
+// de ordem, refazendo tambm os nveis de detalhe (com a mesma
+// reduo), a quantizao e os buffers que a malha anterior tinha
+void _recriaMalha(OBJ *obj)
+{
+	MALHA *malha = obj->malha;
+	int niveis = malha->numNiveis;
+	float reducao = malha->reducao;
+	bool quant = malha->quant != NULL;
+	if(CriaMalha(obj) == NULL) return;
+	if(niveis) CriaNiveisDetalhe(obj,niveis,reducao);
+	if(quant) QuantizaMalha(obj);	// recria tambm os buffers
+	else if(obj->vbo) _criaVBO(obj);
+}
+
+// Divide as faces de cada lote de um objeto em blocos espacialmente
+// coerentes, com no mximo facesPorBloco faces, para que apenas os
+// blocos visveis sejam desenhados (ver SetaRecorte). As faces de
+// cada lote opaco so reordenadas pela diviso recursiva do lote ao
+// meio, no eixo em que os centros das faces esto mais espalhados;
+// os lotes transparentes mantm a ordem das faces, e so apenas
+// divididos em trechos.
+//
+// Retorna o nmero de blocos criados. Como altera a ordem das faces,
+// recria a malha e os buffers do objeto, se houver, com os mesmos
+// nveis de detalhe e quantizao. Os blocos so descartados por
+// AgrupaFaces
+int CriaBlocos(OBJ *obj, int facesPorBloco)
+{
+	int i, k;
+	if(obj == NULL || facesPorBloco < 1 || !obj->numFaces) return 0;
+	if(obj->lotes == NULL) AgrupaFaces(obj);
+
+	// Centro de cada face
+	vector<VERT> centros(obj->numFaces);
+	_executaIntervalos(obj->numFaces, 4096, [&](int ini, int fim) {
+		for(int f=ini; f<fim; ++f)
+		{
+			FACE &face = obj->faces[f];
+			VERT c = { 0, 0, 0 };
+			for(int j=0; j<face.nv; ++j)
+			{
+				VERT &v = obj->vertices[face.vert[j]];
+				c.x += v.x; c.y += v.y; c.z += v.z;
+			}
+			if(face.nv) { c.x /= face.nv; c.y /= face.nv; c.z /= face.nv; }
+			centros[f] = c;
+		}
+	});
+
+	vector<int> ordem(obj->numFaces);
+	for(i=0; i<obj->numFaces; ++i) ordem[i] = i;
+	vector<BLOCO> blocos;
+	// Divide o trecho [ini,fim) da ordem ao meio at que caiba
+	// em um bloco
+	function<void(int,int,int,bool)> divide = [&](int lote, int ini, int fim, bool reordena) {
+		if(fim-ini <= facesPorBloco)
+		{
+			BLOCO bloco;
+			bloco.lote = lote;
+			bloco.inicio = ini;
+			bloco.num = fim-ini;
+			bloco.indInicio = -1;
+			bloco.indNum = 0;
+			blocos.push_back(bloco);
+			return;
+		}
+		int meio = (ini+fim)/2;
+		if(reordena)
+		{
+			VERT min = centros[ordem[ini]], max = min;
+			for(k=ini+1; k<fim; ++k)
+			{
+				VERT &c = centros[ordem[k]];
+				_limites1(c.x,c.y,c.z,min,max);
+			}
+			float dx = max.x-min.x, dy = max.y-min.y, dz = max.z-min.z;
+			int eixo = dx >= dy && dx >= dz ? 0 : (dy >= dz ? 1 : 2);
+			nth_element(ordem.begin()+ini, ordem.begin()+meio, ordem.begin()+fim,
+				[&](int a, int b) { return (&centros[a].x)[eixo] < (&centros[b].x)[eixo]; });
+		}
+		else meio = ini + (fim-ini+facesPorBloco-1)/facesPorBloco/2*facesPorBloco;
+		divide(lote,ini,meio,reordena);
+		divide(lote,meio,fim,reordena);
+	};
+	for(int l=0; l<obj->numLotes; ++l)
+	{
+		LOTE &lote = obj->lotes[l];
+		divide(l,lote.inicio,lote.inicio+lote.num,!_materialTransparente(lote.mat));
+	}
+	if(!_reordenaFaces(obj,ordem)) return 0;
+
+	if(obj->blocos != NULL) free(obj->blocos);
+	obj->numBlocos = blocos.size();
+	obj->blocos = (BLOCO *) malloc(sizeof(BLOCO)*blocos.size());
+	if(obj->blocos == NULL)
+	{
+		obj->numBlocos = 0;
+		return 0;
+	}
+	memcpy(obj->blocos, blocos.data(), sizeof(BLOCO)*blocos.size());
+	_limitesBlocos(obj);
+
+	// A malha e os buffers precisam refletir a nova ordem
+	if(obj->malha != NULL) _recriaMalha(obj);
+#ifdef DEBUG
+	printf("Blocos:   %d\n",obj->numBlocos);
+#endif
+	return obj->numBlocos;
+}
+
+// Funo interna que obtm as faixas a desenhar de um lote: o lote
+// inteiro (de ini, com num elementos) ou, se plano no for NULL, os
+// seus blocos visveis - comeando pelo bloco b, que avana at o
+// prximo lote. Se indices for true, as faixas so de ndices da
+// malha, e no de faces. Blocos visveis consecutivos formam uma
+// nica faixa
+void _faixasLote(OBJ *obj, int lote, int ini, int num, const float (*plano)[4],
+	bool indices, int &b, vector<pair<int,int> > &faixas)
+{
+	faixas.clear();
+	if(plano == NULL)
+	{
+		faixas.push_back(make_pair(ini,num));
+		return;
+	}
+	for(; b<obj->numBlocos && obj->blocos[b].lote == lote; ++b)
+	{
+		BLOCO &bloco = obj->blocos[b];
+		if(!_caixaVisivel(plano,bloco.min,bloco.max)) continue;
+		int bini = indices ? bloco.indInicio : bloco.inicio;
+		int bnum = indices ? bloco.indNum : bloco.num;
+		if(!faixas.empty() && faixas.back().first + faixas.back().second == bini)
+			faixas.back().second += bnum;
+		else
+			faixas.push_back(make_pair(bini,bnum));
+	}
+}
+
+// Primeiro atributo genrico com os dados das instncias (ver
+// DesenhaInstancias): as 4 colunas da matriz e a cor. Evita os
+// atributos que alguns drivers associam aos convencionais
+// (0 = vrtice, 2 = normal, 3 = cor, 8 = texcoord 0)
+#define ATRIB_INSTANCIA	10
+// Nmero de floats de uma instncia no buffer (matriz e cor)
+#define TAM_INSTANCIA	20
+// Nmero de instncias inalteradas entre dois trechos alterados
+// abaixo do qual os trechos so enviados numa chamada s
+#define LACUNA_INSTANCIAS	8
+
+// Indica se o desenho por instncias pode usar a placa (ver
+// SetaInstanciamento)
+bool _instanciamento = true;
+// Programa de desenho por instncias (-1 = ainda no testado,
+// 0 = no disponvel) e posies das suas variveis uniformes
+GLint _progInstancias = -1;
+GLint _locDeq, _locIluminacao, _locNumLuzes, _locLuzes, _locUsaCor, _locCorMaterial, _locUsaTextura;
+
+// Vertex shader do desenho por instncias: reproduz a iluminao
+// fixa de OpenGL (observador no infinito, s a face da frente),
+// com a matriz de cada instncia aplicada antes da modelview. Se
+// corMaterial no for 0, a cor corrente substitui o componente do
+// material indicado (ver DesenhaInstancias e glColorMaterial: 1 = ambiente,
+// 2 = difusa, 3 = as duas, 4 = especular, 5 = emisso). A cor da
+// instncia, se houver, substitui a ambiente e a difusa
+static const char *_fonteVertInstancias =
+	"#version 120\n"
+	"attribute vec4 inst0, inst1, inst2, inst3, instCor;\n"
+	"uniform vec4 deq;\n"
+	"uniform bool iluminacao, usaCor;\n"
+	"uniform int corMaterial;\n"
+	"uniform int numLuzes, luzes[8];\n"
+	"varying vec4 cor;\n"
+	"void main()\n"
+	"{\n"
+	"	mat4 inst = mat4(inst0, inst1, inst2, inst3);\n"
+	"	vec4 olho = gl_ModelViewMatrix * (inst * vec4(gl_Vertex.xyz * deq.w + deq.xyz, 1.0));\n"
+	"	gl_Position = gl_ProjectionMatrix * olho;\n"
+	"	gl_ClipVertex = olho;\n"
+	"	gl_TexCoord[0] = gl_TextureMatrix[0] * gl_MultiTexCoord0;\n"
+	"	vec4 amb = gl_FrontMaterial.ambient, dif = gl_FrontMaterial.diffuse;\n"
+	"	vec4 esp = gl_FrontMaterial.specular, emi = gl_FrontMaterial.emission;\n"
+	"	if(corMaterial == 1 || corMaterial == 3) amb = gl_Color;\n"
+	"	if(corMaterial == 2 || corMaterial == 3) dif = gl_Color;\n"
+	"	if(corMaterial == 4) esp = gl_Color;\n"
+	"	if(corMaterial == 5) emi = gl_Color;\n"
+	"	if(usaCor) amb = dif = instCor;\n"
+	"	if(!iluminacao)\n"
+	"	{\n"
+	"		cor = usaCor ? instCor : gl_Color;\n"
+	"		return;\n"
+	"	}\n"
+	// Normal: cofatores da parte 3x3 da instncia (a inversa
+	// transposta sem a diviso pelo determinante, s o sinal)
+	"	vec3 c0 = inst0.xyz, c1 = inst1.xyz, c2 = inst2.xyz;\n"
+	"	mat3 cof = mat3(cross(c1,c2), cross(c2,c0), cross(c0,c1));\n"
+	"	float s = dot(c0, cross(c1,c2)) < 0.0 ? -1.0 : 1.0;\n"
+	"	vec3 n = normalize(gl_NormalMatrix * (cof * gl_Normal) * s);\n"
+	"	vec4 c = emi + amb * gl_LightModel.ambient;\n"
+	"	for(int j=0; j<numLuzes; ++j)\n"
+	"	{\n"
+	"		int i = luzes[j];\n"
+	"		vec3 l;\n"
+	"		float at = 1.0;\n"
+	"		if(gl_LightSource[i].position.w == 0.0)\n"
+	"			l = normalize(gl_LightSource[i].position.xyz);\n"
+	"		else\n"
+	"		{\n"
+	"			vec3 d = gl_LightSource[i].position.xyz - olho.xyz;\n"
+	"			float dist = length(d);\n"
+	"			l = d / dist;\n"
+	"			at = 1.0 / (gl_LightSource[i].constantAttenuation\n"
+	"				+ gl_LightSource[i].linearAttenuation * dist\n"
+	"				+ gl_LightSource[i].quadraticAttenuation * dist * dist);\n"
+	"			if(gl_LightSource[i].spotCutoff != 180.0)\n"
+	"			{\n"
+	"				float sp = dot(-l, normalize(gl_LightSource[i].spotDirection));\n"
+	"				at *= sp < gl_LightSource[i].spotCosCutoff ? 0.0\n"
+	"					: pow(sp, gl_LightSource[i].spotExponent);\n"
+	"			}\n"
+	"		}\n"
+	"		vec4 t = amb * gl_LightSource[i].ambient;\n"
+	"		float nl = dot(n, l);\n"
+	"		if(nl > 0.0)\n"
+	"		{\n"
+	"			t += nl * dif * gl_LightSource[i].diffuse;\n"
+	"			float nh = max(dot(n, normalize(l + vec3(0.0,0.0,1.0))), 0.0);\n"
+	"			float sh = gl_FrontMaterial.shininess;\n"
+	"			t += (sh == 0.0 ? 1.0 : pow(nh, sh)) * esp * gl_LightSource[i].specular;\n"
+	"		}\n"
+	"		c += at * t;\n"
+	"	}\n"
+	"	cor = clamp(vec4(c.rgb, dif.a), 0.0, 1.0);\n"
+	"}\n";
+
+// Fragment shader do desenho por instncias (textura em GL_MODULATE)
+static const char *_fonteFragInstancias =
+	"#version 120\n"
+	"uniform bool usaTextura;\n"
+	"uniform sampler2D amostra;\n"
+	"varying vec4 cor;\n"
+	"void main()\n"
+	"{\n"
+	"	gl_FragColor = usaTextura ? cor * texture2D(amostra, gl_TexCoord[0].st) : cor;\n"
+	"}\n";
+
+// Funo interna que compila um shader, retornando 0 em caso de erro
+GLuint _compilaShader(GLenum tipo, const char *fonte)
+{
+	GLuint sh = glCreateShader(tipo);
+	glShaderSource(sh, 1, &fonte, NULL);
+	glCompileShader(sh);
+	GLint ok;
+	glGetShaderiv(sh, GL_COMPILE_STATUS, &ok);
+	if(!ok)
+	{
+#ifdef DEBUG
+		char log[1024];
+		glGetShaderInfoLog(sh, sizeof(log), NULL, log);
+		printf("Erro ao compilar shader: %s\n",log);
+#endif
+		glDeleteShader(sh);
+		return 0;
+	}
+	return sh;
+}
+
+// Funo interna que verifica se o desenho por instncias pode usar
+// a placa (OpenGL 3.3, com o perfil de compatibilidade), criando o
+// programa na primeira chamada
+bool _preparaInstancias()
+{
+	if(!_instanciamento) return false;
+	if(_progInstancias >= 0) return _progInstancias > 0;
+	_progInstancias = 0;
+	if(!_suportaGL(3,3,NULL)) return false;
+
+	GLuint vs = _compilaShader(GL_VERTEX_SHADER, _fonteVertInstancias);
+	GLuint fs = _compilaShader(GL_FRAGMENT_SHADER, _fonteFragInstancias);
+	GLuint prog = glCreateProgram();
+	if(vs) glAttachShader(prog, vs);
+	if(fs) glAttachShader(prog, fs);
+	const char *nomes[] = { "inst0", "inst1", "inst2", "inst3", "instCor" };
+	for(int k=0; k<5; ++k)
+		glBindAttribLocation(prog, ATRIB_INSTANCIA+k, nomes[k]);
+	glLinkProgram(prog);
+	// Os shaders s so apagados de fato junto com o programa
+	if(vs) glDeleteShader(vs);
+	if(fs) glDeleteShader(fs);
+	GLint ok;
+	glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+	if(!vs || !fs || !ok)
+	{
+#ifdef DEBUG
+		char log[1024];
+		glGetProgramInfoLog(prog, sizeof(log), NULL, log);
+		printf("Erro ao ligar programa de instncias: %s\n",log);
+#endif
+		glDeleteProgram(prog);
+		return false;
+	}
+	_locDeq = glGetUniformLocation(prog, "deq");
+	_locIluminacao = glGetUniformLocation(prog, "iluminacao");
+	_locNumLuzes = glGetUniformLocation(prog, "numLuzes");
+	_locLuzes = glGetUniformLocation(prog, "luzes");
+	_locUsaCor = glGetUniformLocation(prog, "usaCor");
+	_locCorMaterial = glGetUniformLocation(prog, "corMaterial");
+	_locUsaTextura = glGetUniformLocation(prog, "usaTextura");
+	glUseProgram(prog);
+	glUniform1i(glGetUniformLocation(prog, "amostra"), 0);
+	glUseProgram(0);
+	_progInstancias = prog;
+	return true;
+}
+
+// Funo interna que atualiza o buffer de instncias de um objeto,
+// enviando apenas os trechos que mudaram desde o ltimo desenho
+// (a cpia em obj->instancias serve para a comparao). Se o buffer
+// precisar crescer, sua capacidade  dobrada e tudo  enviado
+void _enviaInstancias(OBJ *obj, const MATRIZ *matrizes, const GLfloat *cores, int num)
+{
+	static const GLfloat branco[4] = { 1.0, 1.0, 1.0, 1.0 };
+	bool todas = false;
+	if(!obj->vboInstancias) glGenBuffers(1, &obj->vboInstancias);
+	glBindBuffer(GL_ARRAY_BUFFER, obj->vboInstancias);
+	if(num > obj->capInstancias)
+	{
+		int cap = max(num, obj->capInstancias*2);
+		GLfloat *novas = (GLfloat *) malloc(cap*TAM_INSTANCIA*sizeof(GLfloat));
+		if(novas == NULL)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			return;
+		}
+		if(obj->instancias != NULL) free(obj->instancias);
+		obj->instancias = novas;
+		obj->capInstancias = cap;
+		glBufferData(GL_ARRAY_BUFFER, cap*TAM_INSTANCIA*sizeof(GLfloat), NULL, GL_DYNAMIC_DRAW);
+		todas = true;
+	}
+
+	// Compara cada instncia com a cpia, acumulando um trecho
+	// [ini,fim) de instncias alteradas
+	int ini = -1, fim = -1;
+	for(int i=0; i<=num; ++i)
+	{
+		if(i < num)
+		{
+			GLfloat *inst = obj->instancias + i*TAM_INSTANCIA;
+			const GLfloat *cor = cores != NULL ? cores + i*4 : branco;
+			if(!todas && !memcmp(inst, matrizes[i].m, 16*sizeof(GLfloat))
+				&& !memcmp(inst+16, cor, 4*sizeof(GLfloat)))
+				continue;
+			memcpy(inst, matrizes[i].m, 16*sizeof(GLfloat));
+			memcpy(inst+16, cor, 4*sizeof(GLfloat));
+			if(ini < 0) ini = i;
+			else if(i - fim >= LACUNA_INSTANCIAS)
+			{
+				glBufferSubData(GL_ARRAY_BUFFER, ini*TAM_INSTANCIA*sizeof(GLfloat),
+					(fim-ini)*TAM_INSTANCIA*sizeof(GLfloat), obj->instancias + ini*TAM_INSTANCIA);
+				ini = i;
+			}
+			fim = i+1;
+		}
+		else if(ini >= 0)
+			glBufferSubData(GL_ARRAY_BUFFER, ini*TAM_INSTANCIA*sizeof(GLfloat),
+				(fim-ini)*TAM_INSTANCIA*sizeof(GLfloat), obj->instancias + ini*TAM_INSTANCIA);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Funo interna que desenha um objeto a partir dos seus buffers
+// (ou da malha em memria, se no houver), com uma chamada a
+// glDrawElements para cada lote do nvel de detalhe indicado
+// (0 = malha original). Se plano no for NULL, desenha apenas os
+// blocos visveis de cada lote (ver _faixasLote). Se instancias
+// no for 0, desenha esse nmero de cpias com o buffer de instncias
+// e o programa de DesenhaInstancias, que j deve estar em uso
+void _desenhaMalha(OBJ *obj, int nivel, const float (*plano)[4], int instancias)
+{
+	MALHA *malha = obj->malha;
+	GLint ult_texid = -1;
+	size_t tamIndice = malha->tipoIndice == GL_UNSIGNED_SHORT ?
+		sizeof(GLushort) : sizeof(GLuint);
+	const char *base = obj->vbo ? NULL : (const char *) malha->indices;
+	LOTE *lotes = nivel ? malha->niveis[nivel-1].lotes : malha->lotes;
+	int numLotes = nivel ? malha->niveis[nivel-1].numLotes : malha->numLotes;
+
+	// Salva atributos de iluminao, materiais e polgonos
+	glPushAttrib(GL_LIGHTING_BIT | GL_POLYGON_BIT);
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+	glDisable(GL_TEXTURE_2D);
+	if(obj->tem_materiais)
+		glDisable(GL_COLOR_MATERIAL);
+	// Em wireframe, desenha apenas as arestas dos tringulos
+	if(_modo=='w')
+		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+
+	if(obj->vao) glBindVertexArray(obj->vao);
+	else _configuraArraysVBO(obj);
+	// Cada instncia avana uma vez por cpia desenhada
+	if(instancias)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, obj->vboInstancias);
+		for(int k=0; k<5; ++k)
+		{
+			glEnableVertexAttribArray(ATRIB_INSTANCIA+k);
+			glVertexAttribPointer(ATRIB_INSTANCIA+k, 4, GL_FLOAT, GL_FALSE,
+				TAM_INSTANCIA*sizeof(GLfloat), (const char *) NULL + k*4*sizeof(GLfloat));
+			glVertexAttribDivisor(ATRIB_INSTANCIA+k, 1);
+		}
+	}
+
+	// Vrtices quantizados: a escala e o deslocamento vo para as
+	// matrizes (para a modelview s sem instncias - ver
+	// DesenhaInstancias), e as normais, que ficam com o tamanho
+	// dividido pela escala, so corrigidas (ver QuantizaMalha)
+	QUANTMALHA *q = malha->quant;
+	if(q != NULL)
+	{
+		glPushAttrib(GL_TRANSFORM_BIT);
+		if(!instancias)
+		{
+			if(!glIsEnabled(GL_NORMALIZE)) glEnable(GL_RESCALE_NORMAL);
+			glMatrixMode(GL_MODELVIEW);
+			glPushMatrix();
+			glTranslatef(q->centro[0],q->centro[1],q->centro[2]);
+			glScalef(q->escala,q->escala,q->escala);
+		}
+		if(q->deslTex >= 0)
+		{
+			glMatrixMode(GL_TEXTURE);
+			glPushMatrix();
+			glTranslatef(q->centroTex[0],q->centroTex[1],0);
+			glScalef(q->escalaTex[0],q->escalaTex[1],1);
+		}
+	}
+
+	vector<pair<int,int> > faixas;
+	int b = 0;
+	for(int l=0; l<numLotes; ++l)
+	{
+		LOTE &lote = lotes[l];
+		_faixasLote(obj,l,lote.inicio,lote.num,plano,true,b,faixas);
+		if(faixas.empty()) continue;
+		if(lote.mat != -1)
+			_aplicaMaterial(lote.mat, lote.texid != -1);
+		// Se o objeto possui uma textura associada, utiliza
+		// o seu texid ao invs da informao do lote
+		GLint texid = obj->textura != -1 ? obj->textura : lote.texid;
+		if(texid == -1 && ult_texid != -1)
+			glDisable(GL_TEXTURE_2D);
+		if(texid != -1 && texid != ult_texid && _modo=='t')
+		{
+			glEnable(GL_TEXTURE_2D);
+			glBindTexture(GL_TEXTURE_2D,texid);
+		}
+		if(instancias)
+		{
+			glUniform1i(_locUsaTextura, texid != -1 && _modo=='t');
+			for(unsigned int f=0; f<faixas.size(); ++f)
+				glDrawElementsInstanced(GL_TRIANGLES, faixas[f].second, malha->tipoIndice,
+					base + faixas[f].first * tamIndice, instancias);
+		}
+		else for(unsigned int f=0; f<faixas.size(); ++f)
+			glDrawElements(GL_TRIANGLES, faixas[f].second, malha->tipoIndice,
+				base + faixas[f].first * tamIndice);
+		ult_texid = texid;
+	}
+
+	if(q != NULL)
+	{
+		if(q->deslTex >= 0) glPopMatrix();
+		if(!instancias)
+		{
+			glMatrixMode(GL_MODELVIEW);
+			glPopMatrix();
+		}
+		glPopAttrib();
+	}
+	// Desativa os atributos das instncias (que ficariam no VAO)
+	if(instancias)
+	{
+		for(int k=0; k<5; ++k)
+		{
+			glVertexAttribDivisor(ATRIB_INSTANCIA+k, 0);
+			glDisableVertexAttribArray(ATRIB_INSTANCIA+k);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	if(obj->vao) glBindVertexArray(0);
+	if(obj->vbo)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	glDisable(GL_TEXTURE_2D);
+	glPopClientAttrib();
+	glPopAttrib();
+}
+
+// Funo interna que desenha um objeto 3D (ver DesenhaObjeto)
+void _desenhaObjeto(OBJ *obj)
+{
+	int i;	// contador
+	GLint ult_texid, texid;	// ltima/atual textura 
+	GLenum prim = GL_POLYGON;	// tipo de primitiva
+
+	// Envia para OpenGL as texturas cuja decodificao terminou
+	ProcessaTexturasPendentes(false);
+	// Agrupa as faces, caso ainda no tenha sido feito
+	if(obj->lotes == NULL && obj->numFaces)
+		AgrupaFaces(obj);
+
+	// Se o objeto possui buffers ou uma malha quantizada, ou se for
+	// escolhido um nvel de detalhe simplificado (ver
+	// SetaNivelDetalhe), desenha a malha (abaixo). Nesse caso, uma
+	// display list pendente (ver CriaDisplayList) nunca seria
+	// compilada, e  descartada
+	int nivel = _escolheNivel(obj);
+	bool desenhaMalha = obj->vbo || nivel
+		|| (obj->malha != NULL && obj->malha->quant != NULL);
+	if(desenhaMalha && obj->dlist >= 1000)
+	{
+		glDeleteLists(obj->dlist-1000,1);
+		obj->dlist = -1;
+	}
+
+	// Descarta o objeto se estiver fora do volume de viso (ver
+	// SetaRecorte), a no ser que a display list esteja sendo criada.
+	// Os blocos do objeto s so testados se no houver display list
+	float plano[6][4];
+	const float (*recorte)[4] = NULL;
+	if(_recorte && obj->dlist < 1000)
+	{
+		_extraiVolumeVisao(plano);
+		if(!_esferaVisivel(plano,obj->centro,obj->raio)
+			|| !_caixaVisivel(plano,obj->min,obj->max))
+			return;
+		if(obj->numBlocos && obj->dlist == -1)
+			recorte = plano;
+	}
+	// Contabiliza as trocas de estado evitadas pelo agrupamento
+	_trocasEvitadas += obj->trocasEvitadas;
+
+	// Desenha a malha - os blocos s valem para a malha original,
+	// se ela tiver sido criada depois deles
+	if(desenhaMalha)
+	{
+		if(nivel || obj->blocos == NULL || obj->blocos[0].indInicio < 0
+			|| obj->malha->numLotes != obj->numLotes)
+			recorte = NULL;
+		_desenhaMalha(obj,nivel,recorte,0);
+		return;
+	}
+
+	// Gera nova display list se for o caso
+	if(obj->dlist >= 1000)
+		glNewList(obj->dlist-1000,GL_COMPILE_AND_EXECUTE);
+	// Ou chama a display list j associada...
+	else if(obj->dlist > -1)
+	{
+		glCallList(obj->dlist);
+		return;
+	}
+
+	// Seleciona GL_LINE_LOOP se o objetivo
+	// for desenhar o objeto em wireframe
+	if(_modo=='w') prim = GL_LINE_LOOP;
+
+	// Salva atributos de iluminao e materiais
+	glPushAttrib(GL_LIGHTING_BIT);
+	glDisable(GL_TEXTURE_2D);
+	// Se objeto possui materiais associados a ele,
+	// desabilita COLOR_MATERIAL - caso contrrio,
+	// mantm estado atual, pois usurio pode estar
+	// utilizando o recurso para colorizar o objeto
+	if(obj->tem_materiais)
+		glDisable(GL_COLOR_MATERIAL);
+
+	// Armazena id da ltima textura utilizada
+	// (por enquanto, nenhuma)
+	ult_texid = -1;
+	// Faixas de faces a desenhar em cada lote e bloco corrente
+	vector<pair<int,int> > faixas;
+	int b = 0;
+	// Varre todos os lotes de faces do objeto: o estado (material
+	// e textura) s  alterado no incio de cada lote
+	for(int l=0; l<obj->numLotes; l++)
+	{
+		LOTE &lote = obj->lotes[l];
+		// Obtm as faces do lote a desenhar: todas, ou as dos
+		// blocos visveis - se no houver nenhuma, pula o lote
+		_faixasLote(obj,l,lote.inicio,lote.num,recorte,false,b,faixas);
+		if(faixas.empty()) continue;
+		// Existe um material associado ao lote ?
+		if(lote.mat != -1)
+			// Sim, envia parmetros para OpenGL
+			_aplicaMaterial(lote.mat, lote.texid != -1);
+
+		// Se o objeto possui uma textura associada, utiliza
+		// o seu texid ao invs da informao em cada lote
+		if(obj->textura != -1)
+			texid = obj->textura;
+		else
+			// L o texid associado ao lote (-1 se no houver)
+			texid = lote.texid;
+
+		// Se o ltimo lote usou textura e este no,
+		// desabilita
+		if(texid == -1 && ult_texid != -1)
+			glDisable(GL_TEXTURE_2D);
+
+		// Ativa texturas 2D se houver necessidade
+		if (texid != -1 && texid != ult_texid && _modo=='t')
+		{
+		       glEnable(GL_TEXTURE_2D);
+		       glBindTexture(GL_TEXTURE_2D,texid);
+		}
+
+		// Varre as faces do lote
+		for(unsigned int f=0; f<faixas.size(); ++f)
+		for(i=faixas[f].first; i<faixas[f].first+faixas[f].second; i++)
+		{
+			// Usa normais calculadas por face (flat shading) se
+			// o objeto no possui normais por vrtice
+			if(!obj->normais_por_vertice)
+				glNormal3f(obj->normais[i].x,obj->normais[i].y,obj->normais[i].z);
+
+			// Obtm os ndices da face (no formato compacto, apontam
+			// para posies consecutivas nos vetores do objeto)
+			const GLint *vert = obj->faces[i].vert;
+			const GLint *norm = obj->faces[i].norm;
+			const GLint *tex  = obj->faces[i].tex;
+			int nv = obj->faces[i].nv;
+
+			// Inicia a face
+			glBegin(prim);
+			// Para todos os vrtices da face
+			for(int vf=0; vf<nv;++vf)
+			{
+				// Se houver normais definidas para cada vrtice,
+				// envia a normal correspondente
+				if(obj->normais_por_vertice)
+					glNormal3fv(&obj->normais[norm[vf]].x);
+
+				// Se houver uma textura associada...
+				if(texid!=-1)
+					// Envia as coordenadas associadas ao vrtice
+					glTexCoord2fv(&obj->texcoords[tex[vf]].s);
+				// Envia o vrtice em si
+				glVertex3fv(&obj->vertices[vert[vf]].x);
+			}
+			// Finaliza a face
+			glEnd();
+		} // fim da varredura de faces
+
+		// Salva a ltima texid utilizada
+		ult_texid = texid;
+	} // fim da varredura de lotes
+	
+	// Finalmente, desabilita as texturas
+	glDisable(GL_TEXTURE_2D);
+	// Restaura os atributos de iluminao e materiais
+	glPopAttrib();
+	// Se for uma nova display list...
+	if(obj->dlist >= 1000)
+	{
+		// Finaliza a display list
+		glEndList();
+		// E armazena a identificao correta
+		obj->dlist-=1000;
+	}
+}
+
+// Funo interna que inicia a medio do tempo de GPU de um desenho
+// (ver SetaPerfil), se houver consultas de tempo. Retorna a consulta
+// iniciada, ou 0
+GLuint _iniciaConsultaGPU()
+{
+	static int suporta = -1;
+	if(suporta < 0) suporta = _suportaGL(3,3,"GL_ARB_timer_query");
+	if(!suporta) return 0;
+	GLuint id;
+	if(_consultasLivres.empty()) glGenQueries(1, &id);
+	else
+	{
+		id = _consultasLivres.back();
+		_consultasLivres.pop_back();
+	}
+	glBeginQuery(GL_TIME_ELAPSED, id);
+	_consultasPendentes.push_back(make_pair(id,_totalQuadros));
+	return id;
+}
+
+// Desenha um objeto 3D passado como parmetro.
+void DesenhaObjeto(OBJ *obj)
+{
+	ZONA zona("desenho");
+	// No mede o tempo ao criar a display list
+	GLuint consulta = _perfil && obj->dlist < 1000 ? _iniciaConsultaGPU() : 0;
+	_desenhaObjeto(obj);
+	if(consulta) glEndQuery(GL_TIME_ELAPSED);
+}
+
+// Funo interna que desenha as instncias de um objeto uma a uma,
+// quando no h desenho por instncias na placa (ver
+// DesenhaInstancias). Com display list, as cores s valem para
+// objetos sem materiais, pois os materiais ficam gravados nela
+void _desenhaInstanciasCPU(OBJ *obj, const MATRIZ *matrizes, const GLfloat *cores, int num)
+{
+	glPushAttrib(GL_LIGHTING_BIT | GL_CURRENT_BIT | GL_TRANSFORM_BIT | GL_ENABLE_BIT);
+	glMatrixMode(GL_MODELVIEW);
+	// As matrizes das instncias podem ter escala
+	glEnable(GL_NORMALIZE);
+	for(int i=0; i<num; ++i)
+	{
+		if(cores != NULL)
+		{
+			// Para os materiais do objeto (ver _aplicaMaterial)...
+			_corInstancia = cores + i*4;
+			// ...e para os objetos sem materiais
+			glColor4fv(_corInstancia);
+			glMaterialfv(GL_FRONT,GL_AMBIENT,_corInstancia);
+			glMaterialfv(GL_FRONT,GL_DIFFUSE,_corInstancia);
+		}
+		glPushMatrix();
+		glMultMatrixf(matrizes[i].m);
+		DesenhaObjeto(obj);
+		glPopMatrix();
+	}
+	_corInstancia = NULL;
+	glPopAttrib();
+}
+
+// Desenha num cpias de um objeto 3D, cada uma transformada pela
+// sua matriz (aplicada antes da modelview corrente) e, se cores no
+// for NULL, com a sua cor RGBA (4 floats por instncia), que
+// substitui as cores ambiente e difusa dos materiais.
+// Com OpenGL 3.3, a malha do objeto (ver CriaMalha)  desenhada com
+// uma chamada a glDrawElementsInstanced por lote, e s as instncias
+// que mudaram desde o desenho anterior so reenviadas; a iluminao
+// fixa  reproduzida por um shader (observador no infinito, s a face
+// da frente, sem neblina e sem nveis de detalhe ou recorte).
+// Seno (ou se desativado em SetaInstanciamento), desenha o objeto
+// uma vez por instncia com DesenhaObjeto
+void DesenhaInstancias(OBJ *obj, const MATRIZ *matrizes, const GLfloat *cores, int num)
+{
+	if(obj == NULL || num <= 0) return;
+	if(!_preparaInstancias())
+	{
+		_desenhaInstanciasCPU(obj, matrizes, cores, num);
+		return;
+	}
+	ZONA zona("desenho");
+	// Envia para OpenGL as texturas cuja decodificao terminou
+	ProcessaTexturasPendentes(false);
+	if(obj->lotes == NULL && obj->numFaces)
+		AgrupaFaces(obj);
+	if(obj->malha == NULL && CriaMalha(obj) == NULL)
+		return;
+	_enviaInstancias(obj, matrizes, cores, num);
+	if(obj->capInstancias < num) return;
+
+	GLuint consulta = _perfil ? _iniciaConsultaGPU() : 0;
+	GLint progAnt;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &progAnt);
+	glUseProgram(_progInstancias);
+	// Vrtices quantizados: a escala e o deslocamento ficam no shader,
+	// pois precisam ser aplicados antes da matriz da instncia
+	QUANTMALHA *q = obj->malha->quant;
+	if(q != NULL)
+		glUniform4f(_locDeq, q->centro[0], q->centro[1], q->centro[2], q->escala);
+	else
+		glUniform4f(_locDeq, 0, 0, 0, 1);
+	glUniform1i(_locIluminacao, glIsEnabled(GL_LIGHTING));
+	// ndices das luzes ligadas
+	GLint luzes[8] = { 0 }, numLuzes = 0;
+	for(int i=0; i<8; ++i)
+		if(glIsEnabled(GL_LIGHT0+i)) luzes[numLuzes++] = i;
+	glUniform1i(_locNumLuzes, numLuzes);
+	glUniform1iv(_locLuzes, 8, luzes);
+	glUniform1i(_locUsaCor, cores != NULL);
+	// GL_COLOR_MATERIAL s vale para objetos sem materiais (ver
+	// _desenhaMalha)
+	GLint corMaterial = 0;
+	if(!obj->tem_materiais && glIsEnabled(GL_COLOR_MATERIAL))
+	{
+		GLint param;
+		glGetIntegerv(GL_COLOR_MATERIAL_PARAMETER, &param);
+		corMaterial = param == GL_AMBIENT ? 1 : param == GL_DIFFUSE ? 2
+			: param == GL_AMBIENT_AND_DIFFUSE ? 3 : param == GL_SPECULAR ? 4 : 5;
+	}
+	glUniform1i(_locCorMaterial, corMaterial);
+	_desenhaMalha(obj, 0, NULL, num);
+	glUseProgram(progAnt);
+	if(consulta) glEndQuery(GL_TIME_ELAPSED);
+}
+
+// Define se DesenhaInstancias pode usar o desenho por instncias
+// da placa (padro) ou se deve sempre desenhar as cpias uma a uma
+void SetaInstanciamento(bool usa)
+{
+	_instanciamento = usa;
+}
+
+// Funo interna para liberar a memria ocupada
+// por um objeto
+void _liberaObjeto(OBJ *obj)
+{
+	// Libera arrays
+	_liberaVetor(obj, obj->vertices);
+	_liberaVetor(obj, obj->normais);
+	_liberaVetor(obj, obj->texcoords);
+	// Se os ndices esto no formato compacto, basta
+	// liberar os vetores que os contm
+	if (obj->inicio_faces != NULL)
+	{
+		_liberaVetor(obj, obj->inicio_faces);
+		_liberaVetor(obj, obj->ind_vertices);
+		_liberaVetor(obj, obj->ind_normais);
+		_liberaVetor(obj, obj->ind_texcoords);
+	}
+	// Seno, para cada face...
+	else for(int i=0; i<obj->numFaces;++i)
+	{
+		// Libera as listas de vrtices da face
+		if (obj->faces[i].vert != NULL) free(obj->faces[i].vert);
+		// Libera as listas de normais da face
+		if (obj->faces[i].norm != NULL) free(obj->faces[i].norm);
+		// Libera as listas de texcoords da face
+		if (obj->faces[i].tex  != NULL) free(obj->faces[i].tex);
+	}
+	// Libera array de faces e os lotes
+	if (obj->faces != NULL) free(obj->faces);
+	if (obj->lotes != NULL) free(obj->lotes);
+	if (obj->blocos != NULL) free(obj->blocos);
+	// Libera os buffers e a malha, se houver
+	DesabilitaVBO(obj);
+	LiberaMalha(obj->malha);
+	LiberaBVH(obj->bvh);
+	// Libera o cache binrio, se houver
+	if (obj->cache != NULL)
+	{
+		ARQMEM arq = { obj->cache, obj->tam_cache, true };
+		_liberaArquivo(&arq);
+	}
+	// Finalmente, libera a estrutura principal
+	free(obj);
+}
+
+// Libera memria ocupada por um objeto 3D
+void LiberaObjeto(OBJ *obj)
+{
+	unsigned int o;
+	if(obj==NULL)	// se for NULL, libera todos os objetos
+	{
+		for(o=0;o<_objetos.size();++o)
+			_liberaObjeto(_objetos[o]);
+		_objetos.clear();
+	}
+	else
+	{
+		// Procura pelo objeto no vector
+		vector<OBJ*>::iterator it = _objetos.begin();
+		for(it = _objetos.begin(); it<_objetos.end(); ++it)
+			// e sai do loop quando encontrar
+			if(*it == obj)
+				break;
+		// Apaga do vector
+		_objetos.erase(it);
+		// E libera as estruturas internas
+		_liberaObjeto(obj);
+	}
+}
+
+// Libera memria ocupada pela lista de materiais e texturas
+void LiberaMateriais()
+{
+	unsigned int i;
+	// Termina as texturas que ainda esto sendo decodificadas
+	ProcessaTexturasPendentes(true);
+#ifdef DEBUG
+	printf("Total de materiais: %d\n",_materiais.size());
+#endif
+	// Para cada material
+	for(i=0;i<_materiais.size();++i)
+	{
+#ifdef DEBUG
+		printf("%s a: (%f,%f,%f,%f) - d: (%f,%f,%f,%f) - e: (%f,%f,%f,%f - %f)\n",_materiais[i]->nome,
+				_materiais[i]->ka[0],_materiais[i]->ka[1],_materiais[i]->ka[2], _materiais[i]->ka[3],
+				_materiais[i]->kd[0],_materiais[i]->kd[1],_materiais[i]->kd[2], _materiais[i]->kd[3],
+				_materiais[i]->ks[0],_materiais[i]->ks[1],_materiais[i]->ks[2], _materiais[i]->ks[3],
+				_materiais[i]->spec);
+#endif
+		// Libera material
+		free(_materiais[i]);
+	}
+	// Limpa lista (e os nomes)
+	_materiais.clear();
+	_indiceMateriais.clear();
+#ifdef DEBUG
+	printf("Total de texturas: %d\n",_texturas.size());
+#endif
+	// Para cada textura
+	for(i=0;i<_texturas.size();++i)
+	{
+		// Libera textura - no  necessrio liberar a imagem, pois esta j
+		// foi liberada durante a carga da textura - ver CarregaTextura
+#ifdef DEBUG
+		printf("%s: %d x %d (id: %d)\n",_texturas[i]->nome,_texturas[i]->dimx,
+				_texturas[i]->dimy,_texturas[i]->texid);
+#endif
+		free(_texturas[i]);
+	}
+	// Limpa lista (e os nomes)
+	_texturas.clear();
+	_indiceTexturas.clear();
+	// Libera o oramento de memria
+	_memoriaTexturas = 0;
+}
+
+// Nmero de tringulos processados de cada vez no clculo
+// vetorial das normais das faces
+#define BLOCO_NORMAIS 256
+
+// Funo interna que calcula a normal (no normalizada) de cada
+// face do objeto, nos vetores SoA nf. Polgonos so divididos em
+// um leque de tringulos a partir do primeiro vrtice, e a soma
+// das normais desses tringulos  a normal do polgono, com
+// tamanho igual ao dobro da sua rea (mesmo se for cncavo)
+void _normaisFaces(OBJ *obj, VETSOA nf)
+{
+	_executaIntervalos(obj->numFaces, 1024, [&](int ini, int fim) {
+		GLfloat buf[9][BLOCO_NORMAIS];
+		// Lados (b-a e c-a) de cada tringulo abc do bloco
+		VETSOA u = { buf[0], buf[1], buf[2] };
+		VETSOA w = { buf[3], buf[4], buf[5] };
+		VETSOA n = { buf[6], buf[7], buf[8] };
+		int dono[BLOCO_NORMAIS];	// face de cada tringulo do bloco
+		int num = 0;
+		// Calcula as normais do bloco e acumula nas faces
+		auto processa = [&]() {
+			ProdutoVetorialSoA(u,w,n,num);
+			for(int i=0; i<num; ++i)
+			{
+				nf.x[dono[i]] += n.x[i];
+				nf.y[dono[i]] += n.y[i];
+				nf.z[dono[i]] += n.z[i];
+			}
+			num = 0;
+		};
+		for(int f=ini; f<fim; ++f)
+		{
+			nf.x[f] = nf.y[f] = nf.z[f] = 0;
+			const GLint *v = &obj->ind_vertices[obj->inicio_faces[f]];
+			int nv = obj->inicio_faces[f+1] - obj->inicio_faces[f];
+			for(int k=1; k+1<nv; ++k)
+			{
+				// Ignora ndices invlidos
+				if((unsigned) v[0] >= (unsigned) obj->numVertices
+					|| (unsigned) v[k] >= (unsigned) obj->numVertices
+					|| (unsigned) v[k+1] >= (unsigned) obj->numVertices)
+					continue;
+				VERT &va = obj->vertices[v[0]];
+				VERT &vb = obj->vertices[v[k]];
+				VERT &vc = obj->vertices[v[k+1]];
+				u.x[num] = vb.x-va.x; u.y[num] = vb.y-va.y; u.z[num] = vb.z-va.z;
+				w.x[num] = vc.x-va.x; w.y[num] = vc.y-va.y; w.z[num] = vc.z-va.z;
+				dono[num] = f;
+				if(++num == BLOCO_NORMAIS) processa();
+			}
+		}
+		processa();
+	});
+}
+
+// Calcula as normais de um objeto 3D, substituindo as que ele j
+// tiver (lidas do arquivo ou calculadas antes). O modo pode ser:
+// 'f' - uma normal por face ("flat shading"), como em
+//       CalculaNormaisPorFace
+// 'a' - normais suaves por vrtice: mdia das normais das faces
+//       que compartilham o vrtice, ponderada pela rea de cada uma
+// 'g' - normais suaves por vrtice, ponderadas pelo ngulo de
+//       cada face no vrtice
+//
+// Nos modos suaves, s so combinadas as faces do mesmo grupo de
+// suavizao (comando s do arquivo .OBJ); as faces sem grupo
+// ("s off") ficam com a normal da prpria face. Se nenhuma face
+// do objeto tiver grupo, todas so suavizadas em conjunto.
+//
+// As normais das faces so calculadas em lotes com instrues
+// vetoriais (SSE/AVX2, se disponveis) e o restante do trabalho 
+// dividido entre as threads (ver SetaNumThreads). As faces so
+// convertidas para o formato compacto (ver CompactaFaces). Se o
+// objeto j tiver uma malha ou buffers, eles devem ser recriados.
+void CalculaNormais(OBJ *obj, char modo)
+{
+	int i;
+	if(obj == NULL || !obj->numFaces) return;
+	if(modo!='f' && modo!='a' && modo!='g') return;
+	CompactaFaces(obj);
+	if(obj->inicio_faces == NULL) return;
+	// Detecta as instrues disponveis antes de criar as threads
+	_obtemSIMD();
+
+	int numFaces = obj->numFaces;
+	vector<GLfloat> vnf(3*numFaces);
+	VETSOA nf = { &vnf[0], &vnf[numFaces], &vnf[2*numFaces] };
+	_normaisFaces(obj,nf);
+
+	// Uma normal por face: basta normalizar
+	if(modo == 'f')
+	{
+		VERT *normais = (VERT *) malloc(sizeof(VERT)*numFaces);
+		if(normais == NULL) return;
+		_executaIntervalos(numFaces, 1024, [&](int ini, int fim) {
+			VETSOA parte = { nf.x+ini, nf.y+ini, nf.z+ini };
+			NormalizaVetoresSoA(parte,fim-ini);
+			for(int f=ini; f<fim; ++f)
+			{
+				normais[f].x = nf.x[f];
+				normais[f].y = nf.y[f];
+				normais[f].z = nf.z[f];
+			}
+		});
+		_liberaVetor(obj,obj->normais);
+		_liberaVetor(obj,obj->ind_normais);
+		obj->normais = normais;
+		obj->ind_normais = NULL;
+		obj->numNormais = 0;
+		obj->normais_por_vertice = false;
+		_apontaFaces(obj);
+		return;
+	}
+
+	// Normais das faces normalizadas (usadas nas faces sem
+	// suavizao e na ponderao por ngulo)
+	vector<GLfloat> vnn(vnf);
+	VETSOA nn = { &vnn[0], &vnn[numFaces], &vnn[2*numFaces] };
+	_executaIntervalos(numFaces, 1024, [&](int ini, int fim) {
+		VETSOA parte = { nn.x+ini, nn.y+ini, nn.z+ini };
+		NormalizaVetoresSoA(parte,fim-ini);
+	});
+
+	// Grupo de suavizao efetivo de cada face (0 = sem suavizao)
+	bool usaGrupos = false;
+	for(i=0; i<numFaces && !usaGrupos; ++i)
+		usaGrupos = obj->faces[i].grupo != 0;
+	vector<GLint> grupo(numFaces,1);
+	if(usaGrupos)
+		for(i=0; i<numFaces; ++i)
+			grupo[i] = obj->faces[i].grupo;
+
+	// Face a que pertence cada "canto" (vrtice de uma face) e,
+	// no modo 'g', o ngulo da face nesse canto
+	int numCantos = obj->inicio_faces[numFaces];
+	const GLint *ind = obj->ind_vertices;
+	vector<GLint> faceCanto(numCantos);
+	vector<GLfloat> peso(modo == 'g' ? numCantos : 0);
+	_executaIntervalos(numFaces, 1024, [&](int ini, int fim) {
+		for(int f=ini; f<fim; ++f)
+		{
+			int ic = obj->inicio_faces[f];
+			int nv = obj->inicio_faces[f+1] - ic;
+			for(int k=0; k<nv; ++k)
+			{
+				faceCanto[ic+k] = f;
+				if(modo != 'g') continue;
+				GLint v = ind[ic+k], va = ind[ic+(k+nv-1)%nv], vp = ind[ic+(k+1)%nv];
+				peso[ic+k] = 0;
+				if((unsigned) v >= (unsigned) obj->numVertices
+					|| (unsigned) va >= (unsigned) obj->numVertices
+					|| (unsigned) vp >= (unsigned) obj->numVertices)
+					continue;
+				VERT &p = obj->vertices[v];
+				VERT e1 = { obj->vertices[va].x-p.x, obj->vertices[va].y-p.y, obj->vertices[va].z-p.z };
+				VERT e2 = { obj->vertices[vp].x-p.x, obj->vertices[vp].y-p.y, obj->vertices[vp].z-p.z };
+				float tam = sqrtf((e1.x*e1.x+e1.y*e1.y+e1.z*e1.z)*(e2.x*e2.x+e2.y*e2.y+e2.z*e2.z));
+				if(tam == 0) continue;
+				float cosang = (e1.x*e2.x+e1.y*e2.y+e1.z*e2.z) / tam;
+				if(cosang > 1) cosang = 1;
+				if(cosang < -1) cosang = -1;
+				peso[ic+k] = acosf(cosang);
+			}
+		}
+	});
+
+	// Lista dos cantos que usam cada vrtice, na ordem das faces
+	int numVertices = obj->numVertices;
+	vector<GLint> iniVert(numVertices+1,0), cantos(numCantos);
+	for(i=0; i<numCantos; ++i)
+		if((unsigned) ind[i] < (unsigned) numVertices)
+			iniVert[ind[i]+1]++;
+	for(i=0; i<numVertices; ++i)
+		iniVert[i+1] += iniVert[i];
+	{
+		vector<GLint> pos(iniVert.begin(),iniVert.end()-1);
+		for(i=0; i<numCantos; ++i)
+			if((unsigned) ind[i] < (unsigned) numVertices)
+				cantos[pos[ind[i]]++] = i;
+	}
+
+	// Informa se o canto c da lista do vrtice v  o primeiro com
+	// o seu grupo (ou seja, se inicia uma nova normal)
+	auto primeiro = [&](int v, int c) {
+		GLint g = grupo[faceCanto[cantos[c]]];
+		if(g == 0) return false;
+		for(int k=iniVert[v]; k<c; ++k)
+			if(grupo[faceCanto[cantos[k]]] == g) return false;
+		return true;
+	};
+
+	// Cada vrtice ter uma normal por grupo de suavizao das faces
+	// que o compartilham: conta-as para saber onde cada uma ficar
+	vector<GLint> iniNormal(numVertices+1,0);
+	_executaIntervalos(numVertices, 4096, [&](int ini, int fim) {
+		for(int v=ini; v<fim; ++v)
+			for(int c=iniVert[v]; c<iniVert[v+1]; ++c)
+				if(primeiro(v,c)) iniNormal[v+1]++;
+	});
+	for(i=0; i<numVertices; ++i)
+		iniNormal[i+1] += iniNormal[i];
+	// As faces sem suavizao ficam com uma normal s sua, aps as demais
+	vector<GLint> normalFace(numFaces,-1);
+	int numNormais = iniNormal[numVertices];
+	for(i=0; i<numFaces; ++i)
+		if(grupo[i] == 0) normalFace[i] = numNormais++;
+
+	VERT *normais = (VERT *) malloc(sizeof(VERT)*(numNormais ? numNormais : 1));
+	GLint *indNormais = (GLint *) malloc(sizeof(GLint)*numCantos);
+	if(normais == NULL || indNormais == NULL)
+	{
+		free(normais); free(indNormais);
+		return;
+	}
+
+	// Soma as normais das faces de cada grupo em cada vrtice
+	_executaIntervalos(numVertices, 4096, [&](int ini, int fim) {
+		for(int v=ini; v<fim; ++v)
+		{
+			int n = iniNormal[v];
+			for(int c=iniVert[v]; c<iniVert[v+1]; ++c)
+			{
+				if(!primeiro(v,c)) continue;
+				GLint g = grupo[faceCanto[cantos[c]]];
+				VERT soma = { 0, 0, 0 };
+				for(int k=c; k<iniVert[v+1]; ++k)
+				{
+					int f = faceCanto[cantos[k]];
+					if(grupo[f] != g) continue;
+					if(modo == 'a')
+					{
+						soma.x += nf.x[f];
+						soma.y += nf.y[f];
+						soma.z += nf.z[f];
+					}
+					else
+					{
+						float p = peso[cantos[k]];
+						soma.x += p*nn.x[f];
+						soma.y += p*nn.y[f];
+						soma.z += p*nn.z[f];
+					}
+					indNormais[cantos[k]] = n;
+				}
+				Normaliza(soma);
+				// Se as faces se anulam, usa a normal da primeira
+				if(soma.x == 0 && soma.y == 0 && soma.z == 0)
+				{
+					int f = faceCanto[cantos[c]];
+					soma.x = nn.x[f]; soma.y = nn.y[f]; soma.z = nn.z[f];
+				}
+				normais[n++] = soma;
+			}
+		}
+	});
+
+	// Faces sem suavizao e cantos com ndices invlidos
+	_executaIntervalos(numFaces, 1024, [&](int ini, int fim) {
+		for(int f=ini; f<fim; ++f)
+		{
+			if(normalFace[f] != -1)
+			{
+				normais[normalFace[f]].x = nn.x[f];
+				normais[normalFace[f]].y = nn.y[f];
+				normais[normalFace[f]].z = nn.z[f];
+			}
+			for(int c=obj->inicio_faces[f]; c<obj->inicio_faces[f+1]; ++c)
+				if(normalFace[f] != -1)
+					indNormais[c] = normalFace[f];
+				else if((unsigned) ind[c] >= (unsigned) numVertices)
+					indNormais[c] = -1;
+		}
+	});
+
+	_liberaVetor(obj,obj->normais);
+	_liberaVetor(obj,obj->ind_normais);
+	obj->normais = normais;
+	obj->ind_normais = indNormais;
+	obj->numNormais = numNormais;
+	obj->normais_por_vertice = true;
+	_apontaFaces(obj);
+}
+
+// Funo interna que transforma os tringulos de uma BVH e recalcula
+// as caixas dos seus ns, mantendo a hierarquia. Como os filhos vm
+// sempre depois do pai, basta percorrer os ns de trs para frente
+void _ajustaBVH(BVH *bvh, MATRIZ &m)
+{
+	TransformaVetores(m,bvh->triangulos,bvh->numTriangulos*3);
+	for(int i=bvh->numNos-1; i>=0; --i)
+	{
+		NOBVH &no = bvh->nos[i];
+		int e;
+		if(no.num)
+		{
+			for(e=0; e<3; ++e)
+			{
+				no.min[e] = FLT_MAX;
+				no.max[e] = -FLT_MAX;
+			}
+			for(int t=no.inicio*3; t<(no.inicio+no.num)*3; ++t)
+			{
+				const float *v = &bvh->triangulos[t].x;
+				for(e=0; e<3; ++e)
+				{
+					no.min[e] = min(no.min[e],v[e]);
+					no.max[e] = max(no.max[e],v[e]);
+				}
+			}
+		}
+		else
+		{
+			const NOBVH &a = bvh->nos[i+1], &b = bvh->nos[no.inicio];
+			for(e=0; e<3; ++e)
+			{
+				no.min[e] = min(a.min[e],b.min[e]);
+				no.max[e] = max(a.max[e],b.max[e]);
+			}
+		}
+	}
+}
+
+// Funo interna que aplica aos vrtices da malha de um objeto as
+// matrizes m (posies) e mn (normais - ver TransformaObjeto). Os
+// nveis de detalhe e as posies dos blocos continuam vlidos, e
+// os erros dos nveis acompanham a maior escala de m. Uma malha
+// quantizada no tem mais os vrtices originais, e  recriada com
+// os seus nveis
+void _transformaMalha(OBJ *obj, MATRIZ &m, MATRIZ &mn)
+{
+	MALHA *malha = obj->malha;
+	if(malha->quant != NULL)
+	{
+		_recriaMalha(obj);
+		return;
+	}
+	const float *a = m.m, *b = mn.m;
+	_executaIntervalos(malha->numVertices, 4096, [&](int ini, int fim) {
+		for(int i=ini; i<fim; ++i)
+		{
+			GLfloat *p = malha->vertices[i].pos, *n = malha->vertices[i].normal;
+			float x = p[0], y = p[1], z = p[2];
+			p[0] = a[0]*x + a[4]*y + a[8]*z + a[12];
+			p[1] = a[1]*x + a[5]*y + a[9]*z + a[13];
+			p[2] = a[2]*x + a[6]*y + a[10]*z + a[14];
+			if(!malha->tem_normais) continue;
+			x = n[0]; y = n[1]; z = n[2];
+			n[0] = b[0]*x + b[4]*y + b[8]*z;
+			n[1] = b[1]*x + b[5]*y + b[9]*z;
+			n[2] = b[2]*x + b[6]*y + b[10]*z;
+			float tam = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+			if(tam > 0)
+			{
+				n[0] /= tam; n[1] /= tam; n[2] /= tam;
+			}
+		}
+	});
+	float esc = 0;
+	for(int c=0; c<3; ++c)
+		esc = max(esc, a[c*4]*a[c*4] + a[c*4+1]*a[c*4+1] + a[c*4+2]*a[c*4+2]);
+	esc = sqrt(esc);
+	for(int n=0; n<malha->numNiveis; ++n)
+		malha->niveis[n].erro *= esc;
+	if(obj->vbo) _criaVBO(obj);
+}
+
+// Aplica a matriz de transformao m a todos os vrtices de um
+// objeto 3D, em uma nica passagem. As normais (por vrtice ou por
+// face) so transformadas pela inversa transposta da parte 3x3 de
+// m, o que as mantm perpendiculares s faces mesmo com escalas no
+// uniformes, e depois normalizadas. O trabalho  dividido entre as
+// threads (ver SetaNumThreads) e usa instrues vetoriais. As caixas
+// e a esfera envolventes do objeto e dos seus blocos so recalculadas.
+//
+// Se m espelhar o objeto (determinante negativo), a orientao dos
+// vrtices das faces se inverte. A malha, se houver, tambm 
+// transformada (ver _transformaMalha), e os buffers e a display list
+// so recriados; a BVH, se houver, tem os seus tringulos
+// transformados e as caixas dos ns ajustadas (o que  bem mais
+// rpido do que recri-la, mas pode torn-la menos eficiente se m
+// distorcer muito o objeto).
+void TransformaObjeto(OBJ *obj, MATRIZ &m)
+{
+	if(obj == NULL) return;
+	// Detecta as instrues disponveis antes de criar as threads
+	_obtemSIMD();
+	_executaIntervalos(obj->numVertices, 4096, [&](int ini, int fim) {
+		TransformaVetores(m,&obj->vertices[ini],fim-ini);
+	});
+	// Atualiza os limites do objeto e dos seus blocos
+	_calculaLimites(obj);
+	if(obj->numBlocos) _limitesBlocos(obj);
+	if(obj->bvh != NULL) _ajustaBVH(obj->bvh,m);
+
+	int numNormais = obj->normais_por_vertice ? obj->numNormais : obj->numFaces;
+	if(obj->normais == NULL) numNormais = 0;
+	// Inversa transposta da parte 3x3, a menos de um fator de escala
+	// (que desaparece ao normalizar): as suas linhas so os produtos
+	// vetoriais das linhas da matriz original
+	VERT lin[3], cof[3];
+	for(int i=0; i<3; ++i)
+	{
+		lin[i].x = m.m[i];
+		lin[i].y = m.m[4+i];
+		lin[i].z = m.m[8+i];
+	}
+	ProdutoVetorial(lin[1],lin[2],cof[0]);
+	ProdutoVetorial(lin[2],lin[0],cof[1]);
+	ProdutoVetorial(lin[0],lin[1],cof[2]);
+	// Se o determinante for negativo, o fator tambm 
+	float sinal = lin[0].x*cof[0].x + lin[0].y*cof[0].y + lin[0].z*cof[0].z < 0 ? -1 : 1;
+	MATRIZ mn;
+	MatrizIdentidade(mn);
+	for(int i=0; i<3; ++i)
+	{
+		mn.m[i]   = sinal*cof[i].x;
+		mn.m[4+i] = sinal*cof[i].y;
+		mn.m[8+i] = sinal*cof[i].z;
+	}
+	_executaIntervalos(numNormais, 4096, [&](int ini, int fim) {
+		TransformaVetores(mn,&obj->normais[ini],fim-ini);
+		NormalizaVetores(&obj->normais[ini],fim-ini);
+	});
+
+	if(obj->malha != NULL) _transformaMalha(obj,m,mn);
+	// A display list, se houver,  compilada novamente no prximo
+	// desenho (ver _criaDList)
+	if(obj->dlist > -1 && obj->dlist < 1000) obj->dlist += 1000;
+}
+
+// Calcula o vetor normal de cada face de um objeto 3D
+// (ver CalculaNormais).
+void CalculaNormaisPorFace(OBJ *obj)
+{
+	// Retorna se o objeto j possui normais por vrtice
+	if(obj->normais_por_vertice) return;
+	CalculaNormais(obj,'f');
+}
+
+// Funo interna que calcula o vetor normal (no normalizado) de
+// um polgono pelo mtodo de Newell, que funciona tambm para
+// polgonos cncavos ou no exatamente planos
+void _normalNewell(OBJ *obj, const GLint *vert, int nv, VERT &n)
+{
+	n.x = n.y = n.z = 0;
+	for(int i=0; i<nv; ++i)
+	{
+		VERT &a = obj->vertices[vert[i]];
+		VERT &b = obj->vertices[vert[(i+1)%nv]];
+		n.x += (a.y - b.y) * (a.z + b.z);
+		n.y += (a.z - b.z) * (a.x + b.x);
+		n.z += (a.x - b.x) * (a.y + b.y);
+	}
+}
+
+// Funo interna que divide uma face em tringulos, devolvendo em
+// tri as posies (0..nv-1) dos vrtices de cada tringulo.
+// Tringulos so mantidos e os demais polgonos so divididos por
+// "ear clipping", projetando-os no plano em que tm maior rea -
+// se o polgono for degenerado, recorre a um leque a partir do
+// primeiro vrtice. Retorna o nmero de tringulos gerados.
+int _triangulaFace(OBJ *obj, const GLint *vert, int nv, vector<int> &tri)
+{
+	tri.clear();
+	if(nv < 3) return 0;
+	if(nv == 3)
+	{
+		tri.push_back(0); tri.push_back(1); tri.push_back(2);
+		return 1;
+	}
+	// Escolhe os eixos de projeo a partir da normal
+	VERT n;
+	_normalNewell(obj,vert,nv,n);
+	float ax = fabs(n.x), ay = fabs(n.y), az = fabs(n.z);
+	int e1, e2;		// eixos usados (0=x, 1=y, 2=z)
+	float sinal;	// orientao do polgono no plano projetado
+	if(az >= ax && az >= ay) { e1 = 0; e2 = 1; sinal = n.z; }
+	else if(ax >= ay)        { e1 = 1; e2 = 2; sinal = n.x; }
+	else                     { e1 = 2; e2 = 0; sinal = n.y; }
+	vector<float> px(nv), py(nv);
+	for(int i=0; i<nv; ++i)
+	{
+		const GLfloat *c = &obj->vertices[vert[i]].x;
+		px[i] = c[e1];
+		py[i] = sinal < 0 ? -c[e2] : c[e2];
+	}
+	// Lista dos vrtices ainda no removidos
+	vector<int> resta(nv);
+	for(int i=0; i<nv; ++i) resta[i] = i;
+	int tentativas = 0;
+	int i = 0;
+	while(resta.size() > 3 && tentativas < (int) resta.size())
+	{
+		int m = resta.size();
+		int a = resta[(i+m-1)%m], b = resta[i%m], c = resta[(i+1)%m];
+		// O vrtice b  convexo ?
+		float cruz = (px[b]-px[a])*(py[c]-py[a]) - (py[b]-py[a])*(px[c]-px[a]);
+		bool orelha = cruz > 0;
+		// Nenhum outro vrtice pode estar dentro do tringulo abc
+		for(int k=0; orelha && k<m; ++k)
+		{
+			int p = resta[k];
+			if(p==a || p==b || p==c) continue;
+			float d1 = (px[b]-px[a])*(py[p]-py[a]) - (py[b]-py[a])*(px[p]-px[a]);
+			float d2 = (px[c]-px[b])*(py[p]-py[b]) - (py[c]-py[b])*(px[p]-px[b]);
+			float d3 = (px[a]-px[c])*(py[p]-py[c]) - (py[a]-py[c])*(px[p]-px[c]);
+			if(d1 >= 0 && d2 >= 0 && d3 >= 0) orelha = false;
+		}
+		if(orelha)
+		{
+			tri.push_back(a); tri.push_back(b); tri.push_back(c);
+			resta.erase(resta.begin() + i%m);
+			tentativas = 0;
+		}
+		else
+		{
+			++i;
+			++tentativas;
+		}
+	}
+	if(resta.size() == 3)
+	{
+		tri.push_back(resta[0]); tri.push_back(resta[1]); tri.push_back(resta[2]);
+		return tri.size()/3;
+	}
+	// Polgono degenerado: usa um leque
+	tri.clear();
+	for(int k=1; k<nv-1; ++k)
+	{
+		tri.push_back(0); tri.push_back(k); tri.push_back(k+1);
+	}
+	return nv-2;
+}
+
+// Entrada da tabela hash usada para unificar as combinaes
+// (vrtice, texcoord, normal) repetidas na criao de uma malha
+typedef struct {
+	GLint v, t, n;	// ndices no OBJ (v = -1 indica entrada livre)
+	GLuint ind;		// ndice do vrtice correspondente na malha
+} ENTRADAHASH;
+
+// Funo interna que calcula o hash de uma combinao (v,t,n)
+inline unsigned int _hashVTN(GLint v, GLint t, GLint n)
+{
+	unsigned int h = (unsigned int) v * 0x9E3779B1u;
+	h ^= (unsigned int) t * 0x85EBCA77u + (h << 6) + (h >> 2);
+	h ^= (unsigned int) n * 0xC2B2AE3Du + (h << 6) + (h >> 2);
+	return h ^ (h >> 15);
+}
+
+// Libera a memria ocupada por uma malha (as malhas associadas
+// a objetos so liberadas automaticamente junto com eles)
+void LiberaMalha(MALHA *malha)
+{
+	if(malha == NULL) return;
+	if(malha->vertices != NULL) free(malha->vertices);
+	if(malha->indices != NULL)  free(malha->indices);
+	if(malha->lotes != NULL)    free(malha->lotes);
+	for(int i=0; i<malha->numNiveis; ++i)
+		free(malha->niveis[i].lotes);
+	if(malha->niveis != NULL)   free(malha->niveis);
+	if(malha->quant != NULL)
+	{
+		free(malha->quant->vertices);
+		free(malha->quant);
+	}
+	free(malha);
+}
+
+// Cria, a partir de um objeto j carregado, uma malha apropriada
+// para desenho indexado: as faces so divididas em tringulos e
+// cada combinao distinta de (vrtice, texcoord, normal) usada
+// nas faces torna-se um nico vrtice, com os atributos
+// intercalados. Os ndices tm 16 bits se houver no mximo 65535
+// vrtices, ou 32 bits caso contrrio. Os tringulos so agrupados
+// em lotes de faces consecutivas com o mesmo material e textura.
+//
+// Se o objeto no possuir normais por vrtice, so utilizadas as
+// normais por face (ver CalculaNormaisPorFace), se houver.
+//
+// A malha fica associada ao objeto (obj->malha), substituindo a
+// anterior, e deve ser recriada se o objeto for alterado. Se as
+// faces estiverem divididas em blocos (ver CriaBlocos), registra
+// tambm a posio dos ndices de cada bloco.
+MALHA *CriaMalha(OBJ *obj)
+{
+	int i, j;
+	MALHA *malha;
+
+	if(obj == NULL) return NULL;
+	if((malha = (MALHA *) malloc(sizeof(MALHA))) == NULL)
+		return NULL;
+
+	// Tabela hash com pelo menos o dobro de posies do que o
+	// nmero de cantos das faces
+	int cantos = 0;
+	for(i=0; i<obj->numFaces; ++i)
+		cantos += obj->faces[i].nv;
+	unsigned int tamHash = 1024;
+	while(tamHash < (unsigned int) cantos*2) tamHash *= 2;
+	ENTRADAHASH *hash = (ENTRADAHASH *) malloc(sizeof(ENTRADAHASH)*tamHash);
+	if(hash == NULL)
+	{
+		free(malha);
+		return NULL;
+	}
+	for(unsigned int h=0; h<tamHash; ++h) hash[h].v = -1;
+
+	// Normais por face, se no houver por vrtice
+	bool normalFace = !obj->normais_por_vertice && obj->normais != NULL;
+
+	_Vetor<VERTMALHA> vertices;
+	_Vetor<GLuint> indices;
+	_Vetor<LOTE> lotes;
+	vector<int> tri;
+	// ndice na malha de cada vrtice da face corrente
+	vector<GLuint> indFace;
+	// Bloco corrente (ver CriaBlocos)
+	int b = 0;
+	for(i=0; i<obj->numFaces; ++i)
+	{
+		FACE &face = obj->faces[i];
+		if(b < obj->numBlocos && i == obj->blocos[b].inicio)
+			obj->blocos[b].indInicio = indices.num;
+		// Inicia um novo lote se o material ou a textura mudarem
+		if(!lotes.num || lotes.dados[lotes.num-1].mat != face.mat
+			|| lotes.dados[lotes.num-1].texid != face.texid)
+		{
+			LOTE *lote = lotes.novo();
+			lote->mat = face.mat;
+			lote->texid = face.texid;
+			lote->inicio = indices.num;
+			lote->num = 0;
+		}
+		// Obtm (ou cria) o vrtice da malha para cada canto
+		indFace.resize(face.nv);
+		for(j=0; j<face.nv; ++j)
+		{
+			GLint v = face.vert[j];
+			GLint t = face.tex != NULL ? face.tex[j] : -1;
+			GLint n = normalFace ? i : (face.norm != NULL ? face.norm[j] : -1);
+			unsigned int h = _hashVTN(v,t,n) & (tamHash-1);
+			while(hash[h].v != -1 && (hash[h].v != v || hash[h].t != t || hash[h].n != n))
+				h = (h+1) & (tamHash-1);
+			if(hash[h].v == -1)
+			{
+				// Nova combinao: cria o vrtice
+				hash[h].v = v; hash[h].t = t; hash[h].n = n;
+				hash[h].ind = vertices.num;
+				VERTMALHA *vm = vertices.novo();
+				memcpy(vm->pos,&obj->vertices[v].x,sizeof(vm->pos));
+				if(n != -1)
+					memcpy(vm->normal,&obj->normais[n].x,sizeof(vm->normal));
+				else
+					vm->normal[0] = vm->normal[1] = vm->normal[2] = 0;
+				if(t != -1)
+				{
+					vm->tex[0] = obj->texcoords[t].s;
+					vm->tex[1] = obj->texcoords[t].t;
+				}
+				else vm->tex[0] = vm->tex[1] = 0;
+			}
+			indFace[j] = hash[h].ind;
+		}
+		// Divide a face em tringulos
+		int ntri = _triangulaFace(obj,face.vert,face.nv,tri);
+		for(j=0; j<ntri*3; ++j)
+			indices.adiciona(indFace[tri[j]]);
+		lotes.dados[lotes.num-1].num += ntri*3;
+		// Final do bloco: registra os seus ndices
+		if(b < obj->numBlocos && i == obj->blocos[b].inicio + obj->blocos[b].num - 1)
+		{
+			obj->blocos[b].indNum = indices.num - obj->blocos[b].indInicio;
+			++b;
+		}
+	}
+	free(hash);
+
+	malha->tem_normais = normalFace || obj->ind_normais != NULL;
+	if(obj->ind_normais == NULL && obj->inicio_faces == NULL)
+		for(i=0; i<obj->numFaces && !malha->tem_normais; ++i)
+			malha->tem_normais = obj->faces[i].norm != NULL;
+	malha->tem_texcoords = obj->ind_texcoords != NULL;
+	if(obj->inicio_faces == NULL)
+		for(i=0; i<obj->numFaces && !malha->tem_texcoords; ++i)
+			malha->tem_texcoords = obj->faces[i].tex != NULL;
+	malha->numVertices = vertices.num;
+	malha->numIndices  = indices.num;
+	malha->numLotes    = lotes.num;
+	malha->numNiveis   = 0;
+	malha->niveis      = NULL;
+	malha->reducao     = 0;
+	malha->quant       = NULL;
+	malha->vertices    = vertices.entrega();
+	malha->lotes       = lotes.entrega();
+	// Usa ndices de 16 bits sempre que possvel
+	if(malha->numVertices <= 65535)
+	{
+		malha->tipoIndice = GL_UNSIGNED_SHORT;
+		GLushort *ind16 = (GLushort *) malloc(sizeof(GLushort)*(indices.num ? indices.num : 1));
+		if(ind16 == NULL)
+		{
+			free(malha->vertices);
+			free(malha->lotes);
+			free(malha);
+			return NULL;
+		}
+		for(j=0; j<indices.num; ++j)
+			ind16[j] = (GLushort) indices.dados[j];
+		malha->indices = ind16;
+	}
+	else
+	{
+		malha->tipoIndice = GL_UNSIGNED_INT;
+		malha->indices = indices.entrega();
+	}
+#ifdef DEBUG
+	printf("Malha: %d vertices, %d triangulos, %d lotes (indices de %d bits)\n",
+		malha->numVertices, malha->numIndices/3, malha->numLotes,
+		malha->tipoIndice == GL_UNSIGNED_SHORT ? 16 : 32);
+#endif
+	// Associa ao objeto
+	if(obj->malha != NULL) LiberaMalha(obj->malha);
+	obj->malha = malha;
+	return malha;
+}
+
+// Qudrica de erro (matriz 4x4 simtrica, armazenada como os 10
+// elementos do tringulo superior): soma dos quadrados das
+// distncias de um ponto a um conjunto de planos
+typedef struct {
+	double a[10];
+} QUADRICA;
+
+// Funo interna que acumula em q a qudrica do plano
+// nx*x + ny*y + nz*z + d = 0 (com a normal unitria)
+void _somaPlano(QUADRICA &q, double nx, double ny, double nz, double d)
+{
+	q.a[0] += nx*nx; q.a[1] += nx*ny; q.a[2] += nx*nz; q.a[3] += nx*d;
+	q.a[4] += ny*ny; q.a[5] += ny*nz; q.a[6] += ny*d;
+	q.a[7] += nz*nz; q.a[8] += nz*d;
+	q.a[9] += d*d;
+}
+
+// Funo interna que avalia a qudrica q1+q2 no ponto p
+double _avaliaQuadricas(const QUADRICA &q1, const QUADRICA &q2, const float *p)
+{
+	double a[10];
+	for(int i=0; i<10; ++i) a[i] = q1.a[i] + q2.a[i];
+	double x = p[0], y = p[1], z = p[2];
+	double erro = a[0]*x*x + 2*a[1]*x*y + 2*a[2]*x*z + 2*a[3]*x
+		+ a[4]*y*y + 2*a[5]*y*z + 2*a[6]*y
+		+ a[7]*z*z + 2*a[8]*z + a[9];
+	return erro > 0 ? erro : 0;
+}
+
+// Funo interna que calcula a normal (no normalizada) do
+// tringulo abc
+inline void _normalTriangulo(const float *a, const float *b, const float *c, double *n)
+{
+	double u[3] = { b[0]-a[0], b[1]-a[1], b[2]-a[2] };
+	double v[3] = { c[0]-a[0], c[1]-a[1], c[2]-a[2] };
+	n[0] = u[1]*v[2] - u[2]*v[1];
+	n[1] = u[2]*v[0] - u[0]*v[2];
+	n[2] = u[0]*v[1] - u[1]*v[0];
+}
+
+// Colapso de aresta candidato: o vrtice de > para o vrtice para
+// (verses dos dois quando o custo foi calculado)
+typedef struct {
+	float custo;
+	int de, para;
+	int verDe, verPara;
+} COLAPSO;
+
+// Ordena os colapsos do menor para o maior custo
+struct _ComparaColapso {
+	bool operator()(const COLAPSO &c1, const COLAPSO &c2) const { return c1.custo > c2.custo; }
+};
+
+// Gera para a malha do objeto (criada se ainda no existir) uma
+// sequncia de at numNiveis nveis de detalhe, cada um com
+// aproximadamente reducao vezes os tringulos do anterior. A malha
+//  simplificada pelo colapso de arestas de menor erro quadrtico
+// (qudricas de Garland e Heckbert): cada nvel  apenas um novo
+// conjunto de ndices sobre os mesmos vrtices da malha.
+//
+// Vrtices em costuras de textura (com mais de uma texcoord), na
+// fronteira entre lotes (material ou textura) e na borda de
+// superfcies abertas nunca so removidos, o que preserva o
+// mapeamento das texturas e os limites dos materiais.
+//
+// Retorna o nmero de nveis gerados (os nveis so escolhidos
+// no desenho conforme SetaNivelDetalhe). Se o objeto j tiver
+// buffers, eles so recriados
+int CriaNiveisDetalhe(OBJ *obj, int numNiveis, float reducao)
+{
+	int i, j, k;
+	if(obj == NULL || numNiveis < 1 || reducao <= 0 || reducao >= 1) return 0;
+	if(obj->malha == NULL && CriaMalha(obj) == NULL) return 0;
+	MALHA *malha = obj->malha;
+	// Os vrtices originais so necessrios (ver QuantizaMalha)
+	if(malha->quant != NULL) return 0;
+	// Descarta os nveis anteriores
+	for(i=0; i<malha->numNiveis; ++i)
+		free(malha->niveis[i].lotes);
+	free(malha->niveis);
+	malha->niveis = NULL;
+	malha->numNiveis = 0;
+
+	// ndices da malha original (os nveis anteriores ficam no final)
+	int numInd = 0;
+	for(i=0; i<malha->numLotes; ++i)
+		numInd = max(numInd, malha->lotes[i].inicio + malha->lotes[i].num);
+	vector<GLuint> indices(numInd);
+	for(i=0; i<numInd; ++i)
+		indices[i] = malha->tipoIndice == GL_UNSIGNED_SHORT ?
+			((GLushort *) malha->indices)[i] : ((GLuint *) malha->indices)[i];
+
+	// Unifica os vrtices da malha com a mesma posio (que diferem
+	// apenas na normal ou na texcoord)
+	int nv = malha->numVertices;
+	vector<int> posVert(nv);
+	vector<float> pos;
+	unordered_map<string,int> mapaPos;
+	for(i=0; i<nv; ++i)
+	{
+		string chave((const char *) malha->vertices[i].pos, sizeof(malha->vertices[i].pos));
+		pair<unordered_map<string,int>::iterator,bool> res =
+			mapaPos.insert(make_pair(chave,(int) pos.size()/3));
+		if(res.second)
+			pos.insert(pos.end(), malha->vertices[i].pos, malha->vertices[i].pos+3);
+		posVert[i] = res.first->second;
+	}
+	int np = pos.size()/3;
+	// Vrtices da malha em cada posio
+	vector<int> iniPos(np+1,0), vertPos(nv);
+	for(i=0; i<nv; ++i) iniPos[posVert[i]+1]++;
+	for(i=0; i<np; ++i) iniPos[i+1] += iniPos[i];
+	{
+		vector<int> preenche(iniPos.begin(), iniPos.end()-1);
+		for(i=0; i<nv; ++i) vertPos[preenche[posVert[i]]++] = i;
+	}
+
+	// Tringulos sobre as posies, com o lote de cada um
+	int nt = numInd/3;
+	vector<int> tri(numInd), loteTri(nt);
+	vector<char> viva(nt,1);
+	for(int l=0; l<malha->numLotes; ++l)
+		for(i=malha->lotes[l].inicio/3; i<(malha->lotes[l].inicio+malha->lotes[l].num)/3; ++i)
+			loteTri[i] = l;
+	for(i=0; i<numInd; ++i) tri[i] = posVert[indices[i]];
+
+	// Qudricas, tringulos de cada posio e vrtices bloqueados
+	vector<QUADRICA> quad(np);
+	memset(quad.data(),0,sizeof(QUADRICA)*np);
+	vector<vector<int> > trisPos(np);
+	vector<char> bloqueado(np,0);
+	vector<int> lotePos(np,-1);
+	unordered_map<long long,int> arestas;
+	int vivas = 0;
+	for(i=0; i<nt; ++i)
+	{
+		int *t = &tri[i*3];
+		if(t[0]==t[1] || t[1]==t[2] || t[0]==t[2]) { viva[i] = 0; continue; }
+		++vivas;
+		double n[3];
+		_normalTriangulo(&pos[t[0]*3],&pos[t[1]*3],&pos[t[2]*3],n);
+		double tam = sqrt(n[0]*n[0]+n[1]*n[1]+n[2]*n[2]);
+		for(j=0; j<3; ++j)
+		{
+			int p = t[j];
+			trisPos[p].push_back(i);
+			if(tam > 0)
+				_somaPlano(quad[p],n[0]/tam,n[1]/tam,n[2]/tam,
+					-(n[0]*pos[p*3]+n[1]*pos[p*3+1]+n[2]*pos[p*3+2])/tam);
+			// Fronteira entre lotes
+			if(lotePos[p] == -1) lotePos[p] = loteTri[i];
+			else if(lotePos[p] != loteTri[i]) bloqueado[p] = 1;
+			int a = min(p,t[(j+1)%3]), b = max(p,t[(j+1)%3]);
+			arestas[(long long) a*np + b]++;
+		}
+	}
+	// Borda de superfcies abertas (arestas com um s tringulo)
+	for(unordered_map<long long,int>::iterator it=arestas.begin(); it!=arestas.end(); ++it)
+		if(it->second == 1)
+			bloqueado[it->first / np] = bloqueado[it->first % np] = 1;
+	// Costuras de textura (apenas entre os vrtices usados
+	// por tringulos texturizados)
+	if(malha->tem_texcoords)
+	{
+		vector<char> texturizado(nv,0);
+		for(i=0; i<numInd; ++i)
+			if(obj->textura != -1 || malha->lotes[loteTri[i/3]].texid != -1)
+				texturizado[indices[i]] = 1;
+		for(i=0; i<np; ++i)
+		{
+			const GLfloat *t0 = NULL;
+			for(j=iniPos[i]; j<iniPos[i+1] && !bloqueado[i]; ++j)
+			{
+				if(!texturizado[vertPos[j]]) continue;
+				const GLfloat *t1 = malha->vertices[vertPos[j]].tex;
+				if(t0 == NULL) t0 = t1;
+				else if(t0[0] != t1[0] || t0[1] != t1[1]) bloqueado[i] = 1;
+			}
+		}
+	}
+
+	// Destino de cada posio removida (-1 se continua na malha)
+	vector<int> destino(np,-1), versao(np,0);
+	priority_queue<COLAPSO, vector<COLAPSO>, _ComparaColapso> fila;
+	// Calcula o melhor sentido para colapsar a aresta (a,b) e
+	// coloca-o na fila
+	auto empilha = [&](int a, int b) {
+		COLAPSO c;
+		c.custo = -1;
+		if(!bloqueado[a])
+		{
+			c.custo = _avaliaQuadricas(quad[a],quad[b],&pos[b*3]);
+			c.de = a; c.para = b;
+		}
+		if(!bloqueado[b])
+		{
+			float custo = _avaliaQuadricas(quad[a],quad[b],&pos[a*3]);
+			if(c.custo < 0 || custo < c.custo)
+			{
+				c.custo = custo;
+				c.de = b; c.para = a;
+			}
+		}
+		if(c.custo < 0) return;
+		c.verDe = versao[c.de];
+		c.verPara = versao[c.para];
+		fila.push(c);
+	};
+	for(unordered_map<long long,int>::iterator it=arestas.begin(); it!=arestas.end(); ++it)
+		empilha(it->first / np, it->first % np);
+	arestas.clear();
+
+	vector<GLuint> novos;			// ndices dos nveis
+	vector<NIVELMALHA> niveis;
+	vector<int> remapeia(nv);
+	vector<int> vizinhos;
+	float erroMax = 0;
+	int alvo = vivas;
+	int ultimo = vivas;			// tringulos do ltimo nvel gerado
+	while((int) niveis.size() < numNiveis)
+	{
+		alvo = (int) (alvo * reducao);
+		while(vivas > alvo && !fila.empty())
+		{
+			COLAPSO c = fila.top();
+			fila.pop();
+			int a = c.de, b = c.para;
+			if(destino[a] != -1 || destino[b] != -1
+				|| versao[a] != c.verDe || versao[b] != c.verPara)
+				continue;
+			// Rejeita o colapso se algum tringulo for invertido
+			bool inverte = false;
+			for(k=0; k<(int) trisPos[a].size() && !inverte; ++k)
+			{
+				int t = trisPos[a][k];
+				int *v = &tri[t*3];
+				if(!viva[t] || v[0]==b || v[1]==b || v[2]==b) continue;
+				const float *p[3], *q[3];
+				for(j=0; j<3; ++j)
+				{
+					p[j] = &pos[v[j]*3];
+					q[j] = v[j]==a ? &pos[b*3] : p[j];
+				}
+				double n0[3], n1[3];
+				_normalTriangulo(p[0],p[1],p[2],n0);
+				_normalTriangulo(q[0],q[1],q[2],n1);
+				inverte = n0[0]*n1[0] + n0[1]*n1[1] + n0[2]*n1[2] <= 0;
+			}
+			if(inverte) continue;
+			// Efetua o colapso: os tringulos da aresta desaparecem
+			// e os demais passam a usar b
+			erroMax = max(erroMax, c.custo);
+			destino[a] = b;
+			for(j=0; j<10; ++j) quad[b].a[j] += quad[a].a[j];
+			for(k=0; k<(int) trisPos[a].size(); ++k)
+			{
+				int t = trisPos[a][k];
+				if(!viva[t]) continue;
+				int *v = &tri[t*3];
+				if(v[0]==b || v[1]==b || v[2]==b)
+				{
+					viva[t] = 0;
+					--vivas;
+					continue;
+				}
+				for(j=0; j<3; ++j) if(v[j]==a) v[j] = b;
+				trisPos[b].push_back(t);
+			}
+			trisPos[a].clear();
+			// Recalcula os custos das arestas de b
+			versao[b]++;
+			vizinhos.clear();
+			int livre = 0;
+			for(k=0; k<(int) trisPos[b].size(); ++k)
+			{
+				int t = trisPos[b][k];
+				if(!viva[t]) continue;
+				trisPos[b][livre++] = t;
+				for(j=0; j<3; ++j)
+					if(tri[t*3+j] != b) vizinhos.push_back(tri[t*3+j]);
+			}
+			trisPos[b].resize(livre);
+			sort(vizinhos.begin(), vizinhos.end());
+			vizinhos.erase(unique(vizinhos.begin(), vizinhos.end()), vizinhos.end());
+			for(k=0; k<(int) vizinhos.size(); ++k)
+				empilha(vizinhos[k],b);
+		}
+		// No h mais o que simplificar
+		if(vivas > ultimo * 0.9f) break;
+		ultimo = vivas;
+
+		// ndices do nvel: cada canto usa, entre os vrtices da
+		// malha na sua nova posio, o de texcoord e normal mais
+		// parecidas com as do vrtice original
+		NIVELMALHA nivel;
+		nivel.erro = sqrt(erroMax);
+		nivel.numLotes = 0;
+		vector<LOTE> lotes;
+		for(i=0; i<nv; ++i) remapeia[i] = -1;
+		for(i=0; i<nt; ++i)
+		{
+			if(!viva[i]) continue;
+			LOTE &orig = malha->lotes[loteTri[i]];
+			if(lotes.empty() || lotes.back().mat != orig.mat || lotes.back().texid != orig.texid)
+			{
+				LOTE lote = { orig.mat, orig.texid, (GLint) (numInd + novos.size()), 0 };
+				lotes.push_back(lote);
+			}
+			for(j=0; j<3; ++j)
+			{
+				int m = indices[i*3+j];
+				if(remapeia[m] == -1)
+				{
+					int p = tri[i*3+j];
+					if(p == posVert[m]) remapeia[m] = m;
+					else
+					{
+						const VERTMALHA &vm = malha->vertices[m];
+						float melhor = 0;
+						for(k=iniPos[p]; k<iniPos[p+1]; ++k)
+						{
+							const VERTMALHA &vc = malha->vertices[vertPos[k]];
+							float ds = vc.tex[0]-vm.tex[0], dt = vc.tex[1]-vm.tex[1];
+							float dif = ds*ds + dt*dt + 1 - (vc.normal[0]*vm.normal[0]
+								+ vc.normal[1]*vm.normal[1] + vc.normal[2]*vm.normal[2]);
+							if(remapeia[m] == -1 || dif < melhor)
+							{
+								remapeia[m] = vertPos[k];
+								melhor = dif;
+							}
+						}
+					}
+				}
+				novos.push_back(remapeia[m]);
+			}
+			lotes.back().num += 3;
+		}
+		nivel.numLotes = lotes.size();
+		nivel.lotes = (LOTE *) malloc(sizeof(LOTE)*(lotes.size() ? lotes.size() : 1));
+		memcpy(nivel.lotes, lotes.data(), sizeof(LOTE)*lotes.size());
+		niveis.push_back(nivel);
+#ifdef DEBUG
+		printf("LOD %d: %d triangulos, erro %g\n",(int) niveis.size(),vivas,nivel.erro);
+#endif
+	}
+
+	// Acrescenta os ndices dos nveis aps os da malha original
+	size_t tamIndice = malha->tipoIndice == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+	void *ind = realloc(malha->indices, tamIndice * (numInd + novos.size() + 1));
+	if(ind == NULL)
+	{
+		for(i=0; i<(int) niveis.size(); ++i) free(niveis[i].lotes);
+		return 0;
+	}
+	for(i=0; i<(int) novos.size(); ++i)
+	{
+		if(malha->tipoIndice == GL_UNSIGNED_SHORT)
+			((GLushort *) ind)[numInd+i] = (GLushort) novos[i];
+		else
+			((GLuint *) ind)[numInd+i] = novos[i];
+	}
+	malha->indices = ind;
+	malha->numIndices = numInd + novos.size();
+	malha->numNiveis = niveis.size();
+	malha->reducao = reducao;
+	if(niveis.size())
+	{
+		malha->niveis = (NIVELMALHA *) malloc(sizeof(NIVELMALHA)*niveis.size());
+		memcpy(malha->niveis, niveis.data(), sizeof(NIVELMALHA)*niveis.size());
+	}
+	// Envia os novos ndices, se o objeto j tiver buffers
+	if(obj->vbo) _criaVBO(obj);
+	return malha->numNiveis;
+}
+
+// Funo interna que converte um valor para inteiro de 16 bits,
+// arredondando e limitando ao intervalo vlido
+inline GLshort _quantiza16(float v)
+{
+	v = floor(v + 0.5f);
+	return (GLshort) (v < -32767 ? -32767 : (v > 32767 ? 32767 : v));
+}
+
+// Substitui os vrtices da malha de um objeto (que  criada, se no
+// existir) por uma verso quantizada, que ocupa de 8 a 16 bytes por
+// vrtice ao invs de 32:
+// - posies com 16 bits por coordenada, relativas ao centro da caixa
+//   envolvente da malha e com a mesma escala nos trs eixos;
+// - normais com 8 bits por coordenada (GL_BYTE, normalizadas pela
+//   prpria OpenGL), se houver;
+// - texcoords com 16 bits, relativas aos seus limites, se houver.
+// Os ndices j so de 16 bits sempre que o nmero de vrtices
+// permite (ver CriaMalha). O desenho usa os valores quantizados
+// diretamente: a escala e o deslocamento das posies e das texcoords
+// so aplicados s matrizes de modelagem e de textura (o que exige
+// uma posio livre na pilha de cada uma). A partir da, o objeto 
+// sempre desenhado pela malha, mesmo sem buffers.
+//
+// Se erro no for NULL, recebe os maiores erros em relao  malha
+// original e a memria ocupada antes e depois. Os nveis de detalhe
+// devem ser criados antes (ver CriaNiveisDetalhe), e so refeitos,
+// assim como a quantizao, quando CriaBlocos ou OtimizaVertices
+// recriam a malha.
+// Retorna false se faltar memria
+bool QuantizaMalha(OBJ *obj, ERROQUANT *erro)
+{
+	int i, e;
+	if(obj == NULL) return false;
+	if(obj->malha == NULL && CriaMalha(obj) == NULL) return false;
+	MALHA *malha = obj->malha;
+	if(malha->quant != NULL) return true;
+	int nv = malha->numVertices;
+	QUANTMALHA *q = (QUANTMALHA *) malloc(sizeof(QUANTMALHA));
+	if(q == NULL) return false;
+	// Formato: posio (com uma coordenada de folga, para alinhar
+	// o restante em 4 bytes), normal e texcoord
+	q->deslNormal = q->deslTex = -1;
+	q->tamVertice = 4*sizeof(GLshort);
+	if(malha->tem_normais)
+	{
+		q->deslNormal = q->tamVertice;
+		q->tamVertice += 4*sizeof(GLbyte);
+	}
+	if(malha->tem_texcoords)
+	{
+		q->deslTex = q->tamVertice;
+		q->tamVertice += 2*sizeof(GLshort);
+	}
+	q->vertices = (char *) malloc(q->tamVertice*(nv ? nv : 1));
+	if(q->vertices == NULL)
+	{
+		free(q);
+		return false;
+	}
+
+	// Limites das posies e das texcoords
+	float pmin[3], pmax[3], tmin[2], tmax[2];
+	for(e=0; e<3; ++e)
+	{
+		pmin[e] = FLT_MAX;
+		pmax[e] = -FLT_MAX;
+	}
+	tmin[0] = tmin[1] = FLT_MAX;
+	tmax[0] = tmax[1] = -FLT_MAX;
+	for(i=0; i<nv; ++i)
+	{
+		VERTMALHA &v = malha->vertices[i];
+		for(e=0; e<3; ++e)
+		{
+			pmin[e] = min(pmin[e],v.pos[e]);
+			pmax[e] = max(pmax[e],v.pos[e]);
+		}
+		for(e=0; e<2; ++e)
+		{
+			tmin[e] = min(tmin[e],v.tex[e]);
+			tmax[e] = max(tmax[e],v.tex[e]);
+		}
+	}
+	// A escala das posies  a mesma nos trs eixos, para que as
+	// normais no sejam distorcidas pela matriz de modelagem
+	float ext = 0;
+	for(e=0; e<3 && nv; ++e)
+	{
+		q->centro[e] = (pmin[e]+pmax[e])/2;
+		ext = max(ext,(pmax[e]-pmin[e])/2);
+	}
+	if(!nv) q->centro[0] = q->centro[1] = q->centro[2] = 0;
+	q->escala = ext > 0 ? ext/32767 : 1;
+	for(e=0; e<2; ++e)
+	{
+		q->centroTex[e] = nv ? (tmin[e]+tmax[e])/2 : 0;
+		float extTex = nv ? (tmax[e]-tmin[e])/2 : 0;
+		q->escalaTex[e] = extTex > 0 ? extTex/32767 : 1;
+	}
+
+	// Quantiza e mede o erro de cada atributo
+	float erroPos = 0, erroNormal = 0, erroTex = 0;
+	for(i=0; i<nv; ++i)
+	{
+		VERTMALHA &v = malha->vertices[i];
+		char *dest = q->vertices + i*q->tamVertice;
+		GLshort *pos = (GLshort *) dest;
+		float d2 = 0;
+		for(e=0; e<3; ++e)
+		{
+			pos[e] = _quantiza16((v.pos[e]-q->centro[e])/q->escala);
+			float d = q->centro[e] + pos[e]*q->escala - v.pos[e];
+			d2 += d*d;
+		}
+		pos[3] = 0;
+		erroPos = max(erroPos,d2);
+		if(q->deslNormal >= 0)
+		{
+			GLbyte *n = (GLbyte *) (dest + q->deslNormal);
+			float dec[3], tam = 0, tamOrig = 0, prod = 0;
+			for(e=0; e<3; ++e)
+			{
+				float c = floor(v.normal[e]*127 + 0.5f);
+				n[e] = (GLbyte) (c < -127 ? -127 : (c > 127 ? 127 : c));
+				dec[e] = n[e] / 127.0f;
+				tam += dec[e]*dec[e];
+				tamOrig += v.normal[e]*v.normal[e];
+				prod += dec[e]*v.normal[e];
+			}
+			n[3] = 0;
+			// ngulo entre a normal original e a decodificada
+			if(tam > 0 && tamOrig > 0)
+			{
+				float c = prod / sqrt(tam*tamOrig);
+				erroNormal = max(erroNormal,(float) acos(min(c,1.0f)));
+			}
+		}
+		if(q->deslTex >= 0)
+		{
+			GLshort *t = (GLshort *) (dest + q->deslTex);
+			for(e=0; e<2; ++e)
+			{
+				t[e] = _quantiza16((v.tex[e]-q->centroTex[e])/q->escalaTex[e]);
+				erroTex = max(erroTex,(float) fabs(q->centroTex[e] + t[e]*q->escalaTex[e] - v.tex[e]));
+			}
+		}
+	}
+	size_t tamIndice = malha->tipoIndice == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+	if(erro != NULL)
+	{
+		erro->posicao = sqrt(erroPos);
+		erro->normal = erroNormal * 180 / M_PI;
+		erro->texcoord = erroTex;
+		erro->bytesAntes = sizeof(VERTMALHA)*nv + tamIndice*malha->numIndices;
+		erro->bytesDepois = q->tamVertice*nv + tamIndice*malha->numIndices;
+	}
+#ifdef DEBUG
+	printf("Quantizacao: %d -> %d bytes por vertice, erros: posicao %g, normal %.2f graus, texcoord %g\n",
+		(int) sizeof(VERTMALHA), q->tamVertice, sqrt(erroPos), erroNormal*180/M_PI, erroTex);
+#endif
+	free(malha->vertices);
+	malha->vertices = NULL;
+	malha->quant = q;
+	// Envia os novos vrtices, se o objeto j tiver buffers
+	if(obj->vbo) _criaVBO(obj);
+	return true;
+}
+
+// Nmero de intervalos ("bins") usados na escolha da diviso
+// de cada n da BVH, e mximo de tringulos em uma folha
+#define BINS_BVH		16
+#define MAX_FOLHA_BVH	8
+// Custos relativos de percorrer um n e de testar um tringulo
+#define CUSTO_NO_BVH	1.0f
+#define CUSTO_TRI_BVH	1.0f
+// Ns com pelo menos esse nmero de tringulos tm a contagem
+// dos intervalos dividida entre as threads
+#define MIN_PARALELO_BVH	(32*1024)
+// Profundidade mxima da pilha usada nas consultas - a BVH no passa
+// de PILHA_BVH-1 nveis, e as consultas nunca empilham mais ns do
+// que a profundidade do n corrente
+#define PILHA_BVH	64
+// A partir desta profundidade os ns so divididos pela mediana: cada
+// nvel reduz os tringulos  metade, e qualquer nmero deles cabe nos
+// nveis restantes mesmo com entradas degeneradas
+#define PROF_MEDIANA_BVH	(PILHA_BVH-32)
+
+// Caixa envolvente usada na construo da BVH
+typedef struct {
+	float min[3], max[3];
+} CAIXABVH;
+
+// Funo interna que esvazia uma caixa
+inline void _esvaziaCaixa(CAIXABVH &c)
+{
+	c.min[0] = c.min[1] = c.min[2] = FLT_MAX;
+	c.max[0] = c.max[1] = c.max[2] = -FLT_MAX;
+}
+
+// Funo interna que expande a caixa c para incluir a caixa d
+inline void _expandeCaixa(CAIXABVH &c, const CAIXABVH &d)
+{
+	for(int e=0; e<3; ++e)
+	{
+		c.min[e] = min(c.min[e],d.min[e]);
+		c.max[e] = max(c.max[e],d.max[e]);
+	}
+}
+
+// Funo interna que retorna metade da rea da superfcie de
+// uma caixa (0 se ela estiver vazia)
+inline float _areaCaixa(const CAIXABVH &c)
+{
+	float dx = c.max[0]-c.min[0], dy = c.max[1]-c.min[1], dz = c.max[2]-c.min[2];
+	if(dx < 0 || dy < 0 || dz < 0) return 0;
+	return dx*dy + dy*dz + dz*dx;
+}
+
+// Intervalo usado na escolha da diviso: tringulos cujo
+// centro cai nele, e a caixa que os envolve
+typedef struct {
+	CAIXABVH caixa;
+	int num;
+} BINBVH;
+
+// Dados usados durante a construo da BVH
+typedef struct {
+	vector<CAIXABVH> caixas;	// caixa de cada tringulo
+	vector<VERT> centros;		// centro da caixa de cada tringulo
+	vector<GLint> ordem;		// tringulos, na ordem das folhas
+	vector<NOBVH> nos;
+} CONSTRUCAOBVH;
+
+// Funo interna que conta, nos intervalos de cada eixo, os
+// tringulos ordem[ini..fim) cujos centros esto em cmin..cmax
+void _contaBins(CONSTRUCAOBVH &cb, int ini, int fim, const float *cmin,
+	const float *escala, BINBVH bins[3][BINS_BVH])
+{
+	for(int e=0; e<3; ++e)
+		for(int b=0; b<BINS_BVH; ++b)
+		{
+			_esvaziaCaixa(bins[e][b].caixa);
+			bins[e][b].num = 0;
+		}
+	for(int i=ini; i<fim; ++i)
+	{
+		int t = cb.ordem[i];
+		const float *c = &cb.centros[t].x;
+		for(int e=0; e<3; ++e)
+		{
+			int b = (int) ((c[e]-cmin[e]) * escala[e]);
+			b = min(max(b,0),BINS_BVH-1);
+			_expandeCaixa(bins[e][b].caixa,cb.caixas[t]);
+			bins[e][b].num++;
+		}
+	}
+}
+
+// Funo interna que constri (recursivamente) o n de profundidade
+// prof que contm os tringulos ordem[ini..fim), escolhendo a diviso
+// de menor custo pela heurstica de rea de superfcie (SAH), ou pela
+// mediana nos nveis mais profundos (ver PROF_MEDIANA_BVH). Retorna o
+// ndice do n criado
+int _criaNoBVH(CONSTRUCAOBVH &cb, int ini, int fim, int prof)
+{
+	int i, e, b;
+	int indice = cb.nos.size();
+	cb.nos.push_back(NOBVH());
+	int num = fim-ini;
+
+	// Caixa do n e caixa dos centros dos tringulos
+	CAIXABVH caixa, centros;
+	_esvaziaCaixa(caixa);
+	_esvaziaCaixa(centros);
+	for(i=ini; i<fim; ++i)
+	{
+		int t = cb.ordem[i];
+		_expandeCaixa(caixa,cb.caixas[t]);
+		const float *c = &cb.centros[t].x;
+		for(e=0; e<3; ++e)
+		{
+			centros.min[e] = min(centros.min[e],c[e]);
+			centros.max[e] = max(centros.max[e],c[e]);
+		}
+	}
+	NOBVH &no = cb.nos[indice];
+	memcpy(no.min,caixa.min,sizeof(no.min));
+	memcpy(no.max,caixa.max,sizeof(no.max));
+
+	// Escolhe o eixo e a posio da diviso
+	float melhorCusto = FLT_MAX;
+	int melhorEixo = -1, melhorBin = 0;
+	float escala[3];
+	if(num > 2 && prof < PROF_MEDIANA_BVH)
+	{
+		for(e=0; e<3; ++e)
+		{
+			float ext = centros.max[e]-centros.min[e];
+			escala[e] = ext > 0 ? BINS_BVH / ext : 0;
+		}
+		BINBVH bins[3][BINS_BVH];
+		if(num >= MIN_PARALELO_BVH)
+		{
+			// Cada thread conta um trecho, e as contagens so somadas
+			mutex mtx;
+			for(e=0; e<3; ++e)
+				for(b=0; b<BINS_BVH; ++b)
+				{
+					_esvaziaCaixa(bins[e][b].caixa);
+					bins[e][b].num = 0;
+				}
+			_executaIntervalos(num, MIN_PARALELO_BVH/4, [&](int pini, int pfim) {
+				BINBVH parcial[3][BINS_BVH];
+				_contaBins(cb,ini+pini,ini+pfim,centros.min,escala,parcial);
+				lock_guard<mutex> trava(mtx);
+				for(int e=0; e<3; ++e)
+					for(int b=0; b<BINS_BVH; ++b)
+					{
+						_expandeCaixa(bins[e][b].caixa,parcial[e][b].caixa);
+						bins[e][b].num += parcial[e][b].num;
+					}
+			});
+		}
+		else _contaBins(cb,ini,fim,centros.min,escala,bins);
+
+		// Custo de cada diviso: reas e contagens acumuladas
+		// da esquerda para a direita e vice-versa
+		float areaPai = _areaCaixa(caixa);
+		for(e=0; e<3 && areaPai > 0; ++e)
+		{
+			if(escala[e] == 0) continue;
+			float areaDir[BINS_BVH];
+			int numDir[BINS_BVH];
+			CAIXABVH acum;
+			_esvaziaCaixa(acum);
+			int cont = 0;
+			for(b=BINS_BVH-1; b>0; --b)
+			{
+				_expandeCaixa(acum,bins[e][b].caixa);
+				cont += bins[e][b].num;
+				areaDir[b] = _areaCaixa(acum);
+				numDir[b] = cont;
+			}
+			_esvaziaCaixa(acum);
+			cont = 0;
+			for(b=0; b<BINS_BVH-1; ++b)
+			{
+				_expandeCaixa(acum,bins[e][b].caixa);
+				cont += bins[e][b].num;
+				if(!cont || !numDir[b+1]) continue;
+				float custo = CUSTO_NO_BVH + CUSTO_TRI_BVH *
+					(_areaCaixa(acum)*cont + areaDir[b+1]*numDir[b+1]) / areaPai;
+				if(custo < melhorCusto)
+				{
+					melhorCusto = custo;
+					melhorEixo = e;
+					melhorBin = b;
+				}
+			}
+		}
+	}
+
+	// Cria uma folha se no houver diviso melhor do que testar
+	// todos os tringulos (e se eles couberem em uma folha)
+	int meio = ini;
+	if(melhorEixo >= 0 && (melhorCusto < CUSTO_TRI_BVH*num || num > MAX_FOLHA_BVH))
+	{
+		e = melhorEixo;
+		float cmin = centros.min[e], esc = escala[e];
+		meio = partition(cb.ordem.begin()+ini, cb.ordem.begin()+fim, [&](int t) {
+			int b = (int) ((( &cb.centros[t].x)[e] - cmin) * esc);
+			return min(max(b,0),BINS_BVH-1) <= melhorBin;
+		}) - cb.ordem.begin();
+	}
+	// Nvel profundo: divide pela mediana dos centros no maior eixo
+	else if(num > MAX_FOLHA_BVH && prof >= PROF_MEDIANA_BVH)
+	{
+		e = 0;
+		for(int k=1; k<3; ++k)
+			if(centros.max[k]-centros.min[k] > centros.max[e]-centros.min[e]) e = k;
+		meio = ini + num/2;
+		nth_element(cb.ordem.begin()+ini, cb.ordem.begin()+meio, cb.ordem.begin()+fim,
+			[&](int t1, int t2) { return (&cb.centros[t1].x)[e] < (&cb.centros[t2].x)[e]; });
+	}
+	// Muitos tringulos com o mesmo centro: divide ao meio
+	else if(num > MAX_FOLHA_BVH)
+		meio = ini + num/2;
+	// Nunca passa da profundidade que as consultas suportam
+	if(meio == ini || meio == fim || prof >= PILHA_BVH-1)
+	{
+		cb.nos[indice].inicio = ini;
+		cb.nos[indice].num = num;
+		return indice;
+	}
+	// N interno: o filho da esquerda vem logo depois do pai
+	_criaNoBVH(cb,ini,meio,prof+1);
+	int dir = _criaNoBVH(cb,meio,fim,prof+1);
+	cb.nos[indice].inicio = dir;
+	cb.nos[indice].num = 0;
+	return indice;
+}
+
+// Libera a memria ocupada por uma BVH (as BVHs associadas a
+// objetos so liberadas automaticamente junto com eles)
+void LiberaBVH(BVH *bvh)
+{
+	if(bvh == NULL) return;
+	if(bvh->nos != NULL) free(bvh->nos);
+	if(bvh->triangulos != NULL) free(bvh->triangulos);
+	if(bvh->faces != NULL) free(bvh->faces);
+	free(bvh);
+}
+
+// Cria uma hierarquia de volumes envolventes (BVH) sobre os
+// tringulos das faces de um objeto, para acelerar as consultas
+// de raio (IntersectaRaioBVH), de ponto mais prximo
+// (PontoMaisProximoBVH) e de sobreposio com uma caixa
+// (SobreposicaoBVH). Os ns so divididos pela heurstica de rea
+// de superfcie, avaliada em BINS_BVH intervalos por eixo (nos ns
+// grandes, a contagem  dividida entre as threads), e armazenados
+// em profundidade, com 32 bytes cada: o filho da esquerda de um n
+// interno  o n seguinte. Os vrtices dos tringulos de cada folha
+// ficam contguos.
+//
+// A BVH fica associada ao objeto (obj->bvh), substituindo a
+// anterior, e deve ser recriada se os vrtices ou a ordem das faces
+// do objeto forem alterados por outras funes que no
+// TransformaObjeto, AgrupaFaces ou CriaBlocos (que a atualizam)
+BVH *CriaBVH(OBJ *obj)
+{
+	int i, k;
+	if(obj == NULL) return NULL;
+	BVH *bvh = (BVH *) malloc(sizeof(BVH));
+	if(bvh == NULL) return NULL;
+
+	// Divide as faces em tringulos
+	CONSTRUCAOBVH cb;
+	vector<GLint> vertTri, faceTri;
+	vector<int> tri;
+	for(i=0; i<obj->numFaces; ++i)
+	{
+		FACE &face = obj->faces[i];
+		int ntri = _triangulaFace(obj,face.vert,face.nv,tri);
+		for(k=0; k<ntri*3; ++k)
+			vertTri.push_back(face.vert[tri[k]]);
+		for(k=0; k<ntri; ++k)
+			faceTri.push_back(i);
+	}
+	int nt = faceTri.size();
+	cb.caixas.resize(nt);
+	cb.centros.resize(nt);
+	cb.ordem.resize(nt);
+	_executaIntervalos(nt, 4096, [&](int ini, int fim) {
+		for(int t=ini; t<fim; ++t)
+		{
+			CAIXABVH &c = cb.caixas[t];
+			_esvaziaCaixa(c);
+			for(int j=0; j<3; ++j)
+			{
+				const float *v = &obj->vertices[vertTri[t*3+j]].x;
+				for(int e=0; e<3; ++e)
+				{
+					c.min[e] = min(c.min[e],v[e]);
+					c.max[e] = max(c.max[e],v[e]);
+				}
+			}
+			cb.centros[t].x = (c.min[0]+c.max[0])/2;
+			cb.centros[t].y = (c.min[1]+c.max[1])/2;
+			cb.centros[t].z = (c.min[2]+c.max[2])/2;
+			cb.ordem[t] = t;
+		}
+	});
+	if(nt) _criaNoBVH(cb,0,nt,0);
+
+	// Copia os ns e os tringulos, na ordem das folhas
+	bvh->numNos = cb.nos.size();
+	bvh->numTriangulos = nt;
+	bvh->nos = (NOBVH *) malloc(sizeof(NOBVH)*(bvh->numNos ? bvh->numNos : 1));
+	bvh->triangulos = (VERT *) malloc(sizeof(VERT)*3*(nt ? nt : 1));
+	bvh->faces = (GLint *) malloc(sizeof(GLint)*(nt ? nt : 1));
+	if(bvh->nos == NULL || bvh->triangulos == NULL || bvh->faces == NULL)
+	{
+		LiberaBVH(bvh);
+		return NULL;
+	}
+	if(bvh->numNos) memcpy(bvh->nos,cb.nos.data(),sizeof(NOBVH)*bvh->numNos);
+	for(i=0; i<nt; ++i)
+	{
+		int t = cb.ordem[i];
+		for(k=0; k<3; ++k)
+			bvh->triangulos[i*3+k] = obj->vertices[vertTri[t*3+k]];
+		bvh->faces[i] = faceTri[t];
+	}
+#ifdef DEBUG
+	printf("BVH: %d triangulos, %d nos\n",nt,bvh->numNos);
+#endif
+	// Associa ao objeto
+	if(obj->bvh != NULL) LiberaBVH(obj->bvh);
+	obj->bvh = bvh;
+	return bvh;
+}
+
+// Funo interna que calcula a distncia, ao longo de um raio, em
+// que ele entra na caixa de um n (FLT_MAX se no a atingir antes
+// de tmax). inv  o inverso de cada componente da direo
+inline float _raioCaixa(const NOBVH &no, const float *orig, const float *inv, float tmax)
+{
+	float t0 = 0, t1 = tmax;
+	for(int e=0; e<3; ++e)
+	{
+		float ta = (no.min[e]-orig[e]) * inv[e];
+		float tb = (no.max[e]-orig[e]) * inv[e];
+		if(ta > tb) swap(ta,tb);
+		// (NaN, quando a origem est no plano de uma face paralela
+		// ao raio,  ignorado pelas comparaes)
+		if(ta > t0) t0 = ta;
+		if(tb < t1) t1 = tb;
+	}
+	return t0 <= t1 ? t0 : FLT_MAX;
+}
+
+// Procura a primeira interseo de um raio (origem e direo, no
+// necessariamente unitria) com os tringulos da BVH, at a
+// distncia tmax (em mltiplos da direo). Retorna false se no
+// houver; caso contrrio, preenche res com a face atingida, a
+// distncia, o ponto e as suas coordenadas baricntricas (u,v) no
+// tringulo. As faces so atingidas pelos dois lados
+bool IntersectaRaioBVH(BVH *bvh, const VERT &origem, const VERT &direcao,
+	float tmax, INTERSECAO *res)
+{
+	if(bvh == NULL || !bvh->numNos) return false;
+	const float *orig = &origem.x, *dir = &direcao.x;
+	float inv[3];
+	for(int e=0; e<3; ++e)
+		inv[e] = 1.0f / dir[e];
+	int pilha[PILHA_BVH], topo = 0;
+	int atual = 0, melhor = -1;
+	float melhorT = tmax, melhorU = 0, melhorV = 0;
+	if(_raioCaixa(bvh->nos[0],orig,inv,melhorT) == FLT_MAX) return false;
+	for(;;)
+	{
+		const NOBVH &no = bvh->nos[atual];
+		if(no.num)
+		{
+			// Folha: testa os tringulos (Mller-Trumbore)
+			for(int i=no.inicio; i<no.inicio+no.num; ++i)
+			{
+				const VERT *v = &bvh->triangulos[i*3];
+				float e1[3] = { v[1].x-v[0].x, v[1].y-v[0].y, v[1].z-v[0].z };
+				float e2[3] = { v[2].x-v[0].x, v[2].y-v[0].y, v[2].z-v[0].z };
+				float p[3] = { dir[1]*e2[2]-dir[2]*e2[1], dir[2]*e2[0]-dir[0]*e2[2],
+					dir[0]*e2[1]-dir[1]*e2[0] };
+				float det = e1[0]*p[0] + e1[1]*p[1] + e1[2]*p[2];
+				if(det == 0) continue;
+				float invDet = 1.0f / det;
+				float s[3] = { orig[0]-v[0].x, orig[1]-v[0].y, orig[2]-v[0].z };
+				float u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2]) * invDet;
+				if(u < 0 || u > 1) continue;
+				float q[3] = { s[1]*e1[2]-s[2]*e1[1], s[2]*e1[0]-s[0]*e1[2],
+					s[0]*e1[1]-s[1]*e1[0] };
+				float w = (dir[0]*q[0] + dir[1]*q[1] + dir[2]*q[2]) * invDet;
+				if(w < 0 || u+w > 1) continue;
+				float t = (e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2]) * invDet;
+				if(t >= 0 && t < melhorT)
+				{
+					melhorT = t;
+					melhor = i;
+					melhorU = u;
+					melhorV = w;
+				}
+			}
+		}
+		else
+		{
+			// N interno: visita primeiro o filho mais prximo
+			int f1 = atual+1, f2 = no.inicio;
+			float t1 = _raioCaixa(bvh->nos[f1],orig,inv,melhorT);
+			float t2 = _raioCaixa(bvh->nos[f2],orig,inv,melhorT);
+			if(t2 < t1) { swap(t1,t2); swap(f1,f2); }
+			if(t1 != FLT_MAX)
+			{
+				if(t2 != FLT_MAX && topo < PILHA_BVH) pilha[topo++] = f2;
+				atual = f1;
+				continue;
+			}
+		}
+		if(!topo) break;
+		atual = pilha[--topo];
+	}
+	if(melhor < 0) return false;
+	if(res != NULL)
+	{
+		res->face = bvh->faces[melhor];
+		res->t = melhorT;
+		res->u = melhorU;
+		res->v = melhorV;
+		res->ponto.x = orig[0] + dir[0]*melhorT;
+		res->ponto.y = orig[1] + dir[1]*melhorT;
+		res->ponto.z = orig[2] + dir[2]*melhorT;
+	}
+	return true;
+}
+
+// Funo interna que retorna o quadrado da distncia de um
+// ponto  caixa de um n (0 se estiver dentro dela)
+inline float _distCaixa2(const NOBVH &no, const float *p)
+{
+	float d = 0;
+	for(int e=0; e<3; ++e)
+	{
+		float x = p[e] < no.min[e] ? no.min[e]-p[e] : (p[e] > no.max[e] ? p[e]-no.max[e] : 0);
+		d += x*x;
+	}
+	return d;
+}
 
-	if ( ( obj = (OBJ *) malloc(sizeof(OBJ)) ) == NULL)
-		return NULL;
+// Funo interna que calcula o ponto do tringulo abc mais prximo
+// de p (pela regio de Voronoi em que p se projeta), e as suas
+// coordenadas baricntricas em relao a b e c
+void _pontoTriangulo(const float *p, const VERT &a, const VERT &b, const VERT &c,
+	float *res, float &u, float &v)
+{
+	float ab[3] = { b.x-a.x, b.y-a.y, b.z-a.z };
+	float ac[3] = { c.x-a.x, c.y-a.y, c.z-a.z };
+	float ap[3] = { p[0]-a.x, p[1]-a.y, p[2]-a.z };
+	float d1 = ab[0]*ap[0] + ab[1]*ap[1] + ab[2]*ap[2];
+	float d2 = ac[0]*ap[0] + ac[1]*ap[1] + ac[2]*ap[2];
+	if(d1 <= 0 && d2 <= 0) { u = v = 0; }
+	else
+	{
+		float bp[3] = { p[0]-b.x, p[1]-b.y, p[2]-b.z };
+		float d3 = ab[0]*bp[0] + ab[1]*bp[1] + ab[2]*bp[2];
+		float d4 = ac[0]*bp[0] + ac[1]*bp[1] + ac[2]*bp[2];
+		float cp[3] = { p[0]-c.x, p[1]-c.y, p[2]-c.z };
+		float d5 = ab[0]*cp[0] + ab[1]*cp[1] + ab[2]*cp[2];
+		float d6 = ac[0]*cp[0] + ac[1]*cp[1] + ac[2]*cp[2];
+		float va = d3*d6 - d5*d4, vb = d5*d2 - d1*d6, vc = d1*d4 - d3*d2;
+		if(d3 >= 0 && d4 <= d3) { u = 1; v = 0; }
+		else if(d6 >= 0 && d5 <= d6) { u = 0; v = 1; }
+		else if(vc <= 0 && d1 >= 0 && d3 <= 0) { u = d1/(d1-d3); v = 0; }
+		else if(vb <= 0 && d2 >= 0 && d6 <= 0) { u = 0; v = d2/(d2-d6); }
+		else if(va <= 0 && d4-d3 >= 0 && d5-d6 >= 0)
+		{
+			v = (d4-d3) / ((d4-d3) + (d5-d6));
+			u = 1-v;
+		}
+		else
+		{
+			float den = 1.0f / (va+vb+vc);
+			u = vb*den;
+			v = vc*den;
+		}
+	}
+	for(int e=0; e<3; ++e)
+		res[e] = (&a.x)[e] + ab[e]*u + ac[e]*v;
+}
 
-	// Inicializa contadores do objeto
-	obj->numVertices  = 0;
-	obj->numFaces     = 0;
-	obj->numNormais   = 0;
-	obj->numTexcoords = 0;
-	// A princpio no temos normais por vrtice...
-	obj->normais_por_vertice = false;
-	// E tambm no temos materiais...
-	obj->tem_materiais = false;
-	obj->textura = -1;	// sem textura associada
-	obj->dlist = -1;	// sem display list
+// Procura o ponto dos tringulos da BVH mais prximo do ponto p,
+// a no mximo distMax dele. Retorna false se no houver; caso
+// contrrio, preenche res com a face, a distncia (em t), o ponto
+// encontrado e as suas coordenadas baricntricas
+bool PontoMaisProximoBVH(BVH *bvh, const VERT &p, float distMax, INTERSECAO *res)
+{
+	if(bvh == NULL || !bvh->numNos) return false;
+	const float *pt = &p.x;
+	int pilha[PILHA_BVH], topo = 0;
+	int atual = 0, melhor = -1;
+	float melhorD2 = distMax*distMax, melhorU = 0, melhorV = 0;
+	float melhorP[3];
+	if(_distCaixa2(bvh->nos[0],pt) > melhorD2) return false;
+	for(;;)
+	{
+		const NOBVH &no = bvh->nos[atual];
+		if(no.num)
+		{
+			for(int i=no.inicio; i<no.inicio+no.num; ++i)
+			{
+				const VERT *v = &bvh->triangulos[i*3];
+				float q[3], u, w;
+				_pontoTriangulo(pt,v[0],v[1],v[2],q,u,w);
+				float d2 = (q[0]-pt[0])*(q[0]-pt[0]) + (q[1]-pt[1])*(q[1]-pt[1])
+					+ (q[2]-pt[2])*(q[2]-pt[2]);
+				if(d2 <= melhorD2)
+				{
+					melhorD2 = d2;
+					melhor = i;
+					melhorU = u;
+					melhorV = w;
+					memcpy(melhorP,q,sizeof(q));
+				}
+			}
+		}
+		else
+		{
+			// Visita primeiro o filho mais prximo
+			int f1 = atual+1, f2 = no.inicio;
+			float d1 = _distCaixa2(bvh->nos[f1],pt);
+			float d2 = _distCaixa2(bvh->nos[f2],pt);
+			if(d2 < d1) { swap(d1,d2); swap(f1,f2); }
+			if(d1 <= melhorD2)
+			{
+				if(d2 <= melhorD2 && topo < PILHA_BVH) pilha[topo++] = f2;
+				atual = f1;
+				continue;
+			}
+		}
+		// Descarta os ns empilhados que ficaram mais distantes
+		// do que o melhor ponto encontrado
+		while(topo && _distCaixa2(bvh->nos[pilha[topo-1]],pt) > melhorD2) --topo;
+		if(!topo) break;
+		atual = pilha[--topo];
+	}
+	if(melhor < 0) return false;
+	if(res != NULL)
+	{
+		res->face = bvh->faces[melhor];
+		res->t = sqrt(melhorD2);
+		res->u = melhorU;
+		res->v = melhorV;
+		res->ponto.x = melhorP[0];
+		res->ponto.y = melhorP[1];
+		res->ponto.z = melhorP[2];
+	}
+	return true;
+}
 
-	obj->vertices = NULL;
-	obj->faces = NULL;
-	obj->normais = NULL;
-	obj->texcoords = NULL;
+// Funo interna que verifica se o tringulo abc intercepta a caixa
+// de centro c e meias-dimenses h, pelo teorema dos eixos separadores
+// (eixos da caixa, normal do tringulo e os 9 produtos vetoriais
+// entre eles e as arestas)
+bool _trianguloCaixa(const VERT *tri, const float *c, const float *h)
+{
+	float v[3][3], ar[3][3];
+	int i, j, e;
+	for(i=0; i<3; ++i)
+		for(e=0; e<3; ++e)
+			v[i][e] = (&tri[i].x)[e] - c[e];
+	for(i=0; i<3; ++i)
+		for(e=0; e<3; ++e)
+			ar[i][e] = v[(i+1)%3][e] - v[i][e];
+	// Eixos da caixa
+	for(e=0; e<3; ++e)
+	{
+		float mn = min(v[0][e],min(v[1][e],v[2][e]));
+		float mx = max(v[0][e],max(v[1][e],v[2][e]));
+		if(mn > h[e] || mx < -h[e]) return false;
+	}
+	// Produtos vetoriais entre os eixos da caixa e as arestas
+	for(i=0; i<3; ++i)
+		for(j=0; j<3; ++j)
+		{
+			float eixo[3] = { 0, 0, 0 };
+			// eixo = unitrio j x aresta i
+			int a = (j+1)%3, b = (j+2)%3;
+			eixo[a] = -ar[i][b];
+			eixo[b] = ar[i][a];
+			float p0 = eixo[0]*v[0][0] + eixo[1]*v[0][1] + eixo[2]*v[0][2];
+			float p1 = eixo[0]*v[1][0] + eixo[1]*v[1][1] + eixo[2]*v[1][2];
+			float p2 = eixo[0]*v[2][0] + eixo[1]*v[2][1] + eixo[2]*v[2][2];
+			float r = h[0]*fabs(eixo[0]) + h[1]*fabs(eixo[1]) + h[2]*fabs(eixo[2]);
+			if(min(p0,min(p1,p2)) > r || max(p0,max(p1,p2)) < -r) return false;
+		}
+	// Normal do tringulo
+	float n[3] = { ar[0][1]*ar[1][2]-ar[0][2]*ar[1][1],
+		ar[0][2]*ar[1][0]-ar[0][0]*ar[1][2], ar[0][0]*ar[1][1]-ar[0][1]*ar[1][0] };
+	float d = n[0]*v[0][0] + n[1]*v[0][1] + n[2]*v[0][2];
+	float r = h[0]*fabs(n[0]) + h[1]*fabs(n[1]) + h[2]*fabs(n[2]);
+	return fabs(d) <= r;
+}
 
-	// A primeira passagem serve apenas para contar quantos
-	// elementos existem no arquivo - necessrio para
-	// alocar memria depois
-	while(!feof(fp))
+// Procura as faces com algum tringulo que intercepte a caixa
+// (cmin,cmax). At maxFaces ndices de faces, sem repetio, so
+// colocados em faces (que pode ser NULL). Retorna o nmero de
+// faces encontradas, que pode ser maior que maxFaces
+int SobreposicaoBVH(BVH *bvh, const VERT &cmin, const VERT &cmax, GLint *faces, int maxFaces)
+{
+	if(bvh == NULL || !bvh->numNos) return 0;
+	float c[3] = { (cmin.x+cmax.x)/2, (cmin.y+cmax.y)/2, (cmin.z+cmax.z)/2 };
+	float h[3] = { (cmax.x-cmin.x)/2, (cmax.y-cmin.y)/2, (cmax.z-cmin.z)/2 };
+	vector<GLint> achadas;
+	int pilha[PILHA_BVH], topo = 0;
+	int atual = 0;
+	for(;;)
 	{
-		fgets(aux,255,fp);
-		if(!strncmp(aux,"v ",2)) // encontramos um vrtice
-			obj->numVertices++;
-		if(!strncmp(aux,"f ",2)) // encontramos uma face
-			obj->numFaces++;
-		if(!strncmp(aux,"vn ",3)) // encontramos uma normal
-			obj->numNormais++;
-		if(!strncmp(aux,"vt ",3)) // encontramos uma texcoord
-			obj->numTexcoords++;
+		const NOBVH &no = bvh->nos[atual];
+		bool entra = no.min[0] <= cmax.x && no.max[0] >= cmin.x
+			&& no.min[1] <= cmax.y && no.max[1] >= cmin.y
+			&& no.min[2] <= cmax.z && no.max[2] >= cmin.z;
+		if(entra && no.num)
+		{
+			for(int i=no.inicio; i<no.inicio+no.num; ++i)
+				if(_trianguloCaixa(&bvh->triangulos[i*3],c,h))
+					achadas.push_back(bvh->faces[i]);
+		}
+		else if(entra)
+		{
+			if(topo < PILHA_BVH) pilha[topo++] = no.inicio;
+			atual++;
+			continue;
+		}
+		if(!topo) break;
+		atual = pilha[--topo];
 	}
-	// Agora voltamos ao incio do arquivo para ler os elementos
-	rewind(fp);
+	// Os tringulos de uma mesma face podem estar em folhas diferentes
+	sort(achadas.begin(), achadas.end());
+	achadas.erase(unique(achadas.begin(), achadas.end()), achadas.end());
+	if(faces != NULL)
+		for(int i=0; i<(int) achadas.size() && i<maxFaces; ++i)
+			faces[i] = achadas[i];
+	return achadas.size();
+}
+
+// Calcula o raio que parte da cmera e passa pelo pixel (x,y) da
+// janela (com y a partir de cima, como nas funes de mouse da
+// GLUT), no sistema de coordenadas definido pelas matrizes correntes
+// - chamando-a com as mesmas transformaes usadas no desenho de um
+// objeto, o raio pode ser usado diretamente em IntersectaRaioBVH
+void RaioTela(int x, int y, VERT &origem, VERT &direcao)
+{
+	GLdouble mv[16], pr[16], p0[3], p1[3];
+	GLint vp[4];
+	glGetDoublev(GL_MODELVIEW_MATRIX, mv);
+	glGetDoublev(GL_PROJECTION_MATRIX, pr);
+	glGetIntegerv(GL_VIEWPORT, vp);
+	double wy = vp[3] - y - 1 + 0.5, wx = x + 0.5;
+	gluUnProject(wx, wy, 0, mv, pr, vp, &p0[0], &p0[1], &p0[2]);
+	gluUnProject(wx, wy, 1, mv, pr, vp, &p1[0], &p1[1], &p1[2]);
+	origem.x = p0[0]; origem.y = p0[1]; origem.z = p0[2];
+	direcao.x = p1[0]-p0[0];
+	direcao.y = p1[1]-p0[1];
+	direcao.z = p1[2]-p0[2];
+}
+
+// Tamanho do cache de vrtices transformados considerado por
+// OtimizaVertices e CalculaACMR
+#define TAM_CACHE_VERTICES	16
+
+// Calcula a taxa mdia de falhas no cache de vrtices transformados
+// (ACMR): o nmero de vrtices transformados por tringulo, simulando
+// um cache FIFO de tamCache posies (0 usa TAM_CACHE_VERTICES) que
+// guarda os ndices das posies das faces, na ordem das faces. Vai
+// de 3 (nenhum reaproveitamento) at cerca de 0,5 nas malhas regulares
+float CalculaACMR(OBJ *obj, int tamCache)
+{
+	if(obj == NULL || !obj->numFaces) return 0;
+	if(tamCache <= 0) tamCache = TAM_CACHE_VERTICES;
+	// Cada vrtice guarda o nmero de falhas quando entrou no cache:
+	// ele ainda est l se houve menos de tamCache falhas depois
+	vector<int> entrada(obj->numVertices, -tamCache-1);
+	int falhas = 0, triangulos = 0;
+	vector<int> tri;
+	for(int i=0; i<obj->numFaces; ++i)
+	{
+		FACE &face = obj->faces[i];
+		int ntri = _triangulaFace(obj,face.vert,face.nv,tri);
+		for(int k=0; k<ntri*3; ++k)
+		{
+			int v = face.vert[tri[k]];
+			if(falhas - entrada[v] >= tamCache)
+				entrada[v] = falhas++;
+		}
+		triangulos += ntri;
+	}
+	return triangulos ? (float) falhas / triangulos : 0;
+}
+
+// Funo interna que ordena as faces ini..fim-1 de um objeto para
+// aproveitar o cache de vrtices (algoritmo Tipsify, de Sander, Nehab
+// e Barczak): as faces so emitidas em leque ao redor de um vrtice,
+// e o prximo vrtice  escolhido entre os da ltima volta que ainda
+// estaro no cache. As faces so acrescentadas a ordem. local deve ter
+// uma posio por vrtice do objeto, com -1 (e  devolvido assim)
+void _ordenaFacesCache(OBJ *obj, int ini, int fim, vector<int> &local, vector<int> &ordem)
+{
+	int i, k, nf = fim-ini;
+	// Numera localmente os vrtices usados pelas faces
+	vector<int> globais;
+	for(i=ini; i<fim; ++i)
+		for(k=0; k<obj->faces[i].nv; ++k)
+		{
+			int v = obj->faces[i].vert[k];
+			if(local[v] < 0)
+			{
+				local[v] = globais.size();
+				globais.push_back(v);
+			}
+		}
+	int nl = globais.size();
+	// Faces de cada vrtice, e nmero de faces ainda no emitidas
+	vector<int> inicioAdj(nl+1,0), adj, vivas(nl,0);
+	for(i=ini; i<fim; ++i)
+		for(k=0; k<obj->faces[i].nv; ++k)
+			vivas[local[obj->faces[i].vert[k]]]++;
+	for(i=0; i<nl; ++i)
+		inicioAdj[i+1] = inicioAdj[i] + vivas[i];
+	adj.resize(inicioAdj[nl]);
+	vector<int> pos(inicioAdj.begin(), inicioAdj.end()-1);
+	for(i=ini; i<fim; ++i)
+		for(k=0; k<obj->faces[i].nv; ++k)
+			adj[pos[local[obj->faces[i].vert[k]]]++] = i-ini;
+
+	const int tam = TAM_CACHE_VERTICES;
+	vector<int> tempo(nl,0), pilha, candidatos;
+	vector<char> emitida(nf,0);
+	int leque = nl ? 0 : -1, s = tam+1, cursor = 0;
+	while(leque >= 0)
+	{
+		// Emite as faces ao redor do vrtice
+		candidatos.clear();
+		for(i=inicioAdj[leque]; i<inicioAdj[leque+1]; ++i)
+		{
+			int f = adj[i];
+			if(emitida[f]) continue;
+			FACE &face = obj->faces[ini+f];
+			for(k=0; k<face.nv; ++k)
+			{
+				int v = local[face.vert[k]];
+				pilha.push_back(v);
+				candidatos.push_back(v);
+				vivas[v]--;
+				// Vrtice fora do cache:  transformado de novo
+				if(s-tempo[v] > tam) tempo[v] = s++;
+			}
+			emitida[f] = 1;
+			ordem.push_back(ini+f);
+		}
+		// O prximo  o vrtice com faces pendentes que est h mais
+		// tempo no cache, mas que ainda estar nele ao final do leque
+		int prox = -1, melhor = -1;
+		for(int v : candidatos)
+		{
+			if(vivas[v] <= 0) continue;
+			int p = s-tempo[v]+2*vivas[v] <= tam ? s-tempo[v] : 0;
+			if(p > melhor)
+			{
+				melhor = p;
+				prox = v;
+			}
+		}
+		// Beco sem sada: volta aos vrtices emitidos recentemente
+		while(prox < 0 && !pilha.empty())
+		{
+			int v = pilha.back();
+			pilha.pop_back();
+			if(vivas[v] > 0) prox = v;
+		}
+		// Ou segue para o prximo vrtice com faces pendentes
+		while(prox < 0 && cursor < nl)
+		{
+			if(vivas[cursor] > 0) prox = cursor;
+			else ++cursor;
+		}
+		leque = prox;
+	}
+	for(int v : globais)
+		local[v] = -1;
+}
+
+// Funo interna que reordena um vetor de atributos de um objeto
+// (vrtices, normais ou texcoords) pela ordem em que so usados
+// pelas faces, atualizando os ndices indicados por campo em cada
+// face. Os atributos no usados vo para o final. Retorna false se
+// faltar memria
+template<class T>
+bool _ordenaPrimeiroUso(OBJ *obj, T *&dados, int num, GLint *FACE::*campo)
+{
+	int i, k;
+	if(dados == NULL || !num) return true;
+	T *novos = (T *) malloc(sizeof(T)*num);
+	if(novos == NULL) return false;
+	vector<GLint> nova(num,-1);
+	int cont = 0;
+	for(i=0; i<obj->numFaces; ++i)
+	{
+		GLint *ind = obj->faces[i].*campo;
+		if(ind == NULL) continue;
+		for(k=0; k<obj->faces[i].nv; ++k)
+			if(ind[k] >= 0 && nova[ind[k]] < 0)
+				nova[ind[k]] = cont++;
+	}
+	for(i=0; i<num; ++i)
+	{
+		if(nova[i] < 0) nova[i] = cont++;
+		novos[nova[i]] = dados[i];
+	}
+	for(i=0; i<obj->numFaces; ++i)
+	{
+		GLint *ind = obj->faces[i].*campo;
+		if(ind == NULL) continue;
+		for(k=0; k<obj->faces[i].nv; ++k)
+			if(ind[k] >= 0) ind[k] = nova[ind[k]];
+	}
+	_liberaVetor(obj,dados);
+	dados = novos;
+	return true;
+}
 
+// Reordena as faces de um objeto para que os vrtices transformados
+// sejam reaproveitados pelo cache da placa (ver _ordenaFacesCache) e,
+// depois, os vrtices, normais e texcoords pela ordem em que as faces
+// os usam, para que sejam lidos em sequncia. Os ndices das faces so
+// atualizados. As faces s mudam de posio dentro de cada bloco (ver
+// CriaBlocos) ou, se no houver blocos, de cada trecho de faces com o
+// mesmo material e textura; os trechos transparentes no so alterados.
+//
+// Retorna a ACMR (ver CalculaACMR) depois da otimizao. Assim como
+// CriaBlocos, recria a malha (que cria os seus vrtices na ordem de
+// uso), os nveis de detalhe e os buffers do objeto, se houver
+float OtimizaVertices(OBJ *obj)
+{
+	int i;
+	if(obj == NULL) return 0;
 #ifdef DEBUG
-	printf("Vertices: %d\n",obj->numVertices);
-	printf("Faces:    %d\n",obj->numFaces);
-	printf("Normais:  %d\n",obj->numNormais);
-	printf("Texcoords:%d\n",obj->numTexcoords);
+	float antes = CalculaACMR(obj,0);
 #endif
+	vector<int> ordem, local(obj->numVertices,-1);
+	ordem.reserve(obj->numFaces);
+	int ini = 0;
+	for(int b=0; ini<obj->numFaces; ++b)
+	{
+		// Trecho que pode ser reordenado
+		int fim, mat;
+		if(b < obj->numBlocos)
+		{
+			fim = obj->blocos[b].inicio + obj->blocos[b].num;
+			mat = obj->faces[ini].mat;
+		}
+		else
+		{
+			FACE &face = obj->faces[ini];
+			mat = face.mat;
+			for(fim=ini+1; fim<obj->numFaces; ++fim)
+				if(obj->faces[fim].mat != face.mat || obj->faces[fim].texid != face.texid)
+					break;
+		}
+		if(_materialTransparente(mat))
+			for(i=ini; i<fim; ++i)
+				ordem.push_back(i);
+		else
+			_ordenaFacesCache(obj,ini,fim,local,ordem);
+		ini = fim;
+	}
+	if(!_reordenaFaces(obj,ordem)) return 0;
 
-	// Aloca os vrtices
-	if ( ( obj->vertices = (VERT *) malloc((sizeof(VERT)) * obj->numVertices) ) == NULL )
-		return NULL;
+	_ordenaPrimeiroUso(obj,obj->vertices,obj->numVertices,&FACE::vert);
+	_ordenaPrimeiroUso(obj,obj->texcoords,obj->numTexcoords,&FACE::tex);
+	if(obj->normais_por_vertice)
+		_ordenaPrimeiroUso(obj,obj->normais,obj->numNormais,&FACE::norm);
 
-	// Aloca as faces
-	if ( ( obj->faces = (FACE *) malloc((sizeof(FACE)) * obj->numFaces) ) == NULL )
-		return NULL;
+	if(obj->malha != NULL) _recriaMalha(obj);
+	float depois = CalculaACMR(obj,0);
+#ifdef DEBUG
+	printf("ACMR:     %.3f -> %.3f (cache de %d vertices)\n",antes,depois,TAM_CACHE_VERTICES);
+#endif
+	return depois;
+}
 
-	// Aloca as normais
-	if(obj->numNormais)
-		if ( ( obj->normais = (VERT *) malloc((sizeof(VERT)) * obj->numNormais) ) == NULL )
-			return NULL;
+// Filtro utilizado na gerao de mipmaps (ver SetaFiltroMipmap)
+char _filtroMipmap = 'c';
 
-	// Aloca as texcoords
-	if(obj->numTexcoords)
-		if ( ( obj->texcoords = (TEXCOORD *) malloc((sizeof(TEXCOORD)) * obj->numTexcoords) ) == NULL )
-			return NULL;
+// Seleciona o filtro utilizado para gerar os mipmaps das texturas:
+// 'c' - caixa (mdia dos pixels cobertos - o mais rpido)
+// 'k' - Kaiser (sinc janelada: nveis reduzidos mais ntidos)
+void SetaFiltroMipmap(char filtro)
+{
+	if(filtro=='c' || filtro=='k') _filtroMipmap = filtro;
+}
 
-	// A segunda passagem  para ler efetivamente os
-	// elementos do arquivo, j que sabemos quantos
-	// tem de cada tipo
-	vcont = 0;
-	ncont = 0;
-	tcont = 0;
-	fcont = 0;
-	// Material corrente = nenhum
-	material = -1;
-	// Textura corrente = nenhuma
-	texid = -1;
+// Raio do filtro de Kaiser (em pixels do nvel gerado)
+// e parmetro alfa da janela
+#define RAIO_KAISER	3.0
+#define ALFA_KAISER	4.0
 
-	// Utilizadas para determinar os limites do objeto
-	// em x,y e z
-	float minx,miny,minz;
-	float maxx,maxy,maxz;
+// Preciso (em bits) dos pesos dos filtros de mipmap
+#define BITS_PESO	14
+// Nmero mximo de pesos por amostra
+#define MAX_TAPS_MIP	32
 
-	while(!feof(fp))
+// Pesos de um filtro de reduo em uma dimenso: a amostra i do
+// nvel seguinte  a soma de peso[k*num+i] * pixel[2i+desl+k],
+// para k de 0 a taps-1 (os ndices fora da imagem so limitados
+//  borda). A soma dos pesos de cada amostra  1<<BITS_PESO
+typedef struct {
+	int num;			// nmero de amostras geradas
+	int taps;			// pesos por amostra
+	int desl;			// deslocamento do primeiro pixel
+	vector<short> peso;
+} FILTROMIP;
+
+// Funo interna que calcula a funo de Bessel modificada I0
+double _besselI0(double x)
+{
+	double soma = 1, termo = 1;
+	for(int k=1; termo > soma*1e-12; ++k)
 	{
-		fgets(aux,255,fp);
-		aux[strlen(aux)-1]=0;	// elimina o \n lido do arquivo
-		// Pula comentrios
-		if(aux[0]=='#') continue;
+		termo *= (x*x/4) / (k*k);
+		soma += termo;
+	}
+	return soma;
+}
 
-		// Definio da biblioteca de materiais ?
-		if(!strncmp(aux,"mtllib",6))
+// Funo interna que calcula o filtro de Kaiser (sinc com janela de
+// Kaiser) na distncia x, em pixels do nvel gerado
+double _kaiser(double x)
+{
+	if(fabs(x) >= RAIO_KAISER) return 0;
+	double sinc = x==0 ? 1 : sin(M_PI*x) / (M_PI*x);
+	double r = x / RAIO_KAISER;
+	return sinc * _besselI0(ALFA_KAISER*sqrt(1-r*r)) / _besselI0(ALFA_KAISER);
+}
+
+// Funo interna que limita um ndice de pixel a [0,tam)
+inline int _limitaIndice(int x, int tam)
+{
+	return x < 0 ? 0 : (x >= tam ? tam-1 : x);
+}
+
+// Funo interna que cria o filtro que reduz uma dimenso com tam
+// pixels para max(tam/2,1). Quando tam  mpar, cada amostra cobre
+// um pouco mais do que 2 pixels, e os pesos variam ao longo da
+// dimenso - assim toda a imagem contribui para o prximo nvel
+void _criaFiltroMip(int tam, char tipo, FILTROMIP &f)
+{
+	f.num = tam > 1 ? tam/2 : 1;
+	// Pixels do nvel original cobertos por uma amostra
+	double escala = (double) tam / f.num;
+	// Primeiro e ltimo pixels utilizados por cada amostra
+	vector<int> prim(f.num), ult(f.num);
+	int i, x, k;
+	for(i=0; i<f.num; ++i)
+	{
+		if(tipo == 'k')
 		{
-				// Chama funo para ler e interpretar o arquivo
-				// que define os materiais
-				_leMateriais(&aux[7]);
-				// Indica que o objeto possui materiais
-				obj->tem_materiais = true;
+			double centro = (i+0.5) * escala;
+			prim[i] = (int) ceil(centro - RAIO_KAISER*escala - 0.5);
+			ult[i] = (int) floor(centro + RAIO_KAISER*escala - 0.5);
 		}
-		// Seleo de material ?
-		if(!strncmp(aux,"usemtl",6))
+		else
 		{
-			// Procura pelo nome e salva o ndice para associar
-			// s prximas faces
-			material = _procuraMaterial(&aux[7]);
-			texid = -1;
+			prim[i] = (int) floor(i*escala);
+			ult[i] = (int) ceil((i+1)*escala) - 1;
 		}
-		// Seleo de uma textura (.jpg)
-		if(!strncmp(aux,"usemat",6))
+	}
+	f.desl = prim[0];
+	int fim = ult[0];
+	for(i=1; i<f.num; ++i)
+	{
+		if(prim[i]-2*i < f.desl) f.desl = prim[i]-2*i;
+		if(ult[i]-2*i > fim) fim = ult[i]-2*i;
+	}
+	f.taps = fim - f.desl + 1;
+	if(f.taps > MAX_TAPS_MIP) f.taps = MAX_TAPS_MIP;
+	f.peso.assign(f.taps*f.num, 0);
+
+	double peso[MAX_TAPS_MIP];
+	for(i=0; i<f.num; ++i)
+	{
+		double soma = 0;
+		for(k=0; k<f.taps; ++k)
 		{
-			// s vezes,  especificado o valor (null) como textura
-			// (especialmente em se tratando do mdulo de exportao
-			// do Blender)
-			if(!strcmp(&aux[7],"(null)"))
-			{
-				texid = -1;
-				continue;
-			}
-			// Tenta carregar a textura
-			ptr = CarregaTextura(&aux[7],mipmap);
-			texid = ptr->texid;
+			x = 2*i + f.desl + k;
+			peso[k] = 0;
+			if(x < prim[i] || x > ult[i]) continue;
+			if(tipo == 'k')
+				peso[k] = _kaiser((x + 0.5 - (i+0.5)*escala) / escala);
+			else
+				// Parte do pixel coberta pela amostra
+				peso[k] = min(x+1.0,(i+1)*escala) - max((double)x,i*escala);
+			soma += peso[k];
 		}
-		// Vrtice ?
-		if(!strncmp(aux,"v ",2))
+		// Converte para inteiros, garantindo a soma exata
+		// (o resto vai para o maior peso)
+		int total = 0, maior = 0;
+		for(k=0; k<f.taps; ++k)
+		{
+			short p = (short) floor(peso[k] / soma * (1<<BITS_PESO) + 0.5);
+			f.peso[k*f.num+i] = p;
+			total += p;
+			if(p > f.peso[maior*f.num+i]) maior = k;
+		}
+		f.peso[maior*f.num+i] += (1<<BITS_PESO) - total;
+	}
+}
+
+// A reduo  separvel: primeiro cada linha do prximo nvel 
+// filtrada verticalmente (resultado com 6 bits fracionrios, em
+// 16 bits), depois horizontalmente. Os clculos so feitos com
+// inteiros, de forma que as verses SSE e AVX2 das rotinas abaixo
+// produzem exatamente o mesmo resultado das escalares
+
+// Filtra verticalmente os pixels [ini,fim) das linhas indicadas
+void _filtraVerticalMip(const unsigned char **linhas, const short *pesos, int taps,
+	int ini, int fim, short *dest)
+{
+	for(int x=ini; x<fim; ++x)
+	{
+		int soma = 1<<7;
+		for(int k=0; k<taps; ++k)
+			soma += pesos[k] * linhas[k][x];
+		soma >>= 8;
+		dest[x] = soma < -32768 ? -32768 : (soma > 32767 ? 32767 : soma);
+	}
+}
+
+// Filtra horizontalmente as amostras [ini,f.num), sendo que os
+// pixels de ndice par (a partir de desl) esto em planos[0] e os
+// de ndice mpar em planos[1]
+void _filtraHorizontalMip(const short **planos, const FILTROMIP &f, int ini,
+	unsigned char *dest)
+{
+	for(int i=ini; i<f.num; ++i)
+	{
+		int soma = 1<<(2*BITS_PESO-9);
+		for(int k=0; k<f.taps; ++k)
+			soma += f.peso[k*f.num+i] * planos[k&1][i+(k>>1)];
+		soma >>= 2*BITS_PESO-8;
+		dest[i] = soma < 0 ? 0 : (soma > 255 ? 255 : soma);
+	}
+}
+
+#ifdef SIMD_X86
+
+// Funo interna que junta dois pesos para _mm_madd_epi16
+inline int _parPesos(short p1, short p2)
+{
+	return (int) ((unsigned short) p1 | ((unsigned int) (unsigned short) p2 << 16));
+}
+
+ALVO_SSE int _filtraVerticalMipSSE(const unsigned char **linhas, const short *pesos,
+	int taps, int largura, short *dest)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i arred = _mm_set1_epi32(1<<7);
+	__m128i pares[MAX_TAPS_MIP/2];
+	for(int k=0; k<taps; k+=2)
+		pares[k/2] = _mm_set1_epi32(_parPesos(pesos[k],k+1<taps ? pesos[k+1] : 0));
+	int x = 0;
+	for(; x+8<=largura; x+=8)
+	{
+		__m128i lo = arred, hi = arred;
+		for(int k=0; k<taps; k+=2)
+		{
+			__m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(linhas[k]+x)),zero);
+			__m128i b = k+1<taps ? _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(linhas[k+1]+x)),zero) : zero;
+			lo = _mm_add_epi32(lo,_mm_madd_epi16(_mm_unpacklo_epi16(a,b),pares[k/2]));
+			hi = _mm_add_epi32(hi,_mm_madd_epi16(_mm_unpackhi_epi16(a,b),pares[k/2]));
+		}
+		_mm_storeu_si128((__m128i *)(dest+x),
+			_mm_packs_epi32(_mm_srai_epi32(lo,8),_mm_srai_epi32(hi,8)));
+	}
+	return x;
+}
+
+ALVO_SSE int _filtraHorizontalMipSSE(const short **planos, const FILTROMIP &f,
+	unsigned char *dest)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i arred = _mm_set1_epi32(1<<(2*BITS_PESO-9));
+	int i = 0;
+	for(; i+8<=f.num; i+=8)
+	{
+		__m128i lo = arred, hi = arred;
+		for(int k=0; k<f.taps; k+=2)
 		{
-			sscanf(aux,"v %f %f %f",&obj->vertices[vcont].x,
-					&obj->vertices[vcont].y,
-					&obj->vertices[vcont].z);
-			if(!vcont)
-			{
-				minx = maxx = obj->vertices[vcont].x;
-				miny = maxy = obj->vertices[vcont].y;
-				minz = maxz = obj->vertices[vcont].z;
-			}
-			else
+			__m128i a = _mm_loadu_si128((const __m128i *)(planos[0]+i+k/2));
+			__m128i pa = _mm_loadu_si128((const __m128i *)(&f.peso[k*f.num+i]));
+			__m128i b = zero, pb = zero;
+			if(k+1 < f.taps)
 			{
-				if(obj->vertices[vcont].x < minx) minx = obj->vertices[vcont].x;
-				if(obj->vertices[vcont].y < miny) miny = obj->vertices[vcont].y;
-				if(obj->vertices[vcont].z < minz) minz = obj->vertices[vcont].z;
-				if(obj->vertices[vcont].x > maxx) maxx = obj->vertices[vcont].x;
-				if(obj->vertices[vcont].y > maxy) maxy = obj->vertices[vcont].y;
-				if(obj->vertices[vcont].z > maxz) maxz = obj->vertices[vcont].z;
+				b = _mm_loadu_si128((const __m128i *)(planos[1]+i+k/2));
+				pb = _mm_loadu_si128((const __m128i *)(&f.peso[(k+1)*f.num+i]));
 			}
-			vcont++;
+			lo = _mm_add_epi32(lo,_mm_madd_epi16(_mm_unpacklo_epi16(a,b),_mm_unpacklo_epi16(pa,pb)));
+			hi = _mm_add_epi32(hi,_mm_madd_epi16(_mm_unpackhi_epi16(a,b),_mm_unpackhi_epi16(pa,pb)));
 		}
-		// Normal ?
-		if(!strncmp(aux,"vn ",3))
+		__m128i r = _mm_packs_epi32(_mm_srai_epi32(lo,2*BITS_PESO-8),_mm_srai_epi32(hi,2*BITS_PESO-8));
+		_mm_storel_epi64((__m128i *)(dest+i),_mm_packus_epi16(r,r));
+	}
+	return i;
+}
+
+// As verses AVX2 tratam 16 pixels por vez: as operaes de
+// intercalao e empacotamento atuam em cada metade de 128 bits,
+// mantendo a ordem original dos pixels
+ALVO_AVX2 int _filtraVerticalMipAVX2(const unsigned char **linhas, const short *pesos,
+	int taps, int largura, short *dest)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i arred = _mm256_set1_epi32(1<<7);
+	__m256i pares[MAX_TAPS_MIP/2];
+	for(int k=0; k<taps; k+=2)
+		pares[k/2] = _mm256_set1_epi32(_parPesos(pesos[k],k+1<taps ? pesos[k+1] : 0));
+	int x = 0;
+	for(; x+16<=largura; x+=16)
+	{
+		__m256i lo = arred, hi = arred;
+		for(int k=0; k<taps; k+=2)
 		{
-			sscanf(aux,"vn %f %f %f",&obj->normais[ncont].x,
-					&obj->normais[ncont].y,
-					&obj->normais[ncont].z);
-			ncont++;
-			// Registra que o arquivo possui definio de normais por
-			// vrtice
-			obj->normais_por_vertice = true;
+			__m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(linhas[k]+x)));
+			__m256i b = k+1<taps ? _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(linhas[k+1]+x))) : zero;
+			lo = _mm256_add_epi32(lo,_mm256_madd_epi16(_mm256_unpacklo_epi16(a,b),pares[k/2]));
+			hi = _mm256_add_epi32(hi,_mm256_madd_epi16(_mm256_unpackhi_epi16(a,b),pares[k/2]));
 		}
-		// Texcoord ?
-		if(!strncmp(aux,"vt ",3))
+		_mm256_storeu_si256((__m256i *)(dest+x),
+			_mm256_packs_epi32(_mm256_srai_epi32(lo,8),_mm256_srai_epi32(hi,8)));
+	}
+	return x;
+}
+
+ALVO_AVX2 int _filtraHorizontalMipAVX2(const short **planos, const FILTROMIP &f,
+	unsigned char *dest)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i arred = _mm256_set1_epi32(1<<(2*BITS_PESO-9));
+	int i = 0;
+	for(; i+16<=f.num; i+=16)
+	{
+		__m256i lo = arred, hi = arred;
+		for(int k=0; k<f.taps; k+=2)
 		{
-			sscanf(aux,"vt %f %f %f",&obj->texcoords[tcont].s,
-					&obj->texcoords[tcont].t,
-					&obj->texcoords[tcont].r);
-			tcont++;
+			__m256i a = _mm256_loadu_si256((const __m256i *)(planos[0]+i+k/2));
+			__m256i pa = _mm256_loadu_si256((const __m256i *)(&f.peso[k*f.num+i]));
+			__m256i b = zero, pb = zero;
+			if(k+1 < f.taps)
+			{
+				b = _mm256_loadu_si256((const __m256i *)(planos[1]+i+k/2));
+				pb = _mm256_loadu_si256((const __m256i *)(&f.peso[(k+1)*f.num+i]));
+			}
+			lo = _mm256_add_epi32(lo,_mm256_madd_epi16(_mm256_unpacklo_epi16(a,b),_mm256_unpacklo_epi16(pa,pb)));
+			hi = _mm256_add_epi32(hi,_mm256_madd_epi16(_mm256_unpackhi_epi16(a,b),_mm256_unpackhi_epi16(pa,pb)));
 		}
-		// Face ?
-		if(!strncmp(aux,"f ",2))
+		__m256i r = _mm256_packs_epi32(_mm256_srai_epi32(lo,2*BITS_PESO-8),_mm256_srai_epi32(hi,2*BITS_PESO-8));
+		_mm_storeu_si128((__m128i *)(dest+i),
+			_mm_packus_epi16(_mm256_castsi256_si128(r),_mm256_extracti128_si256(r,1)));
+	}
+	return i;
+}
+
+#endif
+
+// Funo interna que gera o prximo nvel de mipmap (com
+// max(dimx/2,1) x max(dimy/2,1) pixels) a partir da imagem orig,
+// com ncomp componentes por pixel. As linhas do novo nvel so
+// divididas entre as threads (ver SetaNumThreads)
+void _geraNivelMipmap(const unsigned char *orig, int dimx, int dimy, int ncomp,
+	unsigned char *dest)
+{
+	FILTROMIP fx, fy;
+	_criaFiltroMip(dimx,_filtroMipmap,fx);
+	_criaFiltroMip(dimy,_filtroMipmap,fy);
+	int simd = _obtemSIMD();
+	int largura = dimx * ncomp;
+	// Tamanho de cada plano: amostras e pixels extras  direita
+	int tamplano = fx.num + fx.taps/2 + 1;
+
+	_executaIntervalos(fy.num, 16, [&](int ini, int fim) {
+		vector<short> vert(largura);
+		vector<short> planos(2*ncomp*tamplano);
+		vector<unsigned char> saida(fx.num);
+		const unsigned char *linhas[MAX_TAPS_MIP];
+		short pesos[MAX_TAPS_MIP];
+		for(int j=ini; j<fim; ++j)
 		{
-			// Pula "f "
-			char *ptr = aux+2;
-			// Associa  face o ndice do material corrente, ou -1 se
-			// no houver
-			obj->faces[fcont].mat = material;
-			// Associa  face o texid da textura seleciona ou -1 se
-			// no ouver
-			obj->faces[fcont].texid = texid;
-			// Temporrios para armazenar os ndices desta face
-			int vi[10],ti[10],ni[10];
-			// Separador encontrado
-			char sep;
-			obj->faces[fcont].nv = 0;
-			int nv = 0;
-			bool tem_t = false;
-			bool tem_n = false;
-			// Interpreta a descrio da face
-			while(*ptr)
+			int k, c, x = 0;
+			for(k=0; k<fy.taps; ++k)
 			{
-				// L ndice do vrtice
-				vi[nv] = leNum(&ptr,&sep);
-				// Se o separador for espao, significa que
-				// no temos texcoord nem normais
-				if(sep==' ')
-				{
-					// Nesse caso, incrementamos o contador
-					// de vrtices e continuamos
-					nv++;
-					continue;
-				}
-				// L ndice da texcoord
-				int aux = leNum(&ptr,&sep);
-				// Se o valor for != -1, significa
-				// que existe um ndice de texcoord
-				if(aux!=-1)
-				{
-					ti[nv] = aux;
-					tem_t = true;
-				}
-				// Mas se o separador for " ", significa
-				// que no existe um ndice de normal
-				if(sep==' ')
-				{
-					// E nesse caso, pulamos para
-					// o prximo vrtice
-					nv++;
-					continue;
-				}
-				// L o ndice da normal
-				aux = leNum(&ptr,&sep);
-				if(aux!=-1)
-				{
-					ni[nv] = aux;
-					tem_n = true;
-				}
-				// Prepara para prximo vrtice
-				nv++;
+				linhas[k] = orig + _limitaIndice(2*j+fy.desl+k,dimy) * largura;
+				pesos[k] = fy.peso[k*fy.num+j];
 			}
-			// Fim da face, aloca memria para estruturas e preenche com
-			// os valores lidos
-			obj->faces[fcont].nv = nv;
-			obj->faces[fcont].vert = (int *) malloc(sizeof(int)*nv);
-			// S aloca memria para normais e texcoords se for necessrio
-			if(tem_n) obj->faces[fcont].norm = (int *) malloc(sizeof(int)*nv);
-				else obj->faces[fcont].norm = NULL;
-			if(tem_t) obj->faces[fcont].tex  = (int *) malloc(sizeof(int)*nv);
-				else obj->faces[fcont].tex = NULL;
-			// Copia os ndices dos arrays temporrios para a face
-			for(i=0;i<nv;++i)
+#ifdef SIMD_X86
+			switch(simd)
 			{
-				// Subtramos -1 dos ndices porque o formato OBJ comea
-				// a contar a partir de 1, no 0
-				obj->faces[fcont].vert[i] = vi[i]-1;
-				if(tem_n) obj->faces[fcont].norm[i] = ni[i]-1;
-				if(tem_t) obj->faces[fcont].tex[i]  = ti[i]-1;
+				case SIMD_AVX2: x = _filtraVerticalMipAVX2(linhas,pesos,fy.taps,largura,&vert[0]); break;
+				case SIMD_SSE:  x = _filtraVerticalMipSSE(linhas,pesos,fy.taps,largura,&vert[0]); break;
 			}
-			// Prepara para prxima face
-			fcont++;
-		}
-	}
-#ifdef DEBUG
-	printf("Limites: %f %f %f - %f %f %f\n",minx,miny,minz,maxx,maxy,maxz);
 #endif
-	// Fim, fecha arquivo e retorna apontador para objeto
-	fclose(fp);
-	// Adiciona na lista
-	_objetos.push_back(obj);
-	return obj;
+			_filtraVerticalMip(linhas,pesos,fy.taps,x,largura,&vert[0]);
+
+			// Separa cada componente nos planos par e mpar, j
+			// repetindo os pixels da borda
+			for(x=0; x<2*tamplano; ++x)
+			{
+				const short *pixel = &vert[_limitaIndice(x+fx.desl,dimx) * ncomp];
+				for(c=0; c<ncomp; ++c)
+					planos[((x&1)*ncomp+c)*tamplano + x/2] = pixel[c];
+			}
+			unsigned char *linha = dest + j * fx.num * ncomp;
+			for(c=0; c<ncomp; ++c)
+			{
+				const short *pc[2] = { &planos[c*tamplano], &planos[(ncomp+c)*tamplano] };
+				int i = 0;
+#ifdef SIMD_X86
+				switch(simd)
+				{
+					case SIMD_AVX2: i = _filtraHorizontalMipAVX2(pc,fx,&saida[0]); break;
+					case SIMD_SSE:  i = _filtraHorizontalMipSSE(pc,fx,&saida[0]); break;
+				}
+#endif
+				_filtraHorizontalMip(pc,fx,i,&saida[0]);
+				if(ncomp == 1)
+					memcpy(linha,&saida[0],fx.num);
+				else
+					for(i=0; i<fx.num; ++i)
+						linha[i*ncomp+c] = saida[i];
+			}
+		}
+	});
 }
 
-// Seta o modo de desenho a ser utilizado para os objetos
-// 'w' - wireframe
-// 's' - slido
-// 't' - slido + textura
-void SetaModoDesenho(char modo)
+// Funo interna que indica se OpenGL aceita texturas cujas dimenses
+// no so potncias de 2 (OpenGL 2.0 ou extenso equivalente)
+bool _suportaNPOT()
 {
-	if(modo!='w' && modo!='s' && modo!='t') return;
-	_modo = modo;
+	static int suporta = -1;
+	if(suporta < 0)
+	{
+		const char *versao = (const char *) glGetString(GL_VERSION);
+		const char *ext = (const char *) glGetString(GL_EXTENSIONS);
+		suporta = (versao && atoi(versao) >= 2)
+			|| (ext && strstr(ext,"GL_ARB_texture_non_power_of_two"));
+	}
+	return suporta;
 }
 
-// Desenha um objeto 3D passado como parmetro.
-void DesenhaObjeto(OBJ *obj)
+// Funo interna que envia uma imagem e todos os seus nveis de
+// mipmap (at 1x1) para o alvo indicado (GL_TEXTURE_2D ou uma face
+// de cube map) da textura corrente, com o formato interno indicado
+void _enviaMipmaps(GLenum alvo, GLint interno, const unsigned char *imagem, int dimx, int dimy, int ncomp)
 {
-	int i;	// contador
-	GLint ult_texid, texid;	// ltima/atual textura 
-	GLenum prim = GL_POLYGON;	// tipo de primitiva
-	GLfloat branco[4] = { 1.0, 1.0, 1.0, 1.0 };	// constante para cor branca
-
-	// Gera nova display list se for o caso
-	if(obj->dlist >= 1000)
-		glNewList(obj->dlist-1000,GL_COMPILE_AND_EXECUTE);
-	// Ou chama a display list j associada...
-	else if(obj->dlist > -1)
+	GLenum formato = ncomp==1 ? GL_LUMINANCE : GL_RGB;
+	// Sem suporte a dimenses arbitrrias, a imagem
+	// precisa ser redimensionada pela GLU
+	if(((dimx & (dimx-1)) || (dimy & (dimy-1))) && !_suportaNPOT())
 	{
-		glCallList(obj->dlist);
+		gluBuild2DMipmaps(alvo, interno, dimx, dimy,
+			formato, GL_UNSIGNED_BYTE, imagem);
 		return;
 	}
+	glTexImage2D(alvo, 0, interno, dimx, dimy, 0, formato, GL_UNSIGNED_BYTE, imagem);
+	unsigned char *nivel = NULL;
+	for(int n=1; dimx>1 || dimy>1; ++n)
+	{
+		int prox_x = dimx>1 ? dimx/2 : 1;
+		int prox_y = dimy>1 ? dimy/2 : 1;
+		unsigned char *prox = (unsigned char *) malloc(prox_x*prox_y*ncomp);
+		_geraNivelMipmap(imagem,dimx,dimy,ncomp,prox);
+		free(nivel);
+		imagem = nivel = prox;
+		dimx = prox_x;
+		dimy = prox_y;
+		glTexImage2D(alvo, n, interno, dimx, dimy, 0, formato, GL_UNSIGNED_BYTE, imagem);
+	}
+	free(nivel);
+}
 
-	// Seleciona GL_LINE_LOOP se o objetivo
-	// for desenhar o objeto em wireframe
-	if(_modo=='w') prim = GL_LINE_LOOP;
+// Divisor aplicado s dimenses das texturas na decodificao
+// (ver SetaReducaoTexturas)
+int _reducaoTexturas = 1;
 
-	// Salva atributos de iluminao e materiais
-	glPushAttrib(GL_LIGHTING_BIT);
-	glDisable(GL_TEXTURE_2D);
-	// Se objeto possui materiais associados a ele,
-	// desabilita COLOR_MATERIAL - caso contrrio,
-	// mantm estado atual, pois usurio pode estar
-	// utilizando o recurso para colorizar o objeto
-	if(obj->tem_materiais)
-		glDisable(GL_COLOR_MATERIAL);
+// Protege _memoriaTexturas (as texturas podem ser decodificadas
+// em segundo plano)
+mutex _mtxOrcamento;
 
-	// Armazena id da ltima textura utilizada
-	// (por enquanto, nenhuma)
-	ult_texid = -1;
-	// Varre todas as faces do objeto
-	for(i=0; i<obj->numFaces; i++)
-	{
-		// Usa normais calculadas por face (flat shading) se
-		// o objeto no possui normais por vrtice
-		if(!obj->normais_por_vertice)
-			glNormal3f(obj->normais[i].x,obj->normais[i].y,obj->normais[i].z);
+// Define o divisor aplicado s dimenses das texturas carregadas por
+// CarregaTextura: 1 (resoluo original), 2, 4 ou 8. A reduo 
+// feita pela prpria libjpeg durante a decodificao, que fica
+// proporcionalmente mais rpida
+void SetaReducaoTexturas(int divisor)
+{
+	if(divisor==1 || divisor==2 || divisor==4 || divisor==8)
+		_reducaoTexturas = divisor;
+}
 
-		// Existe um material associado  face ?
-		if(obj->faces[i].mat != -1)
-		{
-			// Sim, envia parmetros para OpenGL
-			int mat = obj->faces[i].mat;
-			glMaterialfv(GL_FRONT,GL_AMBIENT,_materiais[mat]->ka);
-			// Se a face tem textura, ignora a cor difusa do material
-			// (caso contrrio, a textura  colorizada em GL_MODULATE)
-			if(obj->faces[i].texid != -1 && _modo=='t')
-				glMaterialfv(GL_FRONT,GL_DIFFUSE,branco);
-			else
-				glMaterialfv(GL_FRONT,GL_DIFFUSE,_materiais[mat]->kd);
-			glMaterialfv(GL_FRONT,GL_SPECULAR,_materiais[mat]->ks);
-			glMaterialfv(GL_FRONT,GL_EMISSION,_materiais[mat]->ke);
-			glMaterialf(GL_FRONT,GL_SHININESS,_materiais[mat]->spec);
-		}
+// Define um oramento (em bytes) para a memria ocupada pelas
+// texturas carregadas por CarregaTextura, considerando 3 bytes por
+// texel, sem mipmaps (0 = ilimitado). Cada textura  reduzida (at
+// 1/8, a partir do divisor de SetaReducaoTexturas) o quanto for
+// necessrio para caber no que ainda resta do oramento
+void SetaOrcamentoTexturas(long long bytes)
+{
+	if(bytes >= 0) _orcamentoTexturas = bytes;
+}
 
-		// Se o objeto possui uma textura associada, utiliza
-		// o seu texid ao invs da informao em cada face
-		if(obj->textura != -1)
-			texid = obj->textura;
-		else
-			// L o texid associado  face (-1 se no houver)
-			texid = obj->faces[i].texid;
+// Funo interna que retorna o tamanho, em bytes, de uma textura
+// com dimx x dimy texels decodificada com o divisor indicado
+// (como a libjpeg, arredonda as dimenses para cima)
+long long _tamTextura(int dimx, int dimy, int divisor)
+{
+	return (long long) ((dimx+divisor-1)/divisor) * ((dimy+divisor-1)/divisor) * 3;
+}
 
-		// Se a ltima face usou textura e esta no,
-		// desabilita
-		if(texid == -1 && ult_texid != -1)
-			glDisable(GL_TEXTURE_2D);
+// Funo interna que escolhe o divisor para uma textura com
+// dimx x dimy texels, de acordo com o oramento. Se reserva for
+// true, contabiliza a memria ocupada
+int _escolheReducao(int dimx, int dimy, bool reserva)
+{
+	lock_guard<mutex> trava(_mtxOrcamento);
+	int divisor = _reducaoTexturas;
+	if(_orcamentoTexturas > 0)
+		while(divisor < 8 &&
+			_memoriaTexturas + _tamTextura(dimx,dimy,divisor) > _orcamentoTexturas)
+			divisor *= 2;
+	if(reserva)
+		_memoriaTexturas += _tamTextura(dimx,dimy,divisor);
+	return divisor;
+}
 
-		// Ativa texturas 2D se houver necessidade
-		if (texid != -1 && texid != ult_texid && _modo=='t')
-		{
-		       glEnable(GL_TEXTURE_2D);
-		       glBindTexture(GL_TEXTURE_2D,texid);
-		}
+// Indica se CarregaTextura deve usar o cache de texturas
+// decodificadas (ver SetaCacheTexturas)
+bool _usaCacheTexturas = false;
+// Indica se as texturas devem ser comprimidas pelo driver
+bool _comprimeTexturas = false;
 
-		// Inicia a face
-		glBegin(prim);
-		// Para todos os vrtices da face
-		for(int vf=0; vf<obj->faces[i].nv;++vf)
-		{
-			// Se houver normais definidas para cada vrtice,
-			// envia a normal correspondente
-			if(obj->normais_por_vertice)
-				glNormal3f(obj->normais[obj->faces[i].norm[vf]].x,
-				obj->normais[obj->faces[i].norm[vf]].y,
-				obj->normais[obj->faces[i].norm[vf]].z);
+// Formato comprimido utilizado (caso no exista em GL/gl.h)
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT	0x83F0
+#endif
 
-			// Se houver uma textura associada...
-			if(texid!=-1)
-				// Envia as coordenadas associadas ao vrtice
-				glTexCoord2f(obj->texcoords[obj->faces[i].tex[vf]].s,
-				obj->texcoords[obj->faces[i].tex[vf]].t);
-			// Envia o vrtice em si
-			glVertex3f(obj->vertices[obj->faces[i].vert[vf]].x,
-		    	obj->vertices[obj->faces[i].vert[vf]].y,
-			obj->vertices[obj->faces[i].vert[vf]].z);
-		}
-		// Finaliza a face
-		glEnd();
+// Identificao e verso do formato do cache de texturas
+#define MAGICA_CACHE_TEX	"BTEX"
+#define VERSAO_CACHE_TEX	3
 
-		// Salva a ltima texid utilizada
-		ult_texid = texid;
-	} // fim da varredura de faces
-	
-	// Finalmente, desabilita as texturas
-	glDisable(GL_TEXTURE_2D);
-	// Restaura os atributos de iluminao e materiais
-	glPopAttrib();
-	// Se for uma nova display list...
-	if(obj->dlist >= 1000)
+// Nmero mximo de nveis de mipmap armazenados
+#define MAX_NIVEIS_TEX	32
+
+// Cabealho do arquivo de cache de uma textura
+typedef struct {
+	char magica[4];			// MAGICA_CACHE_TEX
+	GLint versao;			// VERSAO_CACHE_TEX
+	long long tamOrigem;	// tamanho do arquivo JPEG de origem
+	long long dataOrigem;	// data de modificao da origem
+	GLint ncomp;			// componentes da imagem e dos nveis no comprimidos
+	GLint dimOrigem[2];		// dimenses da imagem original
+	GLint reducao;			// divisor usado na decodificao
+	GLenum formato;			// GL_RGB ou formato comprimido
+	GLint filtro;			// filtro dos mipmaps (ver SetaFiltroMipmap)
+	GLint numNiveis;		// 1 se no houver mipmaps
+	GLint dim[MAX_NIVEIS_TEX][2];		// dimenses de cada nvel
+	long long desl[MAX_NIVEIS_TEX];		// posio de cada nvel no arquivo
+	long long tam[MAX_NIVEIS_TEX];		// tamanho de cada nvel em bytes
+	long long tamTotal;		// tamanho do arquivo de cache
+} CABTEXC;
+
+// Ativa ou desativa o cache de texturas. Quando ativado,
+// CarregaTextura grava ao lado de cada arquivo JPEG lido um arquivo
+// .texc com a imagem j decodificada e todos os nveis de mipmap,
+// exatamente como foram enviados para OpenGL. Nas cargas seguintes,
+// enquanto o arquivo JPEG no for alterado, o .texc  mapeado em
+// memria e enviado diretamente, sem decodificao.
+//
+// Se comprime for true e o driver suportar S3TC, as texturas so
+// comprimidas (DXT1) pelo driver e armazenadas j comprimidas
+void SetaCacheTexturas(bool usa, bool comprime)
+{
+	_usaCacheTexturas = usa;
+	_comprimeTexturas = comprime;
+}
+
+// Funo interna que retorna o formato interno utilizado para as
+// texturas: GL_RGB, ou o formato comprimido, se pedido e suportado
+GLenum _formatoTexturas()
+{
+#ifdef GL_VERSION_1_3
+	static int suporta = -1;
+	if(!_comprimeTexturas) return GL_RGB;
+	if(suporta < 0)
 	{
-		// Finaliza a display list
-		glEndList();
-		// E armazena a identificao correta
-		obj->dlist-=1000;
+		const char *ext = (const char *) glGetString(GL_EXTENSIONS);
+		suporta = ext && strstr(ext,"GL_EXT_texture_compression_s3tc");
+	}
+	if(suporta) return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+#endif
+	return GL_RGB;
+}
+
+// Funo interna que monta o nome do arquivo de cache de uma textura
+void _nomeCacheTextura(const char *arquivo, char *nomeCache, int tam)
+{
+	snprintf(nomeCache,tam,"%s.texc",arquivo);
+}
+
+// Funo interna que obtm as dimenses de uma imagem JPEG,
+// lendo apenas o seu cabealho
+bool _dimensoesJPG(const char *arquivo, int &dimx, int &dimy)
+{
+	struct jpeg_decompress_struct cinfo;
+	jpeg_error_mgr jerr;
+	FILE *fp = fopen(arquivo,"rb");
+	if(fp == NULL) return false;
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_decompress(&cinfo);
+	jpeg_stdio_src(&cinfo,fp);
+	jpeg_read_header(&cinfo,TRUE);
+	dimx = cinfo.image_width;
+	dimy = cinfo.image_height;
+	jpeg_destroy_decompress(&cinfo);
+	fclose(fp);
+	return true;
+}
+
+// Funo interna que grava o cache de uma textura recm enviada
+// para OpenGL. Os nveis so lidos de volta da prpria textura,
+// portanto ficam no formato em que o driver os armazenou (sem
+// compresso, com os mesmos componentes da imagem: GL_LUMINANCE
+// ou GL_RGB)
+void _gravaCacheTextura(TEX *tex, const char *arquivo)
+{
+	CABTEXC cab;
+	char nomeCache[512], nomeTemp[520];
+	struct stat st;
+	if(stat(arquivo,&st)) return;
+
+	memset(&cab,0,sizeof(cab));
+	memcpy(cab.magica,MAGICA_CACHE_TEX,4);
+	cab.versao = VERSAO_CACHE_TEX;
+	cab.tamOrigem  = st.st_size;
+	cab.dataOrigem = st.st_mtime;
+	cab.ncomp = tex->ncomp == 1 ? 1 : 3;
+	cab.reducao = tex->reducao;
+	cab.filtro = _filtroMipmap;
+	if(!_dimensoesJPG(arquivo,cab.dimOrigem[0],cab.dimOrigem[1])) return;
+
+	_nomeCacheTextura(arquivo,nomeCache,sizeof(nomeCache));
+	snprintf(nomeTemp,sizeof(nomeTemp),"%s.tmp",nomeCache);
+	FILE *fp = fopen(nomeTemp,"wb");
+	if(fp == NULL) return;
+	// O cabealho  reescrito no final, com as posies dos nveis
+	fwrite(&cab,sizeof(cab),1,fp);
+
+	glBindTexture(GL_TEXTURE_2D, tex->texid);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	GLint comprimida = 0;
+#ifdef GL_VERSION_1_3
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &comprimida);
+	if(comprimida)
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, (GLint *) &cab.formato);
+	else
+#endif
+		cab.formato = GL_RGB;
+	GLenum formatoNivel = cab.ncomp == 1 ? GL_LUMINANCE : GL_RGB;
+	vector<unsigned char> nivel;
+	for(int n=0; n<MAX_NIVEIS_TEX; ++n)
+	{
+		GLint dimx = 0, dimy = 0;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, n, GL_TEXTURE_WIDTH, &dimx);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, n, GL_TEXTURE_HEIGHT, &dimy);
+		// Fim da cadeia de mipmaps (ou textura sem mipmaps)
+		if(dimx <= 0 || dimy <= 0) break;
+		GLint tam = dimx * dimy * cab.ncomp;
+#ifdef GL_VERSION_1_3
+		if(comprimida)
+		{
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, n, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &tam);
+			nivel.resize(tam);
+			glGetCompressedTexImage(GL_TEXTURE_2D, n, nivel.data());
+		}
+		else
+#endif
+		{
+			nivel.resize(tam);
+			glGetTexImage(GL_TEXTURE_2D, n, formatoNivel, GL_UNSIGNED_BYTE, nivel.data());
+		}
+		cab.dim[n][0] = dimx;
+		cab.dim[n][1] = dimy;
+		cab.tam[n] = tam;
+		_gravaBloco(fp,cab.desl[n],nivel.data(),tam);
+		cab.numNiveis = n+1;
+		if(dimx == 1 && dimy == 1) break;
 	}
+	cab.tamTotal = ftell(fp);
+	fseek(fp,0,SEEK_SET);
+	fwrite(&cab,sizeof(cab),1,fp);
+	bool erro = ferror(fp) != 0 || !cab.numNiveis;
+	fclose(fp);
+	if(erro || rename(nomeTemp,nomeCache))
+		remove(nomeTemp);
 }
 
-// Funo interna para liberar a memria ocupada
-// por um objeto
-void _liberaObjeto(OBJ *obj)
+// Funo interna que verifica se os nveis de um cache de textura
+// esto dentro do arquivo e, sem compresso, tm o tamanho esperado
+bool _niveisCacheValidos(const CABTEXC *cab)
 {
-	// Libera arrays
-	if (obj->vertices != NULL)  free(obj->vertices);
-	if (obj->normais != NULL)   free(obj->normais);
-	if (obj->texcoords != NULL) free(obj->texcoords);
-	// Para cada face...
-	for(int i=0; i<obj->numFaces;++i)
+	for(int n=0; n<cab->numNiveis; ++n)
 	{
-		// Libera as listas de vrtices da face
-		if (obj->faces[i].vert != NULL) free(obj->faces[i].vert);
-		// Libera as listas de normais da face
-		if (obj->faces[i].norm != NULL) free(obj->faces[i].norm);
-		// Libera as listas de texcoords da face
-		if (obj->faces[i].tex  != NULL) free(obj->faces[i].tex);
+		if(cab->dim[n][0] < 1 || cab->dim[n][1] < 1 || cab->tam[n] < 1
+			|| cab->desl[n] < (long long) sizeof(CABTEXC)
+			|| cab->desl[n] > cab->tamTotal - cab->tam[n])
+			return false;
+		if(cab->formato == GL_RGB
+			&& cab->tam[n] != (long long) cab->dim[n][0] * cab->dim[n][1] * cab->ncomp)
+			return false;
 	}
-	// Libera array de faces
-	if (obj->faces != NULL) free(obj->faces);
-	// Finalmente, libera a estrutura principal
-	free(obj);
+	return true;
 }
 
-// Libera memria ocupada por um objeto 3D
-void LiberaObjeto(OBJ *obj)
+// Funo interna que tenta criar uma textura a partir do seu cache.
+// Retorna NULL se o cache no existir, estiver desatualizado em
+// relao ao arquivo JPEG ou no corresponder  forma de carga
+// atual (mipmaps, filtro, formato ou reduo)
+TEX *_leCacheTextura(const char *arquivo, bool mipmap)
 {
-	unsigned int o;
-	if(obj==NULL)	// se for NULL, libera todos os objetos
+	char nomeCache[512];
+	ARQMEM arq;
+	struct stat st;
+
+	if(stat(arquivo,&st)) return NULL;
+	_nomeCacheTextura(arquivo,nomeCache,sizeof(nomeCache));
+	if(!_mapeiaArquivo(nomeCache,&arq))
+		return NULL;
+	CABTEXC *cab = (CABTEXC *) arq.dados;
+	if(arq.tam < sizeof(CABTEXC) || memcmp(cab->magica,MAGICA_CACHE_TEX,4)
+		|| cab->versao != VERSAO_CACHE_TEX || cab->tamTotal != (long long) arq.tam
+		|| cab->tamOrigem != st.st_size || cab->dataOrigem != st.st_mtime
+		|| cab->numNiveis < 1 || cab->numNiveis > MAX_NIVEIS_TEX
+		|| (cab->ncomp != 1 && cab->ncomp != 3) || !_niveisCacheValidos(cab)
+		|| cab->formato != _formatoTexturas()
+		|| cab->reducao != _escolheReducao(cab->dimOrigem[0],cab->dimOrigem[1],false)
+		// Para mipmaps, a cadeia precisa estar completa
+		// e ter sido gerada com o filtro atual
+		|| (mipmap && (cab->filtro != _filtroMipmap
+			|| cab->dim[cab->numNiveis-1][0] != 1 || cab->dim[cab->numNiveis-1][1] != 1)))
 	{
-		for(o=0;o<_objetos.size();++o)
-			_liberaObjeto(_objetos[o]);
-		_objetos.clear();
+#ifdef DEBUG
+		printf("Cache desatualizado ou invlido: %s\n",nomeCache);
+#endif
+		_liberaArquivo(&arq);
+		return NULL;
 	}
-	else
+
+	TEX *tex = (TEX *) malloc(sizeof(TEX));
+	if(tex == NULL)
 	{
-		// Procura pelo objeto no vector
-		vector<OBJ*>::iterator it = _objetos.begin();
-		for(it = _objetos.begin(); it<_objetos.end(); ++it)
-			// e sai do loop quando encontrar
-			if(*it == obj)
-				break;
-		// Apaga do vector
-		_objetos.erase(it);
-		// E libera as estruturas internas
-		_liberaObjeto(obj);
+		_liberaArquivo(&arq);
+		return NULL;
 	}
-}
-
-// Libera memria ocupada pela lista de materiais e texturas
-void LiberaMateriais()
-{
-	unsigned int i;
-#ifdef DEBUG
-	printf("Total de materiais: %d\n",_materiais.size());
-#endif
-	// Para cada material
-	for(i=0;i<_materiais.size();++i)
+	tex->ncomp = cab->ncomp;
+	tex->dimx  = cab->dim[0][0];
+	tex->dimy  = cab->dim[0][1];
+	tex->data  = NULL;
+	tex->reducao = cab->reducao;
 	{
-#ifdef DEBUG
-		printf("%s a: (%f,%f,%f,%f) - d: (%f,%f,%f,%f) - e: (%f,%f,%f,%f - %f)\n",_materiais[i]->nome,
-				_materiais[i]->ka[0],_materiais[i]->ka[1],_materiais[i]->ka[2], _materiais[i]->ka[3],
-				_materiais[i]->kd[0],_materiais[i]->kd[1],_materiais[i]->kd[2], _materiais[i]->kd[3],
-				_materiais[i]->ks[0],_materiais[i]->ks[1],_materiais[i]->ks[2], _materiais[i]->ks[3],
-				_materiais[i]->spec);
-#endif
-		// Libera material
-		free(_materiais[i]);
+		lock_guard<mutex> trava(_mtxOrcamento);
+		_memoriaTexturas += _tamTextura(cab->dimOrigem[0],cab->dimOrigem[1],cab->reducao);
 	}
-	// Limpa lista
-	_materiais.clear();
-#ifdef DEBUG
-	printf("Total de texturas: %d\n",_texturas.size());
-#endif
-	// Para cada textura
-	for(i=0;i<_texturas.size();++i)
+	glGenTextures(1, &tex->texid);
+	glBindTexture(GL_TEXTURE_2D, tex->texid);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	// Os nveis so enviados diretamente do arquivo mapeado
+	int niveis = mipmap ? cab->numNiveis : 1;
+	for(int n=0; n<niveis; ++n)
 	{
-		// Libera textura - no  necessrio liberar a imagem, pois esta j
-		// foi liberada durante a carga da textura - ver CarregaTextura
-#ifdef DEBUG
-		printf("%s: %d x %d (id: %d)\n",_texturas[i]->nome,_texturas[i]->dimx,
-				_texturas[i]->dimy,_texturas[i]->texid);
+		const char *dados = arq.dados + cab->desl[n];
+#ifdef GL_VERSION_1_3
+		if(cab->formato != GL_RGB)
+			glCompressedTexImage2D(GL_TEXTURE_2D, n, cab->formato, cab->dim[n][0], cab->dim[n][1],
+				0, cab->tam[n], dados);
+		else
 #endif
-		free(_texturas[i]);
+			glTexImage2D(GL_TEXTURE_2D, n, GL_RGB, cab->dim[n][0], cab->dim[n][1],
+				0, cab->ncomp == 1 ? GL_LUMINANCE : GL_RGB, GL_UNSIGNED_BYTE, dados);
 	}
-	// Limpa lista
-	_texturas.clear();
-}
-
-// Calcula o vetor normal de cada face de um objeto 3D.
-void CalculaNormaisPorFace(OBJ *obj)
-{
-	int i;
-	// Retorna se o objeto j possui normais por vrtice
-	if(obj->normais_por_vertice) return;
-	// Aloca memria para as normais (uma por face)
-	if ( ( obj->normais = (VERT *) malloc((sizeof(VERT)) * obj->numFaces) ) == NULL )
-			return;
-	// Varre as faces e calcula a normal, usando os 3 primeiros vrtices de
-	// cada uma
-	for(i=0; i<obj->numFaces; i++)
-	VetorNormal(obj->vertices[obj->faces[i].vert[0]],
-		obj->vertices[obj->faces[i].vert[1]],
-		obj->vertices[obj->faces[i].vert[2]],obj->normais[i]);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmap ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	_liberaArquivo(&arq);
+#ifdef DEBUG
+	printf("Textura: %s (cache)\n",arquivo);
+#endif
+	return tex;
 }
 
-// Funo para ler um arquivo JPEG e criar uma
-// textura OpenGL
+// Funo interna que envia a imagem de uma textura para OpenGL,
+// usando a id j gerada, e libera a memria ocupada pela imagem
 // mipmap = true se deseja-se utilizar mipmaps
-TEX *CarregaTextura(char *arquivo, bool mipmap)
+void _enviaTextura(TEX *pImage, bool mipmap)
 {
+	ZONA zona("envio de textura");
 	GLenum formato;
 
-	if(!arquivo)		// retornamos NULL caso nenhum nome de arquivo seja informado
-		return NULL;
-
-	int indice = _procuraTextura(arquivo);
-	// Se textura j foi carregada, retorna
-	// apontador para ela
-	if(indice!=-1)
-		return _texturas[indice];
-
-	TEX *pImage = CarregaJPG(arquivo);	// carrega o arquivo JPEG
-
-	if(pImage == NULL)	// se no foi possvel carregar o arquivo, finaliza o programa
-		exit(0);
-
-	strcpy(pImage->nome,arquivo);
-	// Gera uma identificao para a nova textura
-	glGenTextures(1, &pImage->texid);
-
 	// Informa o alinhamento da textura na memria
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	// Informa que a textura  a corrente
@@ -911,16 +7782,15 @@ TEX *CarregaTextura(char *arquivo, bool mipmap)
 	if(mipmap)
 	{
 		// Cria mipmaps para obter maior qualidade
-		gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGB, pImage->dimx, pImage->dimy,
-			formato, GL_UNSIGNED_BYTE, pImage->data);
+		_enviaMipmaps(GL_TEXTURE_2D, _formatoTexturas(), pImage->data, pImage->dimx, pImage->dimy, pImage->ncomp);
 		// Ajusta os filtros iniciais para a textura
 		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	}
 	else
 	{
 		// Envia a textura para OpenGL, usando o formato RGB
-		glTexImage2D (GL_TEXTURE_2D, 0, GL_RGB, pImage->dimx, pImage->dimx,
+		glTexImage2D (GL_TEXTURE_2D, 0, _formatoTexturas(), pImage->dimx, pImage->dimy,
 			0, formato, GL_UNSIGNED_BYTE, pImage->data);
 		// Ajusta os filtros iniciais para a textura
 		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -930,9 +7800,210 @@ TEX *CarregaTextura(char *arquivo, bool mipmap)
 	// Finalmente, libera a memria ocupada pela imagem (j que a textura j foi enviada para OpenGL)
 
 	free(pImage->data); 	// libera a memria ocupada pela imagem
+	pImage->data = NULL;
+}
+
+// Indica se CarregaTextura deve decodificar as imagens em
+// segundo plano (ver SetaTexturasAssincronas)
+bool _texturasAssincronas = false;
+
+// Decodificao de uma textura em segundo plano
+typedef struct {
+	TEX *tex;			// textura j includa na lista (com texid definitivo)
+	string arquivo;		// arquivo JPEG a decodificar
+	bool mipmap;
+	TEX *imagem;		// imagem decodificada (NULL se houve erro)
+	bool pronta;		// true quando a decodificao terminar
+} DECODIFICACAO;
+
+// Decodificaes ainda no enviadas para OpenGL - s  acessada
+// pela thread que carrega as texturas (onde est o contexto)
+vector<DECODIFICACAO*> _decodificacoes;
+
+// Conjunto de threads que decodificam as texturas: a fila e os
+// campos imagem e pronta das decodificaes so protegidos por
+// mutex
+struct _DECODIFICADOR {
+	vector<thread> threads;
+	vector<DECODIFICACAO*> fila;	// aguardando uma thread
+	mutex mtx;
+	condition_variable novaTarefa, tarefaPronta;
+	bool encerra;
+
+	_DECODIFICADOR() : encerra(false) {}
+	// Encerra as threads no trmino do programa
+	~_DECODIFICADOR()
+	{
+		{
+			lock_guard<mutex> trava(mtx);
+			encerra = true;
+		}
+		novaTarefa.notify_all();
+		for(unsigned int i=0; i<threads.size(); ++i)
+			threads[i].join();
+	}
+	// Lao executado por cada thread
+	void executa()
+	{
+		unique_lock<mutex> trava(mtx);
+		for(;;)
+		{
+			novaTarefa.wait(trava, [this]() { return encerra || !fila.empty(); });
+			if(encerra) return;
+			DECODIFICACAO *dec = fila.front();
+			fila.erase(fila.begin());
+			trava.unlock();
+			TEX *imagem = CarregaJPG(dec->arquivo.c_str(),true,0);
+			trava.lock();
+			dec->imagem = imagem;
+			dec->pronta = true;
+			tarefaPronta.notify_all();
+		}
+	}
+	// Coloca uma decodificao na fila, criando as threads na
+	// primeira vez
+	void adiciona(DECODIFICACAO *dec)
+	{
+		if(threads.empty())
+		{
+			int num = _obtemNumThreads();
+			for(int i=0; i<num; ++i)
+				threads.push_back(thread(&_DECODIFICADOR::executa,this));
+		}
+		{
+			lock_guard<mutex> trava(mtx);
+			fila.push_back(dec);
+		}
+		novaTarefa.notify_one();
+	}
+} _decodificador;
+
+// Ativa ou desativa a decodificao das texturas em segundo plano.
+// Quando ativada, CarregaTextura (e portanto CarregaObjeto) apenas
+// coloca o arquivo na fila de decodificao e retorna uma textura
+// com a sua id definitiva, mas com um nico texel branco. A imagem
+// real  enviada para OpenGL por ProcessaTexturasPendentes, chamada
+// automaticamente por CarregaObjeto e DesenhaObjeto
+void SetaTexturasAssincronas(bool usa)
+{
+	_texturasAssincronas = usa;
+}
+
+// Envia para OpenGL as texturas cuja decodificao j terminou
+// (deve ser chamada na thread que possui o contexto OpenGL). Se
+// espera for true, aguarda todas as decodificaes pendentes.
+// Retorna quantas texturas ainda esto sendo decodificadas
+int ProcessaTexturasPendentes(bool espera)
+{
+	if(_decodificacoes.empty()) return 0;
+	vector<DECODIFICACAO*> prontas, pendentes;
+	{
+		unique_lock<mutex> trava(_decodificador.mtx);
+		if(espera)
+			_decodificador.tarefaPronta.wait(trava, []() {
+				for(unsigned int i=0; i<_decodificacoes.size(); ++i)
+					if(!_decodificacoes[i]->pronta) return false;
+				return true;
+			});
+		for(unsigned int i=0; i<_decodificacoes.size(); ++i)
+			if(_decodificacoes[i]->pronta)
+				prontas.push_back(_decodificacoes[i]);
+			else
+				pendentes.push_back(_decodificacoes[i]);
+	}
+	_decodificacoes = pendentes;
+	for(unsigned int i=0; i<prontas.size(); ++i)
+	{
+		DECODIFICACAO *dec = prontas[i];
+		if(dec->imagem == NULL)
+			printf("Erro na leitura da textura %s\n",dec->arquivo.c_str());
+		else
+		{
+			// Passa a imagem para a textura j existente
+			dec->tex->ncomp = dec->imagem->ncomp;
+			dec->tex->dimx  = dec->imagem->dimx;
+			dec->tex->dimy  = dec->imagem->dimy;
+			dec->tex->data  = dec->imagem->data;
+			dec->tex->reducao = dec->imagem->reducao;
+			_enviaTextura(dec->tex,dec->mipmap);
+			if(_usaCacheTexturas)
+				_gravaCacheTextura(dec->tex,dec->arquivo.c_str());
+			free(dec->imagem);
+		}
+		delete dec;
+	}
+	return _decodificacoes.size();
+}
+
+// Funo para ler um arquivo JPEG e criar uma
+// textura OpenGL
+// mipmap = true se deseja-se utilizar mipmaps
+TEX *CarregaTextura(char *arquivo, bool mipmap)
+{
+	if(!arquivo)		// retornamos NULL caso nenhum nome de arquivo seja informado
+		return NULL;
+
+	int indice = _procuraTextura(arquivo);
+	// Se textura j foi carregada, retorna
+	// apontador para ela
+	if(indice!=-1)
+		return _texturas[indice];
+
+	TEX *pImage;
+	// Se possvel, usa o cache de texturas (mesmo no modo
+	// assncrono, pois no h o que decodificar)
+	if(_usaCacheTexturas && (pImage = _leCacheTextura(arquivo,mipmap)) != NULL)
+	{
+		_registraTextura(pImage,arquivo);
+		return pImage;
+	}
+
+	if(_texturasAssincronas)
+	{
+		// A imagem ser decodificada em segundo plano: por enquanto,
+		// a textura tem um nico texel branco
+		static const unsigned char branco[3] = { 255, 255, 255 };
+		if((pImage = (TEX *) malloc(sizeof(TEX))) == NULL)
+			exit(0);
+		pImage->ncomp = 3;
+		pImage->dimx = pImage->dimy = 1;
+		pImage->data = NULL;
+		pImage->reducao = 1;
+		glGenTextures(1, &pImage->texid);
+		glBindTexture(GL_TEXTURE_2D, pImage->texid);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, branco);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		_registraTextura(pImage,arquivo);
+
+		DECODIFICACAO *dec = new DECODIFICACAO;
+		dec->tex = pImage;
+		dec->arquivo = arquivo;
+		dec->mipmap = mipmap;
+		dec->imagem = NULL;
+		dec->pronta = false;
+		_decodificacoes.push_back(dec);
+		_decodificador.adiciona(dec);
+		return pImage;
+	}
+
+	// Carrega o arquivo JPEG, reduzido conforme o oramento
+	pImage = CarregaJPG(arquivo,true,0);
+
+	if(pImage == NULL)	// se no foi possvel carregar o arquivo, finaliza o programa
+		exit(0);
+
+	// Gera uma identificao para a nova textura
+	glGenTextures(1, &pImage->texid);
+	// E envia a imagem para OpenGL
+	_enviaTextura(pImage,mipmap);
+	// Grava o cache para a prxima carga
+	if(_usaCacheTexturas)
+		_gravaCacheTextura(pImage,arquivo);
 
-	// Inclui textura na lista
-	_texturas.push_back(pImage);
+	// Inclui textura na lista, com o nome do arquivo
+	_registraTextura(pImage,arquivo);
 	// E retorna apontador para a nova textura
 	return pImage;
 }
@@ -993,7 +8064,6 @@ TEX *CarregaTexturasCubo(char *nomebase, bool mipmap)
 			// Gera uma identificao para a nova textura
 			glGenTextures(1, &pImage->texid);
 			glBindTexture(GL_TEXTURE_CUBE_MAP, pImage->texid);
-			strcpy(pImage->nome,arquivo);
 		}
 
 		if(pImage->ncomp==1) formato = GL_LUMINANCE;
@@ -1001,27 +8071,28 @@ TEX *CarregaTexturasCubo(char *nomebase, bool mipmap)
 
 		if(mipmap)
 			// Cria mipmaps para obter maior qualidade
-			gluBuild2DMipmaps(faces[i], GL_RGB, pImage->dimx, pImage->dimy,
-			formato, GL_UNSIGNED_BYTE, pImage->data);
+			_enviaMipmaps(faces[i], GL_RGB, pImage->data, pImage->dimx, pImage->dimy, pImage->ncomp);
 		else
 			// Envia a textura para OpenGL, usando o formato RGB
-			glTexImage2D (faces[i], 0, GL_RGB, pImage->dimx, pImage->dimx,
+			glTexImage2D (faces[i], 0, GL_RGB, pImage->dimx, pImage->dimy,
 				0, formato, GL_UNSIGNED_BYTE, pImage->data);
 
 		// Finalmente, libera a memria ocupada pela imagem (j que a textura j foi enviada para OpenGL)
 
 		free(pImage->data); 	// libera a memria ocupada pela imagem
 
-		// Inclui somente a primeira textura na lista
-		if(!i) _texturas.push_back(pImage);
-		else free(pImage);
+		// Somente a primeira textura  mantida
+		if(i) free(pImage);
 	}
+	// Inclui a textura na lista, com o nome base (usado para
+	// procur-la depois)
+	_registraTextura(primeira,nomebase);
 
 	// Ajusta os filtros iniciais para o cube map
 	if(mipmap)
 	{
 		glTexParameteri (GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri (GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri (GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	}
 	else
 	{
@@ -1054,6 +8125,303 @@ void SetaFiltroTextura(GLint tex, GLint filtromin, GLint filtromag)
 	glDisable(GL_TEXTURE_2D);
 }
 
+// Borda (em texels) ao redor de cada imagem no atlas, preenchida com
+// a cor da borda da imagem: evita que a filtragem e os mipmaps
+// misturem imagens vizinhas. As imagens tambm comeam em mltiplos
+// deste valor, e s so usados os nveis de mipmap em que a borda
+// ainda tem pelo menos um texel (NIVEIS_ATLAS)
+#define BORDA_ATLAS		8
+#define NIVEIS_ATLAS	3
+
+// Nmero de atlas j criados (usado nos nomes)
+int _numAtlas = 0;
+
+// Imagem colocada em um atlas
+typedef struct {
+	TEX *tex;			// textura original
+	TEX *imagem;		// imagem decodificada novamente
+	int x, y;			// posio no atlas (sem a borda)
+	bool uniforme;		// true se todos os texels tm a mesma cor
+	int numFaces;		// faces que passam a usar o atlas
+} IMGATLAS;
+
+// Funo interna que verifica se uma face pode usar o atlas no lugar
+// da sua textura: as suas coordenadas precisam caber em [0,1] depois
+// de deslocadas por um nmero inteiro (ds,dt) - o que, com a textura
+// repetida, no muda o resultado. Em uma imagem uniforme, qualquer
+// coordenada serve
+bool _faceNoAtlas(OBJ *obj, FACE &face, bool uniforme, int &ds, int &dt)
+{
+	const float EPS = 1e-4;
+	ds = dt = 0;
+	if(face.tex == NULL) return false;
+	if(uniforme) return true;
+	TEXCOORD &tc = obj->texcoords[face.tex[0]];
+	float mins = tc.s, maxs = tc.s, mint = tc.t, maxt = tc.t;
+	for(int k=1; k<face.nv; ++k)
+	{
+		TEXCOORD &tc = obj->texcoords[face.tex[k]];
+		mins = min(mins,tc.s); maxs = max(maxs,tc.s);
+		mint = min(mint,tc.t); maxt = max(maxt,tc.t);
+	}
+	ds = (int) floor(mins + EPS);
+	dt = (int) floor(mint + EPS);
+	return maxs - ds <= 1+EPS && maxt - dt <= 1+EPS;
+}
+
+// Funo interna que retorna o espao ocupado no atlas por um lado
+// de uma imagem: o lado mais a borda, arredondado para manter o
+// alinhamento
+int _ladoNoAtlas(int lado)
+{
+	return (lado + 3*BORDA_ATLAS-1) / BORDA_ATLAS * BORDA_ATLAS;
+}
+
+// Funo interna que distribui as imagens em prateleiras, da mais
+// alta para a mais baixa, em um atlas com a largura indicada (que
+// deve comportar a imagem mais larga). Retorna a altura necessria
+int _empacotaAtlas(vector<IMGATLAS> &imgs, int largura)
+{
+	int x = 0, y = 0, alturaPrateleira = 0;
+	for(unsigned int i=0; i<imgs.size(); ++i)
+	{
+		int w = _ladoNoAtlas(imgs[i].imagem->dimx);
+		int h = _ladoNoAtlas(imgs[i].imagem->dimy);
+		// No cabe mais nesta prateleira: passa para a prxima
+		if(x + w > largura)
+		{
+			x = 0;
+			y += alturaPrateleira;
+			alturaPrateleira = 0;
+		}
+		imgs[i].x = x + BORDA_ATLAS;
+		imgs[i].y = y + BORDA_ATLAS;
+		x += w;
+		if(h > alturaPrateleira) alturaPrateleira = h;
+	}
+	return y + alturaPrateleira;
+}
+
+// Junta em uma nica textura (um "atlas") as texturas pequenas
+// usadas pelo objeto - com no mximo tamMax texels de largura e de
+// altura - e ajusta as coordenadas de textura das faces, para que
+// sejam desenhadas sem troca de textura. As faces em que a textura
+// aparece repetida (ver _faceNoAtlas) continuam usando a textura
+// original, que tambm continua disponvel para os outros objetos.
+//
+// Retorna o atlas, ou NULL se no houver pelo menos duas texturas
+// que possam ser agrupadas. Como AgrupaFaces, se for chamada depois
+// de criados a malha, os buffers ou a display list do objeto, estes
+// devem ser recriados
+TEX *CriaAtlasTexturas(OBJ *obj, int tamMax, bool mipmap)
+{
+	int i, k;
+	if(obj == NULL || obj->texcoords == NULL || obj->textura != -1)
+		return NULL;
+	// As imagens precisam estar decodificadas (ver SetaTexturasAssincronas)
+	ProcessaTexturasPendentes(true);
+
+	// Texturas candidatas, por texid: pequenas e com nome (para
+	// poderem ser decodificadas novamente) - as demais ficam com -1
+	map<GLint,int> indice;
+	vector<IMGATLAS> imgs;
+	for(i=0; i<obj->numFaces; ++i)
+	{
+		GLint texid = obj->faces[i].texid;
+		if(texid == -1 || indice.count(texid)) continue;
+		indice[texid] = -1;
+		for(unsigned int t=0; t<_texturas.size(); ++t)
+		{
+			TEX *tex = _texturas[t];
+			if(tex->texid != (GLuint) texid) continue;
+			if(tex->nome != NULL && tex->dimx <= tamMax && tex->dimy <= tamMax)
+			{
+				IMGATLAS img = { tex, NULL, 0, 0, false, 0 };
+				indice[texid] = imgs.size();
+				imgs.push_back(img);
+			}
+			break;
+		}
+	}
+	// Decodifica as imagens novamente (a cpia enviada
+	// para OpenGL j foi liberada)
+	for(unsigned int t=0; t<imgs.size(); ++t)
+	{
+		TEX *img = CarregaJPG(imgs[t].tex->nome,true,imgs[t].tex->reducao);
+		imgs[t].imagem = img;
+		imgs[t].numFaces = 0;
+		imgs[t].uniforme = img != NULL;
+		if(img == NULL) continue;
+		int tam = img->dimx * img->dimy * img->ncomp;
+		for(i=img->ncomp; i<tam && imgs[t].uniforme; ++i)
+			imgs[t].uniforme = img->data[i] == img->data[i % img->ncomp];
+	}
+	// Conta as faces de cada textura que podem usar o atlas
+	for(i=0; i<obj->numFaces; ++i)
+	{
+		FACE &face = obj->faces[i];
+		if(face.texid == -1 || indice[face.texid] == -1) continue;
+		IMGATLAS &img = imgs[indice[face.texid]];
+		int ds, dt;
+		if(img.imagem != NULL && _faceNoAtlas(obj,face,img.uniforme,ds,dt))
+			img.numFaces++;
+	}
+	vector<IMGATLAS> usadas;
+	long long area = 0;
+	for(unsigned int t=0; t<imgs.size(); ++t)
+	{
+		if(imgs[t].numFaces)
+		{
+			usadas.push_back(imgs[t]);
+			area += (long long) (imgs[t].imagem->dimx + 2*BORDA_ATLAS)
+				* (imgs[t].imagem->dimy + 2*BORDA_ATLAS);
+		}
+		else if(imgs[t].imagem != NULL)
+		{
+			free(imgs[t].imagem->data);
+			free(imgs[t].imagem);
+		}
+	}
+	if(usadas.size() < 2)
+	{
+		for(unsigned int t=0; t<usadas.size(); ++t)
+		{
+			free(usadas[t].imagem->data);
+			free(usadas[t].imagem);
+		}
+		return NULL;
+	}
+	sort(usadas.begin(), usadas.end(), [](const IMGATLAS &a, const IMGATLAS &b) {
+		return a.imagem->dimy > b.imagem->dimy;
+	});
+
+	// Procura a menor largura (potncia de 2) em que as imagens
+	// caibam sem que o atlas fique mais alto do que largo - e que
+	// no seja menor do que a imagem mais larga
+	GLint maxTex = 2048;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTex);
+	int largura = 16, altura, maisLarga = 0;
+	for(unsigned int t=0; t<usadas.size(); ++t)
+		maisLarga = max(maisLarga, _ladoNoAtlas(usadas[t].imagem->dimx));
+	while(largura < maisLarga || (long long) largura*largura < area) largura *= 2;
+	for(;;)
+	{
+		altura = _empacotaAtlas(usadas,largura);
+		if(altura <= largura || largura >= maxTex) break;
+		largura *= 2;
+	}
+	// Altura tambm potncia de 2
+	int alturaAtlas = 16;
+	while(alturaAtlas < altura) alturaAtlas *= 2;
+	if(largura > maxTex || alturaAtlas > maxTex)
+	{
+		for(unsigned int t=0; t<usadas.size(); ++t)
+		{
+			free(usadas[t].imagem->data);
+			free(usadas[t].imagem);
+		}
+		return NULL;
+	}
+
+	// Monta a imagem do atlas (RGB), repetindo a borda de cada imagem
+	TEX *atlas = (TEX *) malloc(sizeof(TEX));
+	unsigned char *dados = (unsigned char *) calloc(largura*alturaAtlas,3);
+	if(atlas == NULL || dados == NULL)
+	{
+		printf("Sem memria para o atlas de texturas!");
+		exit(1);
+	}
+	for(unsigned int t=0; t<usadas.size(); ++t)
+	{
+		TEX *img = usadas[t].imagem;
+		for(int y=-BORDA_ATLAS; y<img->dimy+BORDA_ATLAS; ++y)
+		{
+			int yo = _limitaIndice(y,img->dimy);
+			unsigned char *dest = dados + ((usadas[t].y+y)*largura + usadas[t].x-BORDA_ATLAS) * 3;
+			for(int x=-BORDA_ATLAS; x<img->dimx+BORDA_ATLAS; ++x, dest+=3)
+			{
+				const unsigned char *orig = img->data + (yo*img->dimx + _limitaIndice(x,img->dimx)) * img->ncomp;
+				for(int c=0; c<3; ++c)
+					dest[c] = orig[img->ncomp==1 ? 0 : c];
+			}
+		}
+	}
+
+	glGenTextures(1, &atlas->texid);
+
+	// Coordenadas de textura: cada ndice usado com uma textura do
+	// atlas  copiado e ajustado para o retngulo correspondente (o
+	// mesmo ndice pode ser compartilhado por texturas diferentes, ou
+	// por faces com deslocamentos diferentes)
+	map<GLint,int> noAtlas;
+	for(unsigned int t=0; t<usadas.size(); ++t)
+		noAtlas[usadas[t].tex->texid] = t;
+	vector<TEXCOORD> novas;
+	vector<map<tuple<int,int,int>,int> > copias(usadas.size());
+	for(i=0; i<obj->numFaces; ++i)
+	{
+		FACE &face = obj->faces[i];
+		map<GLint,int>::iterator it = noAtlas.find(face.texid);
+		if(it == noAtlas.end()) continue;
+		int t = it->second, ds, dt;
+		if(!_faceNoAtlas(obj,face,usadas[t].uniforme,ds,dt)) continue;
+		for(k=0; k<face.nv; ++k)
+		{
+			pair<map<tuple<int,int,int>,int>::iterator,bool> res =
+				copias[t].insert(make_pair(make_tuple(face.tex[k],ds,dt),
+					obj->numTexcoords + (int) novas.size()));
+			if(res.second)
+			{
+				TEXCOORD tc = obj->texcoords[face.tex[k]];
+				float s = min(max(tc.s-ds,0.0f),1.0f);
+				float u = min(max(tc.t-dt,0.0f),1.0f);
+				tc.s = (usadas[t].x + s * usadas[t].imagem->dimx) / largura;
+				tc.t = (usadas[t].y + u * usadas[t].imagem->dimy) / alturaAtlas;
+				novas.push_back(tc);
+			}
+			face.tex[k] = res.first->second;
+		}
+		face.texid = atlas->texid;
+	}
+	TEXCOORD *texcoords = (TEXCOORD *) malloc(sizeof(TEXCOORD)*(obj->numTexcoords+novas.size()));
+	if(texcoords == NULL)
+	{
+		printf("Sem memria para o atlas de texturas!");
+		exit(1);
+	}
+	memcpy(texcoords,obj->texcoords,sizeof(TEXCOORD)*obj->numTexcoords);
+	memcpy(texcoords+obj->numTexcoords,novas.data(),sizeof(TEXCOORD)*novas.size());
+	_liberaVetor(obj,obj->texcoords);
+	obj->texcoords = texcoords;
+	obj->numTexcoords += novas.size();
+
+	// Envia o atlas para OpenGL e inclui na lista de texturas
+	atlas->ncomp = 3;
+	atlas->dimx = largura;
+	atlas->dimy = alturaAtlas;
+	atlas->data = dados;
+	atlas->reducao = 1;
+	_enviaTextura(atlas,mipmap);
+#ifdef GL_TEXTURE_MAX_LEVEL
+	if(mipmap)
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, NIVEIS_ATLAS);
+#endif
+	char nome[32];
+	snprintf(nome,sizeof(nome),"#atlas%d",++_numAtlas);
+	_registraTextura(atlas,nome);
+
+	AgrupaFaces(obj);
+#ifdef DEBUG
+	printf("Atlas: %d texturas em %d x %d\n",(int) usadas.size(),largura,alturaAtlas);
+#endif
+	for(unsigned int t=0; t<usadas.size(); ++t)
+	{
+		free(usadas[t].imagem->data);
+		free(usadas[t].imagem);
+	}
+	return atlas;
+}
+
 // Desabilita a gerao de uma display list
 // para o objeto especificado
 void DesabilitaDisplayList(OBJ *ptr)
@@ -1083,7 +8451,9 @@ void _criaDList(OBJ *ptr)
 
 // Cria uma display list para o objeto informado
 // - se for NULL, cria display lists para TODOS os objetos
-// (usada na rotina de desenho, se existir)
+// (usada na rotina de desenho, se existir). Os objetos desenhados
+// pela malha (com buffers, malha quantizada ou nvel de detalhe
+// simplificado) descartam a display list no prximo desenho
 void CriaDisplayList(OBJ *ptr)
 {
 	if(ptr==NULL)
@@ -1100,19 +8470,31 @@ void CriaDisplayList(OBJ *ptr)
 }
 
 // Decodifica uma imagem JPG e armazena-a em uma estrutura TEX.
-void DecodificaJPG(jpeg_decompress_struct* cinfo, TEX *pImageData, bool inverte)
+// As dimenses so divididas por reducao (1, 2, 4 ou 8; se 0, o
+// divisor  escolhido de acordo com SetaReducaoTexturas e
+// SetaOrcamentoTexturas)
+void DecodificaJPG(jpeg_decompress_struct* cinfo, TEX *pImageData, bool inverte, int reducao)
 {
+	ZONA zona("decodificacao");
 	// L o cabealho de um arquivo jpeg
 	jpeg_read_header(cinfo, TRUE);
+
+	// A reduo  feita pela libjpeg, diretamente na DCT
+	if(!reducao)
+		reducao = _escolheReducao(cinfo->image_width, cinfo->image_height, true);
+	cinfo->scale_num = 1;
+	cinfo->scale_denom = reducao;
 	
 	// Comea a descompactar um arquivo jpeg com a informao 
 	// obtida do cabealho
 	jpeg_start_decompress(cinfo);
 
-	// Pega as dimenses da imagem e varre as linhas para ler os dados do pixel
-	pImageData->ncomp = cinfo->num_components;
-	pImageData->dimx  = cinfo->image_width;
-	pImageData->dimy  = cinfo->image_height;
+	// Pega as dimenses da imagem (j reduzida) e varre as linhas
+	// para ler os dados do pixel
+	pImageData->ncomp = cinfo->output_components;
+	pImageData->dimx  = cinfo->output_width;
+	pImageData->dimy  = cinfo->output_height;
+	pImageData->reducao = reducao;
 
 	int rowSpan = pImageData->ncomp * pImageData->dimx;
 	// Aloca memria para o buffer do pixel
@@ -1147,7 +8529,7 @@ void DecodificaJPG(jpeg_decompress_struct* cinfo, TEX *pImageData, bool inverte)
 }
 
 // Carrega o arquivo JPG e retorna seus dados em uma estrutura tImageJPG.
-TEX *CarregaJPG(const char *filename, bool inverte)
+TEX *CarregaJPG(const char *filename, bool inverte, int reducao)
 {
 	struct jpeg_decompress_struct cinfo;
 	TEX *pImageData = NULL;
@@ -1176,9 +8558,11 @@ TEX *CarregaJPG(const char *filename, bool inverte)
 	
 	// Aloca a estrutura que conter os dados jpeg
 	pImageData = (TEX*)malloc(sizeof(TEX));
+	// A textura s recebe um nome ao ser includa na lista
+	pImageData->nome = NULL;
 
 	// Decodifica o arquivo JPG e preenche a estrutura de dados da imagem
-	DecodificaJPG(&cinfo, pImageData, inverte);
+	DecodificaJPG(&cinfo, pImageData, inverte, reducao);
 	
 	// Libera a memria alocada para leitura e decodificao do arquivo JPG
 	jpeg_destroy_decompress(&cinfo);
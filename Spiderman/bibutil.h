@@ -16,6 +16,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+// Necessrio para as funes de buffers (VBOs) e posteriores
+// a OpenGL 1.1 - em Windows,  preciso um carregador de
+// extenses, como GLEW
+#define GL_GLEXT_PROTOTYPES
 #include <GL/glut.h>
 
 extern "C" {
@@ -29,12 +33,13 @@ extern "C" {
 // Define a estrutura de uma imagem
 typedef struct
 {
-	char nome[50];			// nome do arquivo carregado
+	const char *nome;		// nome do arquivo carregado (NULL se a textura no estiver na lista)
 	int ncomp;				// nmero de componentes na textura (1-intensidade, 3-RGB)
 	GLint dimx;				// largura 
 	GLint dimy;				// altura
 	GLuint texid;			// identifio da textura em OpenGL
 	unsigned char *data;	// apontador para a imagem em si
+	int reducao;			// divisor aplicado s dimenses na decodificao
 } TEX;
 
 // Define a estrutura de um vrtice
@@ -42,6 +47,18 @@ typedef struct {
 	GLfloat x,y,z;
 } VERT;
 
+// Define um conjunto de vetores no formato SoA ("structure of
+// arrays"): as coordenadas x, y e z ficam em vetores separados
+typedef struct {
+	GLfloat *x, *y, *z;
+} VETSOA;
+
+// Define uma matriz de transformao 4x4, armazenada por colunas
+// (como em OpenGL)
+typedef struct {
+	GLfloat m[16];
+} MATRIZ;
+
 // Define a estrutura de uma face
 typedef struct {
 	GLint nv;		// nmero de vrtices na face
@@ -50,6 +67,7 @@ typedef struct {
 	GLint *tex;		// ndices das texcoords
 	GLint mat;		// ndice para o material (se houver)
 	GLint texid;	// ndice para a textura (se houver)
+	GLint grupo;	// grupo de suavizao (0 se no houver)
 } FACE;
 
 // Define a estrutura de uma coordenada
@@ -58,6 +76,105 @@ typedef struct {
 	GLfloat s,t,r;
 } TEXCOORD;
 
+// Define um vrtice de uma malha, com os atributos intercalados
+typedef struct {
+	GLfloat pos[3];		// posio
+	GLfloat normal[3];	// normal
+	GLfloat tex[2];		// coordenada de textura
+} VERTMALHA;
+
+// Define um lote de faces (em um OBJ) ou de tringulos (em uma
+// MALHA) consecutivos que usam o mesmo material e a mesma textura
+typedef struct {
+	GLint mat;		// ndice para o material (ou -1)
+	GLint texid;	// textura (ou -1)
+	GLint inicio;	// primeira face (OBJ) ou posio do primeiro ndice (MALHA)
+	GLint num;		// nmero de faces (OBJ) ou de ndices, 3 por tringulo (MALHA)
+} LOTE;
+
+// Define um nvel de detalhe simplificado de uma malha
+typedef struct {
+	GLint numLotes;
+	LOTE *lotes;			// lotes do nvel, com posies nos ndices da malha
+	GLfloat erro;			// erro geomtrico aproximado (nas unidades do objeto)
+} NIVELMALHA;
+
+// Define os vrtices quantizados de uma malha (ver QuantizaMalha)
+typedef struct {
+	char *vertices;			// tamVertice bytes por vrtice
+	GLint tamVertice;
+	GLint deslNormal;		// posio da normal no vrtice (-1 se no houver)
+	GLint deslTex;			// posio da texcoord no vrtice (-1 se no houver)
+	GLfloat centro[3];		// posio = centro + escala * valor quantizado
+	GLfloat escala;
+	GLfloat centroTex[2];	// texcoord = centroTex + escalaTex * valor quantizado
+	GLfloat escalaTex[2];
+} QUANTMALHA;
+
+// Define os erros de uma quantizao (ver QuantizaMalha)
+typedef struct {
+	GLfloat posicao;		// maior distncia entre posies original e quantizada
+	GLfloat normal;			// maior ngulo, em graus, entre as normais
+	GLfloat texcoord;		// maior diferena nas texcoords
+	size_t bytesAntes;		// memria ocupada pelos vrtices e ndices
+	size_t bytesDepois;
+} ERROQUANT;
+
+// Define a estrutura de uma malha de tringulos com um nico
+// ndice por vrtice, pronta para desenho indexado
+typedef struct {
+	GLint numVertices;
+	GLint numIndices;		// inclui os ndices dos nveis de detalhe
+	GLint numLotes;
+	GLenum tipoIndice;		// GL_UNSIGNED_SHORT ou GL_UNSIGNED_INT
+	VERTMALHA *vertices;
+	void *indices;			// ndices de 16 ou 32 bits (ver tipoIndice)
+	LOTE *lotes;
+	bool tem_normais;		// true se os vrtices tm normais
+	bool tem_texcoords;		// true se os vrtices tm texcoords
+	GLint numNiveis;		// nveis de detalhe (ver CriaNiveisDetalhe)
+	NIVELMALHA *niveis;
+	GLfloat reducao;		// reduo pedida entre os nveis
+	QUANTMALHA *quant;		// se no for NULL, substitui vertices
+} MALHA;
+
+// Define um n de uma BVH (ver CriaBVH), com 32 bytes. O filho da
+// esquerda de um n interno  sempre o n seguinte no vetor
+typedef struct {
+	GLfloat min[3];
+	GLint inicio;		// folha: primeiro tringulo; n interno: filho da direita
+	GLfloat max[3];
+	GLint num;			// tringulos da folha (0 em ns internos)
+} NOBVH;
+
+// Define a estrutura de uma hierarquia de volumes envolventes
+// sobre os tringulos das faces de um objeto
+typedef struct {
+	GLint numNos;
+	NOBVH *nos;
+	GLint numTriangulos;
+	VERT *triangulos;	// 3 vrtices por tringulo, na ordem das folhas
+	GLint *faces;		// face de origem de cada tringulo
+} BVH;
+
+// Define o resultado de uma consulta a uma BVH
+typedef struct {
+	GLint face;			// face encontrada
+	GLfloat t;			// distncia ao longo do raio, ou ao ponto consultado
+	VERT ponto;			// ponto encontrado
+	GLfloat u, v;		// coordenadas baricntricas do ponto no tringulo
+} INTERSECAO;
+
+// Define um bloco de faces espacialmente prximas de um objeto,
+// todas do mesmo lote (ver CriaBlocos)
+typedef struct {
+	VERT min, max;		// caixa envolvente das faces do bloco
+	GLint lote;			// lote ao qual as faces pertencem
+	GLint inicio, num;	// faces do bloco
+	GLint indInicio;	// posio dos ndices do bloco na malha (-1 se no houver)
+	GLint indNum;		// e nmero de ndices
+} BLOCO;
+
 // Define a estrutura de um objeto 3D
 typedef struct {
 	GLint numVertices;
@@ -72,11 +189,50 @@ typedef struct {
 	VERT *normais;
 	FACE *faces;
 	TEXCOORD *texcoords;
+	// ndices das faces no formato compacto (CSR), se houver - nesse
+	// caso, os apontadores de cada FACE indicam posies nestes vetores
+	GLint *inicio_faces;	// incio de cada face nos vetores abaixo (numFaces+1)
+	GLint *ind_vertices;	// ndices dos vrtices de todas as faces
+	GLint *ind_normais;		// ndices das normais (ou NULL)
+	GLint *ind_texcoords;	// ndices das texcoords (ou NULL)
+	char *cache;			// cache binrio mapeado em memria, se houver
+	size_t tam_cache;		// (os vetores acima podem apontar para ele)
+	MALHA *malha;			// malha para desenho indexado, se houver
+	GLuint vbo, ibo, vao;	// buffers da malha (0 se no houver)
+	LOTE *lotes;			// faces agrupadas por textura e material
+	GLint numLotes;
+	GLint trocasEvitadas;	// chamadas de troca de estado evitadas por desenho
+	VERT min, max;			// caixa envolvente dos vrtices
+	VERT centro;			// esfera envolvente dos vrtices
+	GLfloat raio;
+	BLOCO *blocos;			// diviso espacial das faces (ver CriaBlocos)
+	GLint numBlocos;
+	BVH *bvh;				// hierarquia para consultas (ver CriaBVH), se houver
+	GLuint vboInstancias;	// buffer de instncias (ver DesenhaInstancias)
+	GLint capInstancias;	// capacidade do buffer, em instncias
+	GLfloat *instancias;	// cpia do contedo do buffer
 } OBJ;
 
+// Define as funes chamadas por LeObjetoFluxo para cada registro
+// de um arquivo .OBJ (qualquer uma pode ser NULL). Os ndices das
+// faces comeam em 0 (-1 indica que o vrtice no tem normal ou
+// texcoord) e os nomes so strings terminadas por \0; os dois s
+// so vlidos durante a chamada. dados  repassado a todas elas
+typedef struct {
+	void *dados;
+	void (*vertice)(void *dados, const VERT &v);
+	void (*normal)(void *dados, const VERT &n);
+	void (*texcoord)(void *dados, const TEXCOORD &t);
+	void (*face)(void *dados, int nv, const GLint *vert, const GLint *norm, const GLint *tex);
+	void (*biblioteca)(void *dados, const char *nome);	// mtllib
+	void (*material)(void *dados, const char *nome);	// usemtl
+	void (*textura)(void *dados, const char *nome);		// usemat
+	void (*suavizacao)(void *dados, int grupo);			// s (0 = off)
+} LEITOROBJ;
+
 // Define um material
 typedef struct {
-	char nome[20];	// Identificao do material
+	const char *nome;	// Identificao do material
 	GLfloat ka[4];	// Ambiente
 	GLfloat kd[4];	// Difuso
 	GLfloat ks[4];	// Especular
@@ -84,6 +240,26 @@ typedef struct {
 	GLfloat spec;	// Fator de especularidade
 } MAT;
 
+// Define as estatsticas dos ltimos quadros (ver ObtemTemposQuadro),
+// com os tempos em milissegundos
+typedef struct {
+	GLint quadros;			// quadros considerados
+	GLfloat qps;			// taxa de quadros por segundo (ver CalculaQPS)
+	GLfloat medio, p50, p95, p99, maximo;	// tempo de quadro na CPU
+	GLint quadrosGPU;		// quadros com tempo de GPU medido (ver SetaPerfil)
+	GLfloat gpuMedio, gpuP50, gpuP95, gpuP99;	// tempo de desenho na GPU
+} TEMPOSQUADRO;
+
+// Mede o tempo de um trecho de cdigo, da declarao at o final do
+// bloco, registrando-o com o nome informado se o perfil estiver ativo
+// (ver SetaPerfil). O nome no  copiado: deve continuar vlido
+struct ZONA {
+	const char *nome;
+	long long inicio;	// em ns (-1 se o perfil estava inativo)
+	ZONA(const char *nome);
+	~ZONA();
+};
+
 // Prottipos das funes
 // Funes para clculos diversos
 void Normaliza(VERT &norm);
@@ -93,30 +269,97 @@ void RotaZ(VERT &in, VERT &out, float ang);
 void RotaY(VERT &in, VERT &out, float ang);
 void RotaX(VERT &in, VERT &out, float ang);
 
+// Funes para clculos em lote (com instrues vetoriais)
+void SetaInstrucoesSIMD(char modo);
+void NormalizaVetores(VERT *v, int num);
+void ProdutoVetorialVetores(VERT *v1, VERT *v2, VERT *vresult, int num);
+void VetorNormalVetores(VERT *vert1, VERT *vert2, VERT *vert3, VERT *n, int num);
+void LimitesVetores(VERT *v, int num, VERT &min, VERT &max);
+void NormalizaVetoresSoA(VETSOA v, int num);
+void ProdutoVetorialSoA(VETSOA v1, VETSOA v2, VETSOA vresult, int num);
+void VetorNormalSoA(VETSOA vert1, VETSOA vert2, VETSOA vert3, VETSOA n, int num);
+void LimitesSoA(VETSOA v, int num, VERT &min, VERT &max);
+
+// Funes para matrizes de transformao
+void MatrizIdentidade(MATRIZ &m);
+void MultiplicaMatrizes(MATRIZ &m1, MATRIZ &m2, MATRIZ &mresult);
+void EscalaMatriz(MATRIZ &m, float ex, float ey, float ez);
+void TransladaMatriz(MATRIZ &m, float tx, float ty, float tz);
+void RotaMatrizZ(MATRIZ &m, float ang);
+void RotaMatrizY(MATRIZ &m, float ang);
+void RotaMatrizX(MATRIZ &m, float ang);
+void TransformaVertice(MATRIZ &m, VERT &in, VERT &out);
+void TransformaVetores(MATRIZ &m, VERT *v, int num);
+void TransformaObjeto(OBJ *obj, MATRIZ &m);
+
 // Funes para carga e desenho de objetos
 OBJ *CarregaObjeto(char *nomeArquivo, bool mipmap);
+void SetaModoCarga(char modo);
+bool LeObjetoFluxo(const char *nomeArquivo, LEITOROBJ *leitor, int tamJanela=0);
+void SetaNumThreads(int num);
+void CompactaFaces(OBJ *obj);
+void SetaCacheObjetos(bool usa);
 void CriaDisplayList(OBJ *obj);
 void DesabilitaDisplayList(OBJ *ptr);
+void CriaVBO(OBJ *ptr);
+void DesabilitaVBO(OBJ *ptr);
 void DesenhaObjeto(OBJ *obj);
+void DesenhaInstancias(OBJ *obj, const MATRIZ *matrizes, const GLfloat *cores, int num);
+void SetaInstanciamento(bool usa);
 void SetaModoDesenho(char modo);
+void AgrupaFaces(OBJ *obj);
+int CriaBlocos(OBJ *obj, int facesPorBloco);
+void SetaRecorte(bool usa);
+int TrocasEvitadas();
 
 // Funes para liberao de memria
 void LiberaObjeto(OBJ *obj);
 void LiberaMateriais();
 
 // Funes para clculo e exibio da taxa de quadros por segundo
+// e para medio de desempenho
 float CalculaQPS(void);
+void ObtemTemposQuadro(TEMPOSQUADRO *t);
+void SetaPerfil(bool ativo);
+bool SalvaPerfil(const char *arquivo);
 void Escreve2D(float x, float y, char *str);
 
 // Funes para clculo de normais
 void CalculaNormaisPorFace(OBJ *obj);
+void CalculaNormais(OBJ *obj, char modo);
+
+// Funes para criao de malhas para desenho indexado
+MALHA *CriaMalha(OBJ *obj);
+void LiberaMalha(MALHA *malha);
+int CriaNiveisDetalhe(OBJ *obj, int numNiveis, float reducao=0.5f);
+void SetaNivelDetalhe(float pixels);
+bool QuantizaMalha(OBJ *obj, ERROQUANT *erro=NULL);
+float OtimizaVertices(OBJ *obj);
+float CalculaACMR(OBJ *obj, int tamCache=0);
+
+// Funes para consultas espaciais (seleo com o mouse e colises)
+BVH *CriaBVH(OBJ *obj);
+void LiberaBVH(BVH *bvh);
+bool IntersectaRaioBVH(BVH *bvh, const VERT &origem, const VERT &direcao,
+	float tmax, INTERSECAO *res);
+bool PontoMaisProximoBVH(BVH *bvh, const VERT &p, float distMax, INTERSECAO *res);
+int SobreposicaoBVH(BVH *bvh, const VERT &cmin, const VERT &cmax, GLint *faces, int maxFaces);
+void RaioTela(int x, int y, VERT &origem, VERT &direcao);
 
 // Funes para manipulao de texturas e materiais
 TEX *CarregaTextura(char *arquivo, bool mipmap);
 TEX *CarregaTexturasCubo(char *arquivo, bool mipmap);
 void SetaFiltroTextura(GLint tex, GLint filtromin, GLint filtromag);
+void SetaFiltroMipmap(char filtro);
+void SetaCacheTexturas(bool usa, bool comprime=false);
+void SetaReducaoTexturas(int divisor);
+void SetaOrcamentoTexturas(long long bytes);
+TEX *CriaAtlasTexturas(OBJ *obj, int tamMax, bool mipmap);
+void SetaAtlasTexturas(int tamMax);
+void SetaTexturasAssincronas(bool usa);
+int ProcessaTexturasPendentes(bool espera);
 MAT *ProcuraMaterial(char *nome);
-TEX *CarregaJPG(const char *filename, bool inverte=true);
+TEX *CarregaJPG(const char *filename, bool inverte=true, int reducao=1);
 
 // Constantes utilizadas caso no existam em GL/gl.h
 #ifndef GL_ARB_texture_cube_map